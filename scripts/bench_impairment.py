@@ -0,0 +1,252 @@
+#! /usr/bin/env python3
+
+# Evaluates FEC and latency settings under simulated network impairments.
+#
+# Starts private pulseaudio daemon with a null sink, loads module-roc-sink
+# driven by module-sine and module-roc-sink-input playing to the null sink, and
+# puts impair_proxy.py between them. Records monitor of the null sink and
+# detects concealed gaps (runs of silence) in the sine wave.
+#
+# For every combination of impairment, FEC, and latency profile reports:
+#  - network loss applied by proxy, and lost packets reported by receiver
+#  - residual loss: share of audio that was concealed after FEC
+#  - number of concealment events (gaps)
+#  - end-to-end latency reported by receiver, and its difference from the
+#    same configuration without impairments
+#
+# Requires pulseaudio, pactl, libpulse-simple, and numpy.
+
+import argparse
+import itertools
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import impair_proxy
+import rocpulse_bench as rb
+
+try:
+    import numpy as np
+except ImportError:
+    rb.die('numpy is required for this benchmark')
+
+# named impairment presets, anything else is parsed as impairment spec
+PRESETS = {
+    'none': '',
+    'loss1': 'loss=0.01',
+    'loss5': 'loss=0.05',
+    'burst': 'ge=0.01:0.3',
+    'jitter': 'jitter=20',
+    'wifi': 'ge=0.005:0.25,jitter=8,reorder=0.01:15,dup=0.001',
+}
+
+BLOCK_FRAMES = rb.SAMPLE_RATE // 10
+
+# samples below this level are treated as silence
+SILENCE_LEVEL = 1e-4
+
+# shorter runs of silence are treated as zero crossings of sine
+MIN_GAP_FRAMES = 32
+
+
+def find_gaps(signal):
+    """Return list of lengths of silent runs in signal, ignoring leading
+    silence before the stream started."""
+    silent = np.abs(signal) < SILENCE_LEVEL
+
+    active = np.flatnonzero(~silent)
+    if len(active) == 0:
+        return None
+    silent = silent[active[0]:]
+
+    # find boundaries of silent runs
+    edges = np.diff(np.concatenate(([0], silent.astype(np.int8), [0])))
+    starts = np.flatnonzero(edges == 1)
+    ends = np.flatnonzero(edges == -1)
+
+    lengths = ends - starts
+    return [int(n) for n in lengths if n >= MIN_GAP_FRAMES], len(silent)
+
+
+def receiver_metrics(daemon):
+    for props in daemon.list_properties('sink-inputs'):
+        if 'roc.metrics.e2e_latency_usec' in props:
+            return props
+    return None
+
+
+def parse_fec(value):
+    """Parse 'encoding[:nbsrc:nbrpr]' into sink arguments."""
+    parts = value.split(':')
+    args = {'fec_encoding': parts[0]}
+    if len(parts) == 3:
+        args['fec_block_nbsrc'] = int(parts[1])
+        args['fec_block_nbrpr'] = int(parts[2])
+    elif len(parts) != 1:
+        rb.die('expected encoding[:nbsrc:nbrpr], got {!r}'.format(value))
+    return args
+
+
+def measure(daemon, ports, proxy_ports, config, spec, args):
+    fec_args = parse_fec(config['fec'])
+
+    sink_args = dict(fec_args)
+    sink_args['packet_length_msec'] = args.packet_length
+    input_args = {
+        'fec_encoding': fec_args['fec_encoding'],
+        'latency_profile': config['latency_profile'],
+        'target_latency_msec': args.target_latency,
+    }
+
+    proxy = impair_proxy.ImpairProxy(list(zip(proxy_ports, ports)), spec,
+                                     seed=args.seed)
+    proxy.start()
+
+    indices = []
+    try:
+        indices += rb.load_roc_pair(daemon, ports, 'bench_roc', 'bench_out', sink_args,
+                                    input_args, sender_ports=proxy_ports)
+        indices.append(daemon.load_module('module-sine', sink='bench_roc',
+                                          frequency=440))
+
+        rec = rb.SimpleStream(daemon.server, rb.PA_STREAM_RECORD, 'bench_out.monitor',
+                              'impairment-record', buffer_msec=100)
+
+        time.sleep(args.warmup)
+        metrics_before = receiver_metrics(daemon)
+
+        blocks = []
+        latencies = []
+        nbytes = BLOCK_FRAMES * rb.CHANNELS * 4
+        next_poll = time.monotonic()
+
+        for _ in range(int(args.duration * rb.SAMPLE_RATE / BLOCK_FRAMES)):
+            samples = np.frombuffer(rec.read(nbytes), dtype=np.float32)
+            blocks.append(samples.reshape(-1, rb.CHANNELS)[:, 0])
+
+            if time.monotonic() >= next_poll:
+                metrics = receiver_metrics(daemon)
+                if metrics:
+                    latencies.append(
+                        int(metrics['roc.metrics.e2e_latency_usec']) / 1000)
+                next_poll += 1
+
+        metrics_after = receiver_metrics(daemon)
+        rec.close()
+    finally:
+        for index in reversed(indices):
+            daemon.unload_module(index)
+        proxy.stop()
+        proxy.close()
+
+    result = {'config': config}
+
+    source_stats = proxy.stats()[proxy_ports[0]]
+    result['proxy'] = proxy.stats()
+    result['network_loss'] = (source_stats['dropped'] / source_stats['received']
+                              if source_stats['received'] else None)
+
+    if metrics_before and metrics_after:
+        result['lost_packets'] = (int(metrics_after['roc.metrics.lost_packets'])
+                                  - int(metrics_before['roc.metrics.lost_packets']))
+        result['expected_packets'] = (
+            int(metrics_after['roc.metrics.expected_packets'])
+            - int(metrics_before['roc.metrics.expected_packets']))
+
+    gaps = find_gaps(np.concatenate(blocks))
+    if gaps is None:
+        rb.log('no audio received for {}'.format(config))
+        result['residual_loss'] = 1.0
+        result['concealment_events'] = None
+    else:
+        lengths, total = gaps
+        result['residual_loss'] = sum(lengths) / total
+        result['concealment_events'] = len(lengths)
+        result['concealed_msec'] = rb.summarize(
+            [n * 1000 / rb.SAMPLE_RATE for n in lengths])
+
+    result['e2e_latency_msec'] = rb.summarize(latencies)
+
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='roc-pulse impairment benchmark',
+        epilog='presets: ' + ', '.join('{} ({})'.format(k, v or 'no impairments')
+                                       for k, v in PRESETS.items()))
+    parser.add_argument('--module-dir', required=True,
+                        help='directory with built modules')
+    parser.add_argument('--source-dir', default='.',
+                        help='source directory, used to report git revision')
+    parser.add_argument('--pulseaudio', default='pulseaudio',
+                        help='pulseaudio executable')
+    parser.add_argument('--output', default='-', help='output json file')
+    parser.add_argument('--impairments', default='none;loss1;loss5;burst;jitter;wifi',
+                        help='semicolon-separated presets or impairment specs '
+                        '(see impair_proxy.py)')
+    parser.add_argument('--fec', default='disable,rs8m,rs8m:10:10,ldpc',
+                        help='comma-separated fec configurations, '
+                        'in form encoding[:nbsrc:nbrpr]')
+    parser.add_argument('--latency-profile', default='responsive,gradual',
+                        help='comma-separated latency profiles')
+    parser.add_argument('--packet-length', type=int, default=5,
+                        help='packet length in milliseconds')
+    parser.add_argument('--target-latency', type=int, default=100,
+                        help='target latency in milliseconds')
+    parser.add_argument('--duration', type=float, default=20,
+                        help='measurement duration for every configuration in seconds')
+    parser.add_argument('--warmup', type=float, default=3,
+                        help='delay before measurement in seconds')
+    parser.add_argument('--seed', type=int, default=1,
+                        help='random seed for impairments')
+    args = parser.parse_args()
+
+    impairments = []
+    for name in args.impairments.split(';'):
+        try:
+            impairments.append((name, impair_proxy.ImpairSpec(PRESETS.get(name, name))))
+        except (ValueError, OSError) as e:
+            rb.die('bad impairment {!r}: {}'.format(name, e))
+
+    results = []
+    ports = rb.PortAllocator()
+
+    with rb.PulseDaemon(args.module_dir, args.pulseaudio) as daemon:
+        daemon.load_module('module-null-sink', sink_name='bench_out')
+
+        for (name, spec), fec, profile in itertools.product(
+                impairments, rb.parse_list(args.fec),
+                rb.parse_list(args.latency_profile)):
+            config = {
+                'impairment': name,
+                'impairment_spec': str(spec),
+                'fec': fec,
+                'latency_profile': profile,
+            }
+            rb.log('measuring {}'.format(config))
+            results.append(
+                measure(daemon, ports.allocate(), ports.allocate(), config, spec, args))
+
+    # latency impact relative to the same configuration without impairments
+    baseline = {}
+    for result in results:
+        config = result['config']
+        if not config['impairment_spec'] == 'none' or not result['e2e_latency_msec']:
+            continue
+        baseline[(config['fec'], config['latency_profile'])] = \
+            result['e2e_latency_msec']['mean']
+
+    for result in results:
+        config = result['config']
+        base = baseline.get((config['fec'], config['latency_profile']))
+        if base is not None and result['e2e_latency_msec']:
+            result['latency_impact_msec'] = result['e2e_latency_msec']['mean'] - base
+
+    rb.write_results(args.output, 'impairment', args.source_dir, results)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,261 @@
+#! /usr/bin/env python3
+
+# Measures latency from roc sink input to the sink where roc sink input plays.
+#
+# Starts private pulseaudio daemon with a null sink, loads module-roc-sink and
+# module-roc-sink-input connected over localhost, plays short tone bursts to
+# roc sink, and records monitor of the null sink. Every burst is found in the
+# recording by cross-correlation, and its playback and capture times are
+# computed from stream positions and latencies reported by pulseaudio.
+#
+# Requires pulseaudio, pactl, libpulse-simple, and numpy.
+
+import argparse
+import itertools
+import os
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import rocpulse_bench as rb
+
+try:
+    import numpy as np
+except ImportError:
+    rb.die('numpy is required for this benchmark')
+
+BLOCK_FRAMES = rb.SAMPLE_RATE // 100
+
+BURST_FREQ = 3000
+BURST_MSEC = 2
+
+
+def make_burst():
+    n = int(rb.SAMPLE_RATE * BURST_MSEC / 1000)
+    t = np.arange(n) / rb.SAMPLE_RATE
+    window = np.hanning(n)
+    return (0.8 * window * np.sin(2 * np.pi * BURST_FREQ * t)).astype(np.float32)
+
+
+class Player(threading.Thread):
+    """Plays silence with a burst every period and remembers when every burst
+    reaches the sink. During warmup, plays only silence, so that roc session
+    is established before the first burst."""
+
+    def __init__(self, stream, burst, period_frames, warmup_frames, total_frames):
+        super().__init__()
+        self.stream = stream
+        self.burst = burst
+        self.period_frames = period_frames
+        self.warmup_frames = warmup_frames
+        self.total_frames = total_frames
+        self.burst_times = []
+
+    def run(self):
+        pos = 0
+        while pos < self.total_frames:
+            block = np.zeros((BLOCK_FRAMES, rb.CHANNELS), dtype=np.float32)
+            bursts = []
+
+            for n in range(BLOCK_FRAMES):
+                if pos + n < self.warmup_frames:
+                    continue
+                offset = (pos + n - self.warmup_frames) % self.period_frames
+                if offset < len(self.burst):
+                    block[n, :] = self.burst[offset]
+                if offset == 0:
+                    bursts.append(pos + n)
+
+            self.stream.write(block.tobytes())
+
+            # last written frame will be played after reported latency
+            now = time.monotonic()
+            latency = self.stream.latency_usec() / 1e6
+            end = pos + BLOCK_FRAMES
+
+            for frame in bursts:
+                self.burst_times.append(now + latency - (end - frame) / rb.SAMPLE_RATE)
+
+            pos = end
+
+
+class Recorder(threading.Thread):
+    """Records samples and remembers when every block was captured."""
+
+    def __init__(self, stream, total_frames):
+        super().__init__()
+        self.stream = stream
+        self.total_frames = total_frames
+        self.blocks = []
+        self.block_ends = []
+
+    def run(self):
+        pos = 0
+        nbytes = BLOCK_FRAMES * rb.CHANNELS * 4
+        while pos < self.total_frames:
+            data = self.stream.read(nbytes)
+
+            # last read frame was captured reported latency ago
+            now = time.monotonic()
+            latency = self.stream.latency_usec() / 1e6
+
+            samples = np.frombuffer(data, dtype=np.float32).reshape(-1, rb.CHANNELS)
+            self.blocks.append(samples[:, 0])
+
+            pos += len(samples)
+            self.block_ends.append((pos, now - latency))
+
+    def capture_time(self, frame):
+        for end, end_time in self.block_ends:
+            if frame < end:
+                return end_time - (end - frame) / rb.SAMPLE_RATE
+        return None
+
+
+def find_bursts(signal, burst, period_frames):
+    corr = np.correlate(signal, burst, mode='valid')
+    corr = np.abs(corr)
+
+    threshold = 0.5 * np.dot(burst, burst)
+    peaks = []
+
+    pos = 0
+    while pos < len(corr):
+        if corr[pos] < threshold:
+            pos += 1
+            continue
+        # strongest peak within half of period
+        end = min(len(corr), pos + period_frames // 2)
+        peaks.append(pos + int(np.argmax(corr[pos:end])))
+        pos = end
+
+    return peaks
+
+
+def burst_latencies(player, recorder, burst, period_frames):
+    """Find bursts in recording and return latency of every one of them, from
+    playback to capture, in milliseconds."""
+    signal = np.concatenate(recorder.blocks)
+    peaks = find_bursts(signal, burst, period_frames)
+
+    latencies = []
+    for frame in peaks:
+        capture_time = recorder.capture_time(frame)
+        if capture_time is None:
+            continue
+        # match with the last burst played before it was captured
+        played = [t for t in player.burst_times if t <= capture_time]
+        if not played:
+            continue
+        latencies.append((capture_time - played[-1]) * 1000)
+
+    return latencies
+
+
+def measure(daemon, ports, config, args):
+    sink_args = {
+        'packet_length_msec': config['packet_length_msec'],
+        'fec_encoding': config['fec_encoding'],
+    }
+    input_args = {
+        'fec_encoding': config['fec_encoding'],
+        'latency_profile': config['latency_profile'],
+        'target_latency_msec': args.target_latency,
+    }
+
+    indices = rb.load_roc_pair(daemon, ports, 'bench_roc', 'bench_out', sink_args,
+                               input_args)
+
+    period_frames = int(rb.SAMPLE_RATE * args.period / 1000)
+    warmup_frames = int(rb.SAMPLE_RATE * args.warmup)
+    total_frames = warmup_frames + int(rb.SAMPLE_RATE * args.duration)
+    # keep recording until last burst arrives
+    tail_frames = 2 * period_frames
+
+    burst = make_burst()
+
+    try:
+        play = rb.SimpleStream(daemon.server, rb.PA_STREAM_PLAYBACK, 'bench_roc',
+                               'latency-play')
+        rec = rb.SimpleStream(daemon.server, rb.PA_STREAM_RECORD, 'bench_out.monitor',
+                              'latency-record')
+
+        player = Player(play, burst, period_frames, warmup_frames, total_frames)
+        recorder = Recorder(rec, total_frames + tail_frames)
+
+        recorder.start()
+        player.start()
+        player.join()
+        recorder.join()
+
+        play.close()
+        rec.close()
+    finally:
+        for index in reversed(indices):
+            daemon.unload_module(index)
+
+    latencies = burst_latencies(player, recorder, burst, period_frames)
+    stats = rb.summarize(latencies)
+
+    return {
+        'config': config,
+        'bursts_played': len(player.burst_times),
+        'bursts_received': len(latencies),
+        'latency_msec': stats,
+        'jitter_msec': stats['stddev'] if stats else None,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description='roc-pulse latency benchmark')
+    parser.add_argument('--module-dir', required=True,
+                        help='directory with built modules')
+    parser.add_argument('--source-dir', default='.',
+                        help='source directory, used to report git revision')
+    parser.add_argument('--pulseaudio', default='pulseaudio',
+                        help='pulseaudio executable')
+    parser.add_argument('--output', default='-', help='output json file')
+    parser.add_argument('--packet-length', default='2,5,10',
+                        help='comma-separated packet lengths in milliseconds')
+    parser.add_argument('--fec', default='disable,rs8m',
+                        help='comma-separated fec encodings')
+    parser.add_argument('--latency-profile', default='responsive,gradual',
+                        help='comma-separated latency profiles')
+    parser.add_argument('--target-latency', type=int, default=100,
+                        help='target latency in milliseconds')
+    parser.add_argument('--period', type=int, default=1000,
+                        help='interval between bursts in milliseconds, should be '
+                        'larger than expected latency')
+    parser.add_argument('--duration', type=float, default=10,
+                        help='measurement duration for every configuration in seconds')
+    parser.add_argument('--warmup', type=float, default=2,
+                        help='delay before measurement in seconds')
+    args = parser.parse_args()
+
+    configs = [{
+        'packet_length_msec': packet_length,
+        'fec_encoding': fec,
+        'latency_profile': profile,
+        'target_latency_msec': args.target_latency,
+    } for packet_length, fec, profile in itertools.product(
+        rb.parse_list(args.packet_length, int), rb.parse_list(args.fec),
+        rb.parse_list(args.latency_profile))]
+
+    results = []
+    ports = rb.PortAllocator()
+
+    with rb.PulseDaemon(args.module_dir, args.pulseaudio) as daemon:
+        daemon.load_module('module-null-sink', sink_name='bench_out',
+                           rate=rb.SAMPLE_RATE, channels=rb.CHANNELS)
+
+        for config in configs:
+            rb.log('measuring {}'.format(config))
+            results.append(measure(daemon, ports.allocate(), config, args))
+
+    rb.write_results(args.output, 'latency', args.source_dir, results)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,259 @@
+#! /usr/bin/env python3
+
+# Measures how resource usage of pulseaudio daemon grows with the number of
+# roc streams.
+#
+# Starts private pulseaudio daemon with a null sink, and for every step loads
+# more pairs of module-roc-sink and module-roc-sink-input connected over
+# localhost. Every roc sink is driven by module-sine, and every roc sink input
+# plays to the null sink. After warmup, samples daemon CPU usage (total and
+# per thread name), RSS, thread count, and context switches from /proc, and
+# packet loss and sink tick lateness from module properties and histograms.
+#
+# Requires pulseaudio and pactl. Plotting requires matplotlib.
+
+import argparse
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import rocpulse_bench as rb
+
+CLOCK_TICKS = os.sysconf('SC_CLK_TCK')
+
+
+def read_file(path):
+    try:
+        with open(path) as fp:
+            return fp.read()
+    except OSError:
+        return None
+
+
+def read_status(path):
+    status = {}
+    for line in (read_file(path) or '').splitlines():
+        key, _, value = line.partition(':')
+        status[key] = value.strip()
+    return status
+
+
+class ProcessSnapshot:
+    """CPU times and context switches of every thread of a process."""
+
+    def __init__(self, pid):
+        self.time = time.monotonic()
+        self.threads = {}
+
+        status = read_status('/proc/{}/status'.format(pid))
+        self.rss_kb = int(status.get('VmRSS', '0 kB').split()[0])
+        self.thread_count = int(status.get('Threads', '0'))
+
+        task_dir = '/proc/{}/task'.format(pid)
+        for tid in os.listdir(task_dir):
+            stat = read_file(os.path.join(task_dir, tid, 'stat'))
+            status = read_status(os.path.join(task_dir, tid, 'status'))
+            if not stat or not status:
+                # thread exited
+                continue
+
+            # comm may contain spaces and parens, so split at last paren
+            comm = stat[stat.index('(') + 1:stat.rindex(')')]
+            fields = stat[stat.rindex(')') + 2:].split()
+
+            self.threads[tid] = {
+                'name': comm,
+                'cpu_ticks': int(fields[11]) + int(fields[12]),
+                'voluntary_switches': int(status['voluntary_ctxt_switches']),
+                'involuntary_switches': int(status['nonvoluntary_ctxt_switches']),
+            }
+
+
+def diff_snapshots(before, after):
+    elapsed = after.time - before.time
+
+    cpu_total = 0
+    wakeups = 0
+    preemptions = 0
+    per_name = {}
+
+    # threads that were started or stopped during measurement are skipped
+    for tid, thread in after.threads.items():
+        if tid not in before.threads:
+            continue
+        prev = before.threads[tid]
+
+        cpu = (thread['cpu_ticks'] - prev['cpu_ticks']) / CLOCK_TICKS / elapsed * 100
+
+        cpu_total += cpu
+        wakeups += thread['voluntary_switches'] - prev['voluntary_switches']
+        preemptions += thread['involuntary_switches'] - prev['involuntary_switches']
+
+        entry = per_name.setdefault(thread['name'], {'threads': 0, 'cpu_percent': 0})
+        entry['threads'] += 1
+        entry['cpu_percent'] += cpu
+
+    return {
+        'cpu_percent': cpu_total,
+        'wakeups_per_sec': wakeups / elapsed,
+        'preemptions_per_sec': preemptions / elapsed,
+        'rss_kb': after.rss_kb,
+        'threads': after.thread_count,
+        'per_thread_name': per_name,
+    }
+
+
+def lost_packets(daemon):
+    total = 0
+    for props in daemon.list_properties('sink-inputs'):
+        total += int(props.get('roc.metrics.lost_packets', '0'))
+    return total
+
+
+def late_ticks(daemon, sinks, threshold_usec):
+    """Number of sink ticks that were later than threshold, using tick lateness
+    histograms; returns None if message API is not available."""
+    total = 0
+    for sink in sinks:
+        hists = daemon.send_message('/roc_sink/{}/histograms'.format(sink),
+                                    'get-histograms')
+        if hists is None:
+            return None
+        # bucket N counts values in range [2^(N-1), 2^N)
+        for n, count in enumerate(hists['tick_lateness_usec']['buckets']):
+            if n > 0 and 2**(n - 1) >= threshold_usec:
+                total += count
+    return total
+
+
+def linear_fit(xs, ys):
+    """Return slope and intercept of least-squares line."""
+    n = len(xs)
+    if n < 2:
+        return None, None
+    mean_x = sum(xs) / n
+    mean_y = sum(ys) / n
+    var = sum((x - mean_x)**2 for x in xs)
+    if var == 0:
+        return None, None
+    slope = sum((x - mean_x) * (y - mean_y) for x, y in zip(xs, ys)) / var
+    return slope, mean_y - slope * mean_x
+
+
+def plot(results, path):
+    try:
+        import matplotlib
+        matplotlib.use('Agg')
+        import matplotlib.pyplot as plt
+    except ImportError:
+        rb.die('matplotlib is required for plotting')
+
+    metrics = [
+        ('cpu_percent', 'CPU, %'),
+        ('rss_kb', 'RSS, KiB'),
+        ('threads', 'threads'),
+        ('wakeups_per_sec', 'wakeups per second'),
+    ]
+
+    streams = [r['streams'] for r in results]
+
+    fig, axes = plt.subplots(len(metrics), 1, figsize=(8, 3 * len(metrics)))
+    for ax, (key, label) in zip(axes, metrics):
+        ax.plot(streams, [r[key] for r in results], marker='o')
+        ax.set_ylabel(label)
+        ax.grid(True)
+    axes[-1].set_xlabel('streams')
+
+    fig.tight_layout()
+    fig.savefig(path)
+    rb.log('plot written to {}'.format(path))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='roc-pulse scalability benchmark')
+    parser.add_argument('--module-dir', required=True,
+                        help='directory with built modules')
+    parser.add_argument('--source-dir', default='.',
+                        help='source directory, used to report git revision')
+    parser.add_argument('--pulseaudio', default='pulseaudio',
+                        help='pulseaudio executable')
+    parser.add_argument('--output', default='-', help='output json file')
+    parser.add_argument('--plot', help='output image file with scaling curves')
+    parser.add_argument('--streams', default='0,1,5,10,20,40,60,80,100',
+                        help='comma-separated numbers of streams')
+    parser.add_argument('--sink-args', default='',
+                        help='extra arguments for module-roc-sink')
+    parser.add_argument('--input-args', default='',
+                        help='extra arguments for module-roc-sink-input')
+    parser.add_argument('--duration', type=float, default=10,
+                        help='measurement duration for every step in seconds')
+    parser.add_argument('--warmup', type=float, default=3,
+                        help='delay before measurement in seconds')
+    parser.add_argument('--late-threshold', type=int, default=4000,
+                        help='tick lateness in microseconds counted as late tick')
+    args = parser.parse_args()
+
+    steps = sorted(set(rb.parse_list(args.streams, int)))
+
+    def parse_args(value):
+        return dict(arg.split('=', 1) for arg in value.split())
+
+    sink_args = parse_args(args.sink_args)
+    input_args = parse_args(args.input_args)
+
+    results = []
+    ports = rb.PortAllocator()
+    sinks = []
+
+    with rb.PulseDaemon(args.module_dir, args.pulseaudio) as daemon:
+        daemon.load_module('module-null-sink', sink_name='bench_out')
+
+        for count in steps:
+            # streams from previous steps are kept loaded
+            while len(sinks) < count:
+                sink = 'bench_roc_{}'.format(len(sinks))
+                rb.load_roc_pair(daemon, ports.allocate(), sink, 'bench_out', sink_args,
+                                 input_args)
+                daemon.load_module('module-sine', sink=sink, frequency=440)
+                sinks.append(sink)
+
+            rb.log('measuring {} streams'.format(count))
+            time.sleep(args.warmup)
+
+            lost_before = lost_packets(daemon)
+            late_before = late_ticks(daemon, sinks, args.late_threshold)
+            before = ProcessSnapshot(daemon.pid)
+
+            time.sleep(args.duration)
+
+            after = ProcessSnapshot(daemon.pid)
+            lost_after = lost_packets(daemon)
+            late_after = late_ticks(daemon, sinks, args.late_threshold)
+
+            result = {'streams': count}
+            result.update(diff_snapshots(before, after))
+            result['lost_packets'] = lost_after - lost_before
+            if late_before is not None and late_after is not None:
+                result['late_ticks'] = late_after - late_before
+            results.append(result)
+
+    # per-stream overhead, comparable across commits
+    overhead = {}
+    for key in ['cpu_percent', 'rss_kb', 'threads', 'wakeups_per_sec']:
+        slope, intercept = linear_fit([r['streams'] for r in results],
+                                      [r[key] for r in results])
+        overhead[key] = {'per_stream': slope, 'base': intercept}
+
+    rb.write_results(args.output, 'scalability', args.source_dir, {
+        'steps': results,
+        'overhead': overhead,
+    })
+
+    if args.plot:
+        plot(results, args.plot)
+
+
+if __name__ == '__main__':
+    main()
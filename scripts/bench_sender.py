@@ -0,0 +1,79 @@
+#! /usr/bin/env python3
+
+# Measures cost of roc sink path faster than real time.
+#
+# Runs rocpulse_sender_bench tool for every combination of sample rate,
+# channels, FEC encoding, and packet length, and collects its reports.
+
+import argparse
+import itertools
+import json
+import os
+import subprocess
+import sys
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import rocpulse_bench as rb
+
+
+def main():
+    parser = argparse.ArgumentParser(description='roc-pulse sender throughput benchmark')
+    parser.add_argument('--tool', required=True, help='path to rocpulse_sender_bench')
+    parser.add_argument('--source-dir', default='.',
+                        help='source directory, used to report git revision')
+    parser.add_argument('--output', default='-', help='output json file')
+    parser.add_argument('--rate', default='44100,48000',
+                        help='comma-separated sample rates')
+    parser.add_argument('--chans', default='mono,stereo',
+                        help='comma-separated channel layouts')
+    parser.add_argument('--format', default='f32,s16',
+                        help='comma-separated sink sample formats')
+    parser.add_argument('--fec', default='disable,rs8m,ldpc',
+                        help='comma-separated fec encodings')
+    parser.add_argument('--packet-length', default='2,5,10',
+                        help='comma-separated packet lengths in milliseconds')
+    parser.add_argument('--writer', default='null',
+                        choices=['null', 'udp', 'batch', 'shm'],
+                        help='where to send packets')
+    parser.add_argument('--duration', type=float, default=60,
+                        help='duration of audio per iteration in seconds')
+    parser.add_argument('--iterations', type=int, default=5,
+                        help='number of iterations for every configuration')
+    args = parser.parse_args()
+
+    results = []
+
+    for rate, chans, fmt, fec, packet_length in itertools.product(
+            rb.parse_list(args.rate, int), rb.parse_list(args.chans),
+            rb.parse_list(args.format), rb.parse_list(args.fec),
+            rb.parse_list(args.packet_length, int)):
+        config = {
+            'sink_rate': rate,
+            'sink_chans': chans,
+            'sink_format': fmt,
+            'fec_encoding': fec,
+            'packet_length_msec': packet_length,
+        }
+        rb.log('measuring {}'.format(config))
+
+        cmd = [
+            args.tool,
+            '-j',
+            '-n', str(args.iterations),
+            '-d', str(args.duration),
+            '-w', args.writer,
+        ] + ['{}={}'.format(k, v) for k, v in config.items()]
+
+        try:
+            report = json.loads(subprocess.check_output(cmd).decode())
+        except (OSError, subprocess.CalledProcessError, ValueError) as e:
+            rb.die('{} failed: {}'.format(' '.join(cmd), e))
+
+        results.append({'config': config, 'writer': args.writer, 'report': report})
+
+    rb.write_results(args.output, 'sender', args.source_dir, results)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,322 @@
+#! /usr/bin/env python3
+
+# UDP proxy that forwards packets between roc sender and receiver on localhost
+# and applies configurable network impairments.
+#
+# Every forwarded port has its own listening socket, where sender sends
+# packets, and upstream socket, which forwards them to receiver. Packets that
+# receiver sends back to upstream socket (e.g. control packets) are returned
+# to sender without impairments. All forwarded ports share one loss model, so
+# that burst losses hit source and repair packets together, as on a real link.
+#
+# Impairments are described by a comma-separated list of key=value pairs:
+#
+#   loss=P            lose every packet with probability P (Bernoulli)
+#   ge=PGB:PBG[:HB[:HG]]
+#                     Gilbert-Elliott loss: PGB and PBG are probabilities of
+#                     transition from good to bad state and back, HB and HG
+#                     are loss probabilities in bad and good states (default
+#                     1 and 0)
+#   trace=FILE        replay loss trace: one character per packet, '1' or 'x'
+#                     means lost, '0' or '.' means received, whitespace is
+#                     ignored; trace is repeated when it ends
+#   delay=MS          constant delay
+#   jitter=MS         random extra delay, uniform in [0, MS]; packets may be
+#                     reordered if jitter is larger than packet interval
+#   reorder=P[:MS]    hold packet for extra MS (default 10) with probability P
+#   dup=P             duplicate packet with probability P
+#
+# For example, "ge=0.01:0.3,jitter=5" approximates bursty wi-fi.
+
+import argparse
+import heapq
+import random
+import selectors
+import signal
+import socket
+import sys
+import threading
+import time
+
+
+class ImpairSpec:
+    def __init__(self, text=''):
+        self.loss = 0.0
+        self.ge = None
+        self.trace = None
+        self.delay = 0.0
+        self.jitter = 0.0
+        self.reorder = 0.0
+        self.reorder_delay = 0.010
+        self.dup = 0.0
+        self.text = text
+
+        for item in text.split(','):
+            if not item:
+                continue
+            key, sep, value = item.partition('=')
+            if not sep:
+                raise ValueError('expected key=value, got {!r}'.format(item))
+            if key == 'loss':
+                self.loss = self._probability(value)
+            elif key == 'ge':
+                parts = [self._probability(v) for v in value.split(':')]
+                if not 2 <= len(parts) <= 4:
+                    raise ValueError('expected ge=PGB:PBG[:HB[:HG]]')
+                self.ge = (parts + [1.0, 0.0][len(parts) - 2:])[:4]
+            elif key == 'trace':
+                self.trace = self._load_trace(value)
+            elif key == 'delay':
+                self.delay = float(value) / 1000
+            elif key == 'jitter':
+                self.jitter = float(value) / 1000
+            elif key == 'reorder':
+                prob, _, delay = value.partition(':')
+                self.reorder = self._probability(prob)
+                if delay:
+                    self.reorder_delay = float(delay) / 1000
+            elif key == 'dup':
+                self.dup = self._probability(value)
+            else:
+                raise ValueError('unknown impairment {!r}'.format(key))
+
+    def __str__(self):
+        return self.text or 'none'
+
+    @staticmethod
+    def _probability(value):
+        prob = float(value)
+        if not 0 <= prob <= 1:
+            raise ValueError('probability should be in range [0; 1]')
+        return prob
+
+    @staticmethod
+    def _load_trace(path):
+        trace = []
+        with open(path) as fp:
+            for ch in fp.read():
+                if ch in '1xX':
+                    trace.append(True)
+                elif ch in '0.':
+                    trace.append(False)
+                elif not ch.isspace():
+                    raise ValueError('unexpected character {!r} in {}'.format(ch, path))
+        if not trace:
+            raise ValueError('empty trace {}'.format(path))
+        return trace
+
+
+class LossModel:
+    def __init__(self, spec, rng):
+        self.spec = spec
+        self.rng = rng
+        self.bad_state = False
+        self.trace_pos = 0
+
+    def lost(self):
+        spec = self.spec
+        if spec.trace:
+            lost = spec.trace[self.trace_pos]
+            self.trace_pos = (self.trace_pos + 1) % len(spec.trace)
+            return lost
+        if spec.ge:
+            p_gb, p_bg, h_bad, h_good = spec.ge
+            if self.bad_state:
+                self.bad_state = self.rng.random() >= p_bg
+            else:
+                self.bad_state = self.rng.random() < p_gb
+            return self.rng.random() < (h_bad if self.bad_state else h_good)
+        return self.rng.random() < spec.loss
+
+
+class _Forward:
+    def __init__(self, listen_port, target_port, host):
+        self.listen_port = listen_port
+        self.target = (host, target_port)
+        self.client = None
+
+        self.listen_sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.listen_sock.bind((host, listen_port))
+        self.listen_sock.setblocking(False)
+
+        self.upstream_sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.upstream_sock.bind((host, 0))
+        self.upstream_sock.setblocking(False)
+
+        self.next_seq = 0
+        self.max_sent_seq = -1
+
+        self.stats = {
+            'received': 0,
+            'dropped': 0,
+            'duplicated': 0,
+            'reordered': 0,
+            'forwarded': 0,
+            'returned': 0,
+        }
+
+    def close(self):
+        self.listen_sock.close()
+        self.upstream_sock.close()
+
+
+class ImpairProxy:
+    """Forwards UDP ports and applies impairments; can be run in a background
+    thread with start() and stop(), or in foreground with run()."""
+
+    def __init__(self, forwards, spec, host='127.0.0.1', seed=None):
+        self.spec = spec if isinstance(spec, ImpairSpec) else ImpairSpec(spec)
+        self.rng = random.Random(seed)
+        self.loss_model = LossModel(self.spec, self.rng)
+        self.forwards = [_Forward(listen, target, host) for listen, target in forwards]
+
+        # heap of (send_time, counter, forward, seq, data)
+        self.queue = []
+        self.counter = 0
+
+        self.selector = selectors.DefaultSelector()
+        for fwd in self.forwards:
+            self.selector.register(fwd.listen_sock, selectors.EVENT_READ, (fwd, True))
+            self.selector.register(fwd.upstream_sock, selectors.EVENT_READ, (fwd, False))
+
+        self.stopped = threading.Event()
+        self.thread = None
+
+    def start(self):
+        self.thread = threading.Thread(target=self.run, daemon=True)
+        self.thread.start()
+
+    def stop(self):
+        self.stopped.set()
+        if self.thread:
+            self.thread.join()
+            self.thread = None
+
+    def close(self):
+        self.selector.close()
+        for fwd in self.forwards:
+            fwd.close()
+
+    def stats(self):
+        return {fwd.listen_port: dict(fwd.stats) for fwd in self.forwards}
+
+    def run(self):
+        while not self.stopped.is_set():
+            timeout = 0.05
+            if self.queue:
+                timeout = max(0, min(timeout, self.queue[0][0] - time.monotonic()))
+
+            for key, _ in self.selector.select(timeout):
+                fwd, from_sender = key.data
+                self._receive(fwd, from_sender)
+
+            self._flush()
+
+    def _receive(self, fwd, from_sender):
+        while True:
+            try:
+                if from_sender:
+                    data, addr = fwd.listen_sock.recvfrom(65536)
+                else:
+                    data, addr = fwd.upstream_sock.recvfrom(65536)
+            except (BlockingIOError, InterruptedError):
+                return
+            except ConnectionRefusedError:
+                # icmp unreachable from previous send, receiver is not ready yet
+                continue
+
+            if not from_sender:
+                if fwd.client:
+                    self._send(fwd.listen_sock, data, fwd.client)
+                    fwd.stats['returned'] += 1
+                continue
+
+            fwd.client = addr
+            fwd.stats['received'] += 1
+
+            seq = fwd.next_seq
+            fwd.next_seq += 1
+
+            if self.loss_model.lost():
+                fwd.stats['dropped'] += 1
+                continue
+
+            copies = 1
+            if self.spec.dup and self.rng.random() < self.spec.dup:
+                copies = 2
+                fwd.stats['duplicated'] += 1
+
+            for _ in range(copies):
+                self._schedule(fwd, seq, data)
+
+    def _schedule(self, fwd, seq, data):
+        spec = self.spec
+
+        delay = spec.delay
+        if spec.jitter:
+            delay += self.rng.uniform(0, spec.jitter)
+        if spec.reorder and self.rng.random() < spec.reorder:
+            delay += spec.reorder_delay
+
+        heapq.heappush(self.queue, (time.monotonic() + delay, self.counter, fwd, seq, data))
+        self.counter += 1
+
+    def _flush(self):
+        now = time.monotonic()
+        while self.queue and self.queue[0][0] <= now:
+            _, _, fwd, seq, data = heapq.heappop(self.queue)
+
+            if seq < fwd.max_sent_seq:
+                fwd.stats['reordered'] += 1
+            fwd.max_sent_seq = max(fwd.max_sent_seq, seq)
+
+            self._send(fwd.upstream_sock, data, fwd.target)
+            fwd.stats['forwarded'] += 1
+
+    @staticmethod
+    def _send(sock, data, addr):
+        try:
+            sock.sendto(data, addr)
+        except (BlockingIOError, ConnectionRefusedError):
+            # same as packet lost in network
+            pass
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='UDP proxy with network impairments',
+        epilog='see comment at the top of the script for impairment syntax')
+    parser.add_argument('--host', default='127.0.0.1', help='address to use')
+    parser.add_argument('--forward', action='append', required=True,
+                        metavar='LISTEN:TARGET',
+                        help='forward packets from LISTEN port to TARGET port, '
+                        'can be given multiple times')
+    parser.add_argument('--impair', default='', help='impairments, e.g. loss=0.05')
+    parser.add_argument('--seed', type=int, help='random seed for reproducible runs')
+    args = parser.parse_args()
+
+    try:
+        forwards = [tuple(int(p) for p in f.split(':')) for f in args.forward]
+        spec = ImpairSpec(args.impair)
+    except ValueError as e:
+        print('error: {}'.format(e), file=sys.stderr)
+        sys.exit(1)
+
+    proxy = ImpairProxy(forwards, spec, args.host, args.seed)
+
+    signal.signal(signal.SIGINT, lambda *_: proxy.stopped.set())
+    signal.signal(signal.SIGTERM, lambda *_: proxy.stopped.set())
+
+    print('forwarding {} with impairments: {}'.format(
+        ', '.join('{}->{}'.format(*f) for f in forwards), spec), file=sys.stderr)
+
+    proxy.run()
+    proxy.close()
+
+    for port, stats in proxy.stats().items():
+        print('{}: {}'.format(port, ' '.join('{}={}'.format(k, v)
+                                              for k, v in stats.items())))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,359 @@
+#! /usr/bin/env python3
+
+# Common helpers for benchmarks: private pulseaudio daemon, module loading,
+# simple playback and record streams, and result output.
+
+import ctypes
+import ctypes.util
+import json
+import math
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+SAMPLE_RATE = 44100
+CHANNELS = 2
+
+# pa_sample_format_t and pa_stream_direction_t values from libpulse
+PA_SAMPLE_FLOAT32LE = 5
+PA_STREAM_PLAYBACK = 1
+PA_STREAM_RECORD = 2
+
+
+def log(msg):
+    print(msg, file=sys.stderr, flush=True)
+
+
+def die(msg):
+    log('error: ' + msg)
+    sys.exit(1)
+
+
+def git_revision(source_dir):
+    try:
+        return subprocess.check_output(
+            ['git', '-C', source_dir, 'describe', '--always', '--dirty'],
+            stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def percentile(values, p):
+    if not values:
+        return None
+    values = sorted(values)
+    pos = min(len(values) - 1, max(0, int(math.ceil(p / 100 * len(values))) - 1))
+    return values[pos]
+
+
+def summarize(values):
+    """Return mean, percentiles, and standard deviation of values."""
+    if not values:
+        return None
+    mean = sum(values) / len(values)
+    stddev = math.sqrt(sum((v - mean) ** 2 for v in values) / len(values))
+    return {
+        'count': len(values),
+        'mean': mean,
+        'min': min(values),
+        'p50': percentile(values, 50),
+        'p99': percentile(values, 99),
+        'max': max(values),
+        'stddev': stddev,
+    }
+
+
+def write_results(path, benchmark, source_dir, results):
+    report = {
+        'benchmark': benchmark,
+        'revision': git_revision(source_dir),
+        'timestamp': int(time.time()),
+        'results': results,
+    }
+    text = json.dumps(report, indent=2) + '\n'
+    if path and path != '-':
+        with open(path, 'w') as fp:
+            fp.write(text)
+        log('results written to {}'.format(path))
+    else:
+        sys.stdout.write(text)
+
+
+def parse_list(value, type=str):
+    return [type(v) for v in value.split(',') if v]
+
+
+class PulseDaemon:
+    """Pulseaudio daemon with its own runtime, state, and config directories,
+    so that it doesn't interfere with user session. Extra environment is passed
+    only to daemon, e.g. to preload libfaketime."""
+
+    def __init__(self, module_dir, pulseaudio='pulseaudio', log_level='notice',
+                 env={}):
+        self.module_dir = os.path.abspath(module_dir)
+        self.pulseaudio = pulseaudio
+        self.log_level = log_level
+        self.daemon_env = env
+        self.proc = None
+        self.tmp_dir = None
+
+    def __enter__(self):
+        self.start()
+        return self
+
+    def __exit__(self, *args):
+        self.stop()
+
+    def _default_search_path(self):
+        out = subprocess.check_output([self.pulseaudio, '--dump-conf']).decode()
+        for line in out.splitlines():
+            key, _, value = line.partition('=')
+            if key.strip() == 'dl-search-path':
+                return value.strip()
+        return ''
+
+    def start(self):
+        if not shutil.which(self.pulseaudio):
+            die("can't find {}".format(self.pulseaudio))
+
+        self.tmp_dir = tempfile.mkdtemp(prefix='rocpulse-bench-')
+        self.socket = os.path.join(self.tmp_dir, 'native')
+        self.server = 'unix:' + self.socket
+        self.log_file = os.path.join(self.tmp_dir, 'pulse.log')
+
+        search_path = self.module_dir
+        default_path = self._default_search_path()
+        if default_path:
+            search_path += ':' + default_path
+
+        self.env = dict(os.environ)
+        self.env.update({
+            'PULSE_RUNTIME_PATH': os.path.join(self.tmp_dir, 'runtime'),
+            'PULSE_STATE_PATH': os.path.join(self.tmp_dir, 'state'),
+            'XDG_CONFIG_HOME': os.path.join(self.tmp_dir, 'config'),
+            'PULSE_SERVER': self.server,
+        })
+
+        self.proc = subprocess.Popen([
+            self.pulseaudio,
+            '-n',
+            '--daemonize=no',
+            '--exit-idle-time=-1',
+            '--use-pid-file=no',
+            '--dl-search-path=' + search_path,
+            '--log-target=file:' + self.log_file,
+            '--log-level=' + self.log_level,
+            '-L', 'module-native-protocol-unix socket={} auth-anonymous=1'.format(
+                self.socket),
+        ], env=dict(self.env, **self.daemon_env))
+
+        deadline = time.monotonic() + 10
+        while time.monotonic() < deadline:
+            if self.proc.poll() is not None:
+                die('pulseaudio exited, see {}'.format(self.log_file))
+            if self.pactl('info', check=False) is not None:
+                log('started pulseaudio at {}'.format(self.server))
+                return
+            time.sleep(0.1)
+
+        die("pulseaudio didn't start, see {}".format(self.log_file))
+
+    def stop(self):
+        if self.proc:
+            self.proc.terminate()
+            try:
+                self.proc.wait(timeout=10)
+            except subprocess.TimeoutExpired:
+                self.proc.kill()
+                self.proc.wait()
+            self.proc = None
+        if self.tmp_dir:
+            shutil.rmtree(self.tmp_dir, ignore_errors=True)
+            self.tmp_dir = None
+
+    def pactl(self, *args, check=True):
+        try:
+            return subprocess.check_output(
+                ['pactl', '-s', self.server] + list(args), env=self.env,
+                stderr=subprocess.DEVNULL).decode()
+        except subprocess.CalledProcessError:
+            if check:
+                die('pactl {} failed, see {}'.format(' '.join(args), self.log_file))
+            return None
+
+    def load_module(self, name, **kwargs):
+        argument = ' '.join('{}={}'.format(k, v) for k, v in kwargs.items())
+        return int(self.pactl('load-module', name, argument).strip())
+
+    def unload_module(self, index):
+        self.pactl('unload-module', str(index), check=False)
+
+    @property
+    def pid(self):
+        return self.proc.pid
+
+    def list_properties(self, kind):
+        """Return properties of every object of given kind (e.g. 'sinks' or
+        'sink-inputs'), as a list of dicts."""
+        objects = []
+        for line in self.pactl('list', kind).splitlines():
+            if re.match(r'^\S.*#\d+$', line):
+                objects.append({})
+                continue
+            match = re.match(r'^\s+([\w.-]+) = "(.*)"$', line)
+            if match and objects:
+                objects[-1][match.group(1)] = match.group(2)
+        return objects
+
+    def send_message(self, path, message):
+        """Send message via message API (pulseaudio 15 or later) and return
+        parsed JSON reply, or None if it failed."""
+        reply = self.pactl('send-message', path, message, check=False)
+        if reply is None:
+            return None
+        try:
+            return json.loads(reply)
+        except ValueError:
+            return None
+
+
+class _SampleSpec(ctypes.Structure):
+    _fields_ = [
+        ('format', ctypes.c_int),
+        ('rate', ctypes.c_uint32),
+        ('channels', ctypes.c_uint8),
+    ]
+
+
+class _BufferAttr(ctypes.Structure):
+    _fields_ = [
+        ('maxlength', ctypes.c_uint32),
+        ('tlength', ctypes.c_uint32),
+        ('prebuf', ctypes.c_uint32),
+        ('minreq', ctypes.c_uint32),
+        ('fragsize', ctypes.c_uint32),
+    ]
+
+
+_libpulse_simple = None
+
+
+def _load_libpulse_simple():
+    global _libpulse_simple
+    if _libpulse_simple:
+        return _libpulse_simple
+
+    name = ctypes.util.find_library('pulse-simple') or 'libpulse-simple.so.0'
+    lib = ctypes.CDLL(name)
+
+    lib.pa_simple_new.restype = ctypes.c_void_p
+    lib.pa_simple_new.argtypes = [
+        ctypes.c_char_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_char_p,
+        ctypes.c_char_p, ctypes.POINTER(_SampleSpec), ctypes.c_void_p,
+        ctypes.POINTER(_BufferAttr), ctypes.POINTER(ctypes.c_int),
+    ]
+    lib.pa_simple_free.argtypes = [ctypes.c_void_p]
+    lib.pa_simple_write.argtypes = [
+        ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_int),
+    ]
+    lib.pa_simple_read.argtypes = [
+        ctypes.c_void_p, ctypes.c_void_p, ctypes.c_size_t, ctypes.POINTER(ctypes.c_int),
+    ]
+    lib.pa_simple_get_latency.restype = ctypes.c_uint64
+    lib.pa_simple_get_latency.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int)]
+
+    _libpulse_simple = lib
+    return lib
+
+
+class SimpleStream:
+    """Blocking playback or record stream of interleaved float32 samples."""
+
+    def __init__(self, server, direction, device, name, buffer_msec=20):
+        self.lib = _load_libpulse_simple()
+
+        spec = _SampleSpec(PA_SAMPLE_FLOAT32LE, SAMPLE_RATE, CHANNELS)
+        frame_size = 4 * CHANNELS
+        nbytes = int(SAMPLE_RATE * buffer_msec / 1000) * frame_size
+
+        attr = _BufferAttr(0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff)
+        if direction == PA_STREAM_PLAYBACK:
+            attr.tlength = nbytes
+        else:
+            attr.fragsize = nbytes
+
+        err = ctypes.c_int(0)
+        self.handle = self.lib.pa_simple_new(
+            server.encode(), b'rocpulse-bench', direction, device.encode(),
+            name.encode(), ctypes.byref(spec), None, ctypes.byref(attr),
+            ctypes.byref(err))
+        if not self.handle:
+            die("can't open stream for {}: error {}".format(device, err.value))
+
+    def close(self):
+        if self.handle:
+            self.lib.pa_simple_free(self.handle)
+            self.handle = None
+
+    def write(self, data):
+        err = ctypes.c_int(0)
+        if self.lib.pa_simple_write(self.handle, data, len(data), ctypes.byref(err)) < 0:
+            die('write failed: error {}'.format(err.value))
+
+    def read(self, nbytes):
+        buf = ctypes.create_string_buffer(nbytes)
+        err = ctypes.c_int(0)
+        if self.lib.pa_simple_read(self.handle, buf, nbytes, ctypes.byref(err)) < 0:
+            die('read failed: error {}'.format(err.value))
+        return buf.raw
+
+    def latency_usec(self):
+        err = ctypes.c_int(0)
+        return self.lib.pa_simple_get_latency(self.handle, ctypes.byref(err))
+
+
+class PortAllocator:
+    """Hands out consecutive triples of ports for source, repair, and control."""
+
+    def __init__(self, base=20000):
+        self.next_port = base
+
+    def allocate(self):
+        ports = (self.next_port, self.next_port + 1, self.next_port + 2)
+        self.next_port += 3
+        return ports
+
+
+def load_roc_pair(daemon, ports, sink_name, target_sink, sink_args={}, input_args={},
+                  sender_ports=None, input_daemon=None):
+    """Load roc sink and roc sink input connected over localhost, and return
+    indices of both modules. If sender ports are given, roc sink sends to them
+    instead of receiver ports, e.g. to put a proxy in between. If input daemon
+    is given, roc sink input is loaded there instead, e.g. to receive with
+    another clock."""
+    source_port, repair_port, control_port = ports
+    remote_source_port, remote_repair_port, remote_control_port = sender_ports or ports
+
+    sink_index = daemon.load_module(
+        'module-roc-sink',
+        sink_name=sink_name,
+        remote_ip='127.0.0.1',
+        remote_source_port=remote_source_port,
+        remote_repair_port=remote_repair_port,
+        remote_control_port=remote_control_port,
+        **sink_args)
+
+    input_index = (input_daemon or daemon).load_module(
+        'module-roc-sink-input',
+        sink=target_sink,
+        local_ip='127.0.0.1',
+        local_source_port=source_port,
+        local_repair_port=repair_port,
+        local_control_port=control_port,
+        **input_args)
+
+    return sink_index, input_index
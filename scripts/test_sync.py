@@ -0,0 +1,276 @@
+#! /usr/bin/env python3
+
+# Checks that synchronized receivers play the stream at the same time.
+#
+# Starts two private pulseaudio daemons. The first one runs roc sinks, driven
+# by module-sine, and the first roc sink input; the second one runs the second
+# roc sink input, optionally with its wall clock shifted by libfaketime, so
+# that end-to-end latency it computes from sender timestamps is off by the
+# clock offset. Both receivers use the same sync_latency_msec and play into
+# null sinks. The test waits until reported alignment error
+# (roc.sync.error_usec) of both of them stays within tolerance.
+#
+# Then it measures actual alignment in the same way as bench_latency.py: plays
+# short tone bursts to both roc sinks, records monitors of both null sinks,
+# finds every burst by cross-correlation, and computes latency of both paths.
+# Their difference (skew) should be within tolerance from the expected one:
+# zero without clock offset, and minus the offset otherwise, since a receiver
+# with clock ahead considers the stream later than it is and plays it earlier.
+#
+# Requires pulseaudio, pactl, libpulse-simple, numpy, and, for non-zero clock
+# offsets, libfaketime. Exits with non-zero status if playout doesn't converge
+# or isn't aligned.
+
+import argparse
+import glob
+import os
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import bench_latency as bl
+import rocpulse_bench as rb
+
+FAKETIME_PATTERNS = [
+    '/usr/lib/*/faketime/libfaketime.so.1',
+    '/usr/lib/faketime/libfaketime.so.1',
+    '/usr/lib64/faketime/libfaketime.so.1',
+    '/usr/local/lib/faketime/libfaketime.so.1',
+]
+
+
+def find_faketime():
+    for pattern in FAKETIME_PATTERNS:
+        paths = sorted(glob.glob(pattern))
+        if paths:
+            return paths[0]
+    return None
+
+
+def faketime_env(lib, offset_msec):
+    # only wall clock is shifted, pulseaudio timers use monotonic clock
+    return {
+        'LD_PRELOAD': lib,
+        'FAKETIME': '{:+.6f}'.format(offset_msec / 1000),
+        'FAKETIME_DONT_FAKE_MONOTONIC': '1',
+    }
+
+
+def measure_latencies(local, remote, args):
+    """Play the same bursts to both roc sinks, and return latencies of both
+    paths, from roc sink to null sink monitor, in milliseconds, or None if
+    bursts weren't found."""
+    period_frames = int(rb.SAMPLE_RATE * args.period / 1000)
+    warmup_frames = int(rb.SAMPLE_RATE * args.warmup)
+    total_frames = warmup_frames + int(rb.SAMPLE_RATE * args.duration)
+    # keep recording until last burst arrives
+    tail_frames = 2 * period_frames
+
+    burst = bl.make_burst()
+
+    play = [
+        rb.SimpleStream(local.server, rb.PA_STREAM_PLAYBACK, 'sync_roc1', 'sync-play1'),
+        rb.SimpleStream(local.server, rb.PA_STREAM_PLAYBACK, 'sync_roc2', 'sync-play2'),
+    ]
+    rec = [
+        rb.SimpleStream(local.server, rb.PA_STREAM_RECORD, 'sync_out.monitor',
+                        'sync-record'),
+        rb.SimpleStream(remote.server, rb.PA_STREAM_RECORD, 'sync_out.monitor',
+                        'sync-record'),
+    ]
+
+    players = [bl.Player(stream, burst, period_frames, warmup_frames, total_frames)
+               for stream in play]
+    recorders = [bl.Recorder(stream, total_frames + tail_frames) for stream in rec]
+
+    for thread in recorders + players:
+        thread.start()
+    for thread in recorders + players:
+        thread.join()
+
+    for stream in play + rec:
+        stream.close()
+
+    latencies = []
+    for player, recorder in zip(players, recorders):
+        stats = rb.summarize(
+            bl.burst_latencies(player, recorder, burst, period_frames))
+        if not stats:
+            return None
+        latencies.append(stats['p50'])
+
+    return latencies
+
+
+def read_sync(daemon):
+    """Return alignment error and extra delay of roc sink input in daemon, in
+    microseconds, or None until they're reported."""
+    for props in daemon.list_properties('sink-inputs'):
+        if 'roc.sync.error_usec' in props:
+            return (int(props['roc.sync.error_usec']),
+                    int(props['roc.sync.delay_usec']))
+    return None
+
+
+def run(local, remote, ports, offset_msec, args):
+    sink_args = {
+        'fec_encoding': args.fec,
+    }
+    input_args = {
+        'fec_encoding': args.fec,
+        'sync_latency_msec': args.sync_latency,
+    }
+
+    sink1, input1 = rb.load_roc_pair(local, ports.allocate(), 'sync_roc1', 'sync_out',
+                                     sink_args, input_args)
+    sink2, input2 = rb.load_roc_pair(local, ports.allocate(), 'sync_roc2', 'sync_out',
+                                     sink_args, input_args, input_daemon=remote)
+
+    sines = [
+        local.load_module('module-sine', sink='sync_roc1', frequency=440),
+        local.load_module('module-sine', sink='sync_roc2', frequency=440),
+    ]
+
+    tolerance = args.tolerance * 1000
+    history = []
+    converged_after = None
+    latencies = None
+
+    try:
+        start = time.monotonic()
+        while time.monotonic() - start < args.timeout:
+            time.sleep(1)
+
+            sync1, sync2 = read_sync(local), read_sync(remote)
+            if sync1 is None or sync2 is None:
+                continue
+
+            history.append((sync1, sync2))
+            rb.log('error {:+} / {:+} usec, delay {} / {} usec'.format(
+                sync1[0], sync2[0], sync1[1], sync2[1]))
+
+            recent = history[-args.settle:]
+            if len(recent) == args.settle and all(
+                    abs(s1[0]) <= tolerance and abs(s2[0]) <= tolerance
+                    for s1, s2 in recent):
+                converged_after = time.monotonic() - start
+                break
+
+        # bursts are played instead of sine
+        while sines:
+            local.unload_module(sines.pop())
+
+        if converged_after is not None:
+            latencies = measure_latencies(local, remote, args)
+    finally:
+        for index in sines + [sink2, input1, sink1]:
+            local.unload_module(index)
+        remote.unload_module(input2)
+
+    result = {
+        'clock_offset_msec': offset_msec,
+        'converged': converged_after is not None,
+        'converged_after_sec': converged_after,
+        'expected_skew_msec': -offset_msec,
+        'skew_msec': None,
+    }
+
+    if latencies:
+        result.update({
+            'latency_msec': latencies,
+            'skew_msec': latencies[1] - latencies[0],
+        })
+
+    if history:
+        (error1, delay1), (error2, delay2) = history[-1]
+        result.update({
+            'error_usec': [error1, error2],
+            'delay_usec': [delay1, delay2],
+            'delay_diff_msec': (delay1 - delay2) / 1000,
+        })
+
+    # receiver with clock ahead sees larger latency and plays earlier
+    result['passed'] = result['skew_msec'] is not None and abs(
+        result['skew_msec'] - result['expected_skew_msec']) <= args.tolerance
+
+    return result
+
+
+def main():
+    parser = argparse.ArgumentParser(description='roc-pulse synchronized playout test')
+    parser.add_argument('--module-dir', required=True,
+                        help='directory with built modules')
+    parser.add_argument('--pulseaudio', default='pulseaudio',
+                        help='pulseaudio executable')
+    parser.add_argument('--faketime-lib', default=None,
+                        help='path to libfaketime.so.1 (default: search)')
+    parser.add_argument('--clock-offset', default='0,30,-30',
+                        help='comma-separated wall clock offsets of the second '
+                        'receiver in milliseconds')
+    parser.add_argument('--sync-latency', type=int, default=200,
+                        help='sync latency of receivers in milliseconds')
+    parser.add_argument('--fec', default='rs8m', help='fec encoding')
+    parser.add_argument('--tolerance', type=float, default=5,
+                        help='allowed reported and measured alignment error in '
+                        'milliseconds')
+    parser.add_argument('--settle', type=int, default=5,
+                        help='number of consecutive checks within tolerance')
+    parser.add_argument('--timeout', type=float, default=60,
+                        help='time to wait for convergence in seconds')
+    parser.add_argument('--period', type=int, default=1000,
+                        help='interval between bursts in milliseconds, should be '
+                        'larger than sync latency')
+    parser.add_argument('--duration', type=float, default=10,
+                        help='alignment measurement duration in seconds')
+    parser.add_argument('--warmup', type=float, default=1,
+                        help='silence before the first burst in seconds')
+    args = parser.parse_args()
+
+    offsets = rb.parse_list(args.clock_offset, int)
+
+    faketime_lib = None
+    if any(offsets):
+        faketime_lib = args.faketime_lib or find_faketime()
+        if not faketime_lib or not os.path.exists(faketime_lib):
+            rb.die("can't find libfaketime, use --faketime-lib")
+
+    results = []
+    ports = rb.PortAllocator()
+
+    with rb.PulseDaemon(args.module_dir, args.pulseaudio) as local:
+        local.load_module('module-null-sink', sink_name='sync_out',
+                          rate=rb.SAMPLE_RATE, channels=rb.CHANNELS)
+
+        for offset in offsets:
+            rb.log('testing clock offset {}ms'.format(offset))
+
+            env = faketime_env(faketime_lib, offset) if offset else {}
+
+            with rb.PulseDaemon(args.module_dir, args.pulseaudio, env=env) as remote:
+                remote.load_module('module-null-sink', sink_name='sync_out',
+                                   rate=rb.SAMPLE_RATE, channels=rb.CHANNELS)
+
+                results.append(run(local, remote, ports, offset, args))
+
+    failed = 0
+    for result in results:
+        status = 'ok' if result['passed'] else 'FAILED'
+        if not result['converged']:
+            details = 'not converged'
+        elif result['skew_msec'] is None:
+            details = 'bursts not found'
+        else:
+            details = 'converged after {:.0f}s, skew {:+.1f}ms, expected {:+}ms'.format(
+                result['converged_after_sec'], result['skew_msec'],
+                result['expected_skew_msec'])
+        print('clock offset {:+}ms: {}, {}'.format(result['clock_offset_msec'], status,
+                                                   details))
+        if not result['passed']:
+            failed += 1
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
@@ -10,13 +10,19 @@
 #include <config.h>
 
 /* public pulseaudio headers */
+#include <pulse/rtclock.h>
 #include <pulse/xmalloc.h>
 
 /* private pulseaudio headers */
+#include <pulsecore/core-util.h>
+#include <pulsecore/core.h>
+#include <pulsecore/idxset.h>
 #include <pulsecore/log.h>
+#include <pulsecore/memblockq.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/module.h>
 #include <pulsecore/namereg.h>
+#include <pulsecore/sample-util.h>
 #include <pulsecore/sink-input.h>
 
 /* roc headers */
@@ -26,7 +32,17 @@
 #include <roc/version.h>
 
 /* local headers */
+#include "rocpulse_config.h"
+#include "rocpulse_convert.h"
 #include "rocpulse_helpers.h"
+#include "rocpulse_histogram.h"
+#include "rocpulse_latency_cache.h"
+#include "rocpulse_log.h"
+#include "rocpulse_metrics.h"
+#include "rocpulse_receiver_pool.h"
+#include "rocpulse_sched.h"
+#include "rocpulse_trace.h"
+#include "rocpulse_worker.h"
 
 PA_MODULE_AUTHOR("Roc Streaming authors");
 PA_MODULE_DESCRIPTION("Read audio stream from Roc receiver");
@@ -39,12 +55,12 @@ PA_MODULE_USAGE("local_ip=<local receiver ip> "
                 "sink=<name for the sink> "
                 "sink_input_properties=<properties for the sink input> "
                 "sink_input_rate=<sample rate> "
-                "sink_input_format=f32 "
-                "sink_input_chans=mono|stereo "
+                "sink_input_format=s16|s32|f32 "
+                "sink_input_chans=mono|stereo|<number of channels>|<channel map> "
                 "packet_encoding_id=<8-bit number> "
                 "packet_encoding_rate=<sample rate> "
                 "packet_encoding_format=s16 "
-                "packet_encoding_chans=mono|stereo "
+                "packet_encoding_chans=mono|stereo|<number of channels>|<channel map> "
                 "fec_encoding=disable|rs8m|ldpc "
                 "resampler_backend=default|builtin|speex|speexdec "
                 "resampler_profile=default|high|medium|low "
@@ -54,128 +70,1287 @@ PA_MODULE_USAGE("local_ip=<local receiver ip> "
                 "latency_tolerance_msec=<maximum latency deviation in milliseconds> "
                 "io_latency_msec=<playback latency in milliseconds> "
                 "no_play_timeout_msec=<no playback timeout in milliseconds> "
-                "choppy_play_timeout_msec=<choppy playback timeout in milliseconds>");
+                "choppy_play_timeout_msec=<choppy playback timeout in milliseconds> "
+                "roc_log_level=none|error|info|note|debug|trace "
+                "metrics_interval_msec=<how often to update metrics, 0 to disable> "
+                "latency_cache=<remember network latency and jitter between restarts> "
+                "deferred_init=<open roc receiver in background> "
+                "sync_latency_msec=<playout latency shared by receivers, 0 to disable> "
+                "receive_workers=<number of threads receiving packets, 0 to disable> "
+                "receive_workers_rt_priority=<realtime priority of receive workers> "
+                "receive_workers_cpus=<list of cpus for receive workers, e.g. 2,4-7> "
+                "secondary_local_ip=<local ip to bind to on secondary path> "
+                "secondary_local_source_port=<local port for source packets> "
+                "secondary_local_repair_port=<local port for repair packets> "
+                "secondary_local_control_port=<local port for control packets> "
+                "local_socket=<unix socket path for local senders using shared memory>");
+
+#define MEMBLOCKQ_MAXLENGTH (16 * 1024 * 1024)
+
+/* duration of fade-in after new receiver is attached */
+static const pa_usec_t ramp_duration = 10000;
+
+/* synchronized playout: how often alignment error is checked, and how large
+ * error is tolerated
+ *
+ * errors up to step threshold are corrected smoothly by playing slightly faster
+ * or slower, with rate deviation proportional to error, so that error decays
+ * with given time constant, and limited by maximum deviation (in ppm)
+ *
+ * larger errors, e.g. on start, are corrected at once by inserting silence or
+ * dropping samples, if they persist for given number of checks in a row, and
+ * with given maximum correction at once
+ */
+static const pa_usec_t sync_interval = 1000000;
+static const pa_usec_t sync_tolerance = 2000;
+static const pa_usec_t sync_rate_time = 10000000;
+static const int64_t sync_max_rate_deviation = 2000;
+static const pa_usec_t sync_step_threshold = 20000;
+static const unsigned int sync_checks = 2;
+static const pa_usec_t sync_max_step = 1000000;
+
+/* how often latency statistics are sampled and written to latency cache */
+static const pa_usec_t latency_cache_sample_interval = 1000000;
+static const pa_usec_t latency_cache_store_interval = 30000000;
+
+/* target latency chosen from cached jitter, when it's not set explicitly */
+static const unsigned int latency_cache_jitter_factor = 10;
+static const pa_usec_t latency_cache_min_target = 40000;
+static const pa_usec_t latency_cache_max_target = 1000000;
+
+/* timing histograms of sink thread */
+enum {
+    HIST_POP_TIME,
+    HIST_READ_TIME,
+    HIST_READ_BYTES,
+    HIST_MAX,
+};
+
+static const char* const hist_names[HIST_MAX] = {
+    "pop_time_usec",
+    "read_time_usec",
+    "read_bytes",
+};
+
+/* roc receiver used by sink thread; with receive_workers, packets are received
+ * and decoded by receiver pool threads, otherwise by roc receiver network thread
+ */
+struct sink_input_receiver {
+    roc_receiver* receiver;
+    rocpulse_receiver_pool* pool;
+};
+
+struct roc_sink_input_userdata {
+    pa_module* module;
+    pa_sink_input* sink_input;
+
+    /* samples read from roc receiver; samples returned to sink are kept in
+     * queue history, so that they can be replayed on rewind
+     */
+    pa_memblockq* memblockq;
+
+    /* name of the sink chosen by user; if it disappears, sink input is moved
+     * to a fallback sink, and when it appears again, sink input is moved back
+     */
+    char* sink_name;
+    bool rescuing;
+
+    pa_hook_slot* sink_put_slot;
+    pa_hook_slot* sink_unlink_slot;
+
+    roc_context* context;
+    struct sink_input_receiver receiver;
+    roc_receiver_config receiver_config;
+
+    /* receiver pool parameters */
+    unsigned int receive_workers;
+    rocpulse_sched_config receive_workers_sched;
+
+    /* custom packet encoding, registered in context when it's opened */
+    roc_packet_encoding packet_encoding_id;
+    roc_media_encoding packet_encoding;
+
+    /* with deferred_init, context and receiver are opened by worker thread,
+     * and sink input plays silence until receiver is ready
+     */
+    rocpulse_worker* init_worker;
+    pa_modargs* init_args;
+    struct sink_input_receiver init_receiver;
+
+    /* fade-in position and length, in frames; used by sink thread */
+    size_t ramp_pos;
+    size_t ramp_len;
+
+    /* synchronized playout; the whole path from capture on sender to sink is
+     * kept at sync_latency by holding extra delay in memblockq, and adjusting
+     * sink input rate relative to nominal rate
+     */
+    pa_usec_t sync_latency;
+    uint32_t sync_nominal_rate;
+    pa_time_event* sync_timer;
+    int64_t sync_error;
+    unsigned int sync_exceeded;
+    unsigned int sync_cooldown;
+    bool sync_warned;
+    bool sync_refused;
+
+    /* extra delay held in memblockq, and remainder of frames read from roc at
+     * nominal rate; used by sink thread
+     */
+    size_t sync_delay_bytes;
+    uint64_t sync_rate_rem;
+
+    /* current module arguments, some of them can be changed at runtime */
+    rocpulse_config* config;
+
+    /* used if sink input format is not supported by roc directly */
+    float* convert_buf;
+    size_t convert_buf_samples;
+
+    /* samples receiver metrics on main loop */
+    rocpulse_metrics_poller* metrics_poller;
+
+    /* smoothed latency statistics, periodically saved to latency cache */
+    bool latency_cache;
+    rocpulse_latency_entry latency_stats;
+    bool has_latency_stats;
+    pa_usec_t latency_stats_stored;
+    pa_time_event* latency_cache_timer;
+
+    /* filled by sink thread, read by main loop */
+    rocpulse_histogram hists[HIST_MAX];
+    rocpulse_histogram_handler* hist_handler;
+
+    bool log_initialized;
+};
+
+static const char* const roc_sink_input_modargs[] = {
+    "local_ip",
+    "local_source_port",
+    "local_repair_port",
+    "local_control_port",
+    "sink",
+    "sink_input_name",
+    "sink_input_properties",
+    "sink_input_rate",
+    "sink_input_format",
+    "sink_input_chans",
+    "packet_encoding_id",
+    "packet_encoding_rate",
+    "packet_encoding_format",
+    "packet_encoding_chans",
+    "fec_encoding",
+    "resampler_backend",
+    "resampler_profile",
+    "latency_backend",
+    "latency_profile",
+    "target_latency_msec",
+    "latency_tolerance_msec",
+    "io_latency_msec",
+    "no_play_timeout_msec",
+    "choppy_play_timeout_msec",
+    "roc_log_level",
+    "metrics_interval_msec",
+    "latency_cache",
+    "deferred_init",
+    "sync_latency_msec",
+    "receive_workers",
+    "receive_workers_rt_priority",
+    "receive_workers_cpus",
+    "secondary_local_ip",
+    "secondary_local_source_port",
+    "secondary_local_repair_port",
+    "secondary_local_control_port",
+    "local_socket",
+    NULL,
+};
+
+/* arguments that can be changed at runtime */
+static const char* const roc_sink_input_runtime_modargs[] = {
+    "local_ip",
+    "local_source_port",
+    "local_repair_port",
+    "local_control_port",
+    "fec_encoding",
+    "resampler_backend",
+    "resampler_profile",
+    "latency_backend",
+    "latency_profile",
+    "target_latency_msec",
+    "latency_tolerance_msec",
+    "no_play_timeout_msec",
+    "choppy_play_timeout_msec",
+    NULL,
+};
+
+enum {
+    /* replace roc receiver used by sink thread */
+    SINK_INPUT_MESSAGE_SET_RECEIVER = PA_SINK_INPUT_MESSAGE_MAX,
+
+    /* add or remove extra delay for synchronized playout */
+    SINK_INPUT_MESSAGE_SYNC_ADJUST,
+};
+
+/* change extra delay held in memblockq: positive delta appends silence after
+ * queued samples, and negative delta drops oldest queued samples; returns
+ * applied change
+ */
+static int64_t adjust_sync_delay(struct roc_sink_input_userdata* u, int64_t delta) {
+    pa_assert(u);
+
+    const pa_sample_spec* sample_spec = &u->sink_input->sample_spec;
+    const size_t frame_size = pa_frame_size(sample_spec);
+
+    if (delta > 0) {
+        size_t length = (size_t)delta - (size_t)delta % frame_size;
+        if (length == 0) {
+            return 0;
+        }
+
+        pa_memchunk silence;
+        pa_memchunk_reset(&silence);
+
+        silence.memblock = pa_memblock_new(u->module->core->mempool, length);
+        silence.length = length;
+
+        pa_silence_memory(pa_memblock_acquire(silence.memblock), length, sample_spec);
+        pa_memblock_release(silence.memblock);
+
+        int ret = pa_memblockq_push(u->memblockq, &silence);
+        pa_memblock_unref(silence.memblock);
+
+        if (ret < 0) {
+            pa_log("failed to push samples to queue");
+            return 0;
+        }
+
+        u->sync_delay_bytes += length;
+        return (int64_t)length;
+    }
+
+    size_t length = PA_MIN((size_t)-delta, pa_memblockq_get_length(u->memblockq));
+    length -= length % frame_size;
+
+    pa_memblockq_drop(u->memblockq, length);
+    u->sync_delay_bytes -= PA_MIN(length, u->sync_delay_bytes);
+
+    return -(int64_t)length;
+}
+
+static bool receiver_is_open(const struct sink_input_receiver* receiver) {
+    return receiver->receiver || receiver->pool;
+}
+
+static void close_receiver(struct sink_input_receiver* receiver) {
+    if (receiver->receiver) {
+        if (roc_receiver_close(receiver->receiver) != 0) {
+            pa_log("failed to close roc receiver");
+        }
+        receiver->receiver = NULL;
+    }
+
+    if (receiver->pool) {
+        rocpulse_receiver_pool_free(receiver->pool);
+        receiver->pool = NULL;
+    }
+}
+
+static int process_message(
+    pa_msgobject* o, int code, void* data, int64_t offset, pa_memchunk* chunk) {
+    struct roc_sink_input_userdata* u = PA_SINK_INPUT(o)->userdata;
+    pa_assert(u);
+
+    switch (code) {
+    case PA_SINK_INPUT_MESSAGE_GET_LATENCY:
+        /* TODO: we should also report roc receiver latency here */
+        *((pa_usec_t*)data) = pa_bytes_to_usec(pa_memblockq_get_length(u->memblockq),
+                                               &u->sink_input->sample_spec);
+
+        /* don't return, the default handler will add in the extra latency
+         * added by the resampler
+         */
+        break;
+
+    case SINK_INPUT_MESSAGE_SET_RECEIVER: {
+        /* swap receivers, old one is returned to main thread */
+        struct sink_input_receiver* receiver = data;
+        struct sink_input_receiver old_receiver = u->receiver;
+        u->receiver = *receiver;
+        *receiver = old_receiver;
+
+        /* fade in from silence */
+        if (!receiver_is_open(&old_receiver) && receiver_is_open(&u->receiver)) {
+            u->ramp_pos = 0;
+        }
+        return 0;
+    }
+
+    case SINK_INPUT_MESSAGE_SYNC_ADJUST: {
+        /* requested change is replaced with applied one */
+        int64_t* delta = data;
+        *delta = adjust_sync_delay(u, *delta);
+        return 0;
+    }
+    }
+
+    return pa_sink_input_process_msg(o, code, data, offset, chunk);
+}
+
+static int read_frame(struct roc_sink_input_userdata* u, roc_frame* frame) {
+    pa_assert(u);
+
+    if (u->receiver.pool) {
+        return rocpulse_receiver_pool_read(u->receiver.pool, frame->samples,
+                                           frame->samples_size / sizeof(float));
+    }
+
+    return roc_receiver_read(u->receiver.receiver, frame);
+}
+
+/* fade in samples after new receiver was attached, to avoid a click */
+static void
+apply_ramp(struct roc_sink_input_userdata* u, float* samples, size_t n_samples) {
+    const size_t n_chans = u->sink_input->sample_spec.channels;
+
+    for (size_t n = 0; n + n_chans <= n_samples && u->ramp_pos < u->ramp_len;
+         n += n_chans) {
+        const float gain = (float)u->ramp_pos / (float)u->ramp_len;
+
+        for (size_t ch = 0; ch < n_chans; ch++) {
+            samples[n + ch] *= gain;
+        }
+
+        u->ramp_pos++;
+    }
+}
+
+static int read_samples(struct roc_sink_input_userdata* u, char* buf, size_t size) {
+    pa_assert(u);
+
+    const pa_sample_spec* sample_spec = &u->sink_input->sample_spec;
+
+    if (!receiver_is_open(&u->receiver)) {
+        /* receiver is not opened yet or is being reconfigured */
+        pa_silence_memory(buf, size, sample_spec);
+        return 0;
+    }
+
+    /* prepare audio frame */
+    roc_frame frame;
+    memset(&frame, 0, sizeof(frame));
+
+    if (!u->convert_buf) {
+        frame.samples = buf;
+        frame.samples_size = size;
+
+        if (read_frame(u, &frame) != 0) {
+            return -1;
+        }
+
+        apply_ramp(u, (float*)buf, size / sizeof(float));
+        return 0;
+    }
+
+    /* read floats piece by piece and convert each piece */
+    const size_t sample_size = pa_sample_size(sample_spec);
+    size_t n_samples = size / sample_size;
+
+    while (n_samples > 0) {
+        size_t n = PA_MIN(n_samples, u->convert_buf_samples);
+
+        frame.samples = u->convert_buf;
+        frame.samples_size = n * sizeof(float);
+
+        if (read_frame(u, &frame) != 0) {
+            return -1;
+        }
+
+        apply_ramp(u, u->convert_buf, n);
+        rocpulse_convert_from_float(buf, sample_spec->format, u->convert_buf, n);
+
+        buf += n * sample_size;
+        n_samples -= n;
+    }
+
+    return 0;
+}
+
+/* how many bytes to read from roc to play given number of bytes; with
+ * synchronized playout, sink input rate may differ from nominal rate, but roc
+ * is still read at nominal rate, so that extra delay in queue shrinks or grows
+ * smoothly, and roc's own latency tuning doesn't compensate the difference;
+ * called by sink thread
+ */
+static size_t sync_read_length(struct roc_sink_input_userdata* u, size_t length) {
+    pa_assert(u);
+
+    const pa_sample_spec* sample_spec = &u->sink_input->thread_info.sample_spec;
+
+    if (u->sync_latency == 0 || sample_spec->rate == u->sync_nominal_rate) {
+        return length;
+    }
+
+    const size_t frame_size = pa_frame_size(sample_spec);
+
+    const uint64_t n_frames
+        = (uint64_t)(length / frame_size) * u->sync_nominal_rate + u->sync_rate_rem;
+
+    const size_t read_length = (size_t)(n_frames / sample_spec->rate) * frame_size;
+
+    /* extra delay can't go below zero */
+    if (read_length + u->sync_delay_bytes < length) {
+        return length;
+    }
+
+    u->sync_rate_rem = n_frames % sample_spec->rate;
+
+    return read_length;
+}
+
+static int pop_cb(pa_sink_input* i, size_t length, pa_memchunk* chunk) {
+    pa_sink_input_assert_ref(i);
+
+    struct roc_sink_input_userdata* u = i->userdata;
+    pa_assert(u);
+
+    pa_usec_t start_time = pa_rtclock_now();
+
+    /* read new samples from roc, unless there are samples to replay after rewind;
+     * with synchronized playout, extra delay is always kept in queue
+     */
+    if (pa_memblockq_get_length(u->memblockq) <= u->sync_delay_bytes) {
+        const size_t read_length = sync_read_length(u, length);
+
+        pa_memchunk new_chunk;
+
+        /* ensure that all chunk fields are set to zero */
+        pa_memchunk_reset(&new_chunk);
+
+        /* allocate memblock */
+        new_chunk.memblock = pa_memblock_new(u->module->core->mempool, read_length);
+
+        /* start writing memblock */
+        char* buf = pa_memblock_acquire(new_chunk.memblock);
+
+        /* read samples from roc receiver to memblock */
+        pa_usec_t read_time = pa_rtclock_now();
+        int ret = read_samples(u, buf, read_length);
+
+        pa_usec_t end_time = pa_rtclock_now();
+        ROCPULSE_TRACE3(receiver_read, read_length, read_time, end_time);
+
+        rocpulse_histogram_add(&u->hists[HIST_READ_TIME], end_time - read_time);
+        rocpulse_histogram_add(&u->hists[HIST_READ_BYTES], read_length);
+
+        /* finish writing memblock */
+        pa_memblock_release(new_chunk.memblock);
+
+        /* handle eof and error */
+        if (ret != 0) {
+            pa_memblock_unref(new_chunk.memblock);
+
+            pa_module_unload_request(u->module, true);
+            return -1;
+        }
+
+        /* setup chunk boundaries */
+        new_chunk.index = 0;
+        new_chunk.length = read_length;
+
+        ret = pa_memblockq_push(u->memblockq, &new_chunk);
+        pa_memblock_unref(new_chunk.memblock);
+
+        if (ret < 0) {
+            pa_log("failed to push samples to queue");
+            return -1;
+        }
+
+        /* difference between read and played samples goes to extra delay */
+        u->sync_delay_bytes = u->sync_delay_bytes + read_length - length;
+    }
+
+    /* return samples from queue to sink */
+    if (pa_memblockq_peek(u->memblockq, chunk) < 0) {
+        return -1;
+    }
+
+    chunk->length = PA_MIN(chunk->length, length);
+    pa_memblockq_drop(u->memblockq, chunk->length);
+
+    rocpulse_histogram_add(&u->hists[HIST_POP_TIME], pa_rtclock_now() - start_time);
+
+    return 0;
+}
+
+static void rewind_cb(pa_sink_input* i, size_t nbytes) {
+    pa_sink_input_assert_ref(i);
+
+    struct roc_sink_input_userdata* u = i->userdata;
+    pa_assert(u);
+
+    const int64_t read_index = pa_memblockq_get_read_index(u->memblockq);
+
+    /* move read pointer back into queue history, so that the samples returned
+     * to sink before will be returned again
+     */
+    pa_memblockq_rewind(u->memblockq, nbytes);
+
+    ROCPULSE_TRACE2(rewind, nbytes,
+                    (size_t)(read_index - pa_memblockq_get_read_index(u->memblockq)));
+}
+
+static void update_max_rewind_cb(pa_sink_input* i, size_t nbytes) {
+    pa_sink_input_assert_ref(i);
+
+    struct roc_sink_input_userdata* u = i->userdata;
+    pa_assert(u);
+
+    /* keep as much history as sink may rewind */
+    pa_memblockq_set_maxrewind(u->memblockq, nbytes);
+}
+
+static void kill_cb(pa_sink_input* i) {
+    pa_sink_input_assert_ref(i);
+
+    struct roc_sink_input_userdata* u = i->userdata;
+    pa_assert(u);
+
+    pa_module_unload_request(u->module, true);
+
+    pa_sink_input_unlink(u->sink_input);
+    pa_sink_input_unref(u->sink_input);
+    u->sink_input = NULL;
+}
+
+static void moving_cb(pa_sink_input* i, pa_sink* dest) {
+    pa_sink_input_assert_ref(i);
+
+    struct roc_sink_input_userdata* u = i->userdata;
+    pa_assert(u);
+
+    if (!dest || u->rescuing) {
+        return;
+    }
+
+    /* sink input was moved by user, remember new choice */
+    pa_xfree(u->sink_name);
+    u->sink_name = pa_xstrdup(dest->name);
+}
+
+static void move_sink_input(struct roc_sink_input_userdata* u, pa_sink* dest) {
+    pa_assert(u);
+    pa_assert(dest);
+
+    pa_log_info("moving sink input from sink %s to sink %s", u->sink_input->sink->name,
+                dest->name);
+
+    /* receiver is not touched, only sink input is re-attached to new sink */
+    u->rescuing = true;
+    if (pa_sink_input_move_to(u->sink_input, dest, false) < 0) {
+        pa_log_warn("failed to move sink input to sink %s", dest->name);
+    }
+    u->rescuing = false;
+}
+
+static pa_sink* find_fallback_sink(struct roc_sink_input_userdata* u, pa_sink* skip) {
+    pa_assert(u);
+
+    pa_sink* sink = pa_namereg_get(u->module->core, NULL, PA_NAMEREG_SINK);
+    if (sink && sink != skip && pa_sink_input_may_move_to(u->sink_input, sink)) {
+        return sink;
+    }
+
+    uint32_t idx;
+    PA_IDXSET_FOREACH(sink, u->module->core->sinks, idx) {
+        if (sink != skip && PA_SINK_IS_LINKED(sink->state)
+            && pa_sink_input_may_move_to(u->sink_input, sink)) {
+            return sink;
+        }
+    }
+
+    return NULL;
+}
+
+static pa_hook_result_t sink_unlink_hook_cb(pa_core* c, pa_sink* sink, void* userdata) {
+    (void)c;
+
+    struct roc_sink_input_userdata* u = userdata;
+    pa_assert(u);
+
+    if (!u->sink_input || u->sink_input->sink != sink) {
+        return PA_HOOK_OK;
+    }
+
+    pa_sink* dest = find_fallback_sink(u, sink);
+    if (!dest) {
+        /* sink input will be killed, and module unloaded */
+        pa_log_info("no sink to move sink input to");
+        return PA_HOOK_OK;
+    }
+
+    move_sink_input(u, dest);
+
+    return PA_HOOK_OK;
+}
+
+static pa_hook_result_t sink_put_hook_cb(pa_core* c, pa_sink* sink, void* userdata) {
+    (void)c;
+
+    struct roc_sink_input_userdata* u = userdata;
+    pa_assert(u);
+
+    if (!u->sink_input || !u->sink_name || u->sink_input->sink == sink
+        || strcmp(sink->name, u->sink_name) != 0) {
+        return PA_HOOK_OK;
+    }
+
+    if (!pa_sink_input_may_move_to(u->sink_input, sink)) {
+        return PA_HOOK_OK;
+    }
+
+    move_sink_input(u, sink);
+
+    return PA_HOOK_OK;
+}
+
+/* open roc receiver and bind it to local endpoints */
+static int open_roc_receiver(struct roc_sink_input_userdata* u,
+                             const roc_receiver_config* receiver_config,
+                             pa_modargs* args,
+                             roc_receiver** out_receiver) {
+    pa_assert(u);
+
+    roc_endpoint* local_source_endp = NULL;
+    roc_endpoint* local_repair_endp = NULL;
+    roc_endpoint* local_control_endp = NULL;
+    roc_receiver* receiver = NULL;
+    int ret = -1;
+
+    roc_fec_encoding fec_encoding = ROC_FEC_ENCODING_DEFAULT;
+
+    if (rocpulse_parse_fec_encoding(&fec_encoding, args, "fec_encoding") < 0) {
+        goto out;
+    }
+
+    /* roc receiver endpoints */
+    if (rocpulse_parse_endpoint(&local_source_endp, ROC_INTERFACE_AUDIO_SOURCE,
+                                fec_encoding, args, "local_ip", ROCPULSE_DEFAULT_IP,
+                                "local_source_port", ROCPULSE_DEFAULT_SOURCE_PORT)
+        < 0) {
+        goto out;
+    }
+
+    if (fec_encoding != ROC_FEC_ENCODING_DISABLE) {
+        if (rocpulse_parse_endpoint(&local_repair_endp, ROC_INTERFACE_AUDIO_REPAIR,
+                                    fec_encoding, args, "local_ip", ROCPULSE_DEFAULT_IP,
+                                    "local_repair_port", ROCPULSE_DEFAULT_REPAIR_PORT)
+            < 0) {
+            goto out;
+        }
+    }
+
+    if (rocpulse_parse_endpoint(&local_control_endp, ROC_INTERFACE_AUDIO_CONTROL,
+                                fec_encoding, args, "local_ip", ROCPULSE_DEFAULT_IP,
+                                "local_control_port", ROCPULSE_DEFAULT_CONTROL_PORT)
+        < 0) {
+        goto out;
+    }
+
+    /* open and bind */
+    if (roc_receiver_open(u->context, receiver_config, &receiver) < 0) {
+        pa_log("can't create roc receiver");
+        goto out;
+    }
+
+    if (roc_receiver_bind(receiver, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_SOURCE,
+                          local_source_endp)
+        != 0) {
+        pa_log("can't bind roc receiver to local address");
+        goto out;
+    }
+
+    if (local_repair_endp) {
+        if (roc_receiver_bind(receiver, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_REPAIR,
+                              local_repair_endp)
+            != 0) {
+            pa_log("can't bind roc receiver to local address");
+            goto out;
+        }
+    }
+
+    if (roc_receiver_bind(receiver, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_CONTROL,
+                          local_control_endp)
+        != 0) {
+        pa_log("can't bind roc receiver to local address");
+        goto out;
+    }
+
+    *out_receiver = receiver;
+    receiver = NULL;
+    ret = 0;
+
+out:
+    if (receiver) {
+        if (roc_receiver_close(receiver) != 0) {
+            pa_log("failed to close roc receiver");
+        }
+    }
+
+    /* roc doesn't need endpoints after bind */
+    if (local_source_endp) {
+        if (roc_endpoint_deallocate(local_source_endp) != 0) {
+            pa_log("failed to deallocate roc endpoint");
+        }
+    }
+
+    if (local_repair_endp) {
+        if (roc_endpoint_deallocate(local_repair_endp) != 0) {
+            pa_log("failed to deallocate roc endpoint");
+        }
+    }
+
+    if (local_control_endp) {
+        if (roc_endpoint_deallocate(local_control_endp) != 0) {
+            pa_log("failed to deallocate roc endpoint");
+        }
+    }
+
+    return ret;
+}
+
+/* open receive workers and bind their sockets to local addresses */
+static int open_receiver_pool(struct roc_sink_input_userdata* u,
+                              const roc_receiver_config* receiver_config,
+                              pa_modargs* args,
+                              rocpulse_receiver_pool** out_pool) {
+    pa_assert(u);
+
+    roc_fec_encoding fec_encoding = ROC_FEC_ENCODING_DEFAULT;
+
+    if (rocpulse_parse_fec_encoding(&fec_encoding, args, "fec_encoding") < 0) {
+        return -1;
+    }
+
+    rocpulse_address source_addr;
+    rocpulse_address repair_addr;
+    rocpulse_address control_addr;
+    const rocpulse_address* repair_addr_ptr = NULL;
+
+    if (rocpulse_parse_address(&source_addr, args, "local_ip", ROCPULSE_DEFAULT_IP,
+                               "local_source_port", ROCPULSE_DEFAULT_SOURCE_PORT)
+        < 0) {
+        return -1;
+    }
+
+    if (fec_encoding != ROC_FEC_ENCODING_DISABLE) {
+        if (rocpulse_parse_address(&repair_addr, args, "local_ip", ROCPULSE_DEFAULT_IP,
+                                   "local_repair_port", ROCPULSE_DEFAULT_REPAIR_PORT)
+            < 0) {
+            return -1;
+        }
+        repair_addr_ptr = &repair_addr;
+    }
+
+    if (rocpulse_parse_address(&control_addr, args, "local_ip", ROCPULSE_DEFAULT_IP,
+                               "local_control_port", ROCPULSE_DEFAULT_CONTROL_PORT)
+        < 0) {
+        return -1;
+    }
+
+    /* redundant streaming: copies of packets come to secondary ports */
+    rocpulse_path secondary;
+    bool has_secondary = false;
+
+    if (rocpulse_parse_path(&secondary, &has_secondary, args, "secondary_local", "local")
+        < 0) {
+        return -1;
+    }
+
+    if (!(*out_pool = rocpulse_receiver_pool_new(
+              u->context, receiver_config, fec_encoding, &source_addr, repair_addr_ptr,
+              &control_addr, has_secondary ? &secondary : NULL,
+              pa_modargs_get_value(args, "local_socket", NULL), u->receive_workers,
+              &u->receive_workers_sched))) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int open_receiver(struct roc_sink_input_userdata* u,
+                         const roc_receiver_config* receiver_config,
+                         pa_modargs* args,
+                         struct sink_input_receiver* out_receiver) {
+    pa_assert(u);
+
+    memset(out_receiver, 0, sizeof(*out_receiver));
+
+    if (u->receive_workers > 0) {
+        return open_receiver_pool(u, receiver_config, args, &out_receiver->pool);
+    }
+
+    return open_roc_receiver(u, receiver_config, args, &out_receiver->receiver);
+}
+
+/* replace receiver used by sink thread, and return old one */
+static void swap_receiver(struct roc_sink_input_userdata* u,
+                          struct sink_input_receiver* receiver) {
+    pa_assert(u);
+
+    if (u->sink_input->sink) {
+        pa_asyncmsgq_send(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input),
+                          SINK_INPUT_MESSAGE_SET_RECEIVER, receiver, 0, NULL);
+    } else {
+        /* sink input is being moved, no thread is using receiver */
+        struct sink_input_receiver old_receiver = u->receiver;
+        u->receiver = *receiver;
+        *receiver = old_receiver;
+    }
+}
+
+/* roc receiver and receiver pool are thread-safe, so this may be called from
+ * main loop
+ */
+static int query_receiver_metrics(struct roc_sink_input_userdata* u,
+                                  rocpulse_metrics* out) {
+    pa_assert(u);
+
+    if (u->receiver.pool) {
+        return rocpulse_receiver_pool_query(u->receiver.pool, out);
+    }
+
+    if (u->receiver.receiver) {
+        return rocpulse_metrics_query_receiver(u->receiver.receiver, out);
+    }
+
+    return -1;
+}
+
+/* latency cache is keyed by local address, which identifies the stream */
+static char* latency_cache_key(const char* local_ip, const char* local_source_port) {
+    return pa_sprintf_malloc("%s:%s", local_ip ? local_ip : ROCPULSE_DEFAULT_IP,
+                             local_source_port ? local_source_port
+                                               : ROCPULSE_DEFAULT_SOURCE_PORT);
+}
+
+/* start from latency that worked during previous run, unless target latency is
+ * set explicitly
+ */
+static void seed_receiver_config(roc_receiver_config* receiver_config,
+                                 pa_modargs* args) {
+    if (receiver_config->target_latency != 0) {
+        return;
+    }
+
+    char* key = latency_cache_key(pa_modargs_get_value(args, "local_ip", NULL),
+                                  pa_modargs_get_value(args, "local_source_port", NULL));
+
+    rocpulse_latency_entry entry;
+    if (rocpulse_latency_cache_load(key, &entry) == 0 && entry.jitter > 0) {
+        pa_usec_t target = PA_CLAMP(entry.jitter * latency_cache_jitter_factor,
+                                    latency_cache_min_target, latency_cache_max_target);
+
+        pa_log_info("using cached statistics for %s: jitter %lluus, latency %lluus, "
+                    "setting target latency to %llums",
+                    key, (unsigned long long)entry.jitter,
+                    (unsigned long long)entry.latency, (unsigned long long)target / 1000);
+
+        receiver_config->target_latency = (unsigned long long)target * 1000;
+    }
+
+    pa_xfree(key);
+}
+
+static void sample_latency_stats(struct roc_sink_input_userdata* u) {
+    pa_assert(u);
+
+    rocpulse_metrics metrics;
+    if (query_receiver_metrics(u, &metrics) < 0 || metrics.n_connections == 0) {
+        return;
+    }
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    /* take the worst connection */
+    pa_usec_t latency = 0;
+    pa_usec_t jitter = 0;
+
+    for (size_t n = 0; n < metrics.n_connections; n++) {
+        latency = PA_MAX(latency, (pa_usec_t)metrics.connections[n].e2e_latency / 1000);
+        jitter = PA_MAX(jitter, (pa_usec_t)metrics.connections[n].mean_jitter / 1000);
+    }
+
+    if (!u->has_latency_stats) {
+        u->latency_stats.latency = latency;
+        u->latency_stats.jitter = jitter;
+        u->has_latency_stats = true;
+    } else {
+        /* exponential moving average with 1/8 weight */
+        u->latency_stats.latency = u->latency_stats.latency
+            - u->latency_stats.latency / 8 + latency / 8;
+        u->latency_stats.jitter
+            = u->latency_stats.jitter - u->latency_stats.jitter / 8 + jitter / 8;
+    }
+#endif // ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+}
+
+static void store_latency_stats(struct roc_sink_input_userdata* u) {
+    pa_assert(u);
+
+    if (!u->has_latency_stats || !u->config) {
+        return;
+    }
+
+    /* local address could be changed at runtime */
+    char* key = latency_cache_key(rocpulse_config_get(u->config, "local_ip"),
+                                  rocpulse_config_get(u->config, "local_source_port"));
+
+    rocpulse_latency_cache_store(key, &u->latency_stats);
+    u->latency_stats_stored = pa_rtclock_now();
+
+    pa_xfree(key);
+}
+
+static void latency_cache_timer_cb(pa_mainloop_api* a,
+                                   pa_time_event* e,
+                                   const struct timeval* t,
+                                   void* userdata) {
+    (void)a;
+    (void)t;
+
+    struct roc_sink_input_userdata* u = userdata;
+    pa_assert(u);
+
+    sample_latency_stats(u);
+
+    pa_usec_t now = pa_rtclock_now();
+
+    if (now - u->latency_stats_stored >= latency_cache_store_interval) {
+        store_latency_stats(u);
+    }
+
+    pa_core_rttime_restart(u->module->core, e, now + latency_cache_sample_interval);
+}
+
+/* with synchronized playout, roc keeps part of sync latency, and the rest is
+ * used for alignment; if target latency is not set explicitly, roc gets a half
+ */
+static int set_sync_target(struct roc_sink_input_userdata* u,
+                           roc_receiver_config* receiver_config,
+                           pa_usec_t io_latency) {
+    pa_assert(u);
+
+    if (u->sync_latency == 0) {
+        return 0;
+    }
+
+    if (receiver_config->target_latency == 0) {
+        receiver_config->target_latency = (unsigned long long)u->sync_latency / 2 * 1000;
+    }
+
+    if (receiver_config->target_latency / 1000 + io_latency >= u->sync_latency) {
+        pa_log("target_latency_msec plus io_latency_msec should be less than "
+               "sync_latency_msec");
+        return -1;
+    }
+
+    return 0;
+}
+
+static void report_sync(struct roc_sink_input_userdata* u) {
+    pa_assert(u);
+
+    pa_proplist* proplist = pa_proplist_new();
+
+    pa_proplist_setf(proplist, "roc.sync.error_usec", "%lld", (long long)u->sync_error);
+    pa_proplist_setf(proplist, "roc.sync.delay_usec", "%llu",
+                     (unsigned long long)pa_bytes_to_usec(u->sync_delay_bytes,
+                                                          &u->sink_input->sample_spec));
+
+    pa_sink_input_update_proplist(u->sink_input, PA_UPDATE_REPLACE, proplist);
+    pa_proplist_free(proplist);
+}
+
+/* adjust sink input rate to correct small alignment error; playing too late
+ * means too much delay, so sink input plays faster and drains extra delay, and
+ * vice versa
+ */
+static void set_sync_rate(struct roc_sink_input_userdata* u, int64_t error) {
+    pa_assert(u);
+
+    int64_t deviation = error * 1000000 / (int64_t)sync_rate_time;
+    deviation = PA_CLAMP(deviation, -sync_max_rate_deviation, sync_max_rate_deviation);
+
+    /* nothing to drain */
+    if (deviation > 0 && u->sync_delay_bytes == 0) {
+        deviation = 0;
+    }
+
+    const int64_t nominal_rate = u->sync_nominal_rate;
+    const uint32_t rate = (uint32_t)(nominal_rate + nominal_rate * deviation / 1000000);
+
+    if (rate != u->sink_input->sample_spec.rate) {
+        pa_sink_input_set_rate(u->sink_input, rate);
+    }
+}
+
+/* compare latency of the whole path with sync latency, and correct extra delay:
+ * small error smoothly by adjusting rate, and large one at once if it persists
+ */
+static void update_sync(struct roc_sink_input_userdata* u) {
+    pa_assert(u);
+
+    if (!u->sink_input->sink) {
+        return;
+    }
+
+    rocpulse_metrics metrics;
+    if (query_receiver_metrics(u, &metrics) < 0) {
+        return;
+    }
+
+    /* end-to-end latency is different for every sender, and there's no single
+     * latency to align to if there are several of them
+     */
+    if (metrics.connection_count > 1) {
+        if (!u->sync_refused) {
+            u->sync_refused = true;
+            pa_log_warn("synchronized playout requires a single sender, but %u are "
+                        "connected; not aligning playout until others go away",
+                        metrics.connection_count);
+        }
+
+        set_sync_rate(u, 0);
+        return;
+    }
 
-struct roc_sink_input_userdata {
-    pa_module* module;
-    pa_sink_input* sink_input;
+    u->sync_refused = false;
 
-    roc_endpoint* local_source_endp;
-    roc_endpoint* local_repair_endp;
-    roc_endpoint* local_control_endp;
+    /* latency from capture on sender to reading from roc; it's unknown until
+     * roc receives timestamps from sender via RTCP
+     */
+    pa_usec_t e2e_latency = 0;
 
-    roc_context* context;
-    roc_receiver* receiver;
-};
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    if (metrics.n_connections == 1) {
+        e2e_latency = (pa_usec_t)metrics.connections[0].e2e_latency / 1000;
+    }
+#endif
 
-static const char* const roc_sink_input_modargs[] = {
-    "local_ip",
-    "local_source_port",
-    "local_repair_port",
-    "local_control_port",
-    "sink",
-    "sink_input_name",
-    "sink_input_properties",
-    "sink_input_rate",
-    "sink_input_format",
-    "sink_input_chans",
-    "packet_encoding_id",
-    "packet_encoding_rate",
-    "packet_encoding_format",
-    "packet_encoding_chans",
-    "fec_encoding",
-    "resampler_backend",
-    "resampler_profile",
-    "latency_backend",
-    "latency_profile",
-    "target_latency_msec",
-    "latency_tolerance_msec",
-    "io_latency_msec",
-    "no_play_timeout_msec",
-    "choppy_play_timeout_msec",
-    NULL,
-};
+    if (e2e_latency == 0) {
+        return;
+    }
 
-static int process_message(
-    pa_msgobject* o, int code, void* data, int64_t offset, pa_memchunk* chunk) {
-    struct roc_sink_input_userdata* u = PA_SINK_INPUT(o)->userdata;
-    pa_assert(u);
+    /* latency from reading from roc to playback, including extra delay */
+    pa_usec_t sink_latency = 0;
+    pa_usec_t input_latency = pa_sink_input_get_latency(u->sink_input, &sink_latency);
 
-    switch (code) {
-    case PA_SINK_INPUT_MESSAGE_GET_LATENCY:
-        /* TODO: we should report internal latency here */
-        *((pa_usec_t*)data) = 0;
+    u->sync_error = (int64_t)(e2e_latency + input_latency + sink_latency)
+        - (int64_t)u->sync_latency;
 
-        /* don't return, the default handler will add in the extra latency
-         * added by the resampler
-         */
-        break;
+    report_sync(u);
+
+    if (u->sync_cooldown > 0) {
+        /* wait until previous correction is reflected in latency */
+        u->sync_cooldown--;
+        return;
     }
 
-    return pa_sink_input_process_msg(o, code, data, offset, chunk);
-}
+    const int64_t abs_error = u->sync_error >= 0 ? u->sync_error : -u->sync_error;
 
-static int pop_cb(pa_sink_input* i, size_t length, pa_memchunk* chunk) {
-    pa_sink_input_assert_ref(i);
+    if (abs_error <= (int64_t)sync_step_threshold) {
+        u->sync_exceeded = 0;
+        if (abs_error <= (int64_t)sync_tolerance) {
+            u->sync_warned = false;
+        }
 
-    struct roc_sink_input_userdata* u = i->userdata;
-    pa_assert(u);
+        set_sync_rate(u, u->sync_error);
+        return;
+    }
 
-    /* ensure that all chunk fields are set to zero */
-    pa_memchunk_reset(chunk);
+    if (++u->sync_exceeded < sync_checks) {
+        return;
+    }
 
-    /* allocate memblock */
-    chunk->memblock = pa_memblock_new(u->module->core->mempool, length);
+    u->sync_exceeded = 0;
+    u->sync_cooldown = sync_checks;
 
-    /* start writing memblock */
-    char* buf = pa_memblock_acquire(chunk->memblock);
+    set_sync_rate(u, 0);
 
-    /* prepare audio frame */
-    roc_frame frame;
-    memset(&frame, 0, sizeof(frame));
+    /* playing too late means too much delay, and vice versa */
+    int64_t correction = PA_CLAMP(-u->sync_error, -(int64_t)sync_max_step,
+                                  (int64_t)sync_max_step);
 
-    frame.samples = buf;
-    frame.samples_size = length;
+    const pa_usec_t amount = (pa_usec_t)(correction >= 0 ? correction : -correction);
 
-    /* read samples from file to memblock */
-    int ret = roc_receiver_read(u->receiver, &frame);
+    int64_t delta = (int64_t)pa_usec_to_bytes(amount, &u->sink_input->sample_spec);
+    if (correction < 0) {
+        delta = -delta;
+    }
 
-    /* finish writing memblock */
-    pa_memblock_release(chunk->memblock);
+    const int64_t requested = delta;
 
-    /* handle eof and error */
-    if (ret != 0) {
-        pa_module_unload_request(u->module, true);
+    pa_asyncmsgq_send(u->sink_input->sink->asyncmsgq, PA_MSGOBJECT(u->sink_input),
+                      SINK_INPUT_MESSAGE_SYNC_ADJUST, &delta, 0, NULL);
+
+    pa_log_debug("playout is off by %lldus, adjusted delay by %lld bytes",
+                 (long long)u->sync_error, (long long)delta);
+
+    if (requested < 0 && delta > requested && !u->sync_warned) {
+        u->sync_warned = true;
+        pa_log_warn("can't align playout: latency is higher than sync latency, consider "
+                    "increasing sync_latency_msec or decreasing target_latency_msec");
+    }
+}
+
+static void sync_timer_cb(pa_mainloop_api* a,
+                          pa_time_event* e,
+                          const struct timeval* t,
+                          void* userdata) {
+    (void)a;
+    (void)t;
+
+    struct roc_sink_input_userdata* u = userdata;
+    pa_assert(u);
+
+    update_sync(u);
+
+    pa_core_rttime_restart(u->module->core, e, pa_rtclock_now() + sync_interval);
+}
+
+/* open roc context and receiver; invoked either from pa__init(), or from worker
+ * thread if initialization is deferred
+ */
+static int setup_roc(struct roc_sink_input_userdata* u,
+                     pa_modargs* args,
+                     struct sink_input_receiver* receiver) {
+    pa_assert(u);
+
+    roc_context_config context_config;
+    memset(&context_config, 0, sizeof(context_config));
+
+    if (roc_context_open(&context_config, &u->context) < 0) {
+        pa_log("can't create roc context");
         return -1;
     }
 
-    /* setup chunk boundaries */
-    chunk->index = 0;
-    chunk->length = frame.samples_size;
+    if (u->packet_encoding_id != 0) {
+        if (roc_context_register_encoding(u->context, u->packet_encoding_id,
+                                          &u->packet_encoding)
+            < 0) {
+            pa_log("can't register packet encoding");
+            return -1;
+        }
+    }
+
+    if (open_receiver(u, &u->receiver_config, args, receiver) < 0) {
+        return -1;
+    }
 
     return 0;
 }
 
-static void rewind_cb(pa_sink_input* i, size_t nbytes) {
-    pa_sink_input_assert_ref(i);
+static int init_run_cb(void* userdata) {
+    struct roc_sink_input_userdata* u = userdata;
+    pa_assert(u);
 
-    struct roc_sink_input_userdata* u = i->userdata;
+    return setup_roc(u, u->init_args, &u->init_receiver);
+}
+
+static void init_done_cb(void* userdata, int result) {
+    struct roc_sink_input_userdata* u = userdata;
     pa_assert(u);
 
-    (void)nbytes;
+    rocpulse_worker_free(u->init_worker);
+    u->init_worker = NULL;
+
+    pa_modargs_free(u->init_args);
+    u->init_args = NULL;
+
+    if (result < 0) {
+        pa_log("deferred initialization failed, unloading module");
+        pa_module_unload_request(u->module, true);
+        return;
+    }
+
+    /* pass receiver to sink thread */
+    struct sink_input_receiver receiver = u->init_receiver;
+    memset(&u->init_receiver, 0, sizeof(u->init_receiver));
+
+    swap_receiver(u, &receiver);
+
+    pa_log_info("roc receiver is ready");
 }
 
-static void kill_cb(pa_sink_input* i) {
-    pa_sink_input_assert_ref(i);
+static int apply_config_cb(void* userdata, pa_modargs* new_args, pa_modargs* old_args) {
+    struct roc_sink_input_userdata* u = userdata;
+    pa_assert(u);
 
-    struct roc_sink_input_userdata* u = i->userdata;
+    if (u->init_worker) {
+        pa_log("can't change configuration until initialization is finished");
+        return -1;
+    }
+
+    roc_receiver_config receiver_config = u->receiver_config;
+
+    if (rocpulse_parse_receiver_config(&receiver_config, new_args) < 0) {
+        return -1;
+    }
+
+    unsigned long long io_latency_us = 0;
+    if (rocpulse_parse_duration_msec_ul(&io_latency_us, 1000, new_args, "io_latency_msec",
+                                        "40")
+        < 0) {
+        return -1;
+    }
+
+    if (set_sync_target(u, &receiver_config, (pa_usec_t)io_latency_us) < 0) {
+        return -1;
+    }
+
+    if (u->latency_cache) {
+        seed_receiver_config(&receiver_config, new_args);
+    }
+
+    /* roc doesn't allow to change receiver parameters in place, and new receiver
+     * can't bind to the same ports while old one is open, so we detach and close
+     * old receiver first; buffered audio is lost, and sink input plays silence
+     * until new receiver buffers incoming packets up to its target latency
+     */
+    struct sink_input_receiver receiver;
+    memset(&receiver, 0, sizeof(receiver));
+
+    swap_receiver(u, &receiver);
+    close_receiver(&receiver);
+
+    if (open_receiver(u, &receiver_config, new_args, &receiver) == 0) {
+        swap_receiver(u, &receiver);
+        u->receiver_config = receiver_config;
+        return 0;
+    }
+
+    /* new configuration doesn't work, restore old one */
+    if (open_receiver(u, &u->receiver_config, old_args, &receiver) == 0) {
+        swap_receiver(u, &receiver);
+    } else {
+        pa_log("can't restore roc receiver, unloading module");
+        pa_module_unload_request(u->module, true);
+    }
+
+    return -1;
+}
+
+static int query_metrics_cb(void* userdata, rocpulse_metrics* out) {
+    struct roc_sink_input_userdata* u = userdata;
     pa_assert(u);
 
-    pa_module_unload_request(u->module, true);
+    return query_receiver_metrics(u, out);
+}
 
-    pa_sink_input_unlink(u->sink_input);
-    pa_sink_input_unref(u->sink_input);
-    u->sink_input = NULL;
+static void update_metrics_cb(void* userdata, pa_proplist* proplist) {
+    struct roc_sink_input_userdata* u = userdata;
+    pa_assert(u);
+
+    pa_sink_input_update_proplist(u->sink_input, PA_UPDATE_REPLACE, proplist);
 }
 
 void pa__done(pa_module*);
@@ -183,10 +1358,6 @@ void pa__done(pa_module*);
 int pa__init(pa_module* m) {
     pa_assert(m);
 
-    /* setup logs */
-    roc_log_set_level(ROC_LOG_DEBUG);
-    roc_log_set_handler(rocpulse_log_handler, NULL);
-
     /* get module arguments (key-value list passed to load-module) */
     pa_modargs* args;
     if (!(args = pa_modargs_new(m->argument, roc_sink_input_modargs))) {
@@ -195,8 +1366,9 @@ int pa__init(pa_module* m) {
     }
 
     /* get sink from arguments */
-    pa_sink* sink = pa_namereg_get(m->core, pa_modargs_get_value(args, "sink", NULL),
-                                   PA_NAMEREG_SINK);
+    const char* sink_name = pa_modargs_get_value(args, "sink", NULL);
+
+    pa_sink* sink = pa_namereg_get(m->core, sink_name, PA_NAMEREG_SINK);
     if (!sink) {
         pa_log("sink does not exist");
         goto error;
@@ -209,174 +1381,160 @@ int pa__init(pa_module* m) {
 
     u->module = m;
 
-    /* roc context */
-    roc_context_config context_config;
-    memset(&context_config, 0, sizeof(context_config));
-
-    if (roc_context_open(&context_config, &u->context) < 0) {
-        pa_log("can't create roc context");
+    /* setup logs */
+    if (rocpulse_log_init(m->core, args, "roc_log_level") < 0) {
         goto error;
     }
+    u->log_initialized = true;
+
+    for (int n = 0; n < HIST_MAX; n++) {
+        rocpulse_histogram_init(&u->hists[n], hist_names[n]);
+    }
+
+    u->sink_name = pa_xstrdup(sink_name);
 
     /* roc receiver config */
     roc_receiver_config receiver_config;
     memset(&receiver_config, 0, sizeof(receiver_config));
 
-    if (rocpulse_parse_media_encoding(&receiver_config.frame_encoding, args,
-                                      "sink_input_rate", "sink_input_format",
-                                      "sink_input_chans")
+    pa_sample_format_t sample_format = PA_SAMPLE_INVALID;
+    pa_channel_map channel_map;
+
+    if (rocpulse_parse_media_encoding(&receiver_config.frame_encoding, &sample_format,
+                                      &channel_map, args, "sink_input_rate",
+                                      "sink_input_format", "sink_input_chans")
         < 0) {
         goto error;
     }
 
-    roc_packet_encoding receiver_packet_encoding = 0;
-
-    if (rocpulse_parse_packet_encoding(&receiver_packet_encoding, args,
+    if (rocpulse_parse_packet_encoding(&u->packet_encoding_id, args,
                                        "packet_encoding_id")
         < 0) {
         goto error;
     }
 
-    if (receiver_packet_encoding != 0) {
-        roc_media_encoding encoding;
-        memset(&encoding, 0, sizeof(encoding));
-
-        if (rocpulse_parse_media_encoding(&encoding, args, "packet_encoding_rate",
-                                          "packet_encoding_format",
-                                          "packet_encoding_chans")
-            < 0) {
+    if (u->packet_encoding_id == 0) {
+        if (receiver_config.frame_encoding.channels == ROC_CHANNEL_LAYOUT_MULTITRACK) {
+            pa_log("packet_encoding_id should be set when sink_input_chans is not mono "
+                   "or stereo");
             goto error;
         }
-
-        if (roc_context_register_encoding(u->context, receiver_packet_encoding, &encoding)
+    } else {
+        if (rocpulse_parse_media_encoding(&u->packet_encoding, NULL, NULL, args,
+                                          "packet_encoding_rate",
+                                          "packet_encoding_format",
+                                          "packet_encoding_chans")
             < 0) {
-            pa_log("can't register packet encoding");
             goto error;
         }
     }
 
-    roc_fec_encoding receiver_fec_encoding = ROC_FEC_ENCODING_DEFAULT;
-
-    if (rocpulse_parse_fec_encoding(&receiver_fec_encoding, args, "fec_encoding") < 0) {
+    if (rocpulse_parse_receiver_config(&receiver_config, args) < 0) {
         goto error;
     }
 
-    if (rocpulse_parse_resampler_backend(&receiver_config.resampler_backend, args,
-                                         "resampler_backend")
-        < 0) {
+    if (pa_modargs_get_value_boolean(args, "latency_cache", &u->latency_cache) < 0) {
+        pa_log("invalid latency_cache");
         goto error;
     }
 
-    if (rocpulse_parse_resampler_profile(&receiver_config.resampler_profile, args,
-                                         "resampler_profile")
+    unsigned long long playback_latency_us = 0;
+    if (rocpulse_parse_duration_msec_ul(&playback_latency_us, 1000, args,
+                                        "io_latency_msec", "40")
         < 0) {
         goto error;
     }
 
-#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
-    if (rocpulse_parse_latency_tuner_backend(&receiver_config.latency_tuner_backend, args,
-                                             "latency_backend")
+    unsigned long long sync_latency_us = 0;
+    if (rocpulse_parse_duration_msec_ul(&sync_latency_us, 1000, args,
+                                        "sync_latency_msec", "0")
         < 0) {
         goto error;
     }
 
-    if (rocpulse_parse_latency_tuner_profile(&receiver_config.latency_tuner_profile, args,
-                                             "latency_profile")
-        < 0) {
+#if ROC_VERSION < ROC_VERSION_CODE(0, 4, 0)
+    if (sync_latency_us > 0) {
+        pa_log("sync_latency_msec requires Roc Toolkit 0.4 or later");
         goto error;
     }
+#endif
 
-    if (rocpulse_parse_duration_msec_ul(&receiver_config.latency_tolerance, 1, args,
-                                        "latency_tolerance_msec", "0")
-        < 0) {
-        goto error;
-    }
-#endif // ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    u->sync_latency = (pa_usec_t)sync_latency_us;
 
-    if (rocpulse_parse_duration_msec_ul(&receiver_config.target_latency, 1, args,
-                                        "target_latency_msec", "0")
-        < 0) {
+    if (set_sync_target(u, &receiver_config, (pa_usec_t)playback_latency_us) < 0) {
         goto error;
     }
 
-    if (rocpulse_parse_duration_msec_ll(&receiver_config.no_playback_timeout, 1, args,
-                                        "no_play_timeout_msec", "0")
-        < 0) {
-        goto error;
+    if (u->latency_cache) {
+        seed_receiver_config(&receiver_config, args);
     }
 
-    if (rocpulse_parse_duration_msec_ll(&receiver_config.choppy_playback_timeout, 1, args,
-                                        "choppy_play_timeout_msec", "0")
-        < 0) {
-        goto error;
-    }
+    u->receiver_config = receiver_config;
 
-    /* roc receiver endpoints */
-    if (rocpulse_parse_endpoint(&u->local_source_endp, ROC_INTERFACE_AUDIO_SOURCE,
-                                receiver_fec_encoding, args, "local_ip",
-                                ROCPULSE_DEFAULT_IP, "local_source_port",
-                                ROCPULSE_DEFAULT_SOURCE_PORT)
-        < 0) {
+    /* receiver pool */
+    if (rocpulse_parse_uint(&u->receive_workers, args, "receive_workers", "0") < 0) {
         goto error;
     }
 
-    if (receiver_fec_encoding != ROC_FEC_ENCODING_DISABLE) {
-        if (rocpulse_parse_endpoint(&u->local_repair_endp, ROC_INTERFACE_AUDIO_REPAIR,
-                                    receiver_fec_encoding, args, "local_ip",
-                                    ROCPULSE_DEFAULT_IP, "local_repair_port",
-                                    ROCPULSE_DEFAULT_REPAIR_PORT)
-            < 0) {
+    /* only receiver pool can drop copies of packets, and copies from both paths
+     * should reach the same worker
+     */
+    if (pa_modargs_get_value(args, "secondary_local_ip", NULL)) {
+        if (u->receive_workers > 1) {
+            pa_log("secondary_local_ip requires receive_workers=1");
             goto error;
         }
+        u->receive_workers = 1;
     }
 
-    if (rocpulse_parse_endpoint(&u->local_control_endp, ROC_INTERFACE_AUDIO_CONTROL,
-                                receiver_fec_encoding, args, "local_ip",
-                                ROCPULSE_DEFAULT_IP, "local_control_port",
-                                ROCPULSE_DEFAULT_CONTROL_PORT)
-        < 0) {
+    /* only receiver pool can decode packets from shared memory */
+    if (pa_modargs_get_value(args, "local_socket", NULL) && u->receive_workers == 0) {
+        u->receive_workers = 1;
+    }
+
+#if ROC_VERSION < ROC_VERSION_CODE(0, 4, 0)
+    if (u->receive_workers > 0) {
+        pa_log("receive_workers, secondary_local_ip, and local_socket require Roc "
+               "Toolkit 0.4 or later");
         goto error;
     }
+#endif
 
-    /* open and bind */
-    if (roc_receiver_open(u->context, &receiver_config, &u->receiver) < 0) {
-        pa_log("can't create roc receiver");
+    if (rocpulse_parse_sched_config(&u->receive_workers_sched, args,
+                                    "receive_workers_rt_priority", "receive_workers_cpus")
+        < 0) {
         goto error;
     }
 
-    if (roc_receiver_bind(u->receiver, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_SOURCE,
-                          u->local_source_endp)
-        != 0) {
-        pa_log("can't bind roc receiver to local address");
+    /* roc context and receiver */
+    bool deferred_init = false;
+    if (pa_modargs_get_value_boolean(args, "deferred_init", &deferred_init) < 0) {
+        pa_log("invalid deferred_init");
         goto error;
     }
 
-    if (u->local_repair_endp) {
-        if (roc_receiver_bind(u->receiver, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_REPAIR,
-                              u->local_repair_endp)
-            != 0) {
-            pa_log("can't bind roc receiver to local address");
+    if (!deferred_init) {
+        if (setup_roc(u, args, &u->receiver) < 0) {
             goto error;
         }
     }
 
-    if (roc_receiver_bind(u->receiver, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_CONTROL,
-                          u->local_control_endp)
-        != 0) {
-        pa_log("can't bind roc receiver to local address");
-        goto error;
-    }
-
-    /* prepare sample spec and channel map used for sink input */
+    /* prepare sample spec used for sink input */
     pa_sample_spec sample_spec;
-    pa_channel_map channel_map;
 
-    if (rocpulse_extract_encoding(&receiver_config.frame_encoding, &sample_spec,
-                                  &channel_map)
+    if (rocpulse_extract_encoding(&receiver_config.frame_encoding, sample_format,
+                                  &sample_spec)
         < 0) {
         goto error;
     }
 
+    if (!rocpulse_convert_is_native(sample_spec.format)) {
+        /* keep whole frames in every piece read from roc */
+        u->convert_buf_samples = ROCPULSE_CONVERT_BUFFER_SAMPLES
+            - ROCPULSE_CONVERT_BUFFER_SAMPLES % sample_spec.channels;
+        u->convert_buf = pa_xnew(float, u->convert_buf_samples);
+    }
+
     /* create and initialize sink input */
     pa_sink_input_new_data data;
     pa_sink_input_new_data_init(&data);
@@ -390,6 +1548,12 @@ int pa__init(pa_module* m) {
     pa_sink_input_new_data_set_sample_spec(&data, &sample_spec);
     pa_sink_input_new_data_set_channel_map(&data, &channel_map);
 
+    /* synchronized playout corrects small errors by adjusting rate */
+    if (u->sync_latency > 0) {
+        data.flags |= PA_SINK_INPUT_VARIABLE_RATE;
+        u->sync_nominal_rate = sample_spec.rate;
+    }
+
     pa_proplist_sets(data.proplist, PA_PROP_MEDIA_NAME, "Roc Receiver");
 
     if (pa_modargs_get_proplist(args, "sink_input_properties", data.proplist,
@@ -408,20 +1572,85 @@ int pa__init(pa_module* m) {
         goto error;
     }
 
+    u->memblockq = pa_memblockq_new("module-roc-sink-input memblockq", 0,
+                                    MEMBLOCKQ_MAXLENGTH, 0, &u->sink_input->sample_spec,
+                                    0, 1, 0, NULL);
+
+    /* no fade-in for receiver opened before sink input is started */
+    u->ramp_len = (size_t)(ramp_duration * sample_spec.rate / PA_USEC_PER_SEC);
+    u->ramp_pos = u->ramp_len;
+
     u->sink_input->userdata = u;
     u->sink_input->parent.process_msg = process_message;
     u->sink_input->pop = pop_cb;
     u->sink_input->process_rewind = rewind_cb;
+    u->sink_input->update_max_rewind = update_max_rewind_cb;
     u->sink_input->kill = kill_cb;
+    u->sink_input->moving = moving_cb;
     pa_sink_input_put(u->sink_input);
 
-    unsigned long long playback_latency_us = 0;
-    if (rocpulse_parse_duration_msec_ul(&playback_latency_us, 1000, args,
-                                        "io_latency_msec", "40")
+    /* follow sinks appearing and disappearing */
+    u->sink_put_slot = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_PUT],
+                                       PA_HOOK_LATE, (pa_hook_cb_t)sink_put_hook_cb, u);
+    u->sink_unlink_slot
+        = pa_hook_connect(&m->core->hooks[PA_CORE_HOOK_SINK_UNLINK], PA_HOOK_LATE,
+                          (pa_hook_cb_t)sink_unlink_hook_cb, u);
+
+    pa_sink_input_set_requested_latency(u->sink_input, playback_latency_us);
+
+    /* start sampling metrics */
+    unsigned long long metrics_interval_us = 0;
+    if (rocpulse_parse_duration_msec_ul(&metrics_interval_us, 1000, args,
+                                        "metrics_interval_msec", "1000")
         < 0) {
         goto error;
     }
-    pa_sink_input_set_requested_latency(u->sink_input, playback_latency_us);
+
+    char* object_path = pa_sprintf_malloc("/roc_sink_input/%u", u->sink_input->index);
+
+    if (metrics_interval_us > 0) {
+        u->metrics_poller
+            = rocpulse_metrics_poller_new(m->core, object_path, metrics_interval_us,
+                                          query_metrics_cb, update_metrics_cb, u);
+    }
+
+    /* make timing histograms available to clients */
+    char* hist_object_path = pa_sprintf_malloc("%s/histograms", object_path);
+    u->hist_handler
+        = rocpulse_histogram_handler_new(m->core, hist_object_path, u->hists, HIST_MAX);
+    pa_xfree(hist_object_path);
+
+    /* allow to change configuration at runtime */
+    char* config_object_path = pa_sprintf_malloc("%s/config", object_path);
+    u->config = rocpulse_config_new(m->core, config_object_path, m->argument,
+                                    roc_sink_input_modargs,
+                                    roc_sink_input_runtime_modargs, apply_config_cb, u);
+    pa_xfree(config_object_path);
+
+    pa_xfree(object_path);
+
+    /* open roc receiver in background; arguments are kept until it's done */
+    if (deferred_init) {
+        u->init_args = pa_modargs_new(m->argument, roc_sink_input_modargs);
+        if (!(u->init_worker = rocpulse_worker_new(m->core, "roc_receiver_init",
+                                                   init_run_cb, init_done_cb, u))) {
+            goto error;
+        }
+    }
+
+    /* start aligning playout */
+    if (u->sync_latency > 0) {
+        u->sync_timer = pa_core_rttime_new(m->core, pa_rtclock_now() + sync_interval,
+                                           sync_timer_cb, u);
+    }
+
+    /* start collecting latency statistics for next runs */
+    if (u->latency_cache) {
+        u->latency_stats_stored = pa_rtclock_now();
+        u->latency_cache_timer = pa_core_rttime_new(
+            m->core, pa_rtclock_now() + latency_cache_sample_interval,
+            latency_cache_timer_cb, u);
+    }
 
     pa_modargs_free(args);
 
@@ -444,39 +1673,67 @@ void pa__done(pa_module* m) {
         return;
     }
 
+    /* wait until worker thread stops using roc and arguments */
+    if (u->init_worker) {
+        rocpulse_worker_free(u->init_worker);
+    }
+
+    if (u->init_args) {
+        pa_modargs_free(u->init_args);
+    }
+
+    if (u->sync_timer) {
+        m->core->mainloop->time_free(u->sync_timer);
+    }
+
+    if (u->latency_cache_timer) {
+        m->core->mainloop->time_free(u->latency_cache_timer);
+        store_latency_stats(u);
+    }
+
+    if (u->metrics_poller) {
+        rocpulse_metrics_poller_free(u->metrics_poller);
+    }
+
+    if (u->hist_handler) {
+        rocpulse_histogram_handler_free(u->hist_handler);
+    }
+
+    if (u->config) {
+        rocpulse_config_free(u->config);
+    }
+
+    if (u->sink_put_slot) {
+        pa_hook_slot_free(u->sink_put_slot);
+    }
+
+    if (u->sink_unlink_slot) {
+        pa_hook_slot_free(u->sink_unlink_slot);
+    }
+
     if (u->sink_input) {
         pa_sink_input_unlink(u->sink_input);
         pa_sink_input_unref(u->sink_input);
     }
 
-    if (u->receiver) {
-        if (roc_receiver_close(u->receiver) != 0) {
-            pa_log("failed to close roc receiver");
-        }
+    if (u->memblockq) {
+        pa_memblockq_free(u->memblockq);
     }
 
+    close_receiver(&u->receiver);
+    close_receiver(&u->init_receiver);
+
     if (u->context) {
         if (roc_context_close(u->context) != 0) {
             pa_log("failed to close roc context");
         }
     }
 
-    if (u->local_source_endp) {
-        if (roc_endpoint_deallocate(u->local_source_endp) != 0) {
-            pa_log("failed to deallocate roc endpoint");
-        }
-    }
-
-    if (u->local_repair_endp) {
-        if (roc_endpoint_deallocate(u->local_repair_endp) != 0) {
-            pa_log("failed to deallocate roc endpoint");
-        }
-    }
+    pa_xfree(u->sink_name);
+    pa_xfree(u->convert_buf);
 
-    if (u->local_control_endp) {
-        if (roc_endpoint_deallocate(u->local_control_endp) != 0) {
-            pa_log("failed to deallocate roc endpoint");
-        }
+    if (u->log_initialized) {
+        rocpulse_log_done();
     }
 
     pa_xfree(u);
@@ -14,10 +14,12 @@
 #include <pulse/xmalloc.h>
 
 /* private pulseaudio headers */
+#include <pulsecore/core-util.h>
 #include <pulsecore/log.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/module.h>
 #include <pulsecore/rtpoll.h>
+#include <pulsecore/semaphore.h>
 #include <pulsecore/sink.h>
 #include <pulsecore/thread-mq.h>
 #include <pulsecore/thread.h>
@@ -28,7 +30,19 @@
 #include <roc/sender.h>
 
 /* local headers */
+#include "rocpulse_adaptive.h"
+#include "rocpulse_batch.h"
+#include "rocpulse_config.h"
+#include "rocpulse_convert.h"
 #include "rocpulse_helpers.h"
+#include "rocpulse_histogram.h"
+#include "rocpulse_log.h"
+#include "rocpulse_metrics.h"
+#include "rocpulse_ring.h"
+#include "rocpulse_sched.h"
+#include "rocpulse_shm.h"
+#include "rocpulse_trace.h"
+#include "rocpulse_worker.h"
 
 PA_MODULE_AUTHOR("Roc Streaming authors");
 PA_MODULE_DESCRIPTION("Write audio stream to Roc sender");
@@ -41,22 +55,39 @@ PA_MODULE_USAGE("remote_ip=<remote receiver ip> "
                 "sink_name=<name for the sink> "
                 "sink_properties=<properties for the sink> "
                 "sink_rate=<sample rate> "
-                "sink_format=f32 "
-                "sink_chans=mono|stereo "
+                "sink_format=s16|s32|f32 "
+                "sink_chans=mono|stereo|<number of channels>|<channel map> "
                 "packet_encoding_id=<8-bit number> "
                 "packet_encoding_rate=<sample rate> "
                 "packet_encoding_format=s16 "
-                "packet_encoding_chans=mono|stereo "
+                "packet_encoding_chans=mono|stereo|<number of channels>|<channel map> "
                 "packet_length_msec=<audio packet length in milliseconds> "
                 "fec_encoding=disable|rs8m|ldpc "
                 "fec_block_nbsrc=<number of source packets in FEC block> "
                 "fec_block_nbrpr=<number of repair packets in FEC block> "
+                "adaptive_fec=<adjust FEC to packet loss> "
+                "fec_block_nbrpr_min=<minimum repair packets for adaptive FEC> "
+                "fec_block_nbrpr_max=<maximum repair packets for adaptive FEC> "
                 "resampler_backend=default|builtin|speex|speexdec "
                 "resampler_profile=default|high|medium|low "
                 "latency_backend=default|niq "
                 "latency_profile=default|intact|responsive|gradual "
                 "target_latency_msec=<target latency in milliseconds> "
-                "latency_tolerance_msec=<maximum latency deviation in milliseconds>");
+                "latency_tolerance_msec=<maximum latency deviation in milliseconds> "
+                "max_rewind_msec=<maximum amount of audio that can be rewound> "
+                "rt_priority=<realtime priority of sink thread> "
+                "cpu_affinity=<list of cpus for sink thread, e.g. 2,4-7> "
+                "roc_log_level=none|error|info|note|debug|trace "
+                "metrics_interval_msec=<how often to update metrics, 0 to disable> "
+                "deferred_init=<open roc sender in background> "
+                "batch_send=<send packets of every tick from sink thread in batches> "
+                "pacing=disable|timer|txtime "
+                "secondary_remote_ip=<remote receiver ip on secondary path> "
+                "secondary_remote_source_port=<receiver port for source packets> "
+                "secondary_remote_repair_port=<receiver port for repair packets> "
+                "secondary_remote_control_port=<receiver port for control packets> "
+                "secondary_local_ip=<local ip to send secondary path packets from> "
+                "remote_socket=<unix socket of receiver on the same host>");
 
 static const char* const roc_sink_modargs[] = {
     "remote_ip",
@@ -76,161 +107,1294 @@ static const char* const roc_sink_modargs[] = {
     "fec_encoding",
     "fec_block_nbsrc",
     "fec_block_nbrpr",
+    "adaptive_fec",
+    "fec_block_nbrpr_min",
+    "fec_block_nbrpr_max",
     "resampler_backend",
     "resampler_profile",
     "latency_backend",
     "latency_profile",
     "target_latency_msec",
     "latency_tolerance_msec",
+    "max_rewind_msec",
+    "rt_priority",
+    "cpu_affinity",
+    "roc_log_level",
+    "metrics_interval_msec",
+    "deferred_init",
+    "batch_send",
+    "pacing",
+    "secondary_remote_ip",
+    "secondary_remote_source_port",
+    "secondary_remote_repair_port",
+    "secondary_remote_control_port",
+    "secondary_local_ip",
+    "remote_socket",
     NULL,
 };
 
+/* arguments that can be changed at runtime */
+static const char* const roc_sink_runtime_modargs[] = {
+    "remote_ip",
+    "remote_source_port",
+    "remote_repair_port",
+    "remote_control_port",
+    "packet_length_msec",
+    "fec_encoding",
+    "fec_block_nbsrc",
+    "fec_block_nbrpr",
+    "resampler_backend",
+    "resampler_profile",
+    "latency_backend",
+    "latency_profile",
+    "target_latency_msec",
+    "latency_tolerance_msec",
+    NULL,
+};
+
+enum {
+    /* replace roc sender used by sink thread */
+    SINK_MESSAGE_SET_SENDER = PA_SINK_MESSAGE_MAX,
+
+    /* replace shared memory channel used by sink thread */
+    SINK_MESSAGE_SET_SHM,
+
+    /* start using new sender, and keep writing to old one until it's faded out */
+    SINK_MESSAGE_SWITCH_SENDER,
+
+    /* start cross-fade from old sender to new one */
+    SINK_MESSAGE_FADE_SENDER,
+
+    /* stop using old sender and return it to main thread */
+    SINK_MESSAGE_TAKE_OLD_SENDER,
+};
+
+/* how often sink thread wakes up to send samples */
+static const pa_usec_t poll_interval = 10000;
+
+/* how often adaptive FEC controller checks packet loss */
+static const pa_usec_t adaptive_interval = 1000000;
+
+/* how often main loop checks connection to local receiver */
+static const pa_usec_t shm_interval = 1000000;
+
+/* how often main loop checks whether receivers play new sender's session
+ * during sender switch, how long it waits for that, and how long is the
+ * cross-fade that follows
+ */
+static const pa_usec_t switch_interval = 100000;
+static const pa_usec_t switch_timeout = 5000000;
+static const pa_usec_t switch_fade_time = 50000;
+
+/* roc defaults, used when parameters are not set explicitly */
+static const unsigned int default_fec_nbsrc = 18;
+static const unsigned int default_fec_nbrpr = 10;
+
+/* timing histograms of sink thread */
+enum {
+    HIST_TICK_LATENESS,
+    HIST_RENDER_TIME,
+    HIST_RENDER_BYTES,
+    HIST_WRITE_TIME,
+    HIST_WRITE_BYTES,
+    HIST_FLUSH_TIME,
+    HIST_FLUSH_PACKETS,
+    HIST_FLUSH_SYSCALLS,
+    HIST_FLUSH_DROPPED,
+    HIST_PACING_ERROR,
+    HIST_MAX,
+};
+
+static const char* const hist_names[HIST_MAX] = {
+    "tick_lateness_usec", "render_time_usec", "render_bytes",
+    "write_time_usec",    "write_bytes",      "flush_time_usec",
+    "flush_packets",      "flush_syscalls",   "flush_dropped_packets",
+    "pacing_error_usec",
+};
+
+/* roc sender used by sink thread; with batch_send, packets are produced by
+ * roc encoder and sent by batch sender at the end of every tick, otherwise
+ * roc sender sends them from its own network thread
+ *
+ * with remote_socket, batch sender uses shared memory channel while local
+ * receiver is connected; channel is owned here, and is connected and replaced
+ * only outside of sink thread
+ */
+struct sink_sender {
+    roc_sender* sender;
+    rocpulse_batch_sender* batch;
+    rocpulse_shm* shm;
+};
+
 struct roc_sink_userdata {
     pa_module* module;
     pa_sink* sink;
 
-    pa_rtpoll* rtpoll;
-    pa_thread* thread;
-    pa_thread_mq thread_mq;
+    pa_rtpoll* rtpoll;
+    pa_thread* thread;
+    pa_thread_mq thread_mq;
+
+    /* scheduling of sink thread; thread applies config when started, reports
+     * state, and posts semaphore
+     */
+    rocpulse_sched_config sched_config;
+    rocpulse_sched_state sched_state;
+    pa_semaphore* sched_sem;
+
+    uint64_t rendered_bytes;
+
+    /* samples that are rendered from sink inputs, but not sent yet; the sink
+     * renders rewind_target bytes ahead, and these bytes can be rewound
+     */
+    rocpulse_ring rewind_buf;
+    size_t rewind_target;
+
+    /* float samples passed to roc; used if sink format is not supported by roc
+     * directly, and during sender switch
+     */
+    float* convert_buf;
+    float* fade_buf;
+    size_t convert_buf_samples;
+
+    roc_context* context;
+    struct sink_sender sender;
+    roc_sender_config sender_config;
+    bool batch_send;
+    rocpulse_pacing pacing;
+
+    /* custom packet encoding, registered in context when it's opened */
+    bool has_packet_encoding;
+    roc_media_encoding packet_encoding;
+
+    /* with deferred_init, context and sender are opened by worker thread, and
+     * sink discards samples until sender is ready
+     */
+    rocpulse_worker* init_worker;
+    pa_modargs* init_args;
+    struct sink_sender init_sender;
+
+    /* current module arguments, some of them can be changed at runtime */
+    rocpulse_config* config;
+
+    /* sender replaced at runtime; roc receivers mix concurrent sessions, so
+     * sink thread keeps writing to old sender and writes silence to new one
+     * until receivers play new session, and then cross-fades between them;
+     * fade_pos and fade_len are in frames, and fade_len is zero until fade
+     * starts
+     */
+    struct sink_sender old_sender;
+    size_t fade_pos;
+    size_t fade_len;
+
+    /* drives sender switch on main loop */
+    pa_time_event* switch_timer;
+    pa_usec_t switch_start_time;
+    bool switch_fading;
+
+    /* samples sender metrics on main loop */
+    rocpulse_metrics_poller* metrics_poller;
+
+    /* adjusts FEC on main loop */
+    rocpulse_adaptive adaptive;
+    pa_time_event* adaptive_timer;
+
+    /* unix socket of local receiver; main loop reconnects to it */
+    char* shm_path;
+    pa_time_event* shm_timer;
+
+    /* filled by sink thread, read by main loop */
+    rocpulse_histogram hists[HIST_MAX];
+    rocpulse_histogram_handler* hist_handler;
+
+    bool log_initialized;
+};
+
+static int process_message(
+    pa_msgobject* o, int code, void* data, int64_t offset, pa_memchunk* chunk) {
+    struct roc_sink_userdata* u = PA_SINK(o)->userdata;
+    pa_assert(u);
+
+    switch (code) {
+    case PA_SINK_MESSAGE_GET_LATENCY:
+        /* TODO: we should also report roc sender latency here */
+        *((pa_usec_t*)data) = pa_bytes_to_usec(rocpulse_ring_length(&u->rewind_buf),
+                                               &u->sink->sample_spec);
+        return 0;
+
+    case SINK_MESSAGE_SET_SENDER: {
+        /* swap senders, old one is returned to main thread */
+        struct sink_sender* sender = data;
+        struct sink_sender old_sender = u->sender;
+        u->sender = *sender;
+        *sender = old_sender;
+        return 0;
+    }
+
+    case SINK_MESSAGE_SET_SHM: {
+        /* swap channels, old one is returned to main thread */
+        rocpulse_shm** shm = data;
+        rocpulse_shm* old_shm = u->sender.shm;
+        u->sender.shm = *shm;
+        *shm = old_shm;
+
+        if (u->sender.batch) {
+            rocpulse_batch_sender_set_shm(u->sender.batch, u->sender.shm);
+        }
+        return 0;
+    }
+
+    case SINK_MESSAGE_SWITCH_SENDER: {
+        /* current sender becomes old one, and is faded out later */
+        struct sink_sender* sender = data;
+        u->old_sender = u->sender;
+        u->sender = *sender;
+        memset(sender, 0, sizeof(*sender));
+        u->fade_pos = 0;
+        u->fade_len = 0;
+        return 0;
+    }
+
+    case SINK_MESSAGE_FADE_SENDER:
+        u->fade_pos = 0;
+        u->fade_len = (size_t)offset;
+        return 0;
+
+    case SINK_MESSAGE_TAKE_OLD_SENDER: {
+        struct sink_sender* sender = data;
+        *sender = u->old_sender;
+        memset(&u->old_sender, 0, sizeof(u->old_sender));
+        u->fade_pos = 0;
+        u->fade_len = 0;
+        return 0;
+    }
+    }
+
+    return pa_sink_process_msg(o, code, data, offset, chunk);
+}
+
+static bool sender_is_open(const struct sink_sender* sender) {
+    return sender->sender || sender->batch;
+}
+
+static void close_sender(struct sink_sender* sender) {
+    if (sender->sender) {
+        if (roc_sender_close(sender->sender) != 0) {
+            pa_log("failed to close roc sender");
+        }
+        sender->sender = NULL;
+    }
+
+    if (sender->batch) {
+        rocpulse_batch_sender_free(sender->batch);
+        sender->batch = NULL;
+    }
+
+    /* after batch sender, which uses it */
+    if (sender->shm) {
+        rocpulse_shm_free(sender->shm);
+        sender->shm = NULL;
+    }
+}
+
+static int write_frame(struct sink_sender* sender, roc_frame* frame) {
+    pa_assert(sender);
+
+    if (sender->batch) {
+        return rocpulse_batch_sender_write(sender->batch, frame);
+    }
+
+    return roc_sender_write(sender->sender, frame);
+}
+
+static int write_floats(struct sink_sender* sender, float* samples, size_t n_samples) {
+    roc_frame frame;
+    memset(&frame, 0, sizeof(frame));
+
+    frame.samples = samples;
+    frame.samples_size = n_samples * sizeof(float);
+
+    return write_frame(sender, &frame);
+}
+
+/* whether sink thread still writes to old sender */
+static bool is_switching(struct roc_sink_userdata* u) {
+    return sender_is_open(&u->old_sender)
+        && (u->fade_len == 0 || u->fade_pos < u->fade_len);
+}
+
+/* write piece of converted samples to old and new sender during switch; new
+ * sender gets silence until fade starts, and then gain of new sender rises
+ * linearly while gain of old sender falls, so that receivers, which mix both
+ * sessions, play the same loudness during the fade
+ */
+static int write_fade(struct roc_sink_userdata* u, size_t n_samples) {
+    pa_assert(u);
+
+    const size_t n_channels = u->sink->sample_spec.channels;
+    const size_t n_frames = n_samples / n_channels;
+
+    for (int to_new = 0; to_new <= 1; to_new++) {
+        for (size_t f = 0; f < n_frames; f++) {
+            float gain = 0;
+            if (u->fade_len > 0) {
+                gain = (float)PA_MIN(u->fade_pos + f, u->fade_len) / (float)u->fade_len;
+            }
+            if (!to_new) {
+                gain = 1 - gain;
+            }
+
+            for (size_t c = 0; c < n_channels; c++) {
+                u->fade_buf[f * n_channels + c]
+                    = u->convert_buf[f * n_channels + c] * gain;
+            }
+        }
+
+        if (to_new) {
+            if (write_floats(&u->sender, u->fade_buf, n_samples) != 0) {
+                return -1;
+            }
+        } else {
+            /* old sender is going away, its failures don't stop the stream */
+            (void)write_floats(&u->old_sender, u->fade_buf, n_samples);
+        }
+    }
+
+    if (u->fade_len > 0) {
+        u->fade_pos = PA_MIN(u->fade_pos + n_frames, u->fade_len);
+    }
+
+    return 0;
+}
+
+static int write_samples(struct roc_sink_userdata* u, const char* buf, size_t size) {
+    pa_assert(u);
+
+    const pa_sample_spec* sample_spec = &u->sink->sample_spec;
+
+    if (!sender_is_open(&u->sender)) {
+        /* sender is not opened yet */
+        return 0;
+    }
+
+    const bool switching = is_switching(u);
+
+    if (rocpulse_convert_is_native(sample_spec->format) && !switching) {
+        roc_frame frame;
+        memset(&frame, 0, sizeof(frame));
+
+        frame.samples = (void*)buf;
+        frame.samples_size = size;
+
+        return write_frame(&u->sender, &frame);
+    }
+
+    /* convert samples to floats piece by piece and write each piece */
+    const size_t sample_size = pa_sample_size(sample_spec);
+    size_t n_samples = size / sample_size;
+
+    while (n_samples > 0) {
+        size_t n = PA_MIN(n_samples, u->convert_buf_samples);
+
+        rocpulse_convert_to_float(u->convert_buf, buf, sample_spec->format, n);
+
+        int ret = switching ? write_fade(u, n)
+                            : write_floats(&u->sender, u->convert_buf, n);
+        if (ret != 0) {
+            return -1;
+        }
+
+        buf += n * sample_size;
+        n_samples -= n;
+    }
+
+    return 0;
+}
+
+static void
+render_samples(struct roc_sink_userdata* u, size_t length, pa_memchunk* chunk) {
+    pa_assert(u);
+
+    pa_usec_t start_time = pa_rtclock_now();
+    ROCPULSE_TRACE2(render_begin, length, start_time);
+
+    /* read chunk from every connected sink input and mix them */
+    pa_sink_render(u->sink, length, chunk);
+
+    pa_usec_t end_time = pa_rtclock_now();
+    ROCPULSE_TRACE2(render_end, chunk->length, end_time);
+
+    rocpulse_histogram_add(&u->hists[HIST_RENDER_TIME], end_time - start_time);
+    rocpulse_histogram_add(&u->hists[HIST_RENDER_BYTES], chunk->length);
+}
+
+static int send_samples(struct roc_sink_userdata* u, const char* buf, size_t size) {
+    pa_assert(u);
+
+    pa_usec_t start_time = pa_rtclock_now();
+
+    int ret = write_samples(u, buf, size);
+
+    pa_usec_t end_time = pa_rtclock_now();
+    ROCPULSE_TRACE3(sender_write, size, start_time, end_time);
+
+    rocpulse_histogram_add(&u->hists[HIST_WRITE_TIME], end_time - start_time);
+    rocpulse_histogram_add(&u->hists[HIST_WRITE_BYTES], size);
+
+    return ret;
+}
+
+/* send packets queued by batch sender during this tick; with pacing, packets
+ * are spread over the next tick
+ */
+static void flush_packets(struct roc_sink_userdata* u) {
+    pa_assert(u);
+
+    if (!u->sender.batch) {
+        return;
+    }
+
+    pa_usec_t start_time = pa_rtclock_now();
+
+    rocpulse_batch_stats stats;
+    memset(&stats, 0, sizeof(stats));
+
+    rocpulse_batch_sender_flush(u->sender.batch, poll_interval, &stats);
+
+    /* old sender is still used during sender switch */
+    if (u->old_sender.batch) {
+        rocpulse_batch_sender_flush(u->old_sender.batch, poll_interval, NULL);
+    }
+
+    pa_usec_t end_time = pa_rtclock_now();
+
+    rocpulse_histogram_add(&u->hists[HIST_FLUSH_TIME], end_time - start_time);
+    rocpulse_histogram_add(&u->hists[HIST_FLUSH_PACKETS], stats.n_packets);
+    rocpulse_histogram_add(&u->hists[HIST_FLUSH_SYSCALLS], stats.n_syscalls);
+    rocpulse_histogram_add(&u->hists[HIST_FLUSH_DROPPED], stats.n_dropped);
+
+    if (stats.n_paced > 0) {
+        rocpulse_histogram_add(&u->hists[HIST_PACING_ERROR], stats.max_pacing_error);
+    }
+}
+
+/* when sink thread should wake up: at next tick, or earlier, when next paced
+ * packet should be sent
+ */
+static pa_usec_t next_wakeup_time(struct roc_sink_userdata* u, pa_usec_t next_time) {
+    pa_assert(u);
+
+    if (!u->sender.batch) {
+        return next_time;
+    }
+
+    pa_usec_t send_time = rocpulse_batch_sender_next_send_time(u->sender.batch);
+    if (send_time != 0 && send_time < next_time) {
+        next_time = send_time;
+    }
+
+    if (u->old_sender.batch) {
+        send_time = rocpulse_batch_sender_next_send_time(u->old_sender.batch);
+        if (send_time != 0 && send_time < next_time) {
+            next_time = send_time;
+        }
+    }
+
+    return next_time;
+}
+
+static void fill_rewind_buffer(struct roc_sink_userdata* u) {
+    pa_assert(u);
+
+    while (rocpulse_ring_length(&u->rewind_buf) < u->rewind_target) {
+        size_t length = u->rewind_target - rocpulse_ring_length(&u->rewind_buf);
+
+        pa_memchunk chunk;
+        render_samples(u, length, &chunk);
+
+        /* copy samples to rewind buffer, they will be sent later */
+        const char* buf = pa_memblock_acquire(chunk.memblock);
+        rocpulse_ring_write(&u->rewind_buf, buf + chunk.index, chunk.length);
+        pa_memblock_release(chunk.memblock);
+
+        pa_memblock_unref(chunk.memblock);
+    }
+}
+
+static void process_samples(struct roc_sink_userdata* u, uint64_t expected_bytes) {
+    pa_assert(u);
+
+    while (u->rendered_bytes < expected_bytes) {
+        size_t length = 0;
+        int ret = 0;
+
+        if (rocpulse_ring_length(&u->rewind_buf) > 0) {
+            /* send samples rendered ahead during previous ticks */
+            const char* buf = rocpulse_ring_peek(&u->rewind_buf, &length);
+
+            length = (size_t)PA_MIN((uint64_t)length, expected_bytes - u->rendered_bytes);
+
+            if ((ret = send_samples(u, buf, length)) == 0) {
+                rocpulse_ring_drop_head(&u->rewind_buf, length);
+            }
+        } else {
+            /* read chunk from every connected sink input, mix them, allocate
+             * memblock, fill it with mixed samples, and return it to us.
+             */
+            pa_memchunk chunk;
+            render_samples(u, 0, &chunk);
+
+            /* start reading chunk's memblock */
+            char* buf = pa_memblock_acquire(chunk.memblock);
+
+            /* write samples from memblock to roc transmitter */
+            ret = send_samples(u, buf + chunk.index, chunk.length);
+            length = chunk.length;
+
+            /* finish reading memblock */
+            pa_memblock_release(chunk.memblock);
+
+            /* return memblock to the pool */
+            pa_memblock_unref(chunk.memblock);
+        }
+
+        if (ret != 0) {
+            break;
+        }
+
+        u->rendered_bytes += length;
+    }
+
+    /* render samples for next ticks */
+    fill_rewind_buffer(u);
+}
+
+static void process_rewind(struct roc_sink_userdata* u) {
+    pa_assert(u);
+
+    size_t nbytes = 0;
+
+    if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
+        /* only samples that were not sent yet can be rewound */
+        nbytes = PA_MIN(u->sink->thread_info.rewind_nbytes,
+                        rocpulse_ring_length(&u->rewind_buf));
+
+        rocpulse_ring_drop_tail(&u->rewind_buf, nbytes);
+    }
+
+    if (nbytes > 0) {
+        pa_log_debug("rewinding %lu bytes", (unsigned long)nbytes);
+    }
+
+    ROCPULSE_TRACE2(rewind, u->sink->thread_info.rewind_nbytes, nbytes);
+
+    pa_sink_process_rewind(u->sink, nbytes);
+
+    /* re-render rewound samples */
+    if (nbytes > 0) {
+        fill_rewind_buffer(u);
+    }
+}
+
+static void update_requested_latency_cb(pa_sink* s) {
+    pa_sink_assert_ref(s);
+
+    struct roc_sink_userdata* u = s->userdata;
+    pa_assert(u);
+
+    pa_usec_t latency = pa_sink_get_requested_latency_within_thread(s);
+    if (latency == (pa_usec_t)-1) {
+        latency = s->thread_info.max_latency;
+    }
+
+    /* one tick of latency is added by waiting for the next tick */
+    latency = latency > poll_interval ? latency - poll_interval : 0;
+
+    u->rewind_target
+        = PA_MIN(pa_usec_to_bytes(latency, &s->sample_spec), u->rewind_buf.size);
+}
+
+static void process_error(struct roc_sink_userdata* u) {
+    pa_assert(u);
+
+    pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->module->core),
+                      PA_CORE_MESSAGE_UNLOAD_MODULE, u->module, 0, NULL, NULL);
+
+    pa_asyncmsgq_wait_for(u->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
+}
+
+static void thread_loop(void* arg) {
+    struct roc_sink_userdata* u = arg;
+    pa_assert(u);
+
+    pa_thread_mq_install(&u->thread_mq);
+
+    rocpulse_sched_apply(&u->sched_config, &u->sched_state);
+    pa_semaphore_post(u->sched_sem);
+
+    pa_usec_t start_time = 0;
+    pa_usec_t next_time = 0;
+
+    for (;;) {
+        /* process rewind */
+        if (u->sink->thread_info.rewind_requested) {
+            process_rewind(u);
+        }
+
+        /* process sink inputs */
+        if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
+            pa_usec_t now_time = pa_rtclock_now();
+
+            if (start_time == 0) {
+                start_time = now_time;
+                next_time = start_time + poll_interval;
+            } else {
+                /* how late we woke up after scheduled tick */
+                if (now_time >= next_time) {
+                    ROCPULSE_TRACE2(tick_late, next_time, now_time);
+                    rocpulse_histogram_add(&u->hists[HIST_TICK_LATENESS],
+                                           now_time - next_time);
+                }
+
+                while (now_time >= next_time) {
+                    uint64_t expected_bytes
+                        = pa_usec_to_bytes(next_time - start_time, &u->sink->sample_spec);
+
+                    /* render samples from sink inputs and write them to output file */
+                    process_samples(u, expected_bytes);
+
+                    /* next tick */
+                    next_time += poll_interval;
+                }
+
+                /* send packets of all processed ticks at once, or with timer
+                 * pacing, packets which time has come
+                 */
+                flush_packets(u);
+            }
+
+            /* schedule set next rendering tick */
+            pa_rtpoll_set_timer_absolute(u->rtpoll, next_wakeup_time(u, next_time));
+        } else {
+            /* sleep until state change */
+            start_time = 0;
+            next_time = 0;
+            u->rendered_bytes = 0;
+            rocpulse_ring_clear(&u->rewind_buf);
+            pa_rtpoll_set_timer_disabled(u->rtpoll);
+        }
+
+        /* process events and wait next rendering tick */
+#if PA_CHECK_VERSION(5, 99, 0)
+        int ret = pa_rtpoll_run(u->rtpoll);
+#else
+        int ret = pa_rtpoll_run(u->rtpoll, true);
+#endif
+        if (ret < 0) {
+            pa_log("pa_rtpoll_run returned error");
+            goto error;
+        }
+
+        if (ret == 0) {
+            break;
+        }
+    }
+
+    return;
+
+error:
+    process_error(u);
+}
+
+/* open roc sender and connect it to remote endpoints */
+static int open_roc_sender(struct roc_sink_userdata* u,
+                           const roc_sender_config* sender_config,
+                           pa_modargs* args,
+                           roc_sender** out_sender) {
+    pa_assert(u);
+
+    roc_endpoint* remote_source_endp = NULL;
+    roc_endpoint* remote_repair_endp = NULL;
+    roc_endpoint* remote_control_endp = NULL;
+    roc_sender* sender = NULL;
+    int ret = -1;
+
+    /* roc sender endpoints */
+    if (rocpulse_parse_endpoint(&remote_source_endp, ROC_INTERFACE_AUDIO_SOURCE,
+                                sender_config->fec_encoding, args, "remote_ip", "",
+                                "remote_source_port", ROCPULSE_DEFAULT_SOURCE_PORT)
+        < 0) {
+        goto out;
+    }
+
+    if (sender_config->fec_encoding != ROC_FEC_ENCODING_DISABLE) {
+        if (rocpulse_parse_endpoint(&remote_repair_endp, ROC_INTERFACE_AUDIO_REPAIR,
+                                    sender_config->fec_encoding, args, "remote_ip", "",
+                                    "remote_repair_port", ROCPULSE_DEFAULT_REPAIR_PORT)
+            < 0) {
+            goto out;
+        }
+    }
+
+    if (rocpulse_parse_endpoint(&remote_control_endp, ROC_INTERFACE_AUDIO_CONTROL,
+                                sender_config->fec_encoding, args, "remote_ip", "",
+                                "remote_control_port", ROCPULSE_DEFAULT_CONTROL_PORT)
+        < 0) {
+        goto out;
+    }
+
+    /* open and connect */
+    if (roc_sender_open(u->context, sender_config, &sender) < 0) {
+        pa_log("can't create roc sender");
+        goto out;
+    }
+
+    if (roc_sender_connect(sender, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_SOURCE,
+                           remote_source_endp)
+        != 0) {
+        pa_log("can't connect roc sender to remote address");
+        goto out;
+    }
+
+    if (remote_repair_endp) {
+        if (roc_sender_connect(sender, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_REPAIR,
+                               remote_repair_endp)
+            != 0) {
+            pa_log("can't connect roc sender to remote address");
+            goto out;
+        }
+    }
+
+    if (roc_sender_connect(sender, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_CONTROL,
+                           remote_control_endp)
+        != 0) {
+        pa_log("can't connect roc sender to remote address");
+        goto out;
+    }
+
+    *out_sender = sender;
+    sender = NULL;
+    ret = 0;
+
+out:
+    if (sender) {
+        if (roc_sender_close(sender) != 0) {
+            pa_log("failed to close roc sender");
+        }
+    }
+
+    /* roc doesn't need endpoints after connect */
+    if (remote_source_endp) {
+        if (roc_endpoint_deallocate(remote_source_endp) != 0) {
+            pa_log("failed to deallocate roc endpoint");
+        }
+    }
+
+    if (remote_repair_endp) {
+        if (roc_endpoint_deallocate(remote_repair_endp) != 0) {
+            pa_log("failed to deallocate roc endpoint");
+        }
+    }
+
+    if (remote_control_endp) {
+        if (roc_endpoint_deallocate(remote_control_endp) != 0) {
+            pa_log("failed to deallocate roc endpoint");
+        }
+    }
+
+    return ret;
+}
+
+/* open roc encoder and socket for sending packets to remote addresses */
+static int open_batch_sender(struct roc_sink_userdata* u,
+                             const roc_sender_config* sender_config,
+                             pa_modargs* args,
+                             rocpulse_batch_sender** out_sender) {
+    pa_assert(u);
+
+    rocpulse_address source_addr;
+    rocpulse_address repair_addr;
+    rocpulse_address control_addr;
+    const rocpulse_address* repair_addr_ptr = NULL;
+
+    if (rocpulse_parse_address(&source_addr, args, "remote_ip", "", "remote_source_port",
+                               ROCPULSE_DEFAULT_SOURCE_PORT)
+        < 0) {
+        return -1;
+    }
+
+    if (sender_config->fec_encoding != ROC_FEC_ENCODING_DISABLE) {
+        if (rocpulse_parse_address(&repair_addr, args, "remote_ip", "",
+                                   "remote_repair_port", ROCPULSE_DEFAULT_REPAIR_PORT)
+            < 0) {
+            return -1;
+        }
+        repair_addr_ptr = &repair_addr;
+    }
+
+    if (rocpulse_parse_address(&control_addr, args, "remote_ip", "",
+                               "remote_control_port", ROCPULSE_DEFAULT_CONTROL_PORT)
+        < 0) {
+        return -1;
+    }
+
+    /* redundant streaming: copy of every packet goes over secondary path */
+    rocpulse_path secondary;
+    bool has_secondary = false;
+
+    if (rocpulse_parse_path(&secondary, &has_secondary, args, "secondary_remote",
+                            "remote")
+        < 0) {
+        return -1;
+    }
+
+    if (has_secondary && pa_modargs_get_value(args, "secondary_local_ip", NULL)) {
+        if (rocpulse_parse_address(&secondary.bind_addr, args, "secondary_local_ip", "",
+                                   "secondary_local_port", "0")
+            < 0) {
+            return -1;
+        }
+        secondary.has_bind_addr = true;
+    }
+
+    if (!(*out_sender = rocpulse_batch_sender_new(
+              u->context, sender_config, u->pacing, &source_addr, repair_addr_ptr,
+              &control_addr, has_secondary ? &secondary : NULL))) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int open_sender(struct roc_sink_userdata* u,
+                       const roc_sender_config* sender_config,
+                       pa_modargs* args,
+                       struct sink_sender* out_sender) {
+    pa_assert(u);
+
+    memset(out_sender, 0, sizeof(*out_sender));
+
+    if (!u->batch_send) {
+        return open_roc_sender(u, sender_config, args, &out_sender->sender);
+    }
+
+    if (open_batch_sender(u, sender_config, args, &out_sender->batch) < 0) {
+        return -1;
+    }
+
+    /* sink thread doesn't use new sender yet, so it can be connected here */
+    if (u->shm_path) {
+        if ((out_sender->shm = rocpulse_shm_connect(u->shm_path))) {
+            rocpulse_batch_sender_set_shm(out_sender->batch, out_sender->shm);
+        } else {
+            pa_log_info("local receiver is not listening on %s, using UDP", u->shm_path);
+        }
+    }
+
+    return 0;
+}
+
+/* open roc context and sender; invoked either from pa__init(), or from worker
+ * thread if initialization is deferred
+ */
+static int
+setup_roc(struct roc_sink_userdata* u, pa_modargs* args, struct sink_sender* sender) {
+    pa_assert(u);
+
+    roc_context_config context_config;
+    memset(&context_config, 0, sizeof(context_config));
+
+    if (roc_context_open(&context_config, &u->context) < 0) {
+        pa_log("can't create roc context");
+        return -1;
+    }
+
+    if (u->has_packet_encoding) {
+        if (roc_context_register_encoding(u->context, u->sender_config.packet_encoding,
+                                          &u->packet_encoding)
+            < 0) {
+            pa_log("can't register packet encoding");
+            return -1;
+        }
+    }
+
+    if (open_sender(u, &u->sender_config, args, sender) < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int init_run_cb(void* userdata) {
+    struct roc_sink_userdata* u = userdata;
+    pa_assert(u);
+
+    return setup_roc(u, u->init_args, &u->init_sender);
+}
+
+static void init_done_cb(void* userdata, int result) {
+    struct roc_sink_userdata* u = userdata;
+    pa_assert(u);
+
+    rocpulse_worker_free(u->init_worker);
+    u->init_worker = NULL;
+
+    pa_modargs_free(u->init_args);
+    u->init_args = NULL;
+
+    if (result < 0) {
+        pa_log("deferred initialization failed, unloading module");
+        pa_module_unload_request(u->module, true);
+        return;
+    }
+
+    /* pass sender to sink thread */
+    struct sink_sender sender = u->init_sender;
+    memset(&u->init_sender, 0, sizeof(u->init_sender));
+
+    pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink), SINK_MESSAGE_SET_SENDER,
+                      &sender, 0, NULL);
+
+    pa_log_info("roc sender is ready");
+}
+
+/* roc sender and encoder are thread-safe, so this may be called from main loop */
+static int query_metrics(struct sink_sender* sender, rocpulse_metrics* out) {
+    if (sender->batch) {
+        return rocpulse_batch_sender_query(sender->batch, out);
+    }
+
+    if (sender->sender) {
+        return rocpulse_metrics_query_sender(sender->sender, out);
+    }
+
+    return -1;
+}
+
+static int query_sender_metrics(struct roc_sink_userdata* u, rocpulse_metrics* out) {
+    pa_assert(u);
+
+    return query_metrics(&u->sender, out);
+}
+
+/* whether receivers of old sender play new sender's session; receivers report
+ * end-to-end latency of a session only when they play it; without connection
+ * metrics, switch timer waits until timeout
+ */
+static bool new_sender_is_playing(struct roc_sink_userdata* u) {
+    pa_assert(u);
+
+    rocpulse_metrics old_metrics, new_metrics;
+
+    if (query_metrics(&u->old_sender, &old_metrics) < 0
+        || query_sender_metrics(u, &new_metrics) < 0) {
+        return false;
+    }
+
+    if (new_metrics.n_connections == 0
+        || new_metrics.connection_count < old_metrics.connection_count) {
+        return false;
+    }
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    for (size_t n = 0; n < new_metrics.n_connections; n++) {
+        if (new_metrics.connections[n].e2e_latency == 0) {
+            return false;
+        }
+    }
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+/* sender switch: wait until receivers play new session, cross-fade from old
+ * sender to new one, and close old sender
+ */
+static void switch_timer_cb(pa_mainloop_api* a,
+                            pa_time_event* e,
+                            const struct timeval* t,
+                            void* userdata) {
+    (void)t;
+
+    struct roc_sink_userdata* u = userdata;
+    pa_assert(u);
+
+    const pa_usec_t now = pa_rtclock_now();
+
+    if (!u->switch_fading) {
+        if (!new_sender_is_playing(u)) {
+            if (now - u->switch_start_time < switch_timeout) {
+                pa_core_rttime_restart(u->module->core, e, now + switch_interval);
+                return;
+            }
+
+            pa_log_warn("receivers didn't report new session in %llu ms, "
+                        "switching sender anyway",
+                        (unsigned long long)(switch_timeout / PA_USEC_PER_MSEC));
+        }
+
+        const size_t fade_len
+            = pa_usec_to_bytes(switch_fade_time, &u->sink->sample_spec)
+            / pa_frame_size(&u->sink->sample_spec);
+
+        pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink),
+                          SINK_MESSAGE_FADE_SENDER, NULL, (int64_t)fade_len, NULL);
+
+        /* sink thread applies fade to samples as it sends them, tick by tick */
+        u->switch_fading = true;
+        pa_core_rttime_restart(u->module->core, e,
+                               now + switch_fade_time + poll_interval);
+        return;
+    }
+
+    struct sink_sender old_sender;
+    pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink),
+                      SINK_MESSAGE_TAKE_OLD_SENDER, &old_sender, 0, NULL);
+
+    close_sender(&old_sender);
+
+    a->time_free(e);
+    u->switch_timer = NULL;
 
-    uint64_t rendered_bytes;
+    pa_log_info("switched to new roc sender in %llu ms",
+                (unsigned long long)((now - u->switch_start_time) / PA_USEC_PER_MSEC));
+}
 
-    roc_endpoint* remote_source_endp;
-    roc_endpoint* remote_repair_endp;
-    roc_endpoint* remote_control_endp;
+static int apply_config_cb(void* userdata, pa_modargs* new_args, pa_modargs* old_args) {
+    (void)old_args;
 
-    roc_context* context;
-    roc_sender* sender;
-};
+    struct roc_sink_userdata* u = userdata;
+    pa_assert(u);
 
-static int process_message(
-    pa_msgobject* o, int code, void* data, int64_t offset, pa_memchunk* chunk) {
-    switch (code) {
-    case PA_SINK_MESSAGE_GET_LATENCY:
-        /* TODO: we should report internal latency here */
-        *((pa_usec_t*)data) = 0;
-        return 0;
+    if (u->init_worker) {
+        pa_log("can't change configuration until initialization is finished");
+        return -1;
     }
 
-    return pa_sink_process_msg(o, code, data, offset, chunk);
-}
+    if (u->switch_timer) {
+        pa_log("can't change configuration until previous change is finished");
+        return -1;
+    }
 
-static void process_samples(struct roc_sink_userdata* u, uint64_t expected_bytes) {
-    pa_assert(u);
+    /* roc doesn't allow to change sender parameters in place, so we open a new
+     * sender with new parameters; receivers see it as a new session and buffer
+     * it up to their target latency before playing, but they mix concurrent
+     * sessions, so old sender keeps playing until then, and switch timer
+     * cross-fades between them afterwards
+     */
+    roc_sender_config sender_config = u->sender_config;
 
-    while (u->rendered_bytes < expected_bytes) {
-        /* read chunk from every connected sink input, mix them, allocate
-         * memblock, fill it with mixed samples, and return it to us.
-         */
-        pa_memchunk chunk;
-        pa_sink_render(u->sink, 0, &chunk);
+    if (rocpulse_parse_sender_config(&sender_config, new_args) < 0) {
+        return -1;
+    }
 
-        /* start reading chunk's memblock */
-        char* buf = pa_memblock_acquire(chunk.memblock);
+    struct sink_sender sender;
+    if (open_sender(u, &sender_config, new_args, &sender) < 0) {
+        return -1;
+    }
 
-        /* prepare audio frame */
-        roc_frame frame;
-        memset(&frame, 0, sizeof(frame));
+    pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink),
+                      SINK_MESSAGE_SWITCH_SENDER, &sender, 0, NULL);
 
-        frame.samples = buf + chunk.index;
-        frame.samples_size = chunk.length;
+    u->sender_config = sender_config;
 
-        /* write samples from memblock to roc transmitter */
-        if (roc_sender_write(u->sender, &frame) != 0) {
-            break;
-        }
+    u->switch_start_time = pa_rtclock_now();
+    u->switch_fading = false;
+    u->switch_timer = pa_core_rttime_new(
+        u->module->core, u->switch_start_time + switch_interval, switch_timer_cb, u);
 
-        u->rendered_bytes += chunk.length;
+    return 0;
+}
 
-        /* finish reading memblock */
-        pa_memblock_release(chunk.memblock);
+static int query_metrics_cb(void* userdata, rocpulse_metrics* out) {
+    struct roc_sink_userdata* u = userdata;
+    pa_assert(u);
 
-        /* return memblock to the pool */
-        pa_memblock_unref(chunk.memblock);
-    }
+    return query_sender_metrics(u, out);
 }
 
-static void process_rewind(struct roc_sink_userdata* u) {
+static void update_metrics_cb(void* userdata, pa_proplist* proplist) {
+    struct roc_sink_userdata* u = userdata;
     pa_assert(u);
 
-    pa_sink_process_rewind(u->sink, 0);
+    pa_sink_update_proplist(u->sink, PA_UPDATE_REPLACE, proplist);
 }
 
-static void process_error(struct roc_sink_userdata* u) {
+static void get_adaptive_params(struct roc_sink_userdata* u,
+                                rocpulse_adaptive_params* params) {
     pa_assert(u);
 
-    pa_asyncmsgq_post(u->thread_mq.outq, PA_MSGOBJECT(u->module->core),
-                      PA_CORE_MESSAGE_UNLOAD_MODULE, u->module, 0, NULL, NULL);
+    params->fec_nbsrc = u->sender_config.fec_block_source_packets;
+    if (params->fec_nbsrc == 0) {
+        params->fec_nbsrc = default_fec_nbsrc;
+    }
 
-    pa_asyncmsgq_wait_for(u->thread_mq.inq, PA_MESSAGE_SHUTDOWN);
+    params->fec_nbrpr = u->sender_config.fec_block_repair_packets;
+    if (params->fec_nbrpr == 0) {
+        params->fec_nbrpr = default_fec_nbrpr;
+    }
 }
 
-static void thread_loop(void* arg) {
-    struct roc_sink_userdata* u = arg;
+static void update_adaptive(struct roc_sink_userdata* u) {
     pa_assert(u);
 
-    pa_thread_mq_install(&u->thread_mq);
+    /* FEC may have been disabled at runtime */
+    if (u->sender_config.fec_encoding == ROC_FEC_ENCODING_DISABLE) {
+        return;
+    }
 
-    const pa_usec_t poll_interval = 10000;
+    /* new sender has no statistics until switch is finished */
+    if (u->switch_timer) {
+        return;
+    }
 
-    pa_usec_t start_time = 0;
-    pa_usec_t next_time = 0;
+    rocpulse_metrics metrics;
+    if (query_sender_metrics(u, &metrics) < 0) {
+        return;
+    }
 
-    for (;;) {
-        /* process rewind */
-        if (u->sink->thread_info.rewind_requested) {
-            process_rewind(u);
-        }
+    if (metrics.n_connections == 0) {
+        return;
+    }
 
-        /* process sink inputs */
-        if (PA_SINK_IS_OPENED(u->sink->thread_info.state)) {
-            pa_usec_t now_time = pa_rtclock_now();
+    /* combine reports from all receivers */
+    uint64_t expected_packets = 0;
+    uint64_t lost_packets = 0;
 
-            if (start_time == 0) {
-                start_time = now_time;
-                next_time = start_time + poll_interval;
-            } else {
-                while (now_time >= next_time) {
-                    uint64_t expected_bytes
-                        = pa_usec_to_bytes(next_time - start_time, &u->sink->sample_spec);
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    for (size_t n = 0; n < metrics.n_connections; n++) {
+        const roc_connection_metrics* conn = &metrics.connections[n];
 
-                    /* render samples from sink inputs and write them to output file */
-                    process_samples(u, expected_bytes);
+        expected_packets += conn->expected_packets;
+        lost_packets += conn->lost_packets;
+    }
+#endif
 
-                    /* next tick */
-                    next_time += poll_interval;
-                }
-            }
+    rocpulse_adaptive_params params;
+    get_adaptive_params(u, &params);
 
-            /* schedule set next rendering tick */
-            pa_rtpoll_set_timer_absolute(u->rtpoll, next_time);
-        } else {
-            /* sleep until state change */
-            start_time = 0;
-            next_time = 0;
-            pa_rtpoll_set_timer_disabled(u->rtpoll);
-        }
+    rocpulse_adaptive_params new_params = params;
+    if (!rocpulse_adaptive_update(&u->adaptive, expected_packets, lost_packets,
+                                  &new_params)) {
+        return;
+    }
 
-        /* process events and wait next rendering tick */
-#if PA_CHECK_VERSION(5, 99, 0)
-        int ret = pa_rtpoll_run(u->rtpoll);
-#else
-        int ret = pa_rtpoll_run(u->rtpoll, true);
-#endif
-        if (ret < 0) {
-            pa_log("pa_rtpoll_run returned error");
-            goto error;
+    pa_log_info("packet loss is %.2f%%, changing FEC repair packets from %u to %u",
+                u->adaptive.loss * 100, params.fec_nbrpr, new_params.fec_nbrpr);
+
+    char* argument = pa_sprintf_malloc("fec_block_nbsrc=%u fec_block_nbrpr=%u",
+                                       new_params.fec_nbsrc, new_params.fec_nbrpr);
+
+    /* roc can't change FEC in place, so this opens new sender, which starts new
+     * session with zero counters
+     */
+    if (rocpulse_config_update(u->config, argument) == 0) {
+        rocpulse_adaptive_reset(&u->adaptive);
+    }
+
+    pa_xfree(argument);
+}
+
+static void adaptive_timer_cb(pa_mainloop_api* a,
+                              pa_time_event* e,
+                              const struct timeval* t,
+                              void* userdata) {
+    (void)a;
+    (void)t;
+
+    struct roc_sink_userdata* u = userdata;
+    pa_assert(u);
+
+    update_adaptive(u);
+
+    pa_core_rttime_restart(u->module->core, e, pa_rtclock_now() + adaptive_interval);
+}
+
+/* switch between shared memory and UDP when local receiver comes and goes;
+ * connecting takes several syscalls, so sink thread only gets ready channel
+ */
+static void shm_timer_cb(pa_mainloop_api* a,
+                         pa_time_event* e,
+                         const struct timeval* t,
+                         void* userdata) {
+    (void)a;
+    (void)t;
+
+    struct roc_sink_userdata* u = userdata;
+    pa_assert(u);
+
+    /* sink thread changes sender only by request from main loop, so it can be
+     * read here
+     */
+    rocpulse_shm* shm = NULL;
+    bool changed = false;
+
+    if (u->sender.batch) {
+        if (!u->sender.shm) {
+            changed = (shm = rocpulse_shm_connect(u->shm_path)) != NULL;
+        } else if (rocpulse_shm_is_closed(u->sender.shm)) {
+            pa_log_info("local receiver closed %s, falling back to UDP", u->shm_path);
+            changed = true;
         }
+    }
 
-        if (ret == 0) {
-            break;
+    if (changed) {
+        pa_asyncmsgq_send(u->sink->asyncmsgq, PA_MSGOBJECT(u->sink),
+                          SINK_MESSAGE_SET_SHM, &shm, 0, NULL);
+
+        /* now we've got old channel */
+        if (shm) {
+            rocpulse_shm_free(shm);
         }
     }
 
-    return;
+    pa_core_rttime_restart(u->module->core, e, pa_rtclock_now() + shm_interval);
+}
 
-error:
-    process_error(u);
+/* parse bounds for adaptive FEC and check that current parameters are within
+ * them
+ */
+static int parse_adaptive_config(struct roc_sink_userdata* u,
+                                 rocpulse_adaptive_config* config,
+                                 pa_modargs* args) {
+    pa_assert(u);
+
+    if (u->sender_config.fec_encoding == ROC_FEC_ENCODING_DISABLE) {
+        pa_log("adaptive_fec requires FEC to be enabled");
+        return -1;
+    }
+
+#if ROC_VERSION < ROC_VERSION_CODE(0, 4, 0)
+    pa_log("adaptive_fec requires Roc Toolkit 0.4 or later");
+    return -1;
+#endif
+
+    rocpulse_adaptive_params params;
+    get_adaptive_params(u, &params);
+
+    char default_max[16];
+
+    /* by default, repair packets may range from one to as many as source packets */
+    pa_snprintf(default_max, sizeof(default_max), "%u",
+                PA_MAX(params.fec_nbrpr, params.fec_nbsrc));
+
+    if (rocpulse_parse_uint(&config->fec_nbrpr_min, args, "fec_block_nbrpr_min", "1")
+            < 0
+        || rocpulse_parse_uint(&config->fec_nbrpr_max, args, "fec_block_nbrpr_max",
+                               default_max)
+            < 0) {
+        return -1;
+    }
+
+    if (config->fec_nbrpr_min == 0 || config->fec_nbrpr_min > params.fec_nbrpr
+        || config->fec_nbrpr_max < params.fec_nbrpr) {
+        pa_log("fec_block_nbrpr should be within fec_block_nbrpr_min and "
+               "fec_block_nbrpr_max");
+        return -1;
+    }
+
+    return 0;
 }
 
 void pa__done(pa_module*);
@@ -238,10 +1402,6 @@ void pa__done(pa_module*);
 int pa__init(pa_module* m) {
     pa_assert(m);
 
-    /* setup logs */
-    roc_log_set_level(ROC_LOG_DEBUG);
-    roc_log_set_handler(rocpulse_log_handler, NULL);
-
     /* get module arguments (key-value list passed to load-module) */
     pa_modargs* args;
     if (!(args = pa_modargs_new(m->argument, roc_sink_modargs))) {
@@ -255,24 +1415,30 @@ int pa__init(pa_module* m) {
     m->userdata = u;
 
     u->module = m;
-    u->rtpoll = pa_rtpoll_new();
-    pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
-
-    /* roc context */
-    roc_context_config context_config;
-    memset(&context_config, 0, sizeof(context_config));
 
-    if (roc_context_open(&context_config, &u->context) < 0) {
-        pa_log("can't create roc context");
+    /* setup logs */
+    if (rocpulse_log_init(m->core, args, "roc_log_level") < 0) {
         goto error;
     }
+    u->log_initialized = true;
+
+    for (int n = 0; n < HIST_MAX; n++) {
+        rocpulse_histogram_init(&u->hists[n], hist_names[n]);
+    }
+
+    u->rtpoll = pa_rtpoll_new();
+    pa_thread_mq_init(&u->thread_mq, m->core->mainloop, u->rtpoll);
 
     /* roc sender config */
     roc_sender_config sender_config;
     memset(&sender_config, 0, sizeof(sender_config));
 
-    if (rocpulse_parse_media_encoding(&sender_config.frame_encoding, args, "sink_rate",
-                                      "sink_format", "sink_chans")
+    pa_sample_format_t sample_format = PA_SAMPLE_INVALID;
+    pa_channel_map channel_map;
+
+    if (rocpulse_parse_media_encoding(&sender_config.frame_encoding, &sample_format,
+                                      &channel_map, args, "sink_rate", "sink_format",
+                                      "sink_chans")
         < 0) {
         goto error;
     }
@@ -284,146 +1450,133 @@ int pa__init(pa_module* m) {
     }
 
     if (sender_config.packet_encoding == 0) {
+        if (sender_config.frame_encoding.channels == ROC_CHANNEL_LAYOUT_MULTITRACK) {
+            pa_log("packet_encoding_id should be set when sink_chans is not mono or "
+                   "stereo");
+            goto error;
+        }
         sender_config.packet_encoding = ROC_PACKET_ENCODING_AVP_L16_STEREO;
     } else {
-        roc_media_encoding encoding;
-        memset(&encoding, 0, sizeof(encoding));
-
-        if (rocpulse_parse_media_encoding(&encoding, args, "packet_encoding_rate",
+        if (rocpulse_parse_media_encoding(&u->packet_encoding, NULL, NULL, args,
+                                          "packet_encoding_rate",
                                           "packet_encoding_format",
                                           "packet_encoding_chans")
             < 0) {
             goto error;
         }
-
-        if (roc_context_register_encoding(u->context, sender_config.packet_encoding,
-                                          &encoding)
-            < 0) {
-            pa_log("can't register packet encoding");
-            goto error;
-        }
+        u->has_packet_encoding = true;
     }
 
-    if (rocpulse_parse_duration_msec_ul(&sender_config.packet_length, 1, args,
-                                        "packet_length_msec", "0")
-        < 0) {
+    if (rocpulse_parse_sender_config(&sender_config, args) < 0) {
         goto error;
     }
 
-    if (rocpulse_parse_fec_encoding(&sender_config.fec_encoding, args, "fec_encoding")
-        < 0) {
-        goto error;
-    }
+    u->sender_config = sender_config;
 
-    if (rocpulse_parse_uint(&sender_config.fec_block_source_packets, args,
-                            "fec_block_nbsrc", "0")
-        < 0) {
+    /* roc context and sender */
+    bool deferred_init = false;
+    if (pa_modargs_get_value_boolean(args, "deferred_init", &deferred_init) < 0) {
+        pa_log("invalid deferred_init");
         goto error;
     }
 
-    if (rocpulse_parse_uint(&sender_config.fec_block_repair_packets, args,
-                            "fec_block_nbrpr", "0")
-        < 0) {
+    if (pa_modargs_get_value_boolean(args, "batch_send", &u->batch_send) < 0) {
+        pa_log("invalid batch_send");
         goto error;
     }
 
-    if (rocpulse_parse_resampler_backend(&sender_config.resampler_backend, args,
-                                         "resampler_backend")
-        < 0) {
+#if ROC_VERSION < ROC_VERSION_CODE(0, 4, 0)
+    if (u->batch_send) {
+        pa_log("batch_send requires Roc Toolkit 0.4 or later");
         goto error;
     }
+#endif
 
-    if (rocpulse_parse_resampler_profile(&sender_config.resampler_profile, args,
-                                         "resampler_profile")
-        < 0) {
+    if (rocpulse_parse_pacing(&u->pacing, args, "pacing") < 0) {
         goto error;
     }
 
-#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
-    if (rocpulse_parse_latency_tuner_backend(&sender_config.latency_tuner_backend, args,
-                                             "latency_backend")
-        < 0) {
+    /* only batch sender controls when packets are sent */
+    if (u->pacing != ROCPULSE_PACING_DISABLE && !u->batch_send) {
+        pa_log("pacing requires batch_send=true");
         goto error;
     }
 
-    if (rocpulse_parse_latency_tuner_profile(&sender_config.latency_tuner_profile, args,
-                                             "latency_profile")
-        < 0) {
+    /* roc sender can't duplicate packets */
+    if (pa_modargs_get_value(args, "secondary_remote_ip", NULL) && !u->batch_send) {
+        pa_log("secondary_remote_ip requires batch_send=true");
         goto error;
     }
 
-    if (rocpulse_parse_duration_msec_ul(&sender_config.latency_tolerance, 1, args,
-                                        "latency_tolerance_msec", "0")
-        < 0) {
-        goto error;
-    }
+    /* shared memory replaces UDP on primary path only while receiver is
+     * connected, and would break deduplication on receiver
+     */
+    if (pa_modargs_get_value(args, "remote_socket", NULL)) {
+        if (!u->batch_send) {
+            pa_log("remote_socket requires batch_send=true");
+            goto error;
+        }
 
-    if (rocpulse_parse_duration_msec_ul(&sender_config.target_latency, 1, args,
-                                        "target_latency_msec", "0")
-        < 0) {
-        goto error;
-    }
-#endif // ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+        if (pa_modargs_get_value(args, "secondary_remote_ip", NULL)) {
+            pa_log("remote_socket can't be used with secondary_remote_ip");
+            goto error;
+        }
 
-    /* roc sender endpoints */
-    if (rocpulse_parse_endpoint(&u->remote_source_endp, ROC_INTERFACE_AUDIO_SOURCE,
-                                sender_config.fec_encoding, args, "remote_ip", "",
-                                "remote_source_port", ROCPULSE_DEFAULT_SOURCE_PORT)
-        < 0) {
-        goto error;
+        u->shm_path = pa_xstrdup(pa_modargs_get_value(args, "remote_socket", NULL));
     }
 
-    if (sender_config.fec_encoding != ROC_FEC_ENCODING_DISABLE) {
-        if (rocpulse_parse_endpoint(&u->remote_repair_endp, ROC_INTERFACE_AUDIO_REPAIR,
-                                    sender_config.fec_encoding, args, "remote_ip", "",
-                                    "remote_repair_port", ROCPULSE_DEFAULT_REPAIR_PORT)
-            < 0) {
+    if (!deferred_init) {
+        if (setup_roc(u, args, &u->sender) < 0) {
             goto error;
         }
     }
 
-    if (rocpulse_parse_endpoint(&u->remote_control_endp, ROC_INTERFACE_AUDIO_CONTROL,
-                                sender_config.fec_encoding, args, "remote_ip", "",
-                                "remote_control_port", ROCPULSE_DEFAULT_CONTROL_PORT)
+    /* prepare sample spec used for sink */
+    pa_sample_spec sample_spec;
+
+    if (rocpulse_extract_encoding(&sender_config.frame_encoding, sample_format,
+                                  &sample_spec)
         < 0) {
         goto error;
     }
 
-    /* open and connect */
-    if (roc_sender_open(u->context, &sender_config, &u->sender) < 0) {
-        pa_log("can't create roc sender");
+    /* keep whole frames in every piece passed to roc */
+    u->convert_buf_samples = ROCPULSE_CONVERT_BUFFER_SAMPLES
+        - ROCPULSE_CONVERT_BUFFER_SAMPLES % sample_spec.channels;
+    u->convert_buf = pa_xnew(float, u->convert_buf_samples);
+    u->fade_buf = pa_xnew(float, u->convert_buf_samples);
+
+    /* prepare rewind buffer */
+    unsigned long long max_rewind_us = 0;
+    if (rocpulse_parse_duration_msec_ul(&max_rewind_us, 1000, args, "max_rewind_msec",
+                                        "0")
+        < 0) {
         goto error;
     }
 
-    if (roc_sender_connect(u->sender, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_SOURCE,
-                           u->remote_source_endp)
-        != 0) {
-        pa_log("can't connect roc sender to remote address");
+    rocpulse_ring_init(&u->rewind_buf, pa_usec_to_bytes(max_rewind_us, &sample_spec));
+    u->rewind_target = u->rewind_buf.size;
+
+    bool adaptive_fec = false;
+    if (pa_modargs_get_value_boolean(args, "adaptive_fec", &adaptive_fec) < 0) {
+        pa_log("invalid adaptive_fec");
         goto error;
     }
 
-    if (u->remote_repair_endp) {
-        if (roc_sender_connect(u->sender, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_REPAIR,
-                               u->remote_repair_endp)
-            != 0) {
-            pa_log("can't connect roc sender to remote address");
+    if (adaptive_fec) {
+        rocpulse_adaptive_config adaptive_config;
+        memset(&adaptive_config, 0, sizeof(adaptive_config));
+
+        if (parse_adaptive_config(u, &adaptive_config, args) < 0) {
             goto error;
         }
-    }
 
-    if (roc_sender_connect(u->sender, ROC_SLOT_DEFAULT, ROC_INTERFACE_AUDIO_CONTROL,
-                           u->remote_control_endp)
-        != 0) {
-        pa_log("can't connect roc sender to remote address");
-        goto error;
+        rocpulse_adaptive_init(&u->adaptive, &adaptive_config);
     }
 
-    /* prepare sample spec and channel map used for sink */
-    pa_sample_spec sample_spec;
-    pa_channel_map channel_map;
-
-    if (rocpulse_extract_encoding(&sender_config.frame_encoding, &sample_spec,
-                                  &channel_map)
+    unsigned long long metrics_interval_us = 0;
+    if (rocpulse_parse_duration_msec_ul(&metrics_interval_us, 1000, args,
+                                        "metrics_interval_msec", "1000")
         < 0) {
         goto error;
     }
@@ -447,7 +1600,9 @@ int pa__init(pa_module* m) {
         goto error;
     }
 
-    u->sink = pa_sink_new(m->core, &data, PA_SINK_LATENCY);
+    u->sink = pa_sink_new(m->core, &data,
+                          u->rewind_buf.size ? PA_SINK_LATENCY | PA_SINK_DYNAMIC_LATENCY
+                                             : PA_SINK_LATENCY);
     pa_sink_new_data_done(&data);
 
     if (!u->sink) {
@@ -459,17 +1614,84 @@ int pa__init(pa_module* m) {
     u->sink->parent.process_msg = process_message;
     u->sink->userdata = u;
 
+    if (u->rewind_buf.size) {
+        u->sink->update_requested_latency = update_requested_latency_cb;
+
+        pa_sink_set_latency_range(u->sink, poll_interval,
+                                  poll_interval + (pa_usec_t)max_rewind_us);
+        pa_sink_set_max_rewind(u->sink, u->rewind_buf.size);
+        pa_sink_set_max_request(u->sink, u->rewind_buf.size);
+    }
+
     /* setup sink event loop */
     pa_sink_set_asyncmsgq(u->sink, u->thread_mq.inq);
     pa_sink_set_rtpoll(u->sink, u->rtpoll);
 
     /* start thread for sink event loop and sample reader */
+    if (rocpulse_parse_sched_config(&u->sched_config, args, "rt_priority",
+                                    "cpu_affinity")
+        < 0) {
+        goto error;
+    }
+
+    u->sched_sem = pa_semaphore_new(0);
+
     if (!(u->thread = pa_thread_new("roc_sender", thread_loop, u))) {
         pa_log("failed to create thread");
         goto error;
     }
 
+    /* wait until thread applies scheduling config and report result */
+    pa_semaphore_wait(u->sched_sem);
+    rocpulse_sched_report(&u->sched_state, u->sink->proplist);
+
     pa_sink_put(u->sink);
+
+    char* object_path = rocpulse_metrics_object_path("/roc_sink", u->sink->name);
+
+    /* start sampling metrics */
+    if (metrics_interval_us > 0) {
+        u->metrics_poller
+            = rocpulse_metrics_poller_new(m->core, object_path, metrics_interval_us,
+                                          query_metrics_cb, update_metrics_cb, u);
+    }
+
+    /* make timing histograms available to clients */
+    char* hist_object_path = pa_sprintf_malloc("%s/histograms", object_path);
+    u->hist_handler
+        = rocpulse_histogram_handler_new(m->core, hist_object_path, u->hists, HIST_MAX);
+    pa_xfree(hist_object_path);
+
+    /* allow to change configuration at runtime */
+    char* config_object_path = pa_sprintf_malloc("%s/config", object_path);
+    u->config
+        = rocpulse_config_new(m->core, config_object_path, m->argument, roc_sink_modargs,
+                              roc_sink_runtime_modargs, apply_config_cb, u);
+    pa_xfree(config_object_path);
+
+    pa_xfree(object_path);
+
+    /* open roc sender in background; arguments are kept until it's done */
+    if (deferred_init) {
+        u->init_args = pa_modargs_new(m->argument, roc_sink_modargs);
+        if (!(u->init_worker = rocpulse_worker_new(m->core, "roc_sender_init",
+                                                   init_run_cb, init_done_cb, u))) {
+            goto error;
+        }
+    }
+
+    /* start adjusting FEC to packet loss */
+    if (adaptive_fec) {
+        u->adaptive_timer = pa_core_rttime_new(
+            m->core, pa_rtclock_now() + adaptive_interval, adaptive_timer_cb, u);
+    }
+
+    /* start watching local receiver */
+    if (u->shm_path) {
+        u->shm_timer = pa_core_rttime_new(m->core, pa_rtclock_now() + shm_interval,
+                                          shm_timer_cb, u);
+    }
+
     pa_modargs_free(args);
 
     return 0;
@@ -491,6 +1713,39 @@ void pa__done(pa_module* m) {
         return;
     }
 
+    /* wait until worker thread stops using roc and arguments */
+    if (u->init_worker) {
+        rocpulse_worker_free(u->init_worker);
+    }
+
+    if (u->init_args) {
+        pa_modargs_free(u->init_args);
+    }
+
+    if (u->adaptive_timer) {
+        m->core->mainloop->time_free(u->adaptive_timer);
+    }
+
+    if (u->shm_timer) {
+        m->core->mainloop->time_free(u->shm_timer);
+    }
+
+    if (u->switch_timer) {
+        m->core->mainloop->time_free(u->switch_timer);
+    }
+
+    if (u->metrics_poller) {
+        rocpulse_metrics_poller_free(u->metrics_poller);
+    }
+
+    if (u->hist_handler) {
+        rocpulse_histogram_handler_free(u->hist_handler);
+    }
+
+    if (u->config) {
+        rocpulse_config_free(u->config);
+    }
+
     if (u->sink) {
         pa_sink_unlink(u->sink);
     }
@@ -510,34 +1765,28 @@ void pa__done(pa_module* m) {
         pa_rtpoll_free(u->rtpoll);
     }
 
-    if (u->sender) {
-        if (roc_sender_close(u->sender) != 0) {
-            pa_log("failed to close roc sender");
-        }
+    if (u->sched_sem) {
+        pa_semaphore_free(u->sched_sem);
     }
 
+    close_sender(&u->sender);
+    close_sender(&u->old_sender);
+    close_sender(&u->init_sender);
+
     if (u->context) {
         if (roc_context_close(u->context) != 0) {
             pa_log("failed to close roc context");
         }
     }
 
-    if (u->remote_source_endp) {
-        if (roc_endpoint_deallocate(u->remote_source_endp) != 0) {
-            pa_log("failed to deallocate roc endpoint");
-        }
-    }
+    rocpulse_ring_done(&u->rewind_buf);
 
-    if (u->remote_repair_endp) {
-        if (roc_endpoint_deallocate(u->remote_repair_endp) != 0) {
-            pa_log("failed to deallocate roc endpoint");
-        }
-    }
+    pa_xfree(u->convert_buf);
+    pa_xfree(u->fade_buf);
+    pa_xfree(u->shm_path);
 
-    if (u->remote_control_endp) {
-        if (roc_endpoint_deallocate(u->remote_control_endp) != 0) {
-            pa_log("failed to deallocate roc endpoint");
-        }
+    if (u->log_initialized) {
+        rocpulse_log_done();
     }
 
     pa_xfree(u);
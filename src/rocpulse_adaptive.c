@@ -0,0 +1,184 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <string.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/macro.h>
+
+/* local headers */
+#include "rocpulse_adaptive.h"
+
+/* windows with fewer packets don't tell much and are skipped */
+#define MIN_WINDOW_PACKETS 50
+
+/* weight of new window in smoothed loss */
+#define LOSS_SMOOTHING 0.3
+
+/* increase redundancy if loss exceeds this part of what FEC can recover */
+#define HIGH_LOSS_FACTOR 0.5
+#define HIGH_LOSS_WINDOWS 3
+
+/* decrease redundancy if loss stays below this part of what FEC would be
+ * able to recover after decreasing
+ */
+#define LOW_LOSS_FACTOR 0.2
+#define LOW_LOSS_WINDOWS 60
+
+/* after a change, loss should be at most this part of what FEC can recover,
+ * between thresholds for increasing and decreasing
+ */
+#define TARGET_LOSS_FACTOR 0.3
+
+/* windows to wait after every change, since every change switches sender */
+#define COOLDOWN_WINDOWS 30
+
+static double recoverable_ratio(unsigned int nbsrc, unsigned int nbrpr) {
+    if (nbsrc + nbrpr == 0) {
+        return 0;
+    }
+    /* share of packets in block that can be lost and still recovered */
+    return (double)nbrpr / (double)(nbsrc + nbrpr);
+}
+
+void rocpulse_adaptive_init(rocpulse_adaptive* adaptive,
+                            const rocpulse_adaptive_config* config) {
+    memset(adaptive, 0, sizeof(*adaptive));
+    adaptive->config = *config;
+}
+
+void rocpulse_adaptive_reset(rocpulse_adaptive* adaptive) {
+    adaptive->has_prev = false;
+    adaptive->high_windows = 0;
+    adaptive->low_windows = 0;
+}
+
+/* fewest repair packets within bounds that keep loss at target part of what
+ * FEC can recover
+ */
+static unsigned int target_nbrpr(const rocpulse_adaptive_config* config,
+                                 unsigned int nbsrc,
+                                 double loss) {
+    unsigned int nbrpr = config->fec_nbrpr_min;
+
+    while (nbrpr < config->fec_nbrpr_max
+           && recoverable_ratio(nbsrc, nbrpr) * TARGET_LOSS_FACTOR < loss) {
+        nbrpr++;
+    }
+
+    return nbrpr;
+}
+
+static bool step_up(const rocpulse_adaptive_config* config,
+                    rocpulse_adaptive_params* params,
+                    double loss) {
+    if (params->fec_nbrpr >= config->fec_nbrpr_max) {
+        return false;
+    }
+
+    params->fec_nbrpr
+        = PA_MAX(params->fec_nbrpr + 1, target_nbrpr(config, params->fec_nbsrc, loss));
+    return true;
+}
+
+static bool step_down(const rocpulse_adaptive_config* config,
+                      rocpulse_adaptive_params* params,
+                      double loss) {
+    if (params->fec_nbrpr <= config->fec_nbrpr_min) {
+        return false;
+    }
+
+    params->fec_nbrpr
+        = PA_MIN(params->fec_nbrpr - 1, target_nbrpr(config, params->fec_nbsrc, loss));
+    return true;
+}
+
+bool rocpulse_adaptive_update(rocpulse_adaptive* adaptive,
+                              uint64_t expected_packets,
+                              uint64_t lost_packets,
+                              rocpulse_adaptive_params* params) {
+    const rocpulse_adaptive_config* config = &adaptive->config;
+
+    /* counters went back, so this is a new session */
+    if (adaptive->has_prev
+        && (expected_packets < adaptive->prev_expected
+            || lost_packets < adaptive->prev_lost)) {
+        adaptive->has_prev = false;
+    }
+
+    if (!adaptive->has_prev) {
+        adaptive->has_prev = true;
+        adaptive->prev_expected = expected_packets;
+        adaptive->prev_lost = lost_packets;
+        return false;
+    }
+
+    uint64_t window_expected = expected_packets - adaptive->prev_expected;
+    uint64_t window_lost = lost_packets - adaptive->prev_lost;
+
+    if (window_expected < MIN_WINDOW_PACKETS) {
+        /* accumulate more packets before taking decision */
+        return false;
+    }
+
+    adaptive->prev_expected = expected_packets;
+    adaptive->prev_lost = lost_packets;
+
+    double window_loss = (double)window_lost / (double)window_expected;
+    if (window_loss > 1) {
+        window_loss = 1;
+    }
+
+    if (adaptive->has_loss) {
+        adaptive->loss
+            = adaptive->loss * (1 - LOSS_SMOOTHING) + window_loss * LOSS_SMOOTHING;
+    } else {
+        adaptive->loss = window_loss;
+        adaptive->has_loss = true;
+    }
+
+    if (adaptive->cooldown_windows > 0) {
+        adaptive->cooldown_windows--;
+        return false;
+    }
+
+    const double current_ratio = recoverable_ratio(params->fec_nbsrc, params->fec_nbrpr);
+    const double lower_ratio = recoverable_ratio(
+        params->fec_nbsrc, params->fec_nbrpr > 0 ? params->fec_nbrpr - 1 : 0);
+
+    if (adaptive->loss > current_ratio * HIGH_LOSS_FACTOR) {
+        adaptive->high_windows++;
+        adaptive->low_windows = 0;
+    } else if (adaptive->loss < lower_ratio * LOW_LOSS_FACTOR) {
+        adaptive->low_windows++;
+        adaptive->high_windows = 0;
+    } else {
+        adaptive->high_windows = 0;
+        adaptive->low_windows = 0;
+    }
+
+    bool changed = false;
+
+    if (adaptive->high_windows >= HIGH_LOSS_WINDOWS) {
+        changed = step_up(config, params, adaptive->loss);
+    } else if (adaptive->low_windows >= LOW_LOSS_WINDOWS) {
+        changed = step_down(config, params, adaptive->loss);
+    }
+
+    if (changed) {
+        adaptive->high_windows = 0;
+        adaptive->low_windows = 0;
+        adaptive->cooldown_windows = COOLDOWN_WINDOWS;
+    }
+
+    return changed;
+}
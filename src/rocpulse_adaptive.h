@@ -0,0 +1,73 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <stdbool.h>
+#include <stdint.h>
+
+/* bounds for adaptive controller */
+typedef struct rocpulse_adaptive_config {
+    /* range for number of repair packets in FEC block */
+    unsigned int fec_nbrpr_min;
+    unsigned int fec_nbrpr_max;
+} rocpulse_adaptive_config;
+
+/* current sender parameters */
+typedef struct rocpulse_adaptive_params {
+    unsigned int fec_nbsrc;
+    unsigned int fec_nbrpr;
+} rocpulse_adaptive_params;
+
+/* adjusts FEC redundancy according to packet loss reported by receivers
+ *
+ * every change requires a new sender, which runs alongside the old one until
+ * receivers buffer its session, and restarts loss statistics, so changes are
+ * rare: loss is smoothed, and redundancy is increased only
+ * after loss stays high for several windows, and decreased only after it stays
+ * low for much longer; instead of small steps, redundancy jumps right to the
+ * value that fits current loss, and after every change the controller waits
+ * for a long time; the thresholds for increasing and decreasing are far enough
+ * from each other, so that a change in one direction never immediately
+ * triggers a change in the other one
+ */
+typedef struct rocpulse_adaptive {
+    rocpulse_adaptive_config config;
+
+    /* counters from previous window */
+    bool has_prev;
+    uint64_t prev_expected;
+    uint64_t prev_lost;
+
+    /* smoothed loss ratio */
+    double loss;
+    bool has_loss;
+
+    unsigned int high_windows;
+    unsigned int low_windows;
+    unsigned int cooldown_windows;
+} rocpulse_adaptive;
+
+void rocpulse_adaptive_init(rocpulse_adaptive* adaptive,
+                            const rocpulse_adaptive_config* config);
+
+/* forget counters, e.g. after a new session was started */
+void rocpulse_adaptive_reset(rocpulse_adaptive* adaptive);
+
+/* should be called once per window with total number of expected and lost
+ * packets reported by receivers; returns true and updates params if they
+ * should be changed
+ */
+bool rocpulse_adaptive_update(rocpulse_adaptive* adaptive,
+                              uint64_t expected_packets,
+                              uint64_t lost_packets,
+                              rocpulse_adaptive_params* params);
@@ -0,0 +1,853 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/* public pulseaudio headers */
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+
+/* roc headers */
+#include <roc/version.h>
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+#include <roc/packet.h>
+#include <roc/sender_encoder.h>
+#endif
+
+/* local headers */
+#include "rocpulse_batch.h"
+#include "rocpulse_shm.h"
+
+int rocpulse_parse_pacing(rocpulse_pacing* out, pa_modargs* args, const char* arg_name) {
+    pa_assert(out);
+    pa_assert(args);
+    pa_assert(arg_name);
+
+    const char* str = pa_modargs_get_value(args, arg_name, "disable");
+
+    if (strcmp(str, "disable") == 0) {
+        *out = ROCPULSE_PACING_DISABLE;
+    } else if (strcmp(str, "timer") == 0) {
+        *out = ROCPULSE_PACING_TIMER;
+    } else if (strcmp(str, "txtime") == 0) {
+        *out = ROCPULSE_PACING_TXTIME;
+    } else {
+        pa_log("invalid %s: %s", arg_name, str);
+        return -1;
+    }
+
+    return 0;
+}
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+
+/* older libc and kernel headers don't have them */
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#define SCM_TXTIME SO_TXTIME
+
+struct sock_txtime {
+    clockid_t clockid;
+    uint32_t flags;
+};
+#endif
+
+/* scheduled send times of recently sent packets, to match them with kernel
+ * timestamps with txtime pacing
+ */
+#define TXTIME_HISTORY 256
+
+/* packets queued between two flushes; one tick usually produces a few */
+#define MAX_PACKETS 64
+
+/* default max_packet_size of roc context */
+#define PACKET_SIZE 2048
+
+/* feedback packets read during one flush */
+#define MAX_FEEDBACK_PACKETS 8
+
+/* primary and secondary path of redundant streaming */
+#define MAX_PATHS 2
+
+/* kernel limits for one GSO datagram */
+#define MAX_GSO_SEGMENTS 64
+#define MAX_GSO_BYTES 65000
+
+enum {
+    IFACE_SOURCE,
+    IFACE_REPAIR,
+    IFACE_CONTROL,
+    N_IFACES,
+};
+
+/* in order of popping packets from encoder */
+static const roc_interface ifaces[N_IFACES] = {
+    ROC_INTERFACE_AUDIO_SOURCE,
+    ROC_INTERFACE_AUDIO_REPAIR,
+    ROC_INTERFACE_AUDIO_CONTROL,
+};
+
+struct batch_packet {
+    int iface;
+    size_t size;
+    pa_usec_t send_time;
+    char bytes[PACKET_SIZE];
+};
+
+struct rocpulse_batch_sender {
+    roc_sender_encoder* encoder;
+
+    bool iface_active[N_IFACES];
+
+    /* with redundant streaming, every packet is sent over each path, to its
+     * own addresses and from its own socket
+     */
+    size_t n_paths;
+    rocpulse_address iface_addr[MAX_PATHS][N_IFACES];
+
+    /* one socket per path for all interfaces; receivers send feedback to the
+     * address from which control packets come
+     */
+    int fds[MAX_PATHS];
+    bool use_gso;
+
+    /* while set, packets of primary path are passed via shared memory instead
+     * of UDP; not owned
+     */
+    rocpulse_shm* shm;
+
+    rocpulse_pacing pacing;
+
+    /* packets before head are sent, packets before sched_end have send time */
+    struct batch_packet packets[MAX_PACKETS];
+    size_t head;
+    size_t sched_end;
+    size_t n_packets;
+
+    /* with txtime pacing, kernel reports when packets actually left primary
+     * socket; packets are identified by counter of sent datagrams
+     */
+    bool use_timestamps;
+    uint32_t next_tx_id;
+    int64_t tx_sched_time[TXTIME_HISTORY];
+
+    /* one message per packet, or per group of packets coalesced with GSO */
+    struct mmsghdr msgs[MAX_PACKETS];
+    struct iovec iovs[MAX_PACKETS];
+    size_t msg_first_packet[MAX_PACKETS];
+    union {
+        char buf[CMSG_SPACE(sizeof(uint64_t))];
+        struct cmsghdr align;
+    } msg_control[MAX_PACKETS];
+
+    struct mmsghdr feedback_msgs[MAX_FEEDBACK_PACKETS];
+    struct iovec feedback_iovs[MAX_FEEDBACK_PACKETS];
+    char feedback_bytes[MAX_FEEDBACK_PACKETS][PACKET_SIZE];
+
+    /* accumulated until next flush */
+    rocpulse_batch_stats stats;
+};
+
+/* let fq qdisc hold packets until time set in SCM_TXTIME, and ask kernel to
+ * report when packets actually leave
+ */
+static int enable_txtime(rocpulse_batch_sender* sender, size_t path) {
+    const int fd = sender->fds[path];
+
+    struct sock_txtime txtime;
+    memset(&txtime, 0, sizeof(txtime));
+    txtime.clockid = CLOCK_MONOTONIC;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+        pa_log("can't enable SO_TXTIME: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (path != 0) {
+        return 0;
+    }
+
+    int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+        | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        pa_log_info("can't enable SO_TIMESTAMPING: %s, pacing error won't be reported",
+                    pa_cstrerror(errno));
+    } else {
+        sender->use_timestamps = true;
+    }
+
+    return 0;
+}
+
+static int open_socket(rocpulse_batch_sender* sender,
+                       size_t path,
+                       const rocpulse_address* bind_addr) {
+    const rocpulse_address* addr = &sender->iface_addr[path][IFACE_SOURCE];
+
+    if ((sender->fds[path] = socket(addr->addr.ss_family,
+                                    SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0))
+        < 0) {
+        pa_log("can't create socket: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    /* choose network interface of secondary path */
+    if (bind_addr
+        && bind(sender->fds[path], (const struct sockaddr*)&bind_addr->addr,
+                bind_addr->addr_len)
+            < 0) {
+        pa_log("can't bind socket: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+rocpulse_batch_sender* rocpulse_batch_sender_new(roc_context* context,
+                                                 const roc_sender_config* config,
+                                                 rocpulse_pacing pacing,
+                                                 const rocpulse_address* source_addr,
+                                                 const rocpulse_address* repair_addr,
+                                                 const rocpulse_address* control_addr,
+                                                 const rocpulse_path* secondary) {
+    pa_assert(context);
+    pa_assert(config);
+    pa_assert(source_addr);
+    pa_assert(control_addr);
+
+    rocpulse_batch_sender* sender = pa_xnew0(rocpulse_batch_sender, 1);
+    sender->n_paths = secondary ? 2 : 1;
+    for (size_t p = 0; p < MAX_PATHS; p++) {
+        sender->fds[p] = -1;
+    }
+    sender->pacing = pacing;
+
+    const rocpulse_address* addrs[N_IFACES] = {
+        source_addr,
+        repair_addr,
+        control_addr,
+    };
+
+    if (roc_sender_encoder_open(context, config, &sender->encoder) < 0) {
+        pa_log("can't create roc sender encoder");
+        goto error;
+    }
+
+    for (int i = 0; i < N_IFACES; i++) {
+        if (!addrs[i]) {
+            continue;
+        }
+
+        roc_protocol proto = 0;
+        if (rocpulse_select_protocol(&proto, ifaces[i], config->fec_encoding) < 0) {
+            goto error;
+        }
+
+        if (roc_sender_encoder_activate(sender->encoder, ifaces[i], proto) != 0) {
+            pa_log("can't activate roc sender encoder interface");
+            goto error;
+        }
+
+        sender->iface_active[i] = true;
+        sender->iface_addr[0][i] = *addrs[i];
+    }
+
+    if (secondary) {
+        sender->iface_addr[1][IFACE_SOURCE] = secondary->source_addr;
+        sender->iface_addr[1][IFACE_REPAIR] = secondary->repair_addr;
+        sender->iface_addr[1][IFACE_CONTROL] = secondary->control_addr;
+    }
+
+    for (size_t p = 0; p < sender->n_paths; p++) {
+        const rocpulse_address* bind_addr
+            = p > 0 && secondary->has_bind_addr ? &secondary->bind_addr : NULL;
+
+        if (open_socket(sender, p, bind_addr) < 0) {
+            goto error;
+        }
+
+        if (pacing == ROCPULSE_PACING_TXTIME && enable_txtime(sender, p) < 0) {
+            goto error;
+        }
+    }
+
+    /* UDP_SEGMENT is known to kernel since 4.18; not used with txtime pacing,
+     * because GSO datagram would leave at time of its first segment
+     */
+    int gso_size = 0;
+    socklen_t gso_size_len = sizeof(gso_size);
+    sender->use_gso = pacing != ROCPULSE_PACING_TXTIME
+        && getsockopt(sender->fds[0], IPPROTO_UDP, UDP_SEGMENT, &gso_size, &gso_size_len)
+            == 0;
+
+    pa_log_debug("batch sender is ready, UDP GSO is %s, sending over %u path(s)",
+                 sender->use_gso ? "enabled" : "disabled", (unsigned)sender->n_paths);
+
+    for (int n = 0; n < MAX_FEEDBACK_PACKETS; n++) {
+        sender->feedback_iovs[n].iov_base = sender->feedback_bytes[n];
+        sender->feedback_iovs[n].iov_len = PACKET_SIZE;
+        sender->feedback_msgs[n].msg_hdr.msg_iov = &sender->feedback_iovs[n];
+        sender->feedback_msgs[n].msg_hdr.msg_iovlen = 1;
+    }
+
+    return sender;
+
+error:
+    rocpulse_batch_sender_free(sender);
+    return NULL;
+}
+
+void rocpulse_batch_sender_free(rocpulse_batch_sender* sender) {
+    pa_assert(sender);
+
+    for (size_t p = 0; p < MAX_PATHS; p++) {
+        if (sender->fds[p] >= 0) {
+            pa_close(sender->fds[p]);
+        }
+    }
+
+    if (sender->encoder) {
+        if (roc_sender_encoder_close(sender->encoder) != 0) {
+            pa_log("failed to close roc sender encoder");
+        }
+    }
+
+    pa_xfree(sender);
+}
+
+static void
+add_cmsg(struct msghdr* hdr, int level, int type, const void* data, size_t size) {
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(hdr);
+    cmsg->cmsg_level = level;
+    cmsg->cmsg_type = type;
+    cmsg->cmsg_len = CMSG_LEN(size);
+
+    memcpy(CMSG_DATA(cmsg), data, size);
+    hdr->msg_controllen = CMSG_SPACE(size);
+}
+
+/* fill messages for packets in range [first_packet; end_packet) sent over given
+ * path; returns number of messages
+ */
+static size_t build_messages(rocpulse_batch_sender* sender,
+                             size_t path,
+                             size_t first_packet,
+                             size_t end_packet) {
+    size_t n_msgs = 0;
+    size_t n = first_packet;
+
+    while (n < end_packet) {
+        const struct batch_packet* head = &sender->packets[n];
+
+        /* all segments of GSO datagram go to the same address, and all of them
+         * except the last one should have the same size
+         */
+        size_t n_segs = 1;
+        size_t total_size = head->size;
+
+        if (sender->use_gso) {
+            while (n + n_segs < end_packet && n_segs < MAX_GSO_SEGMENTS) {
+                const struct batch_packet* pkt = &sender->packets[n + n_segs];
+
+                if (pkt->iface != head->iface || pkt->size > head->size
+                    || total_size + pkt->size > MAX_GSO_BYTES) {
+                    break;
+                }
+
+                total_size += pkt->size;
+                n_segs++;
+
+                if (pkt->size < head->size) {
+                    break;
+                }
+            }
+        }
+
+        for (size_t k = 0; k < n_segs; k++) {
+            sender->iovs[n + k].iov_base = sender->packets[n + k].bytes;
+            sender->iovs[n + k].iov_len = sender->packets[n + k].size;
+        }
+
+        struct mmsghdr* msg = &sender->msgs[n_msgs];
+        memset(msg, 0, sizeof(*msg));
+
+        msg->msg_hdr.msg_name = &sender->iface_addr[path][head->iface].addr;
+        msg->msg_hdr.msg_namelen = sender->iface_addr[path][head->iface].addr_len;
+        msg->msg_hdr.msg_iov = &sender->iovs[n];
+        msg->msg_hdr.msg_iovlen = n_segs;
+
+        if (n_segs > 1) {
+            msg->msg_hdr.msg_control = sender->msg_control[n_msgs].buf;
+            msg->msg_hdr.msg_controllen = sizeof(sender->msg_control[n_msgs].buf);
+
+            uint16_t gso_size = (uint16_t)head->size;
+            add_cmsg(&msg->msg_hdr, IPPROTO_UDP, UDP_SEGMENT, &gso_size,
+                     sizeof(gso_size));
+        } else if (sender->pacing == ROCPULSE_PACING_TXTIME && head->send_time != 0) {
+            msg->msg_hdr.msg_control = sender->msg_control[n_msgs].buf;
+            msg->msg_hdr.msg_controllen = sizeof(sender->msg_control[n_msgs].buf);
+
+            uint64_t txtime = (uint64_t)head->send_time * 1000;
+            add_cmsg(&msg->msg_hdr, SOL_SOCKET, SCM_TXTIME, &txtime, sizeof(txtime));
+        }
+
+        sender->msg_first_packet[n_msgs] = n;
+        n_msgs++;
+        n += n_segs;
+    }
+
+    return n_msgs;
+}
+
+/* remember scheduled time of sent messages, kernel will report actual time */
+static void
+record_sent(rocpulse_batch_sender* sender, size_t first_msg, size_t n_msgs) {
+    if (!sender->use_timestamps) {
+        return;
+    }
+
+    for (size_t n = first_msg; n < first_msg + n_msgs; n++) {
+        const struct batch_packet* pkt = &sender->packets[sender->msg_first_packet[n]];
+
+        sender->tx_sched_time[sender->next_tx_id % TXTIME_HISTORY]
+            = (int64_t)pkt->send_time;
+        sender->next_tx_id++;
+    }
+}
+
+/* copy packets from head to given one to shared memory, and wake up receiver */
+static void send_shm(rocpulse_batch_sender* sender, size_t end_packet) {
+    for (size_t n = sender->head; n < end_packet; n++) {
+        const struct batch_packet* pkt = &sender->packets[n];
+
+        if (!rocpulse_shm_write(sender->shm, (unsigned int)pkt->iface, pkt->bytes,
+                                pkt->size)) {
+            sender->stats.n_dropped++;
+        }
+    }
+
+    if (rocpulse_shm_notify(sender->shm)) {
+        sender->stats.n_syscalls++;
+    }
+}
+
+/* send packets from head to given one over given path; dropped packets are
+ * counted once per path
+ */
+static void send_path(rocpulse_batch_sender* sender, size_t path, size_t end_packet) {
+    if (path == 0 && sender->shm) {
+        send_shm(sender, end_packet);
+        return;
+    }
+
+    size_t n_msgs = build_messages(sender, path, sender->head, end_packet);
+    size_t n_sent = 0;
+
+    while (n_sent < n_msgs) {
+        int ret = sendmmsg(sender->fds[path], &sender->msgs[n_sent],
+                           (unsigned int)(n_msgs - n_sent), 0);
+        sender->stats.n_syscalls++;
+
+        if (ret > 0) {
+            if (path == 0) {
+                record_sent(sender, n_sent, (size_t)ret);
+            }
+            n_sent += (size_t)ret;
+            continue;
+        }
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+
+        const size_t first_packet = sender->msg_first_packet[n_sent];
+
+        if (sender->use_gso && sender->msgs[n_sent].msg_hdr.msg_iovlen > 1
+            && (errno == EIO || errno == EINVAL)) {
+            /* network interface can't offload UDP checksums, resend packets
+             * starting from failed message one by one
+             */
+            pa_log_info("UDP GSO is not supported by network interface, disabling it");
+            sender->use_gso = false;
+            n_msgs = build_messages(sender, path, first_packet, end_packet);
+            n_sent = 0;
+            continue;
+        }
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+            /* socket buffer is full, drop everything left */
+            sender->stats.n_dropped += end_packet - first_packet;
+            break;
+        }
+
+        /* drop failed message, e.g. if destination is unreachable */
+        const size_t last_packet
+            = n_sent + 1 < n_msgs ? sender->msg_first_packet[n_sent + 1] : end_packet;
+
+        sender->stats.n_dropped += last_packet - first_packet;
+        n_sent++;
+    }
+}
+
+/* send packets before given one and remove them from queue */
+static void send_packets(rocpulse_batch_sender* sender, size_t end_packet) {
+    for (size_t p = 0; p < sender->n_paths; p++) {
+        send_path(sender, p, end_packet);
+    }
+
+    sender->stats.n_packets += end_packet - sender->head;
+    sender->head = end_packet;
+
+    if (sender->head == sender->n_packets) {
+        sender->head = sender->sched_end = sender->n_packets = 0;
+    }
+}
+
+/* move unsent packets to the beginning of queue */
+static void compact_packets(rocpulse_batch_sender* sender) {
+    memmove(&sender->packets[0], &sender->packets[sender->head],
+            (sender->n_packets - sender->head) * sizeof(struct batch_packet));
+
+    sender->n_packets -= sender->head;
+    sender->sched_end -= sender->head;
+    sender->head = 0;
+}
+
+/* spread packets queued since previous flush evenly over interval */
+static void schedule_packets(rocpulse_batch_sender* sender,
+                             pa_usec_t now,
+                             pa_usec_t interval) {
+    const size_t n_new = sender->n_packets - sender->sched_end;
+
+    for (size_t n = 0; n < n_new; n++) {
+        sender->packets[sender->sched_end + n].send_time
+            = now + interval * n / n_new;
+    }
+
+    sender->sched_end = sender->n_packets;
+}
+
+static void add_pacing_error(rocpulse_batch_sender* sender, int64_t error) {
+    const pa_usec_t abs_error = (pa_usec_t)(error >= 0 ? error : -error);
+
+    sender->stats.n_paced++;
+    sender->stats.max_pacing_error = PA_MAX(sender->stats.max_pacing_error, abs_error);
+}
+
+/* read kernel timestamps of packets that left, and compare them with scheduled
+ * send times
+ */
+static void receive_timestamps(rocpulse_batch_sender* sender) {
+    /* timestamps are reported in CLOCK_REALTIME */
+    struct timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+
+    const int64_t clock_offset
+        = (int64_t)realtime.tv_sec * 1000000 + realtime.tv_nsec / 1000
+        - (int64_t)pa_rtclock_now();
+
+    for (;;) {
+        union {
+            char buf[256];
+            struct cmsghdr align;
+        } control;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        if (recvmsg(sender->fds[0], &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        sender->stats.n_syscalls++;
+
+        bool has_tss = false;
+        bool has_serr = false;
+        struct scm_timestamping tss;
+        struct sock_extended_err serr;
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+             cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+                has_tss = true;
+            } else if ((cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR)
+                       || (cmsg->cmsg_level == IPPROTO_IPV6
+                           && cmsg->cmsg_type == IPV6_RECVERR)) {
+                memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+                has_serr = true;
+            }
+        }
+
+        if (!has_tss || !has_serr || serr.ee_origin != SO_EE_ORIGIN_TIMESTAMPING) {
+            continue;
+        }
+
+        /* too old, its slot is already reused */
+        if (sender->next_tx_id - serr.ee_data > TXTIME_HISTORY) {
+            continue;
+        }
+
+        const int64_t sched_time = sender->tx_sched_time[serr.ee_data % TXTIME_HISTORY];
+        if (sched_time == 0) {
+            continue;
+        }
+
+        const int64_t sent_time = (int64_t)tss.ts[0].tv_sec * 1000000
+            + tss.ts[0].tv_nsec / 1000 - clock_offset;
+
+        add_pacing_error(sender, sent_time - sched_time);
+    }
+}
+
+/* with redundant streaming, receiver sends feedback over path of which it
+ * has seen control packets last, so both sockets are read
+ */
+static void receive_feedback(rocpulse_batch_sender* sender) {
+    if (sender->shm) {
+        roc_packet packet;
+        unsigned int tag = 0;
+
+        while ((packet.bytes_size = rocpulse_shm_read(sender->shm, &tag,
+                                                      sender->feedback_bytes[0],
+                                                      PACKET_SIZE))
+               > 0) {
+            packet.bytes = sender->feedback_bytes[0];
+
+            (void)roc_sender_encoder_push_feedback_packet(
+                sender->encoder, ROC_INTERFACE_AUDIO_CONTROL, &packet);
+        }
+    }
+
+    for (size_t p = 0; p < sender->n_paths; p++) {
+        int ret = recvmmsg(sender->fds[p], sender->feedback_msgs, MAX_FEEDBACK_PACKETS,
+                           0, NULL);
+        sender->stats.n_syscalls++;
+
+        for (int n = 0; n < ret; n++) {
+            roc_packet packet;
+            packet.bytes = sender->feedback_bytes[n];
+            packet.bytes_size = sender->feedback_msgs[n].msg_len;
+
+            /* malformed packets are just ignored by roc */
+            (void)roc_sender_encoder_push_feedback_packet(
+                sender->encoder, ROC_INTERFACE_AUDIO_CONTROL, &packet);
+        }
+    }
+}
+
+int rocpulse_batch_sender_write(rocpulse_batch_sender* sender, const roc_frame* frame) {
+    pa_assert(sender);
+    pa_assert(frame);
+
+    if (roc_sender_encoder_push_frame(sender->encoder, frame) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < N_IFACES; i++) {
+        if (!sender->iface_active[i]) {
+            continue;
+        }
+
+        for (;;) {
+            /* more packets than fit into queue, e.g. after a long stall */
+            if (sender->n_packets == MAX_PACKETS) {
+                if (sender->head > 0) {
+                    compact_packets(sender);
+                } else {
+                    send_packets(sender, sender->n_packets);
+                }
+            }
+
+            struct batch_packet* pkt = &sender->packets[sender->n_packets];
+
+            roc_packet packet;
+            packet.bytes = pkt->bytes;
+            packet.bytes_size = sizeof(pkt->bytes);
+
+            if (roc_sender_encoder_pop_packet(sender->encoder, ifaces[i], &packet) != 0) {
+                /* no more packets */
+                break;
+            }
+
+            pkt->iface = i;
+            pkt->size = packet.bytes_size;
+            pkt->send_time = 0;
+            sender->n_packets++;
+        }
+    }
+
+    return 0;
+}
+
+void rocpulse_batch_sender_set_shm(rocpulse_batch_sender* sender, rocpulse_shm* shm) {
+    pa_assert(sender);
+
+    sender->shm = shm;
+}
+
+int rocpulse_batch_sender_flush(rocpulse_batch_sender* sender,
+                                pa_usec_t interval,
+                                rocpulse_batch_stats* stats) {
+    pa_assert(sender);
+
+    const pa_usec_t now = pa_rtclock_now();
+
+    receive_feedback(sender);
+
+    if (sender->pacing != ROCPULSE_PACING_DISABLE) {
+        schedule_packets(sender, now, interval);
+    }
+
+    size_t end_packet = sender->n_packets;
+
+    if (sender->pacing == ROCPULSE_PACING_TIMER) {
+        /* send packets which time has come, the rest waits for next flush */
+        end_packet = sender->head;
+
+        while (end_packet < sender->n_packets
+               && sender->packets[end_packet].send_time <= now) {
+            const pa_usec_t send_time = sender->packets[end_packet].send_time;
+
+            add_pacing_error(sender, (int64_t)(now - send_time));
+            end_packet++;
+        }
+    }
+
+    if (end_packet > sender->head) {
+        send_packets(sender, end_packet);
+    }
+
+    if (sender->use_timestamps) {
+        receive_timestamps(sender);
+    }
+
+    if (stats) {
+        *stats = sender->stats;
+    }
+    memset(&sender->stats, 0, sizeof(sender->stats));
+
+    return 0;
+}
+
+pa_usec_t rocpulse_batch_sender_next_send_time(rocpulse_batch_sender* sender) {
+    pa_assert(sender);
+
+    if (sender->pacing != ROCPULSE_PACING_TIMER || sender->head == sender->n_packets) {
+        return 0;
+    }
+
+    return sender->packets[sender->head].send_time;
+}
+
+int rocpulse_batch_sender_query(rocpulse_batch_sender* sender, rocpulse_metrics* out) {
+    pa_assert(sender);
+    pa_assert(out);
+
+    memset(out, 0, sizeof(*out));
+    out->timestamp = pa_rtclock_now();
+
+    roc_sender_metrics sender_metrics;
+    memset(&sender_metrics, 0, sizeof(sender_metrics));
+
+    /* encoder has at most one connection, to the receiver */
+    if (roc_sender_encoder_query(sender->encoder, &sender_metrics, &out->connections[0])
+        != 0) {
+        return -1;
+    }
+
+    out->connection_count = sender_metrics.connection_count;
+    out->n_connections = sender_metrics.connection_count > 0 ? 1 : 0;
+
+    return 0;
+}
+
+#else // ROC_VERSION < ROC_VERSION_CODE(0, 4, 0)
+
+rocpulse_batch_sender* rocpulse_batch_sender_new(roc_context* context,
+                                                 const roc_sender_config* config,
+                                                 rocpulse_pacing pacing,
+                                                 const rocpulse_address* source_addr,
+                                                 const rocpulse_address* repair_addr,
+                                                 const rocpulse_address* control_addr,
+                                                 const rocpulse_path* secondary) {
+    (void)context;
+    (void)config;
+    (void)pacing;
+    (void)source_addr;
+    (void)repair_addr;
+    (void)control_addr;
+    (void)secondary;
+
+    pa_log("batch sender requires Roc Toolkit 0.4 or later");
+    return NULL;
+}
+
+void rocpulse_batch_sender_free(rocpulse_batch_sender* sender) {
+    (void)sender;
+}
+
+void rocpulse_batch_sender_set_shm(rocpulse_batch_sender* sender, rocpulse_shm* shm) {
+    (void)sender;
+    (void)shm;
+}
+
+int rocpulse_batch_sender_write(rocpulse_batch_sender* sender, const roc_frame* frame) {
+    (void)sender;
+    (void)frame;
+
+    return -1;
+}
+
+int rocpulse_batch_sender_flush(rocpulse_batch_sender* sender,
+                                pa_usec_t interval,
+                                rocpulse_batch_stats* stats) {
+    (void)sender;
+    (void)interval;
+    (void)stats;
+
+    return -1;
+}
+
+pa_usec_t rocpulse_batch_sender_next_send_time(rocpulse_batch_sender* sender) {
+    (void)sender;
+
+    return 0;
+}
+
+int rocpulse_batch_sender_query(rocpulse_batch_sender* sender, rocpulse_metrics* out) {
+    (void)sender;
+    (void)out;
+
+    return -1;
+}
+
+#endif // ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
@@ -0,0 +1,126 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <stddef.h>
+
+/* public pulseaudio headers */
+#include <pulse/sample.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/modargs.h>
+
+/* roc headers */
+#include <roc/config.h>
+#include <roc/context.h>
+#include <roc/frame.h>
+
+/* local headers */
+#include "rocpulse_helpers.h"
+#include "rocpulse_metrics.h"
+#include "rocpulse_shm.h"
+
+/* how packets queued during a tick are spread over the tick */
+typedef enum rocpulse_pacing {
+    /* send all packets at once */
+    ROCPULSE_PACING_DISABLE,
+
+    /* send every packet at its time, woken up by sink thread timer */
+    ROCPULSE_PACING_TIMER,
+
+    /* send all packets at once, with SO_TXTIME timestamps, and let fq qdisc
+     * hold every packet until its time
+     */
+    ROCPULSE_PACING_TXTIME,
+} rocpulse_pacing;
+
+int rocpulse_parse_pacing(rocpulse_pacing* out, pa_modargs* args, const char* arg_name);
+
+/* what happened during one flush */
+typedef struct rocpulse_batch_stats {
+    size_t n_packets;
+    size_t n_syscalls;
+    size_t n_dropped;
+
+    /* with pacing, how many packets have known send time, and the largest
+     * deviation of send time from scheduled time among them
+     */
+    size_t n_paced;
+    pa_usec_t max_pacing_error;
+} rocpulse_batch_stats;
+
+/* roc sender that transmits packets itself, in batches
+ *
+ * roc_sender sends every packet from roc network thread with a separate
+ * syscall; instead, batch sender passes frames to roc encoder and queues
+ * packets produced by it, and flush sends all queued packets with a single
+ * sendmmsg(); when kernel supports UDP GSO, consecutive packets of the same
+ * interface are also coalesced into one datagram which is split by kernel
+ *
+ * feedback (RTCP) packets from receivers are read from the same socket during
+ * flush and passed back to encoder
+ *
+ * with secondary path, every packet is also sent to addresses of that path
+ * from a second socket, so that receiver can use whichever copy comes first
+ *
+ * with shared memory channel to receiver on the same host, packets of primary
+ * path are copied to its ring instead of being sent; channel is connected and
+ * replaced by owner of sender, outside of sink thread, and UDP is used while
+ * there is none
+ *
+ * with pacing, packets queued since previous flush are scheduled evenly over
+ * the given interval instead of being sent back to back; with timer pacing,
+ * flush sends only packets which time has come, and should be called again at
+ * next send time
+ *
+ * write and flush should be called from one thread (sink thread); query may
+ * be called concurrently from main loop; requires Roc Toolkit 0.4 or later
+ */
+typedef struct rocpulse_batch_sender rocpulse_batch_sender;
+
+/* returns NULL on error; repair address should be NULL if FEC is disabled;
+ * secondary path is optional; context should use default max_packet_size
+ */
+rocpulse_batch_sender* rocpulse_batch_sender_new(roc_context* context,
+                                                 const roc_sender_config* config,
+                                                 rocpulse_pacing pacing,
+                                                 const rocpulse_address* source_addr,
+                                                 const rocpulse_address* repair_addr,
+                                                 const rocpulse_address* control_addr,
+                                                 const rocpulse_path* secondary);
+
+void rocpulse_batch_sender_free(rocpulse_batch_sender* sender);
+
+/* use shared memory channel instead of UDP for primary path, or UDP again if
+ * it's NULL; should be called from the thread that calls flush; channel is not
+ * owned by sender
+ */
+void rocpulse_batch_sender_set_shm(rocpulse_batch_sender* sender, rocpulse_shm* shm);
+
+/* encode frame and queue produced packets; may flush if queue is full */
+int rocpulse_batch_sender_write(rocpulse_batch_sender* sender, const roc_frame* frame);
+
+/* send queued packets and process incoming feedback; packets that can't be
+ * sent because of full socket buffer are dropped, as roc does, and are counted
+ * for every path separately; interval is used only with pacing
+ */
+int rocpulse_batch_sender_flush(rocpulse_batch_sender* sender,
+                                pa_usec_t interval,
+                                rocpulse_batch_stats* stats);
+
+/* with timer pacing, when flush should be called next time; zero if there
+ * are no queued packets
+ */
+pa_usec_t rocpulse_batch_sender_next_send_time(rocpulse_batch_sender* sender);
+
+int rocpulse_batch_sender_query(rocpulse_batch_sender* sender, rocpulse_metrics* out);
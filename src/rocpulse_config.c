@@ -0,0 +1,235 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <string.h>
+
+/* public pulseaudio headers */
+#include <pulse/def.h>
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/log.h>
+#include <pulsecore/strbuf.h>
+#if PA_CHECK_VERSION(14, 99, 0)
+#include <pulsecore/json.h>
+#include <pulsecore/message-handler.h>
+#endif
+
+/* local headers */
+#include "rocpulse_config.h"
+
+struct rocpulse_config {
+    pa_core* core;
+    char* object_path;
+
+    const char* const* valid_keys;
+    const char* const* runtime_keys;
+
+    rocpulse_config_apply_cb apply_cb;
+    void* userdata;
+
+    pa_modargs* args;
+};
+
+static void append_escaped(pa_strbuf* buf, const char* str, const char* special) {
+    for (; *str; str++) {
+        if (strchr(special, *str)) {
+            pa_strbuf_putc(buf, '\\');
+        }
+        pa_strbuf_putc(buf, *str);
+    }
+}
+
+/* format arguments in load-module syntax, taking every value from overrides
+ * if it's present there, and from current arguments otherwise
+ */
+static char* merge_args(rocpulse_config* config, pa_modargs* overrides) {
+    pa_strbuf* buf = pa_strbuf_new();
+
+    for (size_t n = 0; config->valid_keys[n]; n++) {
+        const char* key = config->valid_keys[n];
+
+        const char* value = pa_modargs_get_value(overrides, key, NULL);
+        if (!value) {
+            value = pa_modargs_get_value(config->args, key, NULL);
+        }
+        if (!value) {
+            continue;
+        }
+
+        pa_strbuf_printf(buf, "%s=\"", key);
+        append_escaped(buf, value, "\"\\");
+        pa_strbuf_puts(buf, "\" ");
+    }
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+int rocpulse_config_update(rocpulse_config* config, const char* argument) {
+    pa_assert(config);
+
+    pa_modargs* overrides = NULL;
+    pa_modargs* new_args = NULL;
+    char* merged = NULL;
+    int ret = -1;
+
+    if (!(overrides = pa_modargs_new(argument, config->runtime_keys))) {
+        pa_log("can't update configuration: invalid arguments or arguments that can't "
+               "be changed at runtime: %s",
+               argument);
+        goto out;
+    }
+
+    merged = merge_args(config, overrides);
+
+    if (!(new_args = pa_modargs_new(merged, config->valid_keys))) {
+        pa_log("can't update configuration: failed to parse merged arguments");
+        goto out;
+    }
+
+    if (config->apply_cb(config->userdata, new_args, config->args) < 0) {
+        pa_log("can't update configuration: failed to apply arguments: %s", argument);
+        goto out;
+    }
+
+    pa_log_info("updated configuration: %s", argument);
+
+    pa_modargs_free(config->args);
+    config->args = new_args;
+    new_args = NULL;
+
+    ret = 0;
+
+out:
+    if (new_args) {
+        pa_modargs_free(new_args);
+    }
+    if (overrides) {
+        pa_modargs_free(overrides);
+    }
+    pa_xfree(merged);
+
+    return ret;
+}
+
+const char* rocpulse_config_get(rocpulse_config* config, const char* key) {
+    pa_assert(config);
+    pa_assert(key);
+
+    return pa_modargs_get_value(config->args, key, NULL);
+}
+
+#if PA_CHECK_VERSION(14, 99, 0)
+static char* format_json(rocpulse_config* config) {
+    pa_strbuf* buf = pa_strbuf_new();
+    const char* sep = "";
+
+    pa_strbuf_puts(buf, "{");
+
+    for (size_t n = 0; config->valid_keys[n]; n++) {
+        const char* key = config->valid_keys[n];
+        const char* value = pa_modargs_get_value(config->args, key, NULL);
+        if (!value) {
+            continue;
+        }
+
+        pa_strbuf_printf(buf, "%s\"%s\":\"", sep, key);
+        append_escaped(buf, value, "\"\\");
+        pa_strbuf_puts(buf, "\"");
+
+        sep = ",";
+    }
+
+    pa_strbuf_puts(buf, "}");
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+static int message_cb(const char* object_path,
+                      const char* message,
+                      const pa_json_object* parameters,
+                      char** response,
+                      void* userdata) {
+    (void)object_path;
+
+    rocpulse_config* config = userdata;
+    pa_assert(config);
+
+    if (strcmp(message, "get-config") == 0) {
+        *response = format_json(config);
+        return PA_OK;
+    }
+
+    if (strcmp(message, "set-config") == 0) {
+        /* parameter is a string with arguments in load-module syntax */
+        if (!parameters || pa_json_object_get_type(parameters) != PA_JSON_TYPE_STRING) {
+            return -PA_ERR_INVALID;
+        }
+
+        if (rocpulse_config_update(config, pa_json_object_get_string(parameters)) < 0) {
+            return -PA_ERR_INVALID;
+        }
+
+        return PA_OK;
+    }
+
+    return -PA_ERR_NOTIMPLEMENTED;
+}
+#endif // PA_CHECK_VERSION(14, 99, 0)
+
+rocpulse_config* rocpulse_config_new(pa_core* core,
+                                     const char* object_path,
+                                     const char* argument,
+                                     const char* const valid_keys[],
+                                     const char* const runtime_keys[],
+                                     rocpulse_config_apply_cb apply_cb,
+                                     void* userdata) {
+    pa_assert(core);
+    pa_assert(object_path);
+    pa_assert(valid_keys);
+    pa_assert(runtime_keys);
+    pa_assert(apply_cb);
+
+    pa_modargs* args = pa_modargs_new(argument, valid_keys);
+    if (!args) {
+        return NULL;
+    }
+
+    rocpulse_config* config = pa_xnew0(rocpulse_config, 1);
+
+    config->core = core;
+    config->object_path = pa_xstrdup(object_path);
+    config->valid_keys = valid_keys;
+    config->runtime_keys = runtime_keys;
+    config->apply_cb = apply_cb;
+    config->userdata = userdata;
+    config->args = args;
+
+#if PA_CHECK_VERSION(14, 99, 0)
+    pa_message_handler_register(core, config->object_path, "Roc configuration",
+                                message_cb, config);
+#endif
+
+    return config;
+}
+
+void rocpulse_config_free(rocpulse_config* config) {
+    pa_assert(config);
+
+#if PA_CHECK_VERSION(14, 99, 0)
+    pa_message_handler_unregister(config->core, config->object_path);
+#endif
+
+    pa_modargs_free(config->args);
+    pa_xfree(config->object_path);
+    pa_xfree(config);
+}
@@ -0,0 +1,51 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core.h>
+#include <pulsecore/modargs.h>
+
+/* invoked when some module arguments are changed at runtime; should either
+ * apply new arguments and return 0, or keep old arguments and return -1
+ */
+typedef int (*rocpulse_config_apply_cb)(void* userdata,
+                                        pa_modargs* new_args,
+                                        pa_modargs* old_args);
+
+/* keeps current module arguments and allows to change some of them at runtime
+ *
+ * arguments are changed by rocpulse_config_update(), or by "set-config"
+ * message sent to given object path; current arguments are returned as JSON
+ * by "get-config" message
+ */
+typedef struct rocpulse_config rocpulse_config;
+
+/* returns NULL if argument can't be parsed */
+rocpulse_config* rocpulse_config_new(pa_core* core,
+                                     const char* object_path,
+                                     const char* argument,
+                                     const char* const valid_keys[],
+                                     const char* const runtime_keys[],
+                                     rocpulse_config_apply_cb apply_cb,
+                                     void* userdata);
+
+void rocpulse_config_free(rocpulse_config* config);
+
+/* get current value of argument */
+const char* rocpulse_config_get(rocpulse_config* config, const char* key);
+
+/* change given arguments, which should be a subset of runtime keys, and leave
+ * other arguments unchanged; returns -1 if arguments are invalid or can't be
+ * applied
+ */
+int rocpulse_config_update(rocpulse_config* config, const char* argument);
@@ -0,0 +1,190 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/* private pulseaudio headers */
+#include <pulsecore/macro.h>
+
+/* local headers */
+#include "rocpulse_convert.h"
+
+/* integer samples are mapped to [-1; 1) range, like in pulseaudio and roc */
+#define S16_SCALE 32768.0f
+#define S32_SCALE 2147483648.0f
+
+/* largest float that fits into int32 after rounding */
+#define S32_MAX_FLOAT 2147483520.0f
+
+bool rocpulse_convert_is_native(pa_sample_format_t format) {
+    return format == PA_SAMPLE_FLOAT32NE;
+}
+
+bool rocpulse_convert_is_supported(pa_sample_format_t format) {
+    switch (format) {
+    case PA_SAMPLE_FLOAT32NE:
+    case PA_SAMPLE_S16NE:
+    case PA_SAMPLE_S32NE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void s16_to_float(float* dst, const int16_t* src, size_t n_samples) {
+    size_t n = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / S16_SCALE);
+
+    for (; n + 8 <= n_samples; n += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + n));
+
+        /* sign-extend 16-bit samples to 32-bit */
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+
+        _mm_storeu_ps(dst + n, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(dst + n + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#endif
+
+    for (; n < n_samples; n++) {
+        dst[n] = (float)src[n] * (1.0f / S16_SCALE);
+    }
+}
+
+static void float_to_s16(int16_t* dst, const float* src, size_t n_samples) {
+    size_t n = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(S16_SCALE);
+    const __m128 min_val = _mm_set1_ps(-S16_SCALE);
+    const __m128 max_val = _mm_set1_ps(S16_SCALE - 1.0f);
+
+    for (; n + 8 <= n_samples; n += 8) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(src + n), scale);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(src + n + 4), scale);
+
+        /* cvtps_epi32 returns INT_MIN on overflow and NaN, which pack would
+         * saturate to -32768, so zero NaN and clamp before converting
+         */
+        a = _mm_and_ps(a, _mm_cmpord_ps(a, a));
+        b = _mm_and_ps(b, _mm_cmpord_ps(b, b));
+
+        a = _mm_min_ps(_mm_max_ps(a, min_val), max_val);
+        b = _mm_min_ps(_mm_max_ps(b, min_val), max_val);
+
+        /* round to nearest and pack */
+        __m128i v = _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b));
+
+        _mm_storeu_si128((__m128i*)(dst + n), v);
+    }
+#endif
+
+    for (; n < n_samples; n++) {
+        float v = PA_CLAMP(src[n] * S16_SCALE, -S16_SCALE, S16_SCALE - 1.0f);
+        dst[n] = (int16_t)lrintf(v);
+    }
+}
+
+static void s32_to_float(float* dst, const int32_t* src, size_t n_samples) {
+    size_t n = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / S32_SCALE);
+
+    for (; n + 4 <= n_samples; n += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + n));
+
+        _mm_storeu_ps(dst + n, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+    }
+#endif
+
+    for (; n < n_samples; n++) {
+        dst[n] = (float)src[n] * (1.0f / S32_SCALE);
+    }
+}
+
+static void float_to_s32(int32_t* dst, const float* src, size_t n_samples) {
+    size_t n = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(S32_SCALE);
+    const __m128 min_val = _mm_set1_ps(-S32_SCALE);
+    const __m128 max_val = _mm_set1_ps(S32_MAX_FLOAT);
+
+    for (; n + 4 <= n_samples; n += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(src + n), scale);
+
+        /* cvtps_epi32 doesn't saturate, so clamp before converting */
+        v = _mm_min_ps(_mm_max_ps(v, min_val), max_val);
+
+        _mm_storeu_si128((__m128i*)(dst + n), _mm_cvtps_epi32(v));
+    }
+#endif
+
+    for (; n < n_samples; n++) {
+        float v = PA_CLAMP(src[n] * S32_SCALE, -S32_SCALE, S32_MAX_FLOAT);
+        dst[n] = (int32_t)lrintf(v);
+    }
+}
+
+void rocpulse_convert_to_float(float* dst,
+                               const void* src,
+                               pa_sample_format_t src_format,
+                               size_t n_samples) {
+    switch (src_format) {
+    case PA_SAMPLE_FLOAT32NE:
+        memcpy(dst, src, n_samples * sizeof(float));
+        return;
+
+    case PA_SAMPLE_S16NE:
+        s16_to_float(dst, src, n_samples);
+        return;
+
+    case PA_SAMPLE_S32NE:
+        s32_to_float(dst, src, n_samples);
+        return;
+
+    default:
+        pa_assert_not_reached();
+    }
+}
+
+void rocpulse_convert_from_float(void* dst,
+                                 pa_sample_format_t dst_format,
+                                 const float* src,
+                                 size_t n_samples) {
+    switch (dst_format) {
+    case PA_SAMPLE_FLOAT32NE:
+        memcpy(dst, src, n_samples * sizeof(float));
+        return;
+
+    case PA_SAMPLE_S16NE:
+        float_to_s16(dst, src, n_samples);
+        return;
+
+    case PA_SAMPLE_S32NE:
+        float_to_s32(dst, src, n_samples);
+        return;
+
+    default:
+        pa_assert_not_reached();
+    }
+}
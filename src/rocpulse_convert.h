@@ -0,0 +1,44 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* public pulseaudio headers */
+#include <pulse/sample.h>
+
+/* system headers */
+#include <stdbool.h>
+#include <stddef.h>
+
+/* maximum number of samples converted at once; modules allocate a float buffer
+ * of this size and pass audio to roc in pieces that fit into it
+ */
+#define ROCPULSE_CONVERT_BUFFER_SAMPLES 4096
+
+/* check whether roc can read and write samples of given format directly,
+ * without conversion
+ */
+bool rocpulse_convert_is_native(pa_sample_format_t format);
+
+/* check whether conversion between given format and roc frames is supported */
+bool rocpulse_convert_is_supported(pa_sample_format_t format);
+
+/* convert n_samples samples from given format to floats */
+void rocpulse_convert_to_float(float* dst,
+                               const void* src,
+                               pa_sample_format_t src_format,
+                               size_t n_samples);
+
+/* convert n_samples floats to given format */
+void rocpulse_convert_from_float(void* dst,
+                                 pa_sample_format_t dst_format,
+                                 const float* src,
+                                 size_t n_samples);
@@ -0,0 +1,177 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <string.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/macro.h>
+
+/* local headers */
+#include "rocpulse_dedup.h"
+
+/* fixed part of RTP header */
+#define RTP_HEADER_SIZE 12
+#define RTP_VERSION 2
+
+void rocpulse_dedup_init(rocpulse_dedup* dedup) {
+    pa_assert(dedup);
+
+    memset(dedup, 0, sizeof(*dedup));
+
+    /* extended sequence numbers may go slightly below zero */
+    for (size_t n = 0; n < ROCPULSE_DEDUP_WINDOW; n++) {
+        dedup->window[n].seqnum = INT64_MIN;
+    }
+}
+
+bool rocpulse_dedup_parse_rtp(const void* bytes,
+                              size_t size,
+                              uint16_t* seqnum,
+                              uint32_t* ssrc) {
+    pa_assert(bytes);
+
+    const uint8_t* hdr = bytes;
+
+    if (size < RTP_HEADER_SIZE || (hdr[0] >> 6) != RTP_VERSION) {
+        return false;
+    }
+
+    *seqnum = (uint16_t)(hdr[2] << 8 | hdr[3]);
+    *ssrc = (uint32_t)hdr[8] << 24 | (uint32_t)hdr[9] << 16 | (uint32_t)hdr[10] << 8
+        | (uint32_t)hdr[11];
+
+    return true;
+}
+
+bool rocpulse_dedup_add_source(rocpulse_dedup* dedup,
+                               unsigned int path,
+                               uint16_t seqnum,
+                               pa_usec_t now) {
+    pa_assert(dedup);
+    pa_assert(path < ROCPULSE_METRICS_MAX_PATHS);
+
+    rocpulse_dedup_stats* stats = &dedup->stats;
+
+    if (!dedup->started) {
+        dedup->started = true;
+        dedup->first_seqnum = dedup->last_seqnum = seqnum;
+    }
+
+    /* extend sequence number, assuming it's close to the last one */
+    const int64_t ext_seqnum = dedup->last_seqnum
+        + (int16_t)(uint16_t)(seqnum - (uint16_t)dedup->last_seqnum);
+
+    /* too late to tell whether it's a copy */
+    if (ext_seqnum <= dedup->last_seqnum - ROCPULSE_DEDUP_WINDOW) {
+        return false;
+    }
+
+    dedup->first_seqnum = PA_MIN(dedup->first_seqnum, ext_seqnum);
+    dedup->last_seqnum = PA_MAX(dedup->last_seqnum, ext_seqnum);
+
+    stats->expected = (uint64_t)(dedup->last_seqnum - dedup->first_seqnum + 1);
+
+    struct rocpulse_dedup_slot* slot
+        = &dedup->window[(ext_seqnum % ROCPULSE_DEDUP_WINDOW + ROCPULSE_DEDUP_WINDOW)
+                         % ROCPULSE_DEDUP_WINDOW];
+
+    if (slot->seqnum != ext_seqnum) {
+        slot->seqnum = ext_seqnum;
+        slot->first_time = now;
+        slot->first_path = (uint8_t)path;
+        slot->path_mask = (uint8_t)(1 << path);
+
+        stats->received[path]++;
+        stats->first[path]++;
+
+        return true;
+    }
+
+    /* duplicated by network on the same path */
+    if (slot->path_mask & (1 << path)) {
+        return false;
+    }
+
+    slot->path_mask |= (uint8_t)(1 << path);
+    stats->received[path]++;
+
+    const int64_t delay = (int64_t)(now - slot->first_time);
+    const int64_t skew = path > slot->first_path ? delay : -delay;
+
+    stats->skew_sum += skew;
+    stats->skew_count++;
+    stats->max_skew = PA_MAX(stats->max_skew, (pa_usec_t)delay);
+
+    return false;
+}
+
+bool rocpulse_dedup_add_other(rocpulse_dedup* dedup, const void* bytes, size_t size) {
+    pa_assert(dedup);
+    pa_assert(bytes);
+
+    /* FNV-1a */
+    const uint8_t* data = bytes;
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t n = 0; n < size; n++) {
+        hash ^= data[n];
+        hash *= 1099511628211ULL;
+    }
+
+    for (size_t n = 0; n < ROCPULSE_DEDUP_HASHES; n++) {
+        if (dedup->hashes[n] == hash) {
+            return false;
+        }
+    }
+
+    dedup->hashes[dedup->next_hash] = hash;
+    dedup->next_hash = (dedup->next_hash + 1) % ROCPULSE_DEDUP_HASHES;
+
+    return true;
+}
+
+void rocpulse_dedup_stats_add(rocpulse_dedup_stats* total,
+                              const rocpulse_dedup_stats* stats) {
+    pa_assert(total);
+    pa_assert(stats);
+
+    total->expected += stats->expected;
+
+    for (size_t p = 0; p < ROCPULSE_METRICS_MAX_PATHS; p++) {
+        total->received[p] += stats->received[p];
+        total->first[p] += stats->first[p];
+    }
+
+    total->skew_sum += stats->skew_sum;
+    total->skew_count += stats->skew_count;
+    total->max_skew = PA_MAX(total->max_skew, stats->max_skew);
+}
+
+void rocpulse_dedup_stats_report(const rocpulse_dedup_stats* stats,
+                                 rocpulse_path_metrics* paths) {
+    pa_assert(stats);
+    pa_assert(paths);
+
+    memset(paths, 0, sizeof(rocpulse_path_metrics) * ROCPULSE_METRICS_MAX_PATHS);
+
+    for (size_t p = 0; p < ROCPULSE_METRICS_MAX_PATHS; p++) {
+        paths[p].expected_packets = stats->expected;
+        paths[p].received_packets = stats->received[p];
+        paths[p].first_packets = stats->first[p];
+    }
+
+    /* skew is relative to primary path */
+    if (stats->skew_count > 0) {
+        paths[1].mean_skew = stats->skew_sum / (int64_t)stats->skew_count;
+        paths[1].max_skew = stats->max_skew;
+    }
+}
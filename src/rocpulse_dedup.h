@@ -0,0 +1,94 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* public pulseaudio headers */
+#include <pulse/sample.h>
+
+/* local headers */
+#include "rocpulse_metrics.h"
+
+/* recent source packets remembered to detect copies that came later */
+#define ROCPULSE_DEDUP_WINDOW 512
+
+/* recent repair and control packets remembered by hash */
+#define ROCPULSE_DEDUP_HASHES 64
+
+/* statistics of one or several senders; can be summed */
+typedef struct rocpulse_dedup_stats {
+    uint64_t expected;
+    uint64_t received[ROCPULSE_METRICS_MAX_PATHS];
+    uint64_t first[ROCPULSE_METRICS_MAX_PATHS];
+
+    /* arrival time over secondary path minus arrival time over primary path */
+    int64_t skew_sum;
+    uint64_t skew_count;
+    pa_usec_t max_skew;
+} rocpulse_dedup_stats;
+
+struct rocpulse_dedup_slot {
+    int64_t seqnum;
+    pa_usec_t first_time;
+    uint8_t first_path;
+    uint8_t path_mask;
+};
+
+/* drops copies of packets of one sender received over several paths, and
+ * collects per-path statistics
+ *
+ * source packets are RTP and are identified by sequence number; repair and
+ * control packets have no common header, and are identified by hash of their
+ * contents
+ */
+typedef struct rocpulse_dedup {
+    bool started;
+    int64_t first_seqnum;
+    int64_t last_seqnum;
+
+    struct rocpulse_dedup_slot window[ROCPULSE_DEDUP_WINDOW];
+
+    uint64_t hashes[ROCPULSE_DEDUP_HASHES];
+    size_t next_hash;
+
+    rocpulse_dedup_stats stats;
+} rocpulse_dedup;
+
+void rocpulse_dedup_init(rocpulse_dedup* dedup);
+
+/* extract sequence number and SSRC from RTP header; returns false if packet
+ * is not RTP
+ */
+bool rocpulse_dedup_parse_rtp(const void* bytes,
+                              size_t size,
+                              uint16_t* seqnum,
+                              uint32_t* ssrc);
+
+/* returns true if source packet is seen first time and should be decoded */
+bool rocpulse_dedup_add_source(rocpulse_dedup* dedup,
+                               unsigned int path,
+                               uint16_t seqnum,
+                               pa_usec_t now);
+
+/* returns true if repair or control packet is seen first time */
+bool rocpulse_dedup_add_other(rocpulse_dedup* dedup, const void* bytes, size_t size);
+
+void rocpulse_dedup_stats_add(rocpulse_dedup_stats* total,
+                              const rocpulse_dedup_stats* stats);
+
+/* fill metrics of all paths */
+void rocpulse_dedup_stats_report(const rocpulse_dedup_stats* stats,
+                                 rocpulse_path_metrics* paths);
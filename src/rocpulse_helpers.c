@@ -11,89 +11,86 @@
 #include <float.h>
 #include <limits.h>
 #include <math.h>
+#include <netdb.h>
 #include <netinet/in.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/socket.h>
 
-/* local headers */
-#include "rocpulse_helpers.h"
-
-void rocpulse_log_handler(const roc_log_message* message, void* argument) {
-    (void)argument;
-
-    switch (message->level) {
-    case ROC_LOG_ERROR:
-        pa_log_level_meta(PA_LOG_ERROR, message->module, -1, NULL, "%s", message->text);
-        return;
-
-    case ROC_LOG_INFO:
-        pa_log_level_meta(PA_LOG_INFO, message->module, -1, NULL, "%s", message->text);
-        return;
-
-    default:
-        pa_log_level_meta(PA_LOG_DEBUG, message->module, -1, NULL, "%s", message->text);
-        return;
-    }
-}
+/* public pulseaudio headers */
+#include <pulse/xmalloc.h>
 
-int rocpulse_parse_endpoint(roc_endpoint** endp,
-                            roc_interface iface,
-                            roc_fec_encoding fec_encoding,
-                            pa_modargs* args,
-                            const char* ip_arg,
-                            const char* default_ip_arg,
-                            const char* port_arg,
-                            const char* default_port_arg) {
-    if (roc_endpoint_allocate(endp) != 0) {
-        pa_log("can't allocate endpoint");
-        return -1;
-    }
+/* private pulseaudio headers */
+#include <pulsecore/core-util.h>
+#include <pulsecore/macro.h>
 
-    roc_protocol proto = 0;
+/* local headers */
+#include "rocpulse_convert.h"
+#include "rocpulse_helpers.h"
 
+int rocpulse_select_protocol(roc_protocol* out,
+                             roc_interface iface,
+                             roc_fec_encoding fec_encoding) {
     switch (iface) {
     case ROC_INTERFACE_AUDIO_SOURCE:
         switch (fec_encoding) {
         case ROC_FEC_ENCODING_DISABLE:
-            proto = ROC_PROTO_RTP;
-            break;
+            *out = ROC_PROTO_RTP;
+            return 0;
         case ROC_FEC_ENCODING_DEFAULT:
         case ROC_FEC_ENCODING_RS8M:
-            proto = ROC_PROTO_RTP_RS8M_SOURCE;
-            break;
+            *out = ROC_PROTO_RTP_RS8M_SOURCE;
+            return 0;
         case ROC_FEC_ENCODING_LDPC_STAIRCASE:
-            proto = ROC_PROTO_RTP_LDPC_SOURCE;
-            break;
+            *out = ROC_PROTO_RTP_LDPC_SOURCE;
+            return 0;
         default:
-            pa_log("can't select endpoint protocol");
-            return -1;
+            break;
         }
         break;
 
     case ROC_INTERFACE_AUDIO_REPAIR:
         switch (fec_encoding) {
-        case ROC_FEC_ENCODING_DISABLE:
-            pa_log("can't select endpoint protocol");
-            return -1;
         case ROC_FEC_ENCODING_DEFAULT:
         case ROC_FEC_ENCODING_RS8M:
-            proto = ROC_PROTO_RS8M_REPAIR;
-            break;
+            *out = ROC_PROTO_RS8M_REPAIR;
+            return 0;
         case ROC_FEC_ENCODING_LDPC_STAIRCASE:
-            proto = ROC_PROTO_LDPC_REPAIR;
-            break;
+            *out = ROC_PROTO_LDPC_REPAIR;
+            return 0;
         default:
-            pa_log("can't select endpoint protocol");
-            return -1;
+            break;
         }
         break;
 
     case ROC_INTERFACE_AUDIO_CONTROL:
-        proto = ROC_PROTO_RTCP;
-        break;
+        *out = ROC_PROTO_RTCP;
+        return 0;
 
     default:
-        pa_log("can't select endpoint protocol");
+        break;
+    }
+
+    pa_log("can't select endpoint protocol");
+    return -1;
+}
+
+int rocpulse_parse_endpoint(roc_endpoint** endp,
+                            roc_interface iface,
+                            roc_fec_encoding fec_encoding,
+                            pa_modargs* args,
+                            const char* ip_arg,
+                            const char* default_ip_arg,
+                            const char* port_arg,
+                            const char* default_port_arg) {
+    if (roc_endpoint_allocate(endp) != 0) {
+        pa_log("can't allocate endpoint");
+        return -1;
+    }
+
+    roc_protocol proto = 0;
+
+    if (rocpulse_select_protocol(&proto, iface, fec_encoding) < 0) {
         return -1;
     }
 
@@ -140,6 +137,102 @@ int rocpulse_parse_endpoint(roc_endpoint** endp,
     return 0;
 }
 
+int rocpulse_parse_address(rocpulse_address* addr,
+                           pa_modargs* args,
+                           const char* ip_arg,
+                           const char* default_ip_arg,
+                           const char* port_arg,
+                           const char* default_port_arg) {
+    const char* ip_str = pa_modargs_get_value(args, ip_arg, default_ip_arg);
+    if (!*ip_str) {
+        ip_str = "0.0.0.0";
+    }
+
+    const char* port_str = pa_modargs_get_value(args, port_arg, default_port_arg);
+
+    char* end = NULL;
+    long port_num = strtol(port_str, &end, 10);
+    if (port_num < 0 || port_num > 65535 || !end || *end) {
+        pa_log("invalid %s: %s", port_arg, port_str);
+        return -1;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+
+    struct addrinfo* result = NULL;
+    int err = getaddrinfo(ip_str, port_str, &hints, &result);
+    if (err != 0) {
+        pa_log("can't resolve %s: %s", ip_str, gai_strerror(err));
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    memcpy(&addr->addr, result->ai_addr, result->ai_addrlen);
+    addr->addr_len = result->ai_addrlen;
+
+    freeaddrinfo(result);
+
+    return 0;
+}
+
+int rocpulse_parse_path(rocpulse_path* out,
+                        bool* enabled,
+                        pa_modargs* args,
+                        const char* prefix,
+                        const char* primary_prefix) {
+    static const char* const port_names[] = { "source", "repair", "control" };
+    static const char* const default_ports[] = {
+        ROCPULSE_DEFAULT_SOURCE_PORT,
+        ROCPULSE_DEFAULT_REPAIR_PORT,
+        ROCPULSE_DEFAULT_CONTROL_PORT,
+    };
+
+    memset(out, 0, sizeof(*out));
+    *enabled = false;
+
+    char* ip_arg = pa_sprintf_malloc("%s_ip", prefix);
+    const char* ip_str = pa_modargs_get_value(args, ip_arg, "");
+
+    if (!*ip_str) {
+        pa_xfree(ip_arg);
+        return 0;
+    }
+
+    rocpulse_address* addrs[] = {
+        &out->source_addr,
+        &out->repair_addr,
+        &out->control_addr,
+    };
+
+    int ret = 0;
+
+    for (size_t n = 0; n < PA_ELEMENTSOF(addrs) && ret == 0; n++) {
+        char* port_arg = pa_sprintf_malloc("%s_%s_port", prefix, port_names[n]);
+        char* primary_port_arg
+            = pa_sprintf_malloc("%s_%s_port", primary_prefix, port_names[n]);
+
+        ret = rocpulse_parse_address(
+            addrs[n], args, ip_arg, "", port_arg,
+            pa_modargs_get_value(args, primary_port_arg, default_ports[n]));
+
+        pa_xfree(port_arg);
+        pa_xfree(primary_port_arg);
+    }
+
+    pa_xfree(ip_arg);
+
+    if (ret < 0) {
+        return -1;
+    }
+
+    *enabled = true;
+    return 0;
+}
+
 int rocpulse_parse_uint(unsigned int* out,
                         pa_modargs* args,
                         const char* arg_name,
@@ -230,6 +323,8 @@ int rocpulse_parse_packet_encoding(roc_packet_encoding* out,
 }
 
 int rocpulse_parse_media_encoding(roc_media_encoding* out,
+                                  pa_sample_format_t* out_sample_format,
+                                  pa_channel_map* out_channel_map,
                                   pa_modargs* args,
                                   const char* rate_arg_name,
                                   const char* format_arg_name,
@@ -240,24 +335,87 @@ int rocpulse_parse_media_encoding(roc_media_encoding* out,
     }
 
     /* format */
-    const char* format = pa_modargs_get_value(args, format_arg_name, "s16");
-    if (!format || !*format || strcmp(format, "s16") == 0 || strcmp(format, "f32") == 0) {
-        // TODO: properly handle format when roc-toolkit is fixed
+    if (out_sample_format) {
+        /* frame encoding: roc always works with floats, and samples of other
+         * formats are converted by us (see rocpulse_convert.h)
+         */
+        const char* format = pa_modargs_get_value(args, format_arg_name, "f32");
+        if (!format || !*format || strcmp(format, "f32") == 0) {
+            *out_sample_format = PA_SAMPLE_FLOAT32NE;
+        } else if (strcmp(format, "s16") == 0) {
+            *out_sample_format = PA_SAMPLE_S16NE;
+        } else if (strcmp(format, "s32") == 0) {
+            *out_sample_format = PA_SAMPLE_S32NE;
+        } else {
+            pa_log("invalid %s: %s", format_arg_name, format);
+            return -1;
+        }
         out->format = ROC_FORMAT_PCM_FLOAT32;
     } else {
-        pa_log("invalid %s: %s", format_arg_name, format);
-        return -1;
+        /* packet encoding */
+        const char* format = pa_modargs_get_value(args, format_arg_name, "s16");
+        if (!format || !*format || strcmp(format, "s16") == 0
+            || strcmp(format, "f32") == 0) {
+            // TODO: properly handle format when roc-toolkit is fixed
+            out->format = ROC_FORMAT_PCM_FLOAT32;
+        } else {
+            pa_log("invalid %s: %s", format_arg_name, format);
+            return -1;
+        }
     }
 
     /* channels */
     const char* chans = pa_modargs_get_value(args, chans_arg_name, "stereo");
+
+    pa_channel_map channel_map;
+    pa_channel_map_init(&channel_map);
+
     if (!chans || !*chans || strcmp(chans, "stereo") == 0) {
-        out->channels = ROC_CHANNEL_LAYOUT_STEREO;
+        pa_channel_map_init_stereo(&channel_map);
     } else if (strcmp(chans, "mono") == 0) {
+        pa_channel_map_init_mono(&channel_map);
+    } else {
+        /* either number of channels, or channel map, e.g. "surround-51" or
+         * "front-left,front-right,lfe"
+         */
+        char* end = NULL;
+        long num = strtol(chans, &end, 10);
+        if (end && !*end) {
+            if (num <= 0 || num > PA_CHANNELS_MAX) {
+                pa_log("invalid %s: out of range: %s", chans_arg_name, chans);
+                return -1;
+            }
+            if (!pa_channel_map_init_extend(&channel_map, (unsigned)num,
+                                            PA_CHANNEL_MAP_DEFAULT)) {
+                pa_log("invalid %s: %s", chans_arg_name, chans);
+                return -1;
+            }
+        } else if (!pa_channel_map_parse(&channel_map, chans)) {
+            pa_log("invalid %s: %s", chans_arg_name, chans);
+            return -1;
+        }
+    }
+
+    pa_channel_map mono_map, stereo_map;
+    pa_channel_map_init_mono(&mono_map);
+    pa_channel_map_init_stereo(&stereo_map);
+
+    if (pa_channel_map_equal(&channel_map, &mono_map)) {
         out->channels = ROC_CHANNEL_LAYOUT_MONO;
+        out->tracks = 0;
+    } else if (pa_channel_map_equal(&channel_map, &stereo_map)) {
+        out->channels = ROC_CHANNEL_LAYOUT_STEREO;
+        out->tracks = 0;
     } else {
-        pa_log("invalid %s: %s", chans_arg_name, chans);
-        return -1;
+        /* roc doesn't know about surround layouts, so other channel maps are
+         * transferred as a set of independent tracks in the same order
+         */
+        out->channels = ROC_CHANNEL_LAYOUT_MULTITRACK;
+        out->tracks = channel_map.channels;
+    }
+
+    if (out_channel_map) {
+        *out_channel_map = channel_map;
     }
 
     return 0;
@@ -374,31 +532,159 @@ int rocpulse_parse_latency_tuner_profile(roc_latency_tuner_profile* out,
 }
 #endif // ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
 
+int rocpulse_parse_sender_config(roc_sender_config* sender_config, pa_modargs* args) {
+    if (rocpulse_parse_duration_msec_ul(&sender_config->packet_length, 1, args,
+                                        "packet_length_msec", "0")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_fec_encoding(&sender_config->fec_encoding, args, "fec_encoding")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_uint(&sender_config->fec_block_source_packets, args,
+                            "fec_block_nbsrc", "0")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_uint(&sender_config->fec_block_repair_packets, args,
+                            "fec_block_nbrpr", "0")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_resampler_backend(&sender_config->resampler_backend, args,
+                                         "resampler_backend")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_resampler_profile(&sender_config->resampler_profile, args,
+                                         "resampler_profile")
+        < 0) {
+        return -1;
+    }
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    if (rocpulse_parse_latency_tuner_backend(&sender_config->latency_tuner_backend, args,
+                                             "latency_backend")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_latency_tuner_profile(&sender_config->latency_tuner_profile, args,
+                                             "latency_profile")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_duration_msec_ul(&sender_config->latency_tolerance, 1, args,
+                                        "latency_tolerance_msec", "0")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_duration_msec_ul(&sender_config->target_latency, 1, args,
+                                        "target_latency_msec", "0")
+        < 0) {
+        return -1;
+    }
+#endif // ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+
+    return 0;
+}
+
+int rocpulse_parse_receiver_config(roc_receiver_config* receiver_config,
+                                   pa_modargs* args) {
+    if (rocpulse_parse_resampler_backend(&receiver_config->resampler_backend, args,
+                                         "resampler_backend")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_resampler_profile(&receiver_config->resampler_profile, args,
+                                         "resampler_profile")
+        < 0) {
+        return -1;
+    }
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    if (rocpulse_parse_latency_tuner_backend(&receiver_config->latency_tuner_backend,
+                                             args, "latency_backend")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_latency_tuner_profile(&receiver_config->latency_tuner_profile,
+                                             args, "latency_profile")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_duration_msec_ul(&receiver_config->latency_tolerance, 1, args,
+                                        "latency_tolerance_msec", "0")
+        < 0) {
+        return -1;
+    }
+#endif // ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+
+    if (rocpulse_parse_duration_msec_ul(&receiver_config->target_latency, 1, args,
+                                        "target_latency_msec", "0")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_duration_msec_ll(&receiver_config->no_playback_timeout, 1, args,
+                                        "no_play_timeout_msec", "0")
+        < 0) {
+        return -1;
+    }
+
+    if (rocpulse_parse_duration_msec_ll(&receiver_config->choppy_playback_timeout, 1,
+                                        args, "choppy_play_timeout_msec", "0")
+        < 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
 int rocpulse_extract_encoding(const roc_media_encoding* src_encoding,
-                              pa_sample_spec* dst_sample_spec,
-                              pa_channel_map* dst_channel_map) {
+                              pa_sample_format_t src_sample_format,
+                              pa_sample_spec* dst_sample_spec) {
     switch (src_encoding->channels) {
     case ROC_CHANNEL_LAYOUT_MONO:
-        pa_channel_map_init_mono(dst_channel_map);
+        dst_sample_spec->channels = 1;
         break;
 
     case ROC_CHANNEL_LAYOUT_STEREO:
-        pa_channel_map_init_stereo(dst_channel_map);
+        dst_sample_spec->channels = 2;
         break;
 
     case ROC_CHANNEL_LAYOUT_MULTITRACK:
-        pa_log("can't select channel map");
+        if (src_encoding->tracks == 0 || src_encoding->tracks > PA_CHANNELS_MAX) {
+            pa_log("can't select number of channels");
+            return -1;
+        }
+        dst_sample_spec->channels = (uint8_t)src_encoding->tracks;
+        break;
+
+    default:
+        pa_log("can't select number of channels");
         return -1;
     }
 
-    switch (src_encoding->format) {
-    case ROC_FORMAT_PCM_FLOAT32:
-        dst_sample_spec->format = PA_SAMPLE_FLOAT32LE;
-        break;
+    if (src_encoding->format != ROC_FORMAT_PCM_FLOAT32
+        || !rocpulse_convert_is_supported(src_sample_format)) {
+        pa_log("can't select sample format");
+        return -1;
     }
 
+    dst_sample_spec->format = src_sample_format;
     dst_sample_spec->rate = src_encoding->rate;
-    dst_sample_spec->channels = dst_channel_map->channels;
 
     return 0;
 }
@@ -11,13 +11,16 @@
 /* config.h from pulseaudio directory (generated after ./configure) */
 #include <config.h>
 
+/* system headers */
+#include <stdbool.h>
+#include <sys/socket.h>
+
 /* private pulseaudio headers */
 #include <pulsecore/modargs.h>
 
 /* roc headers */
 #include <roc/config.h>
 #include <roc/endpoint.h>
-#include <roc/log.h>
 #include <roc/version.h>
 
 #define ROCPULSE_DEFAULT_IP "0.0.0.0"
@@ -26,7 +29,9 @@
 #define ROCPULSE_DEFAULT_REPAIR_PORT "10002"
 #define ROCPULSE_DEFAULT_CONTROL_PORT "10003"
 
-void rocpulse_log_handler(const roc_log_message* message, void* argument);
+int rocpulse_select_protocol(roc_protocol* out,
+                             roc_interface iface,
+                             roc_fec_encoding fec_encoding);
 
 int rocpulse_parse_endpoint(roc_endpoint** endp,
                             roc_interface iface,
@@ -37,6 +42,43 @@ int rocpulse_parse_endpoint(roc_endpoint** endp,
                             const char* port_arg,
                             const char* default_port_arg);
 
+/* resolved socket address, used when packets are sent by us instead of roc */
+typedef struct rocpulse_address {
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+} rocpulse_address;
+
+int rocpulse_parse_address(rocpulse_address* addr,
+                           pa_modargs* args,
+                           const char* ip_arg,
+                           const char* default_ip_arg,
+                           const char* port_arg,
+                           const char* default_port_arg);
+
+/* second network path of redundant streaming; on sender, remote addresses to
+ * which copies of all packets are sent, and optional local address to bind to;
+ * on receiver, local addresses on which copies are received; repair address
+ * is not used if FEC is disabled
+ */
+typedef struct rocpulse_path {
+    rocpulse_address source_addr;
+    rocpulse_address repair_addr;
+    rocpulse_address control_addr;
+
+    bool has_bind_addr;
+    rocpulse_address bind_addr;
+} rocpulse_path;
+
+/* parses "<prefix>_ip" and "<prefix>_{source,repair,control}_port" arguments;
+ * ports default to ones of primary path from "<primary_prefix>_*_port"; if ip
+ * is not set, path is disabled and false is reported in enabled
+ */
+int rocpulse_parse_path(rocpulse_path* out,
+                        bool* enabled,
+                        pa_modargs* args,
+                        const char* prefix,
+                        const char* primary_prefix);
+
 int rocpulse_parse_uint(unsigned int* out,
                         pa_modargs* args,
                         const char* arg_name,
@@ -58,7 +100,13 @@ int rocpulse_parse_packet_encoding(roc_packet_encoding* out,
                                    pa_modargs* args,
                                    const char* arg_name);
 
+/* if out_sample_format is non-NULL, parses frame encoding and reports local
+ * sample format in it; otherwise parses packet encoding; if out_channel_map
+ * is non-NULL, reports local channel map in it
+ */
 int rocpulse_parse_media_encoding(roc_media_encoding* out,
+                                  pa_sample_format_t* out_sample_format,
+                                  pa_channel_map* out_channel_map,
                                   pa_modargs* args,
                                   const char* rate_arg_name,
                                   const char* format_arg_name,
@@ -86,6 +134,17 @@ int rocpulse_parse_latency_tuner_profile(roc_latency_tuner_profile* out,
                                          const char* arg_name);
 #endif // ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
 
+/* parses sender parameters that can be changed at runtime (packet length,
+ * FEC, resampler, latency); frame and packet encodings are parsed separately
+ */
+int rocpulse_parse_sender_config(roc_sender_config* sender_config, pa_modargs* args);
+
+/* parses receiver parameters that can be changed at runtime (resampler,
+ * latency, timeouts); frame encoding is parsed separately
+ */
+int rocpulse_parse_receiver_config(roc_receiver_config* receiver_config,
+                                   pa_modargs* args);
+
 int rocpulse_extract_encoding(const roc_media_encoding* src_encoding,
-                              pa_sample_spec* dst_sample_spec,
-                              pa_channel_map* dst_channel_map);
+                              pa_sample_format_t src_sample_format,
+                              pa_sample_spec* dst_sample_spec);
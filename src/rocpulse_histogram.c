@@ -0,0 +1,143 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <limits.h>
+#include <string.h>
+
+/* public pulseaudio headers */
+#include <pulse/def.h>
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/macro.h>
+#include <pulsecore/strbuf.h>
+#if PA_CHECK_VERSION(14, 99, 0)
+#include <pulsecore/message-handler.h>
+#endif
+
+/* local headers */
+#include "rocpulse_histogram.h"
+
+struct rocpulse_histogram_handler {
+    pa_core* core;
+    char* object_path;
+
+    const rocpulse_histogram* hists;
+    size_t n_hists;
+};
+
+void rocpulse_histogram_init(rocpulse_histogram* hist, const char* name) {
+    pa_assert(hist);
+    pa_assert(name);
+
+    memset(hist, 0, sizeof(*hist));
+    hist->name = name;
+}
+
+void rocpulse_histogram_add(rocpulse_histogram* hist, uint64_t value) {
+    unsigned bucket = value == 0 ? 0 : 64 - (unsigned)__builtin_clzll(value);
+    if (bucket >= ROCPULSE_HISTOGRAM_BUCKETS) {
+        bucket = ROCPULSE_HISTOGRAM_BUCKETS - 1;
+    }
+
+    /* there is only one writer, so there is no need in atomic read-modify-write,
+     * which would be much more expensive
+     */
+    pa_atomic_store(&hist->buckets[bucket], pa_atomic_load(&hist->buckets[bucket]) + 1);
+
+    int int_value = (int)PA_MIN(value, (uint64_t)INT_MAX);
+    if (int_value > pa_atomic_load(&hist->max)) {
+        pa_atomic_store(&hist->max, int_value);
+    }
+}
+
+char* rocpulse_histogram_to_json(const rocpulse_histogram* hists, size_t n_hists) {
+    pa_strbuf* buf = pa_strbuf_new();
+
+    pa_strbuf_puts(buf, "{");
+
+    for (size_t n = 0; n < n_hists; n++) {
+        const rocpulse_histogram* hist = &hists[n];
+
+        pa_strbuf_printf(buf, "%s\"%s\":{\"max\":%d,\"buckets\":[", n > 0 ? "," : "",
+                         hist->name, pa_atomic_load(&hist->max));
+
+        for (size_t b = 0; b < ROCPULSE_HISTOGRAM_BUCKETS; b++) {
+            /* counter may wrap, report it as unsigned */
+            pa_strbuf_printf(buf, "%s%u", b > 0 ? "," : "",
+                             (unsigned)pa_atomic_load(&hist->buckets[b]));
+        }
+
+        pa_strbuf_puts(buf, "]}");
+    }
+
+    pa_strbuf_puts(buf, "}");
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+#if PA_CHECK_VERSION(14, 99, 0)
+static int message_cb(const char* object_path,
+                      const char* message,
+                      const pa_json_object* parameters,
+                      char** response,
+                      void* userdata) {
+    (void)object_path;
+    (void)parameters;
+
+    rocpulse_histogram_handler* handler = userdata;
+    pa_assert(handler);
+
+    if (strcmp(message, "get-histograms") != 0) {
+        return -PA_ERR_NOTIMPLEMENTED;
+    }
+
+    *response = rocpulse_histogram_to_json(handler->hists, handler->n_hists);
+
+    return PA_OK;
+}
+#endif // PA_CHECK_VERSION(14, 99, 0)
+
+rocpulse_histogram_handler*
+rocpulse_histogram_handler_new(pa_core* core,
+                               const char* object_path,
+                               const rocpulse_histogram* hists,
+                               size_t n_hists) {
+    pa_assert(core);
+    pa_assert(object_path);
+    pa_assert(hists);
+
+    rocpulse_histogram_handler* handler = pa_xnew0(rocpulse_histogram_handler, 1);
+
+    handler->core = core;
+    handler->object_path = pa_xstrdup(object_path);
+    handler->hists = hists;
+    handler->n_hists = n_hists;
+
+#if PA_CHECK_VERSION(14, 99, 0)
+    pa_message_handler_register(core, handler->object_path, "Roc timing histograms",
+                                message_cb, handler);
+#endif
+
+    return handler;
+}
+
+void rocpulse_histogram_handler_free(rocpulse_histogram_handler* handler) {
+    pa_assert(handler);
+
+#if PA_CHECK_VERSION(14, 99, 0)
+    pa_message_handler_unregister(handler->core, handler->object_path);
+#endif
+
+    pa_xfree(handler->object_path);
+    pa_xfree(handler);
+}
@@ -0,0 +1,56 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <stddef.h>
+#include <stdint.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/atomic.h>
+#include <pulsecore/core.h>
+
+/* number of buckets in histogram */
+#define ROCPULSE_HISTOGRAM_BUCKETS 24
+
+/* histogram with log2-scale buckets
+ *
+ * bucket 0 counts zero values, and bucket N counts values in [2^(N-1); 2^N);
+ * the last bucket also counts all larger values
+ *
+ * values are added from one thread at a time (module thread) and can be read
+ * concurrently from any thread (main loop) without locks
+ */
+typedef struct rocpulse_histogram {
+    const char* name;
+
+    pa_atomic_t buckets[ROCPULSE_HISTOGRAM_BUCKETS];
+    pa_atomic_t max;
+} rocpulse_histogram;
+
+void rocpulse_histogram_init(rocpulse_histogram* hist, const char* name);
+
+void rocpulse_histogram_add(rocpulse_histogram* hist, uint64_t value);
+
+/* returns histograms as JSON object, should be freed with pa_xfree() */
+char* rocpulse_histogram_to_json(const rocpulse_histogram* hists, size_t n_hists);
+
+/* handles "get-histograms" message sent to given object path */
+typedef struct rocpulse_histogram_handler rocpulse_histogram_handler;
+
+rocpulse_histogram_handler*
+rocpulse_histogram_handler_new(pa_core* core,
+                               const char* object_path,
+                               const rocpulse_histogram* hists,
+                               size_t n_hists);
+
+void rocpulse_histogram_handler_free(rocpulse_histogram_handler* handler);
@@ -0,0 +1,226 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* public pulseaudio headers */
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+
+/* local headers */
+#include "rocpulse_latency_cache.h"
+
+#define CACHE_FILE_NAME "roc-latency-cache"
+
+/* entries above this number are evicted, least recently updated first */
+#define MAX_ENTRIES 64
+
+/* max key length, including terminator */
+#define MAX_KEY_LEN 128
+
+/* entries older than this are ignored */
+#define MAX_ENTRY_AGE (7 * 24 * 60 * 60)
+
+typedef struct cache_line {
+    char key[MAX_KEY_LEN];
+    unsigned long long latency_us;
+    unsigned long long jitter_us;
+    long long updated;
+} cache_line;
+
+static bool is_valid_key(const char* key) {
+    if (!*key || strlen(key) >= MAX_KEY_LEN) {
+        return false;
+    }
+
+    /* key is written as a single word */
+    for (; *key; key++) {
+        if (*key <= ' ' || *key == 0x7f) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* read all entries from file; missing file is not an error */
+static size_t read_lines(const char* path, cache_line* lines) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        if (errno != ENOENT) {
+            pa_log_warn("can't open %s: %s", path, pa_cstrerror(errno));
+        }
+        return 0;
+    }
+
+    size_t n_lines = 0;
+    char buf[256];
+
+    while (n_lines < MAX_ENTRIES && fgets(buf, sizeof(buf), fp)) {
+        cache_line* line = &lines[n_lines];
+
+        if (sscanf(buf, "%127s %llu %llu %lld", line->key, &line->latency_us,
+                   &line->jitter_us, &line->updated)
+            != 4) {
+            /* skip malformed lines */
+            continue;
+        }
+
+        n_lines++;
+    }
+
+    fclose(fp);
+
+    return n_lines;
+}
+
+/* write entries to temporary file and then atomically replace old file, so
+ * that a crash never leaves a truncated file
+ */
+static int write_lines(const char* path, const cache_line* lines, size_t n_lines) {
+    char* tmp_path = pa_sprintf_malloc("%s.tmp", path);
+    int ret = -1;
+
+    FILE* fp = fopen(tmp_path, "w");
+    if (!fp) {
+        pa_log_warn("can't open %s: %s", tmp_path, pa_cstrerror(errno));
+        goto out;
+    }
+
+    for (size_t n = 0; n < n_lines; n++) {
+        fprintf(fp, "%s %llu %llu %lld\n", lines[n].key, lines[n].latency_us,
+                lines[n].jitter_us, lines[n].updated);
+    }
+
+    if (fclose(fp) != 0) {
+        pa_log_warn("can't write %s: %s", tmp_path, pa_cstrerror(errno));
+        unlink(tmp_path);
+        goto out;
+    }
+
+    if (rename(tmp_path, path) != 0) {
+        pa_log_warn("can't rename %s: %s", tmp_path, pa_cstrerror(errno));
+        unlink(tmp_path);
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    pa_xfree(tmp_path);
+
+    return ret;
+}
+
+int rocpulse_latency_cache_load(const char* key, rocpulse_latency_entry* entry) {
+    pa_assert(key);
+    pa_assert(entry);
+
+    if (!is_valid_key(key)) {
+        return -1;
+    }
+
+    char* path = pa_state_path(CACHE_FILE_NAME, true);
+    if (!path) {
+        return -1;
+    }
+
+    cache_line* lines = pa_xnew0(cache_line, MAX_ENTRIES);
+    size_t n_lines = read_lines(path, lines);
+    int ret = -1;
+
+    const long long now = (long long)time(NULL);
+
+    for (size_t n = 0; n < n_lines; n++) {
+        if (strcmp(lines[n].key, key) != 0) {
+            continue;
+        }
+
+        if (now - lines[n].updated > MAX_ENTRY_AGE) {
+            pa_log_debug("ignoring stale latency cache entry for %s", key);
+            break;
+        }
+
+        entry->latency = (pa_usec_t)lines[n].latency_us;
+        entry->jitter = (pa_usec_t)lines[n].jitter_us;
+        ret = 0;
+        break;
+    }
+
+    pa_xfree(lines);
+    pa_xfree(path);
+
+    return ret;
+}
+
+int rocpulse_latency_cache_store(const char* key, const rocpulse_latency_entry* entry) {
+    pa_assert(key);
+    pa_assert(entry);
+
+    if (!is_valid_key(key)) {
+        pa_log_warn("can't cache latency for invalid key: %s", key);
+        return -1;
+    }
+
+    char* path = pa_state_path(CACHE_FILE_NAME, true);
+    if (!path) {
+        return -1;
+    }
+
+    cache_line* lines = pa_xnew0(cache_line, MAX_ENTRIES);
+    size_t n_lines = read_lines(path, lines);
+
+    /* find existing entry, or free slot, or least recently updated entry */
+    size_t pos = n_lines;
+
+    for (size_t n = 0; n < n_lines; n++) {
+        if (strcmp(lines[n].key, key) == 0) {
+            pos = n;
+            break;
+        }
+    }
+
+    if (pos == MAX_ENTRIES) {
+        pos = 0;
+        for (size_t n = 1; n < n_lines; n++) {
+            if (lines[n].updated < lines[pos].updated) {
+                pos = n;
+            }
+        }
+    }
+
+    if (pos == n_lines) {
+        n_lines++;
+    }
+
+    cache_line* line = &lines[pos];
+
+    pa_strlcpy(line->key, key, sizeof(line->key));
+    line->latency_us = (unsigned long long)entry->latency;
+    line->jitter_us = (unsigned long long)entry->jitter;
+    line->updated = (long long)time(NULL);
+
+    int ret = write_lines(path, lines, n_lines);
+
+    pa_xfree(lines);
+    pa_xfree(path);
+
+    return ret;
+}
@@ -0,0 +1,37 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* public pulseaudio headers */
+#include <pulse/sample.h>
+
+/* latency statistics learned during previous run */
+typedef struct rocpulse_latency_entry {
+    /* end-to-end latency */
+    pa_usec_t latency;
+
+    /* mean packet jitter */
+    pa_usec_t jitter;
+} rocpulse_latency_entry;
+
+/* latency statistics are kept in a small text file in pulseaudio state
+ * directory, one line per key; entries not updated for a long time are
+ * considered stale and ignored
+ *
+ * these functions should be called only from main loop
+ */
+
+/* find entry for given key; returns -1 if there is no fresh entry */
+int rocpulse_latency_cache_load(const char* key, rocpulse_latency_entry* entry);
+
+/* add or replace entry for given key; returns -1 if file can't be written */
+int rocpulse_latency_cache_store(const char* key, const rocpulse_latency_entry* entry);
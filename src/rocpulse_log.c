@@ -0,0 +1,445 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <stdlib.h>
+#include <string.h>
+
+/* public pulseaudio headers */
+#include <pulse/mainloop-api.h>
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/atomic.h>
+#include <pulsecore/hashmap.h>
+#include <pulsecore/idxset.h>
+#include <pulsecore/log.h>
+#include <pulsecore/ratelimit.h>
+#include <pulsecore/shared.h>
+
+/* local headers */
+#include "rocpulse_log.h"
+
+/* number of messages in queue, should be power of two */
+#define QUEUE_SIZE 512
+
+/* how often queue is drained */
+#define DRAIN_INTERVAL (100 * PA_USEC_PER_MSEC)
+
+/* rate limit for every roc module */
+#define RATELIMIT_INTERVAL PA_USEC_PER_SEC
+#define RATELIMIT_BURST 50
+
+/* roc modules above this number share one rate limit */
+#define MAX_RATELIMITS 64
+
+/* longer messages are truncated */
+#define MAX_MODULE_LEN 32
+#define MAX_TEXT_LEN 256
+
+/* module types (shared libraries) that may use bridge at once */
+#define MAX_COPIES 8
+
+/* name under which bridge is registered in core */
+#define SHARED_NAME "rocpulse-log-bridge-1"
+
+struct log_entry {
+    /* sequence number, see enqueue() and dequeue() */
+    pa_atomic_t seq;
+
+    roc_log_level level;
+    char module[MAX_MODULE_LEN];
+    char text[MAX_TEXT_LEN];
+};
+
+/* callbacks of one copy of this file; every module type is a separate shared
+ * library linked with its own copy
+ *
+ * set_handler identifies roc instance used by the copy: when libroc is linked
+ * statically (default build), every module type has its own roc logger, and
+ * when it's a shared library, all module types use the same one
+ */
+struct log_copy {
+    roc_log_handler handler;
+    pa_time_event_cb_t drain_cb;
+    void (*set_handler)(roc_log_handler, void*);
+};
+
+/* all module types share one bridge; it's allocated by the first loaded
+ * module, registered in core, and freed by the last unloaded one
+ *
+ * every copy installs its own handler into its roc instance, and all handlers
+ * write to the same queue; drain timer points to callback of one copy, the
+ * owner, and when owner's module type is unloaded while another one is still
+ * loaded, timer is handed over to that one
+ */
+struct log_bridge {
+    /* bounded lock-free queue with multiple producers (roc threads) and single
+     * consumer (main loop); each entry's sequence number tells whether it is
+     * free for writing at given position or ready for reading
+     */
+    struct log_entry queue[QUEUE_SIZE];
+    pa_atomic_t write_pos;
+    unsigned read_pos;
+    pa_atomic_t dropped;
+
+    pa_core* core;
+    pa_time_event* drain_event;
+
+    /* roc module name => pa_ratelimit, accessed only on main loop */
+    pa_hashmap* ratelimits;
+    pa_ratelimit shared_ratelimit;
+
+    /* copies used by at least one module instance */
+    const struct log_copy* copies[MAX_COPIES];
+
+    const struct log_copy* owner;
+};
+
+/* bridge as seen by this copy, and number of module instances using this copy */
+static struct log_bridge* log_bridge;
+static unsigned log_refcount;
+
+static void copy_str(char* dst, const char* src, size_t dst_size) {
+    size_t len = src ? strnlen(src, dst_size - 1) : 0;
+
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+static void enqueue(struct log_bridge* bridge, const roc_log_message* message) {
+    unsigned pos = (unsigned)pa_atomic_load(&bridge->write_pos);
+    struct log_entry* entry;
+
+    for (;;) {
+        entry = &bridge->queue[pos % QUEUE_SIZE];
+
+        int diff = (int)((unsigned)pa_atomic_load(&entry->seq) - pos);
+
+        if (diff == 0) {
+            /* entry is free, try to claim it */
+            if (pa_atomic_cmpxchg(&bridge->write_pos, (int)pos, (int)(pos + 1))) {
+                break;
+            }
+        } else if (diff < 0) {
+            /* queue is full, never block roc threads */
+            pa_atomic_inc(&bridge->dropped);
+            return;
+        }
+
+        pos = (unsigned)pa_atomic_load(&bridge->write_pos);
+    }
+
+    entry->level = message->level;
+    copy_str(entry->module, message->module, sizeof(entry->module));
+    copy_str(entry->text, message->text, sizeof(entry->text));
+
+    /* publish entry to consumer */
+    pa_atomic_store(&entry->seq, (int)(pos + 1));
+}
+
+static bool dequeue(struct log_bridge* bridge, struct log_entry* out) {
+    struct log_entry* entry = &bridge->queue[bridge->read_pos % QUEUE_SIZE];
+
+    int diff = (int)((unsigned)pa_atomic_load(&entry->seq) - (bridge->read_pos + 1));
+    if (diff < 0) {
+        return false;
+    }
+
+    out->level = entry->level;
+    memcpy(out->module, entry->module, sizeof(out->module));
+    memcpy(out->text, entry->text, sizeof(out->text));
+
+    /* make entry free for producers on next lap */
+    pa_atomic_store(&entry->seq, (int)(bridge->read_pos + QUEUE_SIZE));
+    bridge->read_pos++;
+
+    return true;
+}
+
+static void log_handler(const roc_log_message* message, void* argument) {
+    struct log_bridge* bridge = argument;
+
+    enqueue(bridge, message);
+}
+
+static pa_log_level_t map_level(roc_log_level level) {
+    switch (level) {
+    case ROC_LOG_ERROR:
+        return PA_LOG_ERROR;
+
+    case ROC_LOG_INFO:
+        return PA_LOG_INFO;
+
+    default:
+        return PA_LOG_DEBUG;
+    }
+}
+
+static pa_ratelimit* get_ratelimit(struct log_bridge* bridge, const char* module) {
+    pa_ratelimit* r = pa_hashmap_get(bridge->ratelimits, module);
+
+    if (!r) {
+        if (pa_hashmap_size(bridge->ratelimits) >= MAX_RATELIMITS) {
+            return &bridge->shared_ratelimit;
+        }
+
+        r = pa_xnew0(pa_ratelimit, 1);
+        r->interval = RATELIMIT_INTERVAL;
+        r->burst = RATELIMIT_BURST;
+
+        pa_hashmap_put(bridge->ratelimits, pa_xstrdup(module), r);
+    }
+
+    return r;
+}
+
+static void drain(struct log_bridge* bridge) {
+    struct log_entry entry;
+
+    while (dequeue(bridge, &entry)) {
+        pa_log_level_t level = map_level(entry.level);
+
+        /* errors are never suppressed */
+        if (level != PA_LOG_ERROR
+            && !pa_ratelimit_test(get_ratelimit(bridge, entry.module), level)) {
+            continue;
+        }
+
+        pa_log_level_meta(level, entry.module, -1, NULL, "%s", entry.text);
+    }
+
+    int dropped = pa_atomic_load(&bridge->dropped);
+    if (dropped > 0) {
+        pa_atomic_sub(&bridge->dropped, dropped);
+        pa_log_warn("dropped %d roc log messages because of queue overflow", dropped);
+    }
+}
+
+static void drain_cb(pa_mainloop_api* a,
+                     pa_time_event* e,
+                     const struct timeval* t,
+                     void* userdata) {
+    (void)a;
+    (void)t;
+
+    struct log_bridge* bridge = userdata;
+    pa_assert(bridge);
+
+    drain(bridge);
+
+    pa_core_rttime_restart(bridge->core, e, pa_rtclock_now() + DRAIN_INTERVAL);
+}
+
+static const struct log_copy this_copy = {
+    log_handler,
+    drain_cb,
+    roc_log_set_handler,
+};
+
+/* install drain timer of given copy */
+static void set_owner(struct log_bridge* bridge, const struct log_copy* owner) {
+    if (bridge->drain_event) {
+        bridge->core->mainloop->time_free(bridge->drain_event);
+    }
+
+    bridge->drain_event = pa_core_rttime_new(
+        bridge->core, pa_rtclock_now() + DRAIN_INTERVAL, owner->drain_cb, bridge);
+
+    bridge->owner = owner;
+}
+
+static struct log_bridge* bridge_new(pa_core* core) {
+    struct log_bridge* bridge = pa_xnew0(struct log_bridge, 1);
+
+    bridge->core = core;
+    bridge->ratelimits
+        = pa_hashmap_new_full(pa_idxset_string_hash_func, pa_idxset_string_compare_func,
+                              pa_xfree, pa_xfree);
+    bridge->shared_ratelimit.interval = RATELIMIT_INTERVAL;
+    bridge->shared_ratelimit.burst = RATELIMIT_BURST;
+
+    for (unsigned n = 0; n < QUEUE_SIZE; n++) {
+        pa_atomic_store(&bridge->queue[n].seq, (int)n);
+    }
+
+    pa_shared_set(core, SHARED_NAME, bridge);
+
+    return bridge;
+}
+
+static void bridge_free(struct log_bridge* bridge) {
+    drain(bridge);
+
+    bridge->core->mainloop->time_free(bridge->drain_event);
+    pa_hashmap_free(bridge->ratelimits);
+
+    pa_shared_remove(bridge->core, SHARED_NAME);
+
+    pa_xfree(bridge);
+}
+
+/* level of pulseaudio logs; PULSE_LOG overrides level of daemon, and daemon
+ * itself is by default at notice level
+ */
+static pa_log_level_t pulseaudio_level(void) {
+    const char* env = getenv("PULSE_LOG");
+    if (env && *env) {
+        return (pa_log_level_t)PA_CLAMP(atoi(env), 0, PA_LOG_LEVEL_MAX - 1);
+    }
+
+    return PA_LOG_NOTICE;
+}
+
+/* most verbose roc level which messages are still shown by pulseaudio; trace
+ * is enabled only explicitly
+ */
+static roc_log_level default_level(void) {
+    static const roc_log_level levels[] = {
+        ROC_LOG_ERROR,
+        ROC_LOG_INFO,
+        ROC_LOG_NOTE,
+        ROC_LOG_DEBUG,
+    };
+
+    const pa_log_level_t pa_level = pulseaudio_level();
+    roc_log_level level = ROC_LOG_ERROR;
+
+    for (size_t n = 0; n < PA_ELEMENTSOF(levels); n++) {
+        if (map_level(levels[n]) <= pa_level) {
+            level = levels[n];
+        }
+    }
+
+    return level;
+}
+
+static int parse_level(roc_log_level* out, pa_modargs* args, const char* arg_name) {
+    const char* str = pa_modargs_get_value(args, arg_name, "");
+
+    if (!str || !*str || strcmp(str, "default") == 0) {
+        *out = default_level();
+        return 0;
+    } else if (strcmp(str, "none") == 0) {
+        *out = ROC_LOG_NONE;
+        return 0;
+    } else if (strcmp(str, "error") == 0) {
+        *out = ROC_LOG_ERROR;
+        return 0;
+    } else if (strcmp(str, "info") == 0) {
+        *out = ROC_LOG_INFO;
+        return 0;
+    } else if (strcmp(str, "note") == 0) {
+        *out = ROC_LOG_NOTE;
+        return 0;
+    } else if (strcmp(str, "debug") == 0) {
+        *out = ROC_LOG_DEBUG;
+        return 0;
+    } else if (strcmp(str, "trace") == 0) {
+        *out = ROC_LOG_TRACE;
+        return 0;
+    } else {
+        pa_log("invalid %s: %s", arg_name, str);
+        return -1;
+    }
+}
+
+int rocpulse_log_init(pa_core* core, pa_modargs* args, const char* level_arg_name) {
+    pa_assert(core);
+
+    roc_log_level level = ROC_LOG_ERROR;
+    if (parse_level(&level, args, level_arg_name) < 0) {
+        return -1;
+    }
+
+    if (log_refcount == 0) {
+        struct log_bridge* bridge = pa_shared_get(core, SHARED_NAME);
+
+        if (!bridge) {
+            bridge = bridge_new(core);
+        }
+
+        size_t slot = 0;
+        while (slot < MAX_COPIES && bridge->copies[slot]) {
+            slot++;
+        }
+
+        if (slot == MAX_COPIES) {
+            pa_log("too many roc module types loaded");
+            return -1;
+        }
+
+        bridge->copies[slot] = &this_copy;
+        log_bridge = bridge;
+
+        if (!bridge->owner) {
+            set_owner(bridge, &this_copy);
+        }
+
+        /* roc of this copy, and of other copies if libroc is shared */
+        roc_log_set_handler(log_handler, bridge);
+    }
+
+    log_refcount++;
+
+    /* level is per roc instance, the last loaded module using it wins */
+    roc_log_set_level(level);
+
+    return 0;
+}
+
+void rocpulse_log_done(void) {
+    pa_assert(log_refcount > 0);
+    pa_assert(log_bridge);
+
+    if (--log_refcount > 0) {
+        return;
+    }
+
+    struct log_bridge* bridge = log_bridge;
+    const struct log_copy* next_owner = NULL;
+    const struct log_copy* same_roc = NULL;
+
+    for (size_t n = 0; n < MAX_COPIES; n++) {
+        if (bridge->copies[n] == &this_copy) {
+            bridge->copies[n] = NULL;
+        } else if (bridge->copies[n]) {
+            next_owner = bridge->copies[n];
+
+            if (next_owner->set_handler == this_copy.set_handler) {
+                same_roc = next_owner;
+            }
+        }
+    }
+
+    log_bridge = NULL;
+
+    /* code of this copy is going to be unloaded; roc waits until handler that
+     * is being called returns, so it's not used after that; if roc is shared
+     * with another copy, hand it over instead of restoring default handler
+     */
+    if (same_roc) {
+        roc_log_set_handler(same_roc->handler, bridge);
+    } else {
+        roc_log_set_handler(NULL, NULL);
+    }
+
+    if (!next_owner) {
+        bridge_free(bridge);
+        return;
+    }
+
+    if (bridge->owner == &this_copy) {
+        drain(bridge);
+        set_owner(bridge, next_owner);
+    }
+}
@@ -0,0 +1,32 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core.h>
+#include <pulsecore/modargs.h>
+
+/* roc headers */
+#include <roc/log.h>
+
+/* bridge roc logs to pulseaudio
+ *
+ * the bridge is shared by all module instances of all module types, via core,
+ * and is reference-counted; every module type installs its handler into roc it
+ * is linked with, roc threads only copy messages into a lock-free queue, and
+ * the queue is drained, rate-limited, and passed to pulseaudio logger
+ * periodically on main loop
+ *
+ * unless set by module argument, roc log level follows pulseaudio log level
+ */
+int rocpulse_log_init(pa_core* core, pa_modargs* args, const char* level_arg_name);
+void rocpulse_log_done(void);
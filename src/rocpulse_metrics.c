@@ -0,0 +1,343 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <ctype.h>
+#include <string.h>
+
+/* public pulseaudio headers */
+#include <pulse/def.h>
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/strbuf.h>
+#if PA_CHECK_VERSION(14, 99, 0)
+#include <pulsecore/message-handler.h>
+#endif
+
+/* local headers */
+#include "rocpulse_metrics.h"
+
+struct rocpulse_metrics_poller {
+    pa_core* core;
+    char* object_path;
+
+    pa_usec_t interval;
+    pa_time_event* timer;
+
+    rocpulse_metrics_query_cb query_cb;
+    rocpulse_metrics_update_cb update_cb;
+    void* userdata;
+
+    /* last snapshot, formatted when it's taken, so that requests from clients
+     * don't have to touch roc at all
+     */
+    char* json;
+    pa_proplist* proplist;
+};
+
+int rocpulse_metrics_query_sender(roc_sender* sender, rocpulse_metrics* out) {
+    pa_assert(sender);
+    pa_assert(out);
+
+    memset(out, 0, sizeof(*out));
+    out->timestamp = pa_rtclock_now();
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    roc_sender_metrics sender_metrics;
+    memset(&sender_metrics, 0, sizeof(sender_metrics));
+
+    size_t n_connections = ROCPULSE_METRICS_MAX_CONNECTIONS;
+
+    if (roc_sender_query(sender, ROC_SLOT_DEFAULT, &sender_metrics, out->connections,
+                         &n_connections)
+        != 0) {
+        return -1;
+    }
+
+    out->connection_count = sender_metrics.connection_count;
+    out->n_connections = n_connections;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+int rocpulse_metrics_query_receiver(roc_receiver* receiver, rocpulse_metrics* out) {
+    pa_assert(receiver);
+    pa_assert(out);
+
+    memset(out, 0, sizeof(*out));
+    out->timestamp = pa_rtclock_now();
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    roc_receiver_metrics receiver_metrics;
+    memset(&receiver_metrics, 0, sizeof(receiver_metrics));
+
+    size_t n_connections = ROCPULSE_METRICS_MAX_CONNECTIONS;
+
+    if (roc_receiver_query(receiver, ROC_SLOT_DEFAULT, &receiver_metrics,
+                           out->connections, &n_connections)
+        != 0) {
+        return -1;
+    }
+
+    out->connection_count = receiver_metrics.connection_count;
+    out->n_connections = n_connections;
+
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static char* format_json(const rocpulse_metrics* metrics) {
+    pa_strbuf* buf = pa_strbuf_new();
+
+    pa_strbuf_printf(buf, "{\"timestamp_usec\":%llu,\"connection_count\":%u",
+                     (unsigned long long)metrics->timestamp, metrics->connection_count);
+
+    pa_strbuf_puts(buf, ",\"connections\":[");
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    for (size_t n = 0; n < metrics->n_connections; n++) {
+        const roc_connection_metrics* conn = &metrics->connections[n];
+
+        pa_strbuf_printf(buf,
+                         "%s{\"e2e_latency_ns\":%llu,\"mean_jitter_ns\":%llu"
+                         ",\"expected_packets\":%llu,\"lost_packets\":%llu}",
+                         n > 0 ? "," : "", (unsigned long long)conn->e2e_latency,
+                         (unsigned long long)conn->mean_jitter,
+                         (unsigned long long)conn->expected_packets,
+                         (unsigned long long)conn->lost_packets);
+    }
+#endif
+
+    pa_strbuf_puts(buf, "]");
+
+    if (metrics->n_paths > 0) {
+        pa_strbuf_puts(buf, ",\"paths\":[");
+
+        for (size_t n = 0; n < metrics->n_paths; n++) {
+            const rocpulse_path_metrics* path = &metrics->paths[n];
+
+            pa_strbuf_printf(buf,
+                             "%s{\"expected_packets\":%llu,\"received_packets\":%llu"
+                             ",\"first_packets\":%llu,\"mean_skew_usec\":%lld"
+                             ",\"max_skew_usec\":%llu}",
+                             n > 0 ? "," : "", (unsigned long long)path->expected_packets,
+                             (unsigned long long)path->received_packets,
+                             (unsigned long long)path->first_packets,
+                             (long long)path->mean_skew,
+                             (unsigned long long)path->max_skew);
+        }
+
+        pa_strbuf_puts(buf, "]");
+    }
+
+    pa_strbuf_puts(buf, "}");
+
+    return pa_strbuf_to_string_free(buf);
+}
+
+static pa_proplist* format_proplist(const rocpulse_metrics_poller* poller,
+                                    const rocpulse_metrics* metrics) {
+    pa_proplist* proplist = pa_proplist_new();
+
+    pa_proplist_sets(proplist, "roc.metrics.object_path", poller->object_path);
+    pa_proplist_setf(proplist, "roc.metrics.connection_count", "%u",
+                     metrics->connection_count);
+
+    /* proplist is flat, so connections are aggregated: worst latency and jitter,
+     * and total packet counts
+     */
+    unsigned long long e2e_latency = 0, mean_jitter = 0;
+    unsigned long long expected_packets = 0, lost_packets = 0;
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    for (size_t n = 0; n < metrics->n_connections; n++) {
+        const roc_connection_metrics* conn = &metrics->connections[n];
+
+        e2e_latency = PA_MAX(e2e_latency, (unsigned long long)conn->e2e_latency);
+        mean_jitter = PA_MAX(mean_jitter, (unsigned long long)conn->mean_jitter);
+        expected_packets += conn->expected_packets;
+        lost_packets += conn->lost_packets;
+    }
+#endif
+
+    pa_proplist_setf(proplist, "roc.metrics.e2e_latency_usec", "%llu",
+                     e2e_latency / 1000);
+    pa_proplist_setf(proplist, "roc.metrics.mean_jitter_usec", "%llu",
+                     mean_jitter / 1000);
+    pa_proplist_setf(proplist, "roc.metrics.expected_packets", "%llu",
+                     expected_packets);
+    pa_proplist_setf(proplist, "roc.metrics.lost_packets", "%llu", lost_packets);
+
+    static const char* const path_names[ROCPULSE_METRICS_MAX_PATHS] = {
+        "primary",
+        "secondary",
+    };
+
+    for (size_t n = 0; n < metrics->n_paths; n++) {
+        const rocpulse_path_metrics* path = &metrics->paths[n];
+
+        pa_proplist_setf(proplist, "roc.metrics.%s_path.lost_packets", "%llu",
+                         path_names[n],
+                         (unsigned long long)(path->expected_packets
+                                              - PA_MIN(path->received_packets,
+                                                       path->expected_packets)));
+    }
+
+    return proplist;
+}
+
+static void sample(rocpulse_metrics_poller* poller) {
+    rocpulse_metrics metrics;
+
+    if (poller->query_cb(poller->userdata, &metrics) < 0) {
+        pa_log_debug("can't query roc metrics");
+        return;
+    }
+
+    pa_xfree(poller->json);
+    poller->json = format_json(&metrics);
+
+    /* updating proplist notifies clients, so do it only if something changed */
+    pa_proplist* proplist = format_proplist(poller, &metrics);
+
+    if (poller->proplist && pa_proplist_equal(poller->proplist, proplist)) {
+        pa_proplist_free(proplist);
+        return;
+    }
+
+    if (poller->proplist) {
+        pa_proplist_free(poller->proplist);
+    }
+    poller->proplist = proplist;
+
+    poller->update_cb(poller->userdata, proplist);
+}
+
+static void timer_cb(pa_mainloop_api* a,
+                     pa_time_event* e,
+                     const struct timeval* t,
+                     void* userdata) {
+    (void)a;
+    (void)t;
+
+    rocpulse_metrics_poller* poller = userdata;
+    pa_assert(poller);
+
+    sample(poller);
+
+    pa_core_rttime_restart(poller->core, e, pa_rtclock_now() + poller->interval);
+}
+
+#if PA_CHECK_VERSION(14, 99, 0)
+static int message_cb(const char* object_path,
+                      const char* message,
+                      const pa_json_object* parameters,
+                      char** response,
+                      void* userdata) {
+    (void)object_path;
+    (void)parameters;
+
+    rocpulse_metrics_poller* poller = userdata;
+    pa_assert(poller);
+
+    if (strcmp(message, "get-metrics") != 0) {
+        return -PA_ERR_NOTIMPLEMENTED;
+    }
+
+    if (!poller->json) {
+        return -PA_ERR_NODATA;
+    }
+
+    *response = pa_xstrdup(poller->json);
+
+    return PA_OK;
+}
+#endif // PA_CHECK_VERSION(14, 99, 0)
+
+rocpulse_metrics_poller* rocpulse_metrics_poller_new(pa_core* core,
+                                                     const char* object_path,
+                                                     pa_usec_t interval,
+                                                     rocpulse_metrics_query_cb query_cb,
+                                                     rocpulse_metrics_update_cb update_cb,
+                                                     void* userdata) {
+    pa_assert(core);
+    pa_assert(object_path);
+    pa_assert(interval > 0);
+    pa_assert(query_cb);
+    pa_assert(update_cb);
+
+    rocpulse_metrics_poller* poller = pa_xnew0(rocpulse_metrics_poller, 1);
+
+    poller->core = core;
+    poller->object_path = pa_xstrdup(object_path);
+    poller->interval = interval;
+    poller->query_cb = query_cb;
+    poller->update_cb = update_cb;
+    poller->userdata = userdata;
+
+    /* take first snapshot right away */
+    sample(poller);
+
+    poller->timer
+        = pa_core_rttime_new(core, pa_rtclock_now() + interval, timer_cb, poller);
+
+#if PA_CHECK_VERSION(14, 99, 0)
+    pa_message_handler_register(core, poller->object_path, "Roc metrics", message_cb,
+                                poller);
+#endif
+
+    return poller;
+}
+
+void rocpulse_metrics_poller_free(rocpulse_metrics_poller* poller) {
+    pa_assert(poller);
+
+#if PA_CHECK_VERSION(14, 99, 0)
+    pa_message_handler_unregister(poller->core, poller->object_path);
+#endif
+
+    if (poller->timer) {
+        poller->core->mainloop->time_free(poller->timer);
+    }
+
+    if (poller->proplist) {
+        pa_proplist_free(poller->proplist);
+    }
+
+    pa_xfree(poller->json);
+    pa_xfree(poller->object_path);
+    pa_xfree(poller);
+}
+
+char* rocpulse_metrics_object_path(const char* prefix, const char* name) {
+    pa_assert(prefix);
+    pa_assert(name);
+
+    char* path = pa_sprintf_malloc("%s/%s", prefix, name);
+
+    /* only alphanumeric characters and "_-./" are allowed */
+    for (char* c = path; *c; c++) {
+        if (!isalnum((unsigned char)*c) && !strchr("_-./", *c)) {
+            *c = '_';
+        }
+    }
+
+    return path;
+}
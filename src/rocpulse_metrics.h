@@ -0,0 +1,93 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* public pulseaudio headers */
+#include <pulse/proplist.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core.h>
+
+/* roc headers */
+#include <roc/receiver.h>
+#include <roc/sender.h>
+#include <roc/version.h>
+
+/* connections above this number are not reported */
+#define ROCPULSE_METRICS_MAX_CONNECTIONS 16
+
+/* primary and secondary path of redundant streaming */
+#define ROCPULSE_METRICS_MAX_PATHS 2
+
+/* statistics of one path of redundant streaming, summed over senders */
+typedef struct rocpulse_path_metrics {
+    /* source packets expected, received over this path, and received over
+     * this path earlier than over other path
+     */
+    uint64_t expected_packets;
+    uint64_t received_packets;
+    uint64_t first_packets;
+
+    /* packets received over both paths: mean and maximum difference between
+     * arrival over this path and over primary path
+     */
+    int64_t mean_skew;
+    pa_usec_t max_skew;
+} rocpulse_path_metrics;
+
+/* snapshot of roc sender or receiver metrics */
+typedef struct rocpulse_metrics {
+    /* when snapshot was taken */
+    pa_usec_t timestamp;
+
+    /* total number of connections, and connections reported below */
+    unsigned int connection_count;
+    size_t n_connections;
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+    roc_connection_metrics connections[ROCPULSE_METRICS_MAX_CONNECTIONS];
+#endif
+
+    /* zero if redundant streaming is not used */
+    size_t n_paths;
+    rocpulse_path_metrics paths[ROCPULSE_METRICS_MAX_PATHS];
+} rocpulse_metrics;
+
+/* query metrics from roc; roc sender and receiver are thread-safe, so these
+ * may be called from main loop while module thread is running
+ */
+int rocpulse_metrics_query_sender(roc_sender* sender, rocpulse_metrics* out);
+int rocpulse_metrics_query_receiver(roc_receiver* receiver, rocpulse_metrics* out);
+
+typedef int (*rocpulse_metrics_query_cb)(void* userdata, rocpulse_metrics* out);
+typedef void (*rocpulse_metrics_update_cb)(void* userdata, pa_proplist* proplist);
+
+/* periodically samples metrics on main loop and caches them
+ *
+ * cached metrics are returned as JSON by "get-metrics" message sent to given
+ * object path, and are mirrored into proplist passed to update callback
+ */
+typedef struct rocpulse_metrics_poller rocpulse_metrics_poller;
+
+rocpulse_metrics_poller* rocpulse_metrics_poller_new(pa_core* core,
+                                                     const char* object_path,
+                                                     pa_usec_t interval,
+                                                     rocpulse_metrics_query_cb query_cb,
+                                                     rocpulse_metrics_update_cb update_cb,
+                                                     void* userdata);
+
+void rocpulse_metrics_poller_free(rocpulse_metrics_poller* poller);
+
+/* build message object path from prefix and name, replacing characters not
+ * allowed in object paths
+ */
+char* rocpulse_metrics_object_path(const char* prefix, const char* name);
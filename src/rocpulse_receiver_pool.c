@@ -0,0 +1,1298 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <errno.h>
+#include <linux/filter.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* public pulseaudio headers */
+#include <pulse/rtclock.h>
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/mutex.h>
+#include <pulsecore/thread.h>
+
+/* roc headers */
+#include <roc/version.h>
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+#include <roc/packet.h>
+#include <roc/receiver_decoder.h>
+#endif
+
+/* local headers */
+#include "rocpulse_dedup.h"
+#include "rocpulse_receiver_pool.h"
+#include "rocpulse_shm.h"
+
+#if ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
+
+/* older libc headers don't have it */
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51
+#endif
+
+/* primary and secondary path of redundant streaming */
+#define MAX_PATHS 2
+
+/* senders served by one worker */
+#define MAX_SESSIONS 32
+
+/* local senders which connected, but haven't passed shared memory yet */
+#define MAX_HANDSHAKES 4
+
+/* packets read by one syscall */
+#define RECV_BATCH 32
+
+/* default max_packet_size of roc context */
+#define PACKET_SIZE 2048
+
+/* samples popped from decoder at once */
+#define MIX_BUF_SAMPLES 4096
+
+/* how often worker wakes up to send feedback and expire sessions */
+static const int poll_timeout_msec = 50;
+
+/* session without packets is removed after this timeout, unless receiver
+ * config sets no playback timeout
+ */
+static const pa_usec_t default_session_timeout = 2000000;
+
+/* local sender passes shared memory right after connecting, and connection is
+ * dropped if it doesn't
+ */
+static const pa_usec_t handshake_timeout = 1000000;
+
+/* also used as tags of shared memory packets, same as in batch sender */
+enum {
+    IFACE_SOURCE,
+    IFACE_REPAIR,
+    IFACE_CONTROL,
+    N_IFACES,
+};
+
+enum {
+    POLL_STOP,
+    POLL_SOCKET,
+    POLL_SHM_LISTEN,
+    POLL_SHM_HANDSHAKE,
+    POLL_SHM_EVENT,
+    POLL_SHM_CONN,
+};
+
+/* what is behind every entry of poll set */
+struct poll_entry {
+    int kind;
+    unsigned int path;
+    int iface;
+    size_t session;
+    size_t handshake;
+};
+
+static const roc_interface ifaces[N_IFACES] = {
+    ROC_INTERFACE_AUDIO_SOURCE,
+    ROC_INTERFACE_AUDIO_REPAIR,
+    ROC_INTERFACE_AUDIO_CONTROL,
+};
+
+/* stop pipe, sockets of all paths, shared memory listener, connections with
+ * pending handshake, and event and connection of every shared memory session
+ */
+#define MAX_POLL_FDS (2 + MAX_PATHS * N_IFACES + MAX_HANDSHAKES + 2 * MAX_SESSIONS)
+
+/* one sender, identified by its address without port, because source, repair,
+ * and control packets of one sender usually come from different ports
+ *
+ * with secondary path, sender has different address on every path, and is
+ * identified by SSRC of its source packets instead; address is remembered for
+ * every path to find sender of repair and control packets
+ */
+struct pool_session {
+    bool has_host[MAX_PATHS];
+    struct sockaddr_storage hosts[MAX_PATHS];
+    uint32_t ssrc;
+
+    roc_receiver_decoder* decoder;
+    pa_usec_t last_packet_time;
+
+    /* where feedback is sent; it's the address of sender control packets, on
+     * the path over which they came last
+     */
+    bool has_control_peer;
+    unsigned int control_path;
+    struct sockaddr_storage control_peer;
+    socklen_t control_peer_len;
+
+    /* with secondary path, drops copies; owned by worker, and its statistics
+     * are copied under mutex for main loop
+     */
+    rocpulse_dedup* dedup;
+    rocpulse_dedup_stats dedup_stats;
+
+    /* local sender connected over shared memory; it has no address and no
+     * timeout, and is removed when its connection is closed
+     */
+    rocpulse_shm* shm;
+    bool closed;
+};
+
+/* accepted connection of local sender; handshake is finished by worker when
+ * connection becomes readable, so that worker never blocks on it
+ */
+struct pool_handshake {
+    rocpulse_shm* shm;
+    pa_usec_t deadline;
+    bool readable;
+};
+
+struct pool_worker {
+    rocpulse_receiver_pool* pool;
+    unsigned int index;
+
+    rocpulse_sched_config sched_config;
+    pa_thread* thread;
+
+    /* sockets bound to local ports, one per active interface of every path */
+    int fds[MAX_PATHS][N_IFACES];
+
+    /* sessions are added and removed by worker; mutex protects them from
+     * concurrent access by sink thread and main loop, worker itself reads
+     * them without lock
+     */
+    pa_mutex* mutex;
+
+    /* held by main loop while it queries decoders outside of mutex, so that
+     * worker doesn't close them meanwhile; worker only tries to take it, and
+     * postpones removal of sessions if it's busy
+     */
+    pa_mutex* query_mutex;
+    struct pool_session sessions[MAX_SESSIONS];
+    size_t n_sessions;
+    bool full_warned;
+
+    struct pool_handshake handshakes[MAX_HANDSHAKES];
+    size_t n_handshakes;
+
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iovs[RECV_BATCH];
+    struct sockaddr_storage addrs[RECV_BATCH];
+    char bytes[RECV_BATCH][PACKET_SIZE];
+
+    char feedback_bytes[PACKET_SIZE];
+
+    /* rebuilt on every iteration, since shared memory sessions come and go */
+    struct pollfd pfds[MAX_POLL_FDS];
+    struct poll_entry poll_entries[MAX_POLL_FDS];
+};
+
+struct rocpulse_receiver_pool {
+    roc_context* context;
+    roc_receiver_config config;
+
+    bool iface_active[N_IFACES];
+    roc_protocol iface_proto[N_IFACES];
+
+    size_t n_paths;
+
+    /* unix socket on which local senders connect; polled by first worker */
+    char* shm_path;
+    int shm_listen_fd;
+
+    pa_usec_t session_timeout;
+
+    /* written when pool is freed, to wake up and stop all workers */
+    int stop_fds[2];
+
+    struct pool_worker* workers;
+    unsigned int n_workers;
+
+    /* used by sink thread */
+    float mix_buf[MIX_BUF_SAMPLES];
+    size_t mix_buf_samples;
+};
+
+static bool same_host(const struct sockaddr_storage* a,
+                      const struct sockaddr_storage* b) {
+    if (a->ss_family != b->ss_family) {
+        return false;
+    }
+
+    if (a->ss_family == AF_INET) {
+        return ((const struct sockaddr_in*)a)->sin_addr.s_addr
+            == ((const struct sockaddr_in*)b)->sin_addr.s_addr;
+    }
+
+    if (a->ss_family == AF_INET6) {
+        return memcmp(&((const struct sockaddr_in6*)a)->sin6_addr,
+                      &((const struct sockaddr_in6*)b)->sin6_addr,
+                      sizeof(struct in6_addr))
+            == 0;
+    }
+
+    return false;
+}
+
+static void format_host(const struct sockaddr_storage* addr, char* buf, size_t bufsz) {
+    if (getnameinfo((const struct sockaddr*)addr, sizeof(*addr), buf, (socklen_t)bufsz,
+                    NULL, 0, NI_NUMERICHOST)
+        != 0) {
+        pa_snprintf(buf, bufsz, "<unknown>");
+    }
+}
+
+static void close_decoder(roc_receiver_decoder* decoder) {
+    if (roc_receiver_decoder_close(decoder) != 0) {
+        pa_log("failed to close roc receiver decoder");
+    }
+}
+
+/* decoder and dedup of removed session, which sink thread doesn't see anymore */
+static void close_session(struct pool_session* session) {
+    close_decoder(session->decoder);
+    pa_xfree(session->dedup);
+
+    if (session->shm) {
+        rocpulse_shm_free(session->shm);
+    }
+}
+
+static const struct sockaddr_storage* session_host(const struct pool_session* session) {
+    for (size_t p = 0; p < MAX_PATHS; p++) {
+        if (session->has_host[p]) {
+            return &session->hosts[p];
+        }
+    }
+
+    return NULL;
+}
+
+/* host is NULL for local sender */
+static struct pool_session* add_session(struct pool_worker* worker,
+                                        unsigned int path,
+                                        const struct sockaddr_storage* host,
+                                        uint32_t ssrc) {
+    rocpulse_receiver_pool* pool = worker->pool;
+
+    if (worker->n_sessions == MAX_SESSIONS) {
+        if (!worker->full_warned) {
+            pa_log_warn("receive worker %u has too many senders, ignoring new ones",
+                        worker->index);
+            worker->full_warned = true;
+        }
+        return NULL;
+    }
+
+    roc_receiver_decoder* decoder = NULL;
+
+    if (roc_receiver_decoder_open(pool->context, &pool->config, &decoder) != 0) {
+        pa_log("can't create roc receiver decoder");
+        return NULL;
+    }
+
+    for (int i = 0; i < N_IFACES; i++) {
+        if (!pool->iface_active[i]) {
+            continue;
+        }
+
+        if (roc_receiver_decoder_activate(decoder, ifaces[i], pool->iface_proto[i])
+            != 0) {
+            pa_log("can't activate roc receiver decoder interface");
+            close_decoder(decoder);
+            return NULL;
+        }
+    }
+
+    rocpulse_dedup* dedup = NULL;
+
+    if (pool->n_paths > 1) {
+        dedup = pa_xnew(rocpulse_dedup, 1);
+        rocpulse_dedup_init(dedup);
+    }
+
+    if (host) {
+        char host_str[NI_MAXHOST];
+        format_host(host, host_str, sizeof(host_str));
+        pa_log_info("new sender %s on receive worker %u", host_str, worker->index);
+    } else {
+        pa_log_info("new local sender on receive worker %u", worker->index);
+    }
+
+    pa_mutex_lock(worker->mutex);
+
+    struct pool_session* session = &worker->sessions[worker->n_sessions++];
+    memset(session, 0, sizeof(*session));
+    if (host) {
+        session->has_host[path] = true;
+        session->hosts[path] = *host;
+    }
+    session->ssrc = ssrc;
+    session->decoder = decoder;
+    session->dedup = dedup;
+
+    pa_mutex_unlock(worker->mutex);
+
+    return session;
+}
+
+static struct pool_session* find_session(struct pool_worker* worker,
+                                         unsigned int path,
+                                         const struct sockaddr_storage* host) {
+    for (size_t n = 0; n < worker->n_sessions; n++) {
+        struct pool_session* session = &worker->sessions[n];
+
+        if (session->has_host[path] && same_host(&session->hosts[path], host)) {
+            return session;
+        }
+    }
+
+    return NULL;
+}
+
+/* with secondary path, find sender of source packet by SSRC, and remember its
+ * address on this path
+ */
+static struct pool_session* find_session_by_ssrc(struct pool_worker* worker,
+                                                 unsigned int path,
+                                                 const struct sockaddr_storage* host,
+                                                 uint32_t ssrc) {
+    for (size_t n = 0; n < worker->n_sessions; n++) {
+        struct pool_session* session = &worker->sessions[n];
+
+        if (session->ssrc != ssrc) {
+            continue;
+        }
+
+        if (!session->has_host[path] || !same_host(&session->hosts[path], host)) {
+            char host_str[NI_MAXHOST];
+            format_host(host, host_str, sizeof(host_str));
+            pa_log_info("sender with SSRC %u is %s on %s path", ssrc, host_str,
+                        path == 0 ? "primary" : "secondary");
+
+            session->has_host[path] = true;
+            session->hosts[path] = *host;
+        }
+
+        return session;
+    }
+
+    return NULL;
+}
+
+static void expire_sessions(struct pool_worker* worker, pa_usec_t now) {
+    bool query_locked = false;
+
+    for (size_t n = 0; n < worker->n_sessions;) {
+        struct pool_session* session = &worker->sessions[n];
+
+        if (session->shm) {
+            if (!session->closed) {
+                n++;
+                continue;
+            }
+
+            pa_log_info("local sender on receive worker %u disconnected", worker->index);
+        } else {
+            if (now - session->last_packet_time < worker->pool->session_timeout) {
+                n++;
+                continue;
+            }
+
+            char host_str[NI_MAXHOST];
+            format_host(session_host(session), host_str, sizeof(host_str));
+            pa_log_info("sender %s on receive worker %u timed out", host_str,
+                        worker->index);
+        }
+
+        /* main loop is querying decoders; retry on next iteration */
+        if (!query_locked) {
+            if (!pa_mutex_try_lock(worker->query_mutex)) {
+                break;
+            }
+            query_locked = true;
+        }
+
+        struct pool_session removed = *session;
+
+        pa_mutex_lock(worker->mutex);
+        *session = worker->sessions[--worker->n_sessions];
+        pa_mutex_unlock(worker->mutex);
+
+        close_session(&removed);
+        worker->full_warned = false;
+    }
+
+    if (query_locked) {
+        pa_mutex_unlock(worker->query_mutex);
+    }
+}
+
+/* with secondary path, find sender of packet and tell whether it's the first
+ * copy of packet
+ */
+static struct pool_session* dedup_packet(struct pool_worker* worker,
+                                         unsigned int path,
+                                         int iface,
+                                         int n,
+                                         pa_usec_t now,
+                                         bool* is_first) {
+    const void* bytes = worker->bytes[n];
+    const size_t size = worker->msgs[n].msg_len;
+    struct pool_session* session = NULL;
+
+    if (iface != IFACE_SOURCE) {
+        if ((session = find_session(worker, path, &worker->addrs[n]))) {
+            *is_first = rocpulse_dedup_add_other(session->dedup, bytes, size);
+        }
+        return session;
+    }
+
+    uint16_t seqnum = 0;
+    uint32_t ssrc = 0;
+
+    if (!rocpulse_dedup_parse_rtp(bytes, size, &seqnum, &ssrc)) {
+        return NULL;
+    }
+
+    if (!(session = find_session_by_ssrc(worker, path, &worker->addrs[n], ssrc))) {
+        session = add_session(worker, path, &worker->addrs[n], ssrc);
+    }
+
+    if (session) {
+        *is_first = rocpulse_dedup_add_source(session->dedup, path, seqnum, now);
+    }
+
+    return session;
+}
+
+static void receive_packets(struct pool_worker* worker, unsigned int path, int iface) {
+    for (int n = 0; n < RECV_BATCH; n++) {
+        worker->msgs[n].msg_hdr.msg_namelen = sizeof(worker->addrs[n]);
+    }
+
+    int ret = recvmmsg(worker->fds[path][iface], worker->msgs, RECV_BATCH, MSG_DONTWAIT,
+                       NULL);
+    if (ret <= 0) {
+        return;
+    }
+
+    const pa_usec_t now = pa_rtclock_now();
+
+    for (int n = 0; n < ret; n++) {
+        struct pool_session* session = NULL;
+        bool is_first = true;
+
+        if (worker->pool->n_paths > 1) {
+            session = dedup_packet(worker, path, iface, n, now, &is_first);
+        } else {
+            session = find_session(worker, path, &worker->addrs[n]);
+
+            /* like roc, start new session only when source packets arrive */
+            if (!session && iface == IFACE_SOURCE) {
+                session = add_session(worker, path, &worker->addrs[n], 0);
+            }
+        }
+        if (!session) {
+            continue;
+        }
+
+        session->last_packet_time = now;
+
+        if (iface == IFACE_CONTROL) {
+            session->control_path = path;
+            session->control_peer = worker->addrs[n];
+            session->control_peer_len = worker->msgs[n].msg_hdr.msg_namelen;
+            session->has_control_peer = true;
+        }
+
+        /* copy from other path, already passed to decoder */
+        if (!is_first) {
+            continue;
+        }
+
+        roc_packet packet;
+        packet.bytes = worker->bytes[n];
+        packet.bytes_size = worker->msgs[n].msg_len;
+
+        /* malformed packets are just ignored by roc */
+        (void)roc_receiver_decoder_push_packet(session->decoder, ifaces[iface], &packet);
+    }
+}
+
+/* packets written by local sender since last wakeup */
+static void receive_shm(struct pool_worker* worker, struct pool_session* session) {
+    rocpulse_shm_clear_event(session->shm);
+
+    size_t size = 0;
+    unsigned int tag = 0;
+
+    while ((size = rocpulse_shm_read(session->shm, &tag, worker->bytes[0], PACKET_SIZE))
+           > 0) {
+        if (tag >= N_IFACES || !worker->pool->iface_active[tag]) {
+            continue;
+        }
+
+        session->last_packet_time = pa_rtclock_now();
+
+        roc_packet packet;
+        packet.bytes = worker->bytes[0];
+        packet.bytes_size = size;
+
+        (void)roc_receiver_decoder_push_packet(session->decoder, ifaces[tag], &packet);
+    }
+
+    if (rocpulse_shm_is_broken(session->shm)) {
+        session->closed = true;
+    }
+}
+
+/* handshake is tried right away, since sender usually passes memory together
+ * with connecting
+ */
+static void accept_shm(struct pool_worker* worker) {
+    rocpulse_shm* shm = rocpulse_shm_accept(worker->pool->shm_listen_fd);
+    if (!shm) {
+        return;
+    }
+
+    struct pool_handshake* handshake = &worker->handshakes[worker->n_handshakes++];
+    handshake->shm = shm;
+    handshake->deadline = pa_rtclock_now() + handshake_timeout;
+    handshake->readable = true;
+}
+
+static void add_shm_session(struct pool_worker* worker, rocpulse_shm* shm) {
+    struct pool_session* session = add_session(worker, 0, NULL, 0);
+    if (!session) {
+        rocpulse_shm_free(shm);
+        return;
+    }
+
+    /* not seen by sink thread and main loop, so no lock */
+    session->shm = shm;
+    session->last_packet_time = pa_rtclock_now();
+}
+
+/* turn local senders that passed shared memory into sessions, and drop the
+ * ones that failed or didn't pass it in time
+ */
+static void finish_handshakes(struct pool_worker* worker, pa_usec_t now) {
+    for (size_t n = 0; n < worker->n_handshakes;) {
+        struct pool_handshake* handshake = &worker->handshakes[n];
+
+        int ret = 0;
+        if (handshake->readable) {
+            handshake->readable = false;
+            ret = rocpulse_shm_handshake(handshake->shm);
+        }
+
+        if (ret == 0 && now < handshake->deadline) {
+            n++;
+            continue;
+        }
+
+        if (ret == 0) {
+            pa_log_warn("local sender on receive worker %u didn't pass shared memory",
+                        worker->index);
+        }
+
+        rocpulse_shm* shm = handshake->shm;
+        *handshake = worker->handshakes[--worker->n_handshakes];
+
+        if (ret > 0) {
+            add_shm_session(worker, shm);
+        } else {
+            rocpulse_shm_free(shm);
+        }
+    }
+}
+
+static void send_feedback(struct pool_worker* worker) {
+    for (size_t n = 0; n < worker->n_sessions; n++) {
+        struct pool_session* session = &worker->sessions[n];
+
+        if (!session->shm && !session->has_control_peer) {
+            continue;
+        }
+
+        for (;;) {
+            roc_packet packet;
+            packet.bytes = worker->feedback_bytes;
+            packet.bytes_size = sizeof(worker->feedback_bytes);
+
+            if (roc_receiver_decoder_pop_feedback_packet(
+                    session->decoder, ROC_INTERFACE_AUDIO_CONTROL, &packet)
+                != 0) {
+                /* no more packets */
+                break;
+            }
+
+            if (session->shm) {
+                (void)rocpulse_shm_write(session->shm, IFACE_CONTROL, packet.bytes,
+                                         packet.bytes_size);
+                continue;
+            }
+
+            /* if socket buffer is full, packet is dropped, as roc does */
+            (void)sendto(worker->fds[session->control_path][IFACE_CONTROL], packet.bytes,
+                         packet.bytes_size, MSG_DONTWAIT,
+                         (const struct sockaddr*)&session->control_peer,
+                         session->control_peer_len);
+        }
+    }
+}
+
+/* make statistics of redundant streaming visible to main loop */
+static void publish_stats(struct pool_worker* worker) {
+    if (worker->pool->n_paths == 1) {
+        return;
+    }
+
+    pa_mutex_lock(worker->mutex);
+
+    for (size_t n = 0; n < worker->n_sessions; n++) {
+        worker->sessions[n].dedup_stats = worker->sessions[n].dedup->stats;
+    }
+
+    pa_mutex_unlock(worker->mutex);
+}
+
+static void add_poll_fd(
+    struct pool_worker* worker, int* n_pfds, int fd, int kind, struct poll_entry entry) {
+    worker->pfds[*n_pfds].fd = fd;
+    worker->pfds[*n_pfds].events = POLLIN;
+    worker->pfds[*n_pfds].revents = 0;
+    worker->poll_entries[*n_pfds] = entry;
+    worker->poll_entries[*n_pfds].kind = kind;
+    (*n_pfds)++;
+}
+
+static int build_poll_set(struct pool_worker* worker) {
+    rocpulse_receiver_pool* pool = worker->pool;
+
+    struct poll_entry entry;
+    memset(&entry, 0, sizeof(entry));
+
+    int n_pfds = 0;
+
+    add_poll_fd(worker, &n_pfds, pool->stop_fds[0], POLL_STOP, entry);
+
+    for (unsigned int p = 0; p < MAX_PATHS; p++) {
+        for (int i = 0; i < N_IFACES; i++) {
+            if (worker->fds[p][i] >= 0) {
+                entry.path = p;
+                entry.iface = i;
+                add_poll_fd(worker, &n_pfds, worker->fds[p][i], POLL_SOCKET, entry);
+            }
+        }
+    }
+
+    /* when there are too many pending handshakes, new connections wait in
+     * backlog of listening socket
+     */
+    if (worker->index == 0 && pool->shm_listen_fd >= 0
+        && worker->n_handshakes < MAX_HANDSHAKES) {
+        add_poll_fd(worker, &n_pfds, pool->shm_listen_fd, POLL_SHM_LISTEN, entry);
+    }
+
+    for (size_t n = 0; n < worker->n_handshakes; n++) {
+        entry.handshake = n;
+        add_poll_fd(worker, &n_pfds, rocpulse_shm_conn_fd(worker->handshakes[n].shm),
+                    POLL_SHM_HANDSHAKE, entry);
+    }
+
+    for (size_t n = 0; n < worker->n_sessions; n++) {
+        rocpulse_shm* shm = worker->sessions[n].shm;
+
+        if (shm && !worker->sessions[n].closed) {
+            entry.session = n;
+            add_poll_fd(worker, &n_pfds, rocpulse_shm_event_fd(shm), POLL_SHM_EVENT,
+                        entry);
+            add_poll_fd(worker, &n_pfds, rocpulse_shm_conn_fd(shm), POLL_SHM_CONN,
+                        entry);
+        }
+    }
+
+    return n_pfds;
+}
+
+static void worker_thread(void* userdata) {
+    struct pool_worker* worker = userdata;
+    pa_assert(worker);
+
+    rocpulse_sched_state sched_state;
+    rocpulse_sched_apply(&worker->sched_config, &sched_state);
+
+    pa_log_debug("receive worker %u started", worker->index);
+
+    for (;;) {
+        const int n_pfds = build_poll_set(worker);
+
+        if (poll(worker->pfds, (nfds_t)n_pfds, poll_timeout_msec) < 0
+            && errno != EINTR) {
+            pa_log("receive worker %u can't poll sockets: %s", worker->index,
+                   pa_cstrerror(errno));
+            break;
+        }
+
+        if (worker->pfds[0].revents) {
+            break;
+        }
+
+        /* handshakes are only appended in this loop, and sessions are added
+         * and removed after it, so indices in poll set stay valid
+         */
+        for (int n = 1; n < n_pfds; n++) {
+            const struct poll_entry* entry = &worker->poll_entries[n];
+
+            if (!worker->pfds[n].revents) {
+                continue;
+            }
+
+            switch (entry->kind) {
+            case POLL_SOCKET:
+                if (worker->pfds[n].revents & POLLIN) {
+                    receive_packets(worker, entry->path, entry->iface);
+                }
+                break;
+
+            case POLL_SHM_LISTEN:
+                accept_shm(worker);
+                break;
+
+            case POLL_SHM_HANDSHAKE:
+                worker->handshakes[entry->handshake].readable = true;
+                break;
+
+            case POLL_SHM_EVENT:
+                receive_shm(worker, &worker->sessions[entry->session]);
+                break;
+
+            case POLL_SHM_CONN:
+                /* nothing is sent over connection after handshake, so it's
+                 * hangup; drain packets written before sender went away
+                 */
+                receive_shm(worker, &worker->sessions[entry->session]);
+                worker->sessions[entry->session].closed = true;
+                break;
+            }
+        }
+
+        const pa_usec_t now = pa_rtclock_now();
+
+        finish_handshakes(worker, now);
+        publish_stats(worker);
+        send_feedback(worker);
+        expire_sessions(worker, now);
+    }
+
+    pa_log_debug("receive worker %u stopped", worker->index);
+}
+
+static int open_socket(const rocpulse_address* addr) {
+    int fd = socket(addr->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        pa_log("can't create socket: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        pa_log("can't enable SO_REUSEPORT: %s", pa_cstrerror(errno));
+        pa_close(fd);
+        return -1;
+    }
+
+    if (bind(fd, (const struct sockaddr*)&addr->addr, addr->addr_len) < 0) {
+        pa_log("can't bind socket to local address: %s", pa_cstrerror(errno));
+        pa_close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* by default, kernel chooses socket of reuseport group by hash of source and
+ * destination addresses and ports, and packets of one sender sent to different
+ * ports may go to different workers; instead, choose socket by source address,
+ * ignoring port; IPv4 and IPv6 headers are told apart by version field, since
+ * IPv6 socket may receive both
+ */
+static int attach_steering(int fd, unsigned int n_workers) {
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 2),
+        /* IPv4: source address */
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 12),
+        BPF_STMT(BPF_JMP | BPF_JA, 1),
+        /* IPv6: last 4 bytes of source address */
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_NET_OFF + 20),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, n_workers),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+
+    struct sock_fprog prog;
+    memset(&prog, 0, sizeof(prog));
+    prog.len = sizeof(code) / sizeof(code[0]);
+    prog.filter = code;
+
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+/* bind sockets of all workers to one address; if port is zero, all of them
+ * use the port chosen for the first one
+ */
+static int bind_iface(rocpulse_receiver_pool* pool,
+                      unsigned int path,
+                      int iface,
+                      const rocpulse_address* addr) {
+    rocpulse_address bind_addr = *addr;
+
+    for (unsigned int w = 0; w < pool->n_workers; w++) {
+        if ((pool->workers[w].fds[path][iface] = open_socket(&bind_addr)) < 0) {
+            return -1;
+        }
+
+        if (w == 0) {
+            bind_addr.addr_len = sizeof(bind_addr.addr);
+            if (getsockname(pool->workers[w].fds[path][iface],
+                            (struct sockaddr*)&bind_addr.addr, &bind_addr.addr_len)
+                < 0) {
+                pa_log("can't get socket address: %s", pa_cstrerror(errno));
+                return -1;
+            }
+        }
+    }
+
+    if (pool->n_workers > 1) {
+        if (attach_steering(pool->workers[0].fds[path][iface], pool->n_workers) < 0) {
+            pa_log_warn("can't steer packets by source address: %s, falling back to "
+                        "kernel hashing, FEC and RTCP may not work",
+                        pa_cstrerror(errno));
+        }
+    }
+
+    return 0;
+}
+
+/* n-th cpu of the set, counting from zero */
+static int nth_cpu(const cpu_set_t* cpus, unsigned int n) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, cpus) && n-- == 0) {
+            return cpu;
+        }
+    }
+
+    return -1;
+}
+
+rocpulse_receiver_pool* rocpulse_receiver_pool_new(roc_context* context,
+                                                   const roc_receiver_config* config,
+                                                   roc_fec_encoding fec_encoding,
+                                                   const rocpulse_address* source_addr,
+                                                   const rocpulse_address* repair_addr,
+                                                   const rocpulse_address* control_addr,
+                                                   const rocpulse_path* secondary,
+                                                   const char* shm_path,
+                                                   unsigned int n_workers,
+                                                   const rocpulse_sched_config* sched) {
+    pa_assert(context);
+    pa_assert(config);
+    pa_assert(source_addr);
+    pa_assert(control_addr);
+    pa_assert(n_workers > 0);
+    pa_assert(sched);
+
+    rocpulse_receiver_pool* pool = pa_xnew0(rocpulse_receiver_pool, 1);
+    pool->stop_fds[0] = pool->stop_fds[1] = -1;
+    pool->shm_listen_fd = -1;
+    pool->n_paths = secondary ? 2 : 1;
+
+    pool->context = context;
+    pool->config = *config;
+    pool->session_timeout = config->no_playback_timeout > 0
+        ? (pa_usec_t)config->no_playback_timeout / 1000
+        : default_session_timeout;
+
+    const rocpulse_address* addrs[MAX_PATHS][N_IFACES] = {
+        {
+            source_addr,
+            repair_addr,
+            control_addr,
+        },
+        {
+            secondary ? &secondary->source_addr : NULL,
+            secondary && repair_addr ? &secondary->repair_addr : NULL,
+            secondary ? &secondary->control_addr : NULL,
+        },
+    };
+
+    /* copies of packets of one sender must reach the same worker, but
+     * steering can't match addresses of sender on different paths
+     */
+    if (secondary && n_workers > 1) {
+        pa_log("secondary path requires single receive worker");
+        goto error;
+    }
+
+    /* keep whole frames in every piece popped from decoder */
+    pa_sample_spec sample_spec;
+    if (rocpulse_extract_encoding(&config->frame_encoding, PA_SAMPLE_FLOAT32LE,
+                                  &sample_spec)
+        < 0) {
+        goto error;
+    }
+    pool->mix_buf_samples = MIX_BUF_SAMPLES - MIX_BUF_SAMPLES % sample_spec.channels;
+
+    if (pa_pipe_cloexec(pool->stop_fds) < 0) {
+        pa_log("can't create pipe: %s", pa_cstrerror(errno));
+        goto error;
+    }
+
+    pool->workers = pa_xnew0(struct pool_worker, n_workers);
+    pool->n_workers = n_workers;
+
+    for (unsigned int w = 0; w < n_workers; w++) {
+        for (unsigned int p = 0; p < MAX_PATHS; p++) {
+            for (int i = 0; i < N_IFACES; i++) {
+                pool->workers[w].fds[p][i] = -1;
+            }
+        }
+    }
+
+    /* workers bind sockets in the same order, so that index of worker is index
+     * of its socket in every reuseport group
+     */
+    for (unsigned int p = 0; p < pool->n_paths; p++) {
+        for (int i = 0; i < N_IFACES; i++) {
+            if (!addrs[p][i]) {
+                continue;
+            }
+
+            if (rocpulse_select_protocol(&pool->iface_proto[i], ifaces[i], fec_encoding)
+                < 0) {
+                goto error;
+            }
+
+            if (bind_iface(pool, p, i, addrs[p][i]) < 0) {
+                goto error;
+            }
+
+            pool->iface_active[i] = true;
+        }
+    }
+
+    if (shm_path) {
+        if ((pool->shm_listen_fd = rocpulse_shm_listen(shm_path)) < 0) {
+            goto error;
+        }
+        pool->shm_path = pa_xstrdup(shm_path);
+    }
+
+    /* pin every worker to its own cpu */
+    cpu_set_t cpus;
+    if (sched->has_cpu_affinity) {
+        cpus = sched->cpu_affinity;
+    } else if (sched_getaffinity(0, sizeof(cpus), &cpus) < 0) {
+        CPU_ZERO(&cpus);
+    }
+
+    const unsigned int n_cpus = (unsigned int)CPU_COUNT(&cpus);
+
+    for (unsigned int w = 0; w < n_workers; w++) {
+        struct pool_worker* worker = &pool->workers[w];
+
+        worker->pool = pool;
+        worker->index = w;
+        worker->mutex = pa_mutex_new(false, true);
+        worker->query_mutex = pa_mutex_new(false, false);
+
+        for (int n = 0; n < RECV_BATCH; n++) {
+            worker->iovs[n].iov_base = worker->bytes[n];
+            worker->iovs[n].iov_len = PACKET_SIZE;
+            worker->msgs[n].msg_hdr.msg_iov = &worker->iovs[n];
+            worker->msgs[n].msg_hdr.msg_iovlen = 1;
+            worker->msgs[n].msg_hdr.msg_name = &worker->addrs[n];
+        }
+
+        worker->sched_config.rt_priority = sched->rt_priority;
+
+        if (n_cpus > 0) {
+            worker->sched_config.has_cpu_affinity = true;
+            CPU_ZERO(&worker->sched_config.cpu_affinity);
+            CPU_SET(nth_cpu(&cpus, w % n_cpus), &worker->sched_config.cpu_affinity);
+        }
+    }
+
+    for (unsigned int w = 0; w < n_workers; w++) {
+        char name[32];
+        pa_snprintf(name, sizeof(name), "roc-receive-%u", w);
+
+        if (!(pool->workers[w].thread
+              = pa_thread_new(name, worker_thread, &pool->workers[w]))) {
+            pa_log("can't start receive worker thread");
+            goto error;
+        }
+    }
+
+    pa_log_info("receiver pool is ready, %u workers, %u path(s)", n_workers,
+                (unsigned)pool->n_paths);
+
+    return pool;
+
+error:
+    rocpulse_receiver_pool_free(pool);
+    return NULL;
+}
+
+void rocpulse_receiver_pool_free(rocpulse_receiver_pool* pool) {
+    pa_assert(pool);
+
+    /* pipe stays readable, so every worker sees it */
+    if (pool->stop_fds[1] >= 0) {
+        const char c = 0;
+        if (write(pool->stop_fds[1], &c, 1) != 1) {
+            pa_log("can't wake up receive workers: %s", pa_cstrerror(errno));
+        }
+    }
+
+    for (unsigned int w = 0; w < pool->n_workers; w++) {
+        if (pool->workers[w].thread) {
+            pa_thread_free(pool->workers[w].thread);
+        }
+    }
+
+    for (unsigned int w = 0; w < pool->n_workers; w++) {
+        struct pool_worker* worker = &pool->workers[w];
+
+        for (size_t n = 0; n < worker->n_sessions; n++) {
+            close_session(&worker->sessions[n]);
+        }
+
+        for (size_t n = 0; n < worker->n_handshakes; n++) {
+            rocpulse_shm_free(worker->handshakes[n].shm);
+        }
+
+        for (unsigned int p = 0; p < MAX_PATHS; p++) {
+            for (int i = 0; i < N_IFACES; i++) {
+                if (worker->fds[p][i] >= 0) {
+                    pa_close(worker->fds[p][i]);
+                }
+            }
+        }
+
+        if (worker->mutex) {
+            pa_mutex_free(worker->mutex);
+        }
+        if (worker->query_mutex) {
+            pa_mutex_free(worker->query_mutex);
+        }
+    }
+
+    for (int n = 0; n < 2; n++) {
+        if (pool->stop_fds[n] >= 0) {
+            pa_close(pool->stop_fds[n]);
+        }
+    }
+
+    if (pool->shm_listen_fd >= 0) {
+        pa_close(pool->shm_listen_fd);
+        unlink(pool->shm_path);
+    }
+
+    pa_xfree(pool->shm_path);
+    pa_xfree(pool->workers);
+    pa_xfree(pool);
+}
+
+static void mix_session(rocpulse_receiver_pool* pool,
+                        roc_receiver_decoder* decoder,
+                        float* samples,
+                        size_t n_samples) {
+    while (n_samples > 0) {
+        size_t n = PA_MIN(n_samples, pool->mix_buf_samples);
+
+        roc_frame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.samples = pool->mix_buf;
+        frame.samples_size = n * sizeof(float);
+
+        if (roc_receiver_decoder_pop_frame(decoder, &frame) != 0) {
+            /* session adds silence */
+            return;
+        }
+
+        for (size_t k = 0; k < n; k++) {
+            samples[k] += pool->mix_buf[k];
+        }
+
+        samples += n;
+        n_samples -= n;
+    }
+}
+
+int rocpulse_receiver_pool_read(rocpulse_receiver_pool* pool,
+                                float* samples,
+                                size_t n_samples) {
+    pa_assert(pool);
+    pa_assert(samples);
+
+    memset(samples, 0, n_samples * sizeof(float));
+
+    size_t n_sessions = 0;
+
+    for (unsigned int w = 0; w < pool->n_workers; w++) {
+        struct pool_worker* worker = &pool->workers[w];
+
+        pa_mutex_lock(worker->mutex);
+
+        for (size_t n = 0; n < worker->n_sessions; n++) {
+            mix_session(pool, worker->sessions[n].decoder, samples, n_samples);
+        }
+        n_sessions += worker->n_sessions;
+
+        pa_mutex_unlock(worker->mutex);
+    }
+
+    /* like roc mixer, clip sum of several senders */
+    if (n_sessions > 1) {
+        for (size_t n = 0; n < n_samples; n++) {
+            samples[n] = PA_CLAMP(samples[n], -1.0f, 1.0f);
+        }
+    }
+
+    return 0;
+}
+
+int rocpulse_receiver_pool_query(rocpulse_receiver_pool* pool, rocpulse_metrics* out) {
+    pa_assert(pool);
+    pa_assert(out);
+
+    memset(out, 0, sizeof(*out));
+    out->timestamp = pa_rtclock_now();
+
+    rocpulse_dedup_stats dedup_stats;
+    memset(&dedup_stats, 0, sizeof(dedup_stats));
+
+    for (unsigned int w = 0; w < pool->n_workers; w++) {
+        struct pool_worker* worker = &pool->workers[w];
+
+        /* sink thread takes mutex on every read, so it's held only to copy
+         * decoders, which are then queried without it; query_mutex keeps them
+         * open until then
+         */
+        roc_receiver_decoder* decoders[MAX_SESSIONS];
+        size_t n_decoders = 0;
+
+        pa_mutex_lock(worker->query_mutex);
+        pa_mutex_lock(worker->mutex);
+
+        for (size_t n = 0; n < worker->n_sessions; n++) {
+            rocpulse_dedup_stats_add(&dedup_stats, &worker->sessions[n].dedup_stats);
+            decoders[n_decoders++] = worker->sessions[n].decoder;
+        }
+
+        pa_mutex_unlock(worker->mutex);
+
+        for (size_t n = 0; n < n_decoders; n++) {
+            roc_receiver_metrics receiver_metrics;
+            memset(&receiver_metrics, 0, sizeof(receiver_metrics));
+
+            /* decoder has at most one connection, to its sender */
+            roc_connection_metrics conn_metrics;
+            memset(&conn_metrics, 0, sizeof(conn_metrics));
+
+            if (roc_receiver_decoder_query(decoders[n], &receiver_metrics,
+                                           &conn_metrics)
+                != 0) {
+                continue;
+            }
+
+            out->connection_count += receiver_metrics.connection_count;
+
+            /* connections that don't fit are only counted */
+            if (receiver_metrics.connection_count > 0
+                && out->n_connections < ROCPULSE_METRICS_MAX_CONNECTIONS) {
+                out->connections[out->n_connections++] = conn_metrics;
+            }
+        }
+
+        pa_mutex_unlock(worker->query_mutex);
+    }
+
+    if (pool->n_paths > 1) {
+        out->n_paths = pool->n_paths;
+        rocpulse_dedup_stats_report(&dedup_stats, out->paths);
+    }
+
+    return 0;
+}
+
+#else // ROC_VERSION < ROC_VERSION_CODE(0, 4, 0)
+
+rocpulse_receiver_pool* rocpulse_receiver_pool_new(roc_context* context,
+                                                   const roc_receiver_config* config,
+                                                   roc_fec_encoding fec_encoding,
+                                                   const rocpulse_address* source_addr,
+                                                   const rocpulse_address* repair_addr,
+                                                   const rocpulse_address* control_addr,
+                                                   const rocpulse_path* secondary,
+                                                   const char* shm_path,
+                                                   unsigned int n_workers,
+                                                   const rocpulse_sched_config* sched) {
+    (void)context;
+    (void)config;
+    (void)fec_encoding;
+    (void)source_addr;
+    (void)repair_addr;
+    (void)control_addr;
+    (void)secondary;
+    (void)shm_path;
+    (void)n_workers;
+    (void)sched;
+
+    pa_log("receiver pool requires Roc Toolkit 0.4 or later");
+    return NULL;
+}
+
+void rocpulse_receiver_pool_free(rocpulse_receiver_pool* pool) {
+    (void)pool;
+}
+
+int rocpulse_receiver_pool_read(rocpulse_receiver_pool* pool,
+                                float* samples,
+                                size_t n_samples) {
+    (void)pool;
+    (void)samples;
+    (void)n_samples;
+
+    return -1;
+}
+
+int rocpulse_receiver_pool_query(rocpulse_receiver_pool* pool, rocpulse_metrics* out) {
+    (void)pool;
+    (void)out;
+
+    return -1;
+}
+
+#endif // ROC_VERSION >= ROC_VERSION_CODE(0, 4, 0)
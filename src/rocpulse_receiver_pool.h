@@ -0,0 +1,75 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <stddef.h>
+
+/* roc headers */
+#include <roc/config.h>
+#include <roc/context.h>
+
+/* local headers */
+#include "rocpulse_helpers.h"
+#include "rocpulse_metrics.h"
+#include "rocpulse_sched.h"
+
+/* roc receiver that spreads incoming sessions across several threads
+ *
+ * roc_receiver reads and decodes packets of all senders on one network
+ * thread; instead, every worker of the pool binds its own SO_REUSEPORT socket
+ * to the same local ports, and kernel steers packets to workers by source
+ * address, so that all packets of one sender always reach the same worker;
+ * worker runs a roc decoder per sender and is pinned to its own cpu
+ *
+ * with secondary path, pool also binds to local ports of that path, and
+ * senders send copies of every packet over both paths; copies of one packet
+ * are found by RTP sequence number (source) or contents (repair, control),
+ * and only the first one is decoded; requires single worker
+ *
+ * with shared memory path, pool also listens on unix socket, and local
+ * senders that connect to it pass packets over shared memory; first worker
+ * serves them, and they are removed when connection is closed
+ *
+ * read mixes frames of all senders, like roc_receiver does; read should be
+ * called from one thread (sink thread); query may be called concurrently from
+ * main loop, and doesn't block read while it queries decoders; requires Roc
+ * Toolkit 0.4 or later
+ */
+typedef struct rocpulse_receiver_pool rocpulse_receiver_pool;
+
+/* returns NULL on error; FEC encoding selects protocols of local ports, and
+ * repair address should be NULL if FEC is disabled; secondary path is
+ * optional, and its bind address is not used; shared memory path is optional
+ * too, and is path of unix socket to listen on; workers use rt priority from
+ * sched config, and are distributed over its cpus, or over all allowed cpus
+ * if affinity is not set
+ */
+rocpulse_receiver_pool* rocpulse_receiver_pool_new(roc_context* context,
+                                                   const roc_receiver_config* config,
+                                                   roc_fec_encoding fec_encoding,
+                                                   const rocpulse_address* source_addr,
+                                                   const rocpulse_address* repair_addr,
+                                                   const rocpulse_address* control_addr,
+                                                   const rocpulse_path* secondary,
+                                                   const char* shm_path,
+                                                   unsigned int n_workers,
+                                                   const rocpulse_sched_config* sched);
+
+void rocpulse_receiver_pool_free(rocpulse_receiver_pool* pool);
+
+/* fill interleaved samples with mix of all senders; silence if there are none */
+int rocpulse_receiver_pool_read(rocpulse_receiver_pool* pool,
+                                float* samples,
+                                size_t n_samples);
+
+int rocpulse_receiver_pool_query(rocpulse_receiver_pool* pool, rocpulse_metrics* out);
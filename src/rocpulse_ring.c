@@ -0,0 +1,102 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <string.h>
+
+/* public pulseaudio headers */
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/macro.h>
+
+/* local headers */
+#include "rocpulse_ring.h"
+
+void rocpulse_ring_init(rocpulse_ring* ring, size_t size) {
+    pa_assert(ring);
+
+    ring->buf = size ? pa_xmalloc(size) : NULL;
+    ring->size = size;
+    ring->head = 0;
+    ring->length = 0;
+}
+
+void rocpulse_ring_done(rocpulse_ring* ring) {
+    pa_assert(ring);
+
+    pa_xfree(ring->buf);
+    memset(ring, 0, sizeof(*ring));
+}
+
+size_t rocpulse_ring_length(const rocpulse_ring* ring) {
+    pa_assert(ring);
+
+    return ring->length;
+}
+
+size_t rocpulse_ring_free(const rocpulse_ring* ring) {
+    pa_assert(ring);
+
+    return ring->size - ring->length;
+}
+
+void rocpulse_ring_write(rocpulse_ring* ring, const void* data, size_t size) {
+    pa_assert(ring);
+    pa_assert(size <= rocpulse_ring_free(ring));
+
+    const char* src = data;
+
+    while (size > 0) {
+        size_t tail = (ring->head + ring->length) % ring->size;
+        size_t n = PA_MIN(size, ring->size - tail);
+
+        memcpy(ring->buf + tail, src, n);
+
+        ring->length += n;
+        src += n;
+        size -= n;
+    }
+}
+
+const void* rocpulse_ring_peek(const rocpulse_ring* ring, size_t* size) {
+    pa_assert(ring);
+    pa_assert(size);
+
+    *size = PA_MIN(ring->length, ring->size - ring->head);
+
+    return ring->buf + ring->head;
+}
+
+void rocpulse_ring_drop_head(rocpulse_ring* ring, size_t size) {
+    pa_assert(ring);
+    pa_assert(size <= ring->length);
+
+    ring->head += size;
+    if (ring->head >= ring->size) {
+        ring->head -= ring->size;
+    }
+    ring->length -= size;
+}
+
+void rocpulse_ring_drop_tail(rocpulse_ring* ring, size_t size) {
+    pa_assert(ring);
+    pa_assert(size <= ring->length);
+
+    ring->length -= size;
+}
+
+void rocpulse_ring_clear(rocpulse_ring* ring) {
+    pa_assert(ring);
+
+    ring->head = 0;
+    ring->length = 0;
+}
@@ -0,0 +1,47 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* system headers */
+#include <stddef.h>
+
+/* fixed-size byte ring buffer, not thread-safe;
+ * data is appended to tail and consumed from head, and can also be
+ * removed from tail, which is used to handle rewinds
+ */
+typedef struct rocpulse_ring {
+    char* buf;
+    size_t size;
+    size_t head;
+    size_t length;
+} rocpulse_ring;
+
+void rocpulse_ring_init(rocpulse_ring* ring, size_t size);
+void rocpulse_ring_done(rocpulse_ring* ring);
+
+/* number of bytes stored in ring */
+size_t rocpulse_ring_length(const rocpulse_ring* ring);
+
+/* number of bytes that can be appended to ring */
+size_t rocpulse_ring_free(const rocpulse_ring* ring);
+
+/* append bytes to tail; size should not exceed rocpulse_ring_free() */
+void rocpulse_ring_write(rocpulse_ring* ring, const void* data, size_t size);
+
+/* get pointer to contiguous region at head and its size */
+const void* rocpulse_ring_peek(const rocpulse_ring* ring, size_t* size);
+
+/* remove bytes from head */
+void rocpulse_ring_drop_head(rocpulse_ring* ring, size_t size);
+
+/* remove bytes from tail */
+void rocpulse_ring_drop_tail(rocpulse_ring* ring, size_t size);
+
+/* remove all bytes */
+void rocpulse_ring_clear(rocpulse_ring* ring);
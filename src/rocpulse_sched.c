@@ -0,0 +1,217 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+/* public pulseaudio headers */
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/strbuf.h>
+
+/* local headers */
+#include "rocpulse_helpers.h"
+#include "rocpulse_sched.h"
+
+#ifndef SCHED_RESET_ON_FORK
+#define SCHED_RESET_ON_FORK 0x40000000
+#endif
+
+static int parse_cpu_list(cpu_set_t* out, const char* str) {
+    CPU_ZERO(out);
+
+    /* comma-separated list of cpus and cpu ranges, e.g. "2,4-7" */
+    while (*str) {
+        char* end = NULL;
+        long first = strtol(str, &end, 10);
+        if (end == str || first < 0 || first >= CPU_SETSIZE) {
+            return -1;
+        }
+
+        long last = first;
+        if (*end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+            if (end == str || last < first || last >= CPU_SETSIZE) {
+                return -1;
+            }
+        }
+
+        for (long cpu = first; cpu <= last; cpu++) {
+            CPU_SET((int)cpu, out);
+        }
+
+        if (*end == ',') {
+            end++;
+        } else if (*end) {
+            return -1;
+        }
+        str = end;
+    }
+
+    return CPU_COUNT(out) > 0 ? 0 : -1;
+}
+
+int rocpulse_parse_sched_config(rocpulse_sched_config* out,
+                                pa_modargs* args,
+                                const char* rt_priority_arg_name,
+                                const char* cpu_affinity_arg_name) {
+    memset(out, 0, sizeof(*out));
+
+    /* priority */
+    unsigned int rt_priority = 0;
+    if (rocpulse_parse_uint(&rt_priority, args, rt_priority_arg_name, "0") < 0) {
+        return -1;
+    }
+
+    if (rt_priority > 0) {
+        int min_priority = sched_get_priority_min(SCHED_RR);
+        int max_priority = sched_get_priority_max(SCHED_RR);
+
+        if ((int)rt_priority < min_priority || (int)rt_priority > max_priority) {
+            pa_log("invalid %s: should be in range [%d; %d]: %u", rt_priority_arg_name,
+                   min_priority, max_priority, rt_priority);
+            return -1;
+        }
+    }
+
+    out->rt_priority = (int)rt_priority;
+
+    /* affinity */
+    const char* cpus = pa_modargs_get_value(args, cpu_affinity_arg_name, "");
+    if (cpus && *cpus) {
+        if (parse_cpu_list(&out->cpu_affinity, cpus) < 0) {
+            pa_log("invalid %s: %s", cpu_affinity_arg_name, cpus);
+            return -1;
+        }
+        out->has_cpu_affinity = true;
+    }
+
+    return 0;
+}
+
+void rocpulse_sched_apply(const rocpulse_sched_config* config,
+                          rocpulse_sched_state* state) {
+    pa_assert(config);
+    pa_assert(state);
+
+    const pthread_t thread = pthread_self();
+    int err;
+
+    if (config->rt_priority > 0) {
+        /* same as pulseaudio threads: SCHED_RR not inherited by children, and
+         * if RLIMIT_RTPRIO doesn't allow it, ask rtkit, which may grant lower
+         * priority than requested
+         */
+        if (pa_thread_make_realtime(config->rt_priority) < 0) {
+            err = errno;
+
+            struct rlimit rl;
+            memset(&rl, 0, sizeof(rl));
+            getrlimit(RLIMIT_RTPRIO, &rl);
+
+            pa_log_warn("can't enable realtime scheduling with priority %d: %s"
+                        " (RLIMIT_RTPRIO is %lld), keeping default scheduling",
+                        config->rt_priority, pa_cstrerror(err),
+                        rl.rlim_cur == RLIM_INFINITY ? -1LL : (long long)rl.rlim_cur);
+        }
+    }
+
+    if (config->has_cpu_affinity) {
+        if ((err = pthread_setaffinity_np(thread, sizeof(cpu_set_t),
+                                          &config->cpu_affinity))
+            != 0) {
+            pa_log_warn("can't set cpu affinity: %s, keeping default affinity",
+                        pa_cstrerror(err));
+        }
+    }
+
+    /* report what we've actually got */
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+
+    if (pthread_getschedparam(thread, &state->policy, &param) == 0) {
+        state->policy &= ~SCHED_RESET_ON_FORK;
+        state->priority = param.sched_priority;
+    } else {
+        state->policy = -1;
+        state->priority = 0;
+    }
+
+    CPU_ZERO(&state->cpu_affinity);
+    pthread_getaffinity_np(thread, sizeof(cpu_set_t), &state->cpu_affinity);
+}
+
+static const char* policy_to_str(int policy) {
+    switch (policy) {
+    case SCHED_OTHER:
+        return "other";
+    case SCHED_FIFO:
+        return "fifo";
+    case SCHED_RR:
+        return "rr";
+#ifdef SCHED_BATCH
+    case SCHED_BATCH:
+        return "batch";
+#endif
+#ifdef SCHED_IDLE
+    case SCHED_IDLE:
+        return "idle";
+#endif
+    default:
+        return "unknown";
+    }
+}
+
+void rocpulse_sched_report(const rocpulse_sched_state* state, pa_proplist* proplist) {
+    pa_assert(state);
+    pa_assert(proplist);
+
+    pa_proplist_sets(proplist, "roc.thread.sched_policy", policy_to_str(state->policy));
+    pa_proplist_setf(proplist, "roc.thread.sched_priority", "%d", state->priority);
+
+    /* format cpu set as list of ranges, e.g. "2,4-7" */
+    pa_strbuf* buf = pa_strbuf_new();
+    const char* sep = "";
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &state->cpu_affinity)) {
+            continue;
+        }
+
+        int last = cpu;
+        while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &state->cpu_affinity)) {
+            last++;
+        }
+
+        if (last == cpu) {
+            pa_strbuf_printf(buf, "%s%d", sep, cpu);
+        } else {
+            pa_strbuf_printf(buf, "%s%d-%d", sep, cpu, last);
+        }
+
+        sep = ",";
+        cpu = last;
+    }
+
+    char* str = pa_strbuf_to_string_free(buf);
+    pa_proplist_sets(proplist, "roc.thread.cpu_affinity", str);
+    pa_xfree(str);
+}
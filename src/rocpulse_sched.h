@@ -0,0 +1,53 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <sched.h>
+#include <stdbool.h>
+
+/* public pulseaudio headers */
+#include <pulse/proplist.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/modargs.h>
+
+/* scheduling parameters requested for module thread */
+typedef struct rocpulse_sched_config {
+    /* realtime priority, or zero to keep default scheduling */
+    int rt_priority;
+
+    /* set of allowed cpus, used if has_cpu_affinity is true */
+    bool has_cpu_affinity;
+    cpu_set_t cpu_affinity;
+} rocpulse_sched_config;
+
+/* scheduling parameters actually applied to module thread */
+typedef struct rocpulse_sched_state {
+    int policy;
+    int priority;
+    cpu_set_t cpu_affinity;
+} rocpulse_sched_state;
+
+int rocpulse_parse_sched_config(rocpulse_sched_config* out,
+                                pa_modargs* args,
+                                const char* rt_priority_arg_name,
+                                const char* cpu_affinity_arg_name);
+
+/* apply config to calling thread and report resulting state;
+ * if config can't be applied, logs a warning and keeps current scheduling
+ */
+void rocpulse_sched_apply(const rocpulse_sched_config* config,
+                          rocpulse_sched_state* state);
+
+/* add sched state to proplist */
+void rocpulse_sched_report(const rocpulse_sched_state* state, pa_proplist* proplist);
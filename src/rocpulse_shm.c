@@ -0,0 +1,547 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* public pulseaudio headers */
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/atomic.h>
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+
+/* local headers */
+#include "rocpulse_shm.h"
+
+#define SHM_MAGIC 0x50434f52 /* "ROCP" */
+#define SHM_VERSION 1
+
+/* default max_packet_size of roc context */
+#define SLOT_SIZE 2048
+
+/* a few seconds of packets; receiver drains ring on every wakeup */
+#define FORWARD_SLOTS 256
+
+/* feedback packets are rare */
+#define BACKWARD_SLOTS 16
+
+struct shm_slot {
+    uint32_t tag;
+    uint32_t size;
+    char bytes[SLOT_SIZE];
+};
+
+/* free-running indices; tail is written by producer and head by consumer,
+ * each on its own cache line
+ */
+struct shm_ring_header {
+    pa_atomic_t head __attribute__((aligned(64)));
+    pa_atomic_t tail __attribute__((aligned(64)));
+};
+
+/* contents of memfd */
+struct shm_layout {
+    uint32_t magic;
+    uint32_t version;
+
+    struct shm_ring_header forward_header;
+    struct shm_ring_header backward_header;
+
+    struct shm_slot forward[FORWARD_SLOTS];
+    struct shm_slot backward[BACKWARD_SLOTS];
+};
+
+struct shm_ring {
+    struct shm_ring_header* header;
+    struct shm_slot* slots;
+    unsigned int n_slots;
+};
+
+struct rocpulse_shm {
+    int conn_fd;
+    int mem_fd;
+    int event_fd;
+
+    struct shm_layout* mem;
+
+    /* sender writes forward ring and reads backward ring, receiver does the
+     * opposite
+     */
+    struct shm_ring tx;
+    struct shm_ring rx;
+
+    bool pending;
+
+    /* set by thread that reads ring, checked by is_closed from any thread */
+    pa_atomic_t broken;
+};
+
+static rocpulse_shm* shm_new(void) {
+    rocpulse_shm* shm = pa_xnew0(rocpulse_shm, 1);
+    shm->conn_fd = shm->mem_fd = shm->event_fd = -1;
+
+    return shm;
+}
+
+static void shm_map_rings(rocpulse_shm* shm, bool is_sender) {
+    struct shm_ring forward = {
+        &shm->mem->forward_header,
+        shm->mem->forward,
+        FORWARD_SLOTS,
+    };
+    struct shm_ring backward = {
+        &shm->mem->backward_header,
+        shm->mem->backward,
+        BACKWARD_SLOTS,
+    };
+
+    shm->tx = is_sender ? forward : backward;
+    shm->rx = is_sender ? backward : forward;
+}
+
+static int make_unix_addr(struct sockaddr_un* addr, const char* path) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        pa_log("socket path is too long: %s", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+
+    return 0;
+}
+
+rocpulse_shm* rocpulse_shm_connect(const char* path) {
+    pa_assert(path);
+
+    rocpulse_shm* shm = shm_new();
+
+    struct sockaddr_un addr;
+    if (make_unix_addr(&addr, path) < 0) {
+        goto error;
+    }
+
+    if ((shm->conn_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0)) < 0) {
+        pa_log("can't create unix socket: %s", pa_cstrerror(errno));
+        goto error;
+    }
+
+    /* usually receiver isn't there yet, or is on another host */
+    if (connect(shm->conn_fd, (const struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        pa_log_debug("can't connect to %s: %s", path, pa_cstrerror(errno));
+        goto error;
+    }
+
+    if ((shm->mem_fd = memfd_create("roc-pulse", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) {
+        pa_log("can't create memfd: %s", pa_cstrerror(errno));
+        goto error;
+    }
+
+    if (ftruncate(shm->mem_fd, sizeof(struct shm_layout)) < 0) {
+        pa_log("can't resize memfd: %s", pa_cstrerror(errno));
+        goto error;
+    }
+
+    /* receiver checks that memory can't be truncated under it */
+    if (fcntl(shm->mem_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        pa_log("can't seal memfd: %s", pa_cstrerror(errno));
+        goto error;
+    }
+
+    if ((shm->mem = mmap(NULL, sizeof(struct shm_layout), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, shm->mem_fd, 0))
+        == MAP_FAILED) {
+        shm->mem = NULL;
+        pa_log("can't map memfd: %s", pa_cstrerror(errno));
+        goto error;
+    }
+
+    shm->mem->magic = SHM_MAGIC;
+    shm->mem->version = SHM_VERSION;
+
+    if ((shm->event_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+        pa_log("can't create eventfd: %s", pa_cstrerror(errno));
+        goto error;
+    }
+
+    /* pass memfd and eventfd to receiver */
+    const int fds[2] = { shm->mem_fd, shm->event_fd };
+
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(shm->conn_fd, &msg, MSG_NOSIGNAL) < 0) {
+        pa_log("can't pass shared memory to %s: %s", path, pa_cstrerror(errno));
+        goto error;
+    }
+
+    pa_make_fd_nonblock(shm->conn_fd);
+
+    shm_map_rings(shm, true);
+
+    pa_log_info("connected to local receiver %s, using shared memory", path);
+
+    return shm;
+
+error:
+    rocpulse_shm_free(shm);
+    return NULL;
+}
+
+/* check whether socket file belongs to running receiver */
+static bool is_listening(const struct sockaddr_un* addr) {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+
+    const bool ret = connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) == 0;
+    pa_close(fd);
+
+    return ret;
+}
+
+int rocpulse_shm_listen(const char* path) {
+    pa_assert(path);
+
+    struct sockaddr_un addr;
+    if (make_unix_addr(&addr, path) < 0) {
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        pa_log("can't create unix socket: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    int ret = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+
+    /* remove socket left by receiver that crashed, but not by running one */
+    if (ret < 0 && errno == EADDRINUSE) {
+        if (is_listening(&addr)) {
+            pa_log("another receiver is listening on %s", path);
+            goto error;
+        }
+
+        unlink(path);
+        ret = bind(fd, (const struct sockaddr*)&addr, sizeof(addr));
+    }
+
+    if (ret < 0) {
+        pa_log("can't bind unix socket to %s: %s", path, pa_cstrerror(errno));
+        goto error;
+    }
+
+    if (listen(fd, 16) < 0) {
+        pa_log("can't listen on %s: %s", path, pa_cstrerror(errno));
+        goto error;
+    }
+
+    return fd;
+
+error:
+    pa_close(fd);
+    return -1;
+}
+
+/* read memfd and eventfd passed by sender; returns 0 if sender hasn't passed
+ * them yet
+ */
+static int receive_fds(rocpulse_shm* shm) {
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * 2)];
+        struct cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    const ssize_t ret = recvmsg(shm->conn_fd, &msg, MSG_CMSG_CLOEXEC);
+
+    /* another receiver checking whether somebody listens on this path */
+    if (ret == 0) {
+        pa_log_debug("peer closed connection before handshake");
+        return -1;
+    }
+
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        pa_log("can't receive shared memory from sender: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    int fds[2] = { -1, -1 };
+    size_t n_fds = 0;
+
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            n_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), PA_MIN(n_fds, 2) * sizeof(int));
+        }
+    }
+
+    shm->mem_fd = fds[0];
+    shm->event_fd = fds[1];
+
+    if (n_fds != 2 || (msg.msg_flags & MSG_CTRUNC)) {
+        pa_log("sender passed unexpected file descriptors");
+        return -1;
+    }
+
+    return 1;
+}
+
+rocpulse_shm* rocpulse_shm_accept(int listen_fd) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            pa_log("can't accept connection: %s", pa_cstrerror(errno));
+        }
+        return NULL;
+    }
+
+    rocpulse_shm* shm = shm_new();
+    shm->conn_fd = fd;
+
+    return shm;
+}
+
+int rocpulse_shm_handshake(rocpulse_shm* shm) {
+    pa_assert(shm);
+    pa_assert(!shm->mem);
+
+    const int ret = receive_fds(shm);
+    if (ret <= 0) {
+        return ret;
+    }
+
+    /* memory of wrong size or which can be truncated by sender would crash us
+     * with SIGBUS
+     */
+    struct stat st;
+    if (fstat(shm->mem_fd, &st) < 0 || st.st_size != sizeof(struct shm_layout)) {
+        pa_log("sender passed shared memory of unexpected size");
+        return -1;
+    }
+
+    int seals = fcntl(shm->mem_fd, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+        pa_log("sender passed shared memory without seals");
+        return -1;
+    }
+
+    if ((shm->mem = mmap(NULL, sizeof(struct shm_layout), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, shm->mem_fd, 0))
+        == MAP_FAILED) {
+        shm->mem = NULL;
+        pa_log("can't map shared memory: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    if (shm->mem->magic != SHM_MAGIC || shm->mem->version != SHM_VERSION) {
+        pa_log("sender uses incompatible shared memory version");
+        return -1;
+    }
+
+    shm_map_rings(shm, false);
+
+    return 1;
+}
+
+void rocpulse_shm_free(rocpulse_shm* shm) {
+    pa_assert(shm);
+
+    if (shm->mem) {
+        munmap(shm->mem, sizeof(struct shm_layout));
+    }
+
+    const int fds[] = { shm->conn_fd, shm->mem_fd, shm->event_fd };
+
+    for (size_t n = 0; n < PA_ELEMENTSOF(fds); n++) {
+        if (fds[n] >= 0) {
+            pa_close(fds[n]);
+        }
+    }
+
+    pa_xfree(shm);
+}
+
+bool rocpulse_shm_write(rocpulse_shm* shm,
+                        unsigned int tag,
+                        const void* bytes,
+                        size_t size) {
+    pa_assert(shm);
+    pa_assert(bytes);
+    pa_assert(size <= SLOT_SIZE);
+
+    struct shm_ring* ring = &shm->tx;
+
+    const unsigned int head = (unsigned int)pa_atomic_load(&ring->header->head);
+    const unsigned int tail = (unsigned int)pa_atomic_load(&ring->header->tail);
+
+    if (tail - head >= ring->n_slots) {
+        return false;
+    }
+
+    struct shm_slot* slot = &ring->slots[tail % ring->n_slots];
+    slot->tag = tag;
+    slot->size = (uint32_t)size;
+    memcpy(slot->bytes, bytes, size);
+
+    /* publish slot after it's filled */
+    pa_atomic_store(&ring->header->tail, (int)(tail + 1));
+    shm->pending = true;
+
+    return true;
+}
+
+bool rocpulse_shm_notify(rocpulse_shm* shm) {
+    pa_assert(shm);
+
+    if (!shm->pending) {
+        return false;
+    }
+    shm->pending = false;
+
+    /* if counter overflows, receiver is awake anyway */
+    const uint64_t one = 1;
+    if (write(shm->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        pa_log_debug("can't wake up receiver: %s", pa_cstrerror(errno));
+    }
+
+    return true;
+}
+
+size_t rocpulse_shm_read(rocpulse_shm* shm, unsigned int* tag, void* bytes, size_t size) {
+    pa_assert(shm);
+    pa_assert(tag);
+    pa_assert(bytes);
+
+    struct shm_ring* ring = &shm->rx;
+
+    for (;;) {
+        const unsigned int head = (unsigned int)pa_atomic_load(&ring->header->head);
+        const unsigned int tail = (unsigned int)pa_atomic_load(&ring->header->tail);
+
+        if (tail == head) {
+            return 0;
+        }
+
+        if (tail - head > ring->n_slots) {
+            pa_log("peer corrupted shared memory ring");
+            pa_atomic_store(&shm->broken, 1);
+            return 0;
+        }
+
+        const struct shm_slot* slot = &ring->slots[head % ring->n_slots];
+
+        /* peer could change size after check */
+        const size_t slot_size = *(const volatile uint32_t*)&slot->size;
+        const bool valid = slot_size > 0 && slot_size <= SLOT_SIZE && slot_size <= size;
+
+        if (valid) {
+            *tag = slot->tag;
+            memcpy(bytes, slot->bytes, slot_size);
+        }
+
+        /* release slot after it's copied */
+        pa_atomic_store(&ring->header->head, (int)(head + 1));
+
+        if (valid) {
+            return slot_size;
+        }
+    }
+}
+
+int rocpulse_shm_event_fd(rocpulse_shm* shm) {
+    pa_assert(shm);
+
+    return shm->event_fd;
+}
+
+void rocpulse_shm_clear_event(rocpulse_shm* shm) {
+    pa_assert(shm);
+
+    uint64_t value = 0;
+    if (read(shm->event_fd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        pa_log_debug("can't read eventfd: %s", pa_cstrerror(errno));
+    }
+}
+
+int rocpulse_shm_conn_fd(rocpulse_shm* shm) {
+    pa_assert(shm);
+
+    return shm->conn_fd;
+}
+
+bool rocpulse_shm_is_broken(rocpulse_shm* shm) {
+    pa_assert(shm);
+
+    return pa_atomic_load(&shm->broken);
+}
+
+bool rocpulse_shm_is_closed(rocpulse_shm* shm) {
+    pa_assert(shm);
+
+    if (pa_atomic_load(&shm->broken)) {
+        return true;
+    }
+
+    char byte = 0;
+    const ssize_t ret = recv(shm->conn_fd, &byte, 1, MSG_DONTWAIT | MSG_PEEK);
+
+    return ret == 0 || (ret < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
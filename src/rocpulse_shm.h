@@ -0,0 +1,84 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <stdbool.h>
+#include <stddef.h>
+
+/* shared memory channel between sender and receiver on the same host
+ *
+ * sender creates memfd with two lock-free single-producer single-consumer
+ * rings of packets, one from sender to receiver and one for feedback from
+ * receiver to sender, and passes it, with eventfd to wake up receiver, over
+ * unix socket on which receiver listens; unix connection is kept open, and
+ * its hangup tells that peer is gone
+ *
+ * every packet has a tag, which is index of interface, the same on both
+ * sides; packets that don't fit into ring are dropped, like with UDP
+ *
+ * all functions of one side should be called from one thread, except
+ * is_closed, which may be called from another one; memory and indices written
+ * by peer are not trusted
+ */
+typedef struct rocpulse_shm rocpulse_shm;
+
+/* sender side: connect to receiver socket and pass shared memory to it;
+ * returns NULL if receiver is not listening on this path
+ */
+rocpulse_shm* rocpulse_shm_connect(const char* path);
+
+/* receiver side: create listening socket; returns -1 on error */
+int rocpulse_shm_listen(const char* path);
+
+/* receiver side: accept connection on listening socket; returns NULL if there
+ * is none or on error; doesn't block, and channel can't be used until
+ * handshake is done
+ */
+rocpulse_shm* rocpulse_shm_accept(int listen_fd);
+
+/* receiver side: receive and map shared memory of sender; should be called
+ * when connection becomes readable; returns 1 when done, 0 if sender hasn't
+ * passed memory yet, or -1 on error
+ */
+int rocpulse_shm_handshake(rocpulse_shm* shm);
+
+void rocpulse_shm_free(rocpulse_shm* shm);
+
+/* copy packet to ring; returns false if it's full */
+bool rocpulse_shm_write(rocpulse_shm* shm,
+                        unsigned int tag,
+                        const void* bytes,
+                        size_t size);
+
+/* sender side: wake up receiver if packets were written since previous call;
+ * returns true if it took a syscall
+ */
+bool rocpulse_shm_notify(rocpulse_shm* shm);
+
+/* copy next packet from ring; returns its size, or zero if ring is empty */
+size_t rocpulse_shm_read(rocpulse_shm* shm, unsigned int* tag, void* bytes, size_t size);
+
+/* receiver side: becomes readable when sender wakes up receiver; should be
+ * cleared before reading ring
+ */
+int rocpulse_shm_event_fd(rocpulse_shm* shm);
+void rocpulse_shm_clear_event(rocpulse_shm* shm);
+
+/* unix connection, gets POLLHUP when peer is gone */
+int rocpulse_shm_conn_fd(rocpulse_shm* shm);
+
+/* true if peer closed connection or corrupted shared memory */
+bool rocpulse_shm_is_closed(rocpulse_shm* shm);
+
+/* true if peer corrupted shared memory; unlike is_closed, takes no syscall */
+bool rocpulse_shm_is_broken(rocpulse_shm* shm);
@@ -0,0 +1,37 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* USDT tracepoints for perf, bpftrace, systemtap, etc.
+ *
+ * enabled by ENABLE_USDT cmake option; a probe is a single nop instruction
+ * until a tracer is attached, so probes only take arguments which are already
+ * computed anyway
+ *
+ * when disabled, probes are compiled out completely
+ */
+#if defined(ROCPULSE_ENABLE_USDT)
+
+#include <sys/sdt.h>
+
+#define ROCPULSE_TRACE1(name, a1) DTRACE_PROBE1(rocpulse, name, a1)
+#define ROCPULSE_TRACE2(name, a1, a2) DTRACE_PROBE2(rocpulse, name, a1, a2)
+#define ROCPULSE_TRACE3(name, a1, a2, a3) DTRACE_PROBE3(rocpulse, name, a1, a2, a3)
+
+#else // !defined(ROCPULSE_ENABLE_USDT)
+
+/* arguments are referenced but not evaluated, so that variables used only for
+ * tracing don't produce warnings
+ */
+#define ROCPULSE_TRACE1(name, a1) ((void)sizeof(a1))
+#define ROCPULSE_TRACE2(name, a1, a2) ((void)sizeof(a1), (void)sizeof(a2))
+#define ROCPULSE_TRACE3(name, a1, a2, a3)                                                \
+    ((void)sizeof(a1), (void)sizeof(a2), (void)sizeof(a3))
+
+#endif // defined(ROCPULSE_ENABLE_USDT)
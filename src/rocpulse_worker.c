@@ -0,0 +1,132 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <errno.h>
+#include <unistd.h>
+
+/* public pulseaudio headers */
+#include <pulse/mainloop-api.h>
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/thread.h>
+
+/* local headers */
+#include "rocpulse_worker.h"
+
+struct rocpulse_worker {
+    pa_core* core;
+
+    rocpulse_worker_run_cb run_cb;
+    rocpulse_worker_done_cb done_cb;
+    void* userdata;
+
+    pa_thread* thread;
+
+    /* thread writes to pipe when it finishes, which wakes up main loop */
+    int done_fds[2];
+    pa_io_event* done_event;
+
+    /* written by thread before writing to pipe */
+    int result;
+};
+
+static void thread_loop(void* arg) {
+    rocpulse_worker* worker = arg;
+    pa_assert(worker);
+
+    worker->result = worker->run_cb(worker->userdata);
+
+    const char c = 0;
+    if (write(worker->done_fds[1], &c, 1) != 1) {
+        pa_log("can't wake up main loop: %s", pa_cstrerror(errno));
+    }
+}
+
+static void io_cb(pa_mainloop_api* a,
+                  pa_io_event* e,
+                  int fd,
+                  pa_io_event_flags_t events,
+                  void* userdata) {
+    (void)a;
+    (void)e;
+    (void)fd;
+    (void)events;
+
+    rocpulse_worker* worker = userdata;
+    pa_assert(worker);
+
+    worker->core->mainloop->io_free(worker->done_event);
+    worker->done_event = NULL;
+
+    pa_thread_free(worker->thread);
+    worker->thread = NULL;
+
+    /* may free worker, so it's the last thing we do */
+    worker->done_cb(worker->userdata, worker->result);
+}
+
+rocpulse_worker* rocpulse_worker_new(pa_core* core,
+                                     const char* name,
+                                     rocpulse_worker_run_cb run_cb,
+                                     rocpulse_worker_done_cb done_cb,
+                                     void* userdata) {
+    pa_assert(core);
+    pa_assert(name);
+    pa_assert(run_cb);
+    pa_assert(done_cb);
+
+    rocpulse_worker* worker = pa_xnew0(rocpulse_worker, 1);
+
+    worker->core = core;
+    worker->run_cb = run_cb;
+    worker->done_cb = done_cb;
+    worker->userdata = userdata;
+
+    if (pa_pipe_cloexec(worker->done_fds) < 0) {
+        pa_log("can't create pipe: %s", pa_cstrerror(errno));
+        pa_xfree(worker);
+        return NULL;
+    }
+
+    worker->done_event = core->mainloop->io_new(core->mainloop, worker->done_fds[0],
+                                                PA_IO_EVENT_INPUT, io_cb, worker);
+
+    if (!(worker->thread = pa_thread_new(name, thread_loop, worker))) {
+        pa_log("failed to create thread");
+        rocpulse_worker_free(worker);
+        return NULL;
+    }
+
+    return worker;
+}
+
+void rocpulse_worker_free(rocpulse_worker* worker) {
+    pa_assert(worker);
+
+    if (worker->done_event) {
+        worker->core->mainloop->io_free(worker->done_event);
+    }
+
+    /* waits until run callback returns */
+    if (worker->thread) {
+        pa_thread_free(worker->thread);
+    }
+
+    pa_close(worker->done_fds[0]);
+    pa_close(worker->done_fds[1]);
+
+    pa_xfree(worker);
+}
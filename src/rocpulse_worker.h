@@ -0,0 +1,39 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core.h>
+
+/* invoked on worker thread; returns 0 on success or -1 on error */
+typedef int (*rocpulse_worker_run_cb)(void* userdata);
+
+/* invoked on main loop with result of run callback */
+typedef void (*rocpulse_worker_done_cb)(void* userdata, int result);
+
+/* runs a blocking operation on a separate thread and reports result on main
+ * loop, so that main loop is not stalled
+ *
+ * done callback is invoked after thread is joined, and it's allowed to free
+ * worker from it; if worker is freed before that, it waits until run callback
+ * returns, and done callback is not invoked
+ */
+typedef struct rocpulse_worker rocpulse_worker;
+
+/* returns NULL if thread can't be started */
+rocpulse_worker* rocpulse_worker_new(pa_core* core,
+                                     const char* name,
+                                     rocpulse_worker_run_cb run_cb,
+                                     rocpulse_worker_done_cb done_cb,
+                                     void* userdata);
+
+void rocpulse_worker_free(rocpulse_worker* worker);
@@ -0,0 +1,72 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* system headers */
+#include <errno.h>
+#include <stdlib.h>
+
+/* local headers */
+#include "rocpulse_alloc_count.h"
+
+#ifdef __GLIBC__
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+static uint64_t alloc_count;
+
+static void count_alloc(void) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+}
+
+void* malloc(size_t size) {
+    count_alloc();
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+    count_alloc();
+    return __libc_calloc(nmemb, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    count_alloc();
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size) {
+    count_alloc();
+    void* ptr = __libc_memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+bool rocpulse_alloc_count_supported(void) {
+    return true;
+}
+
+uint64_t rocpulse_alloc_count_get(void) {
+    return __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+}
+
+#else // !__GLIBC__
+
+bool rocpulse_alloc_count_supported(void) {
+    return false;
+}
+
+uint64_t rocpulse_alloc_count_get(void) {
+    return 0;
+}
+
+#endif // __GLIBC__
@@ -0,0 +1,22 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+#pragma once
+
+/* system headers */
+#include <stdbool.h>
+#include <stdint.h>
+
+/* counts heap allocations made by the whole process, including roc
+ *
+ * works by interposing malloc family, which is supported only with glibc;
+ * tools should take difference between two readings
+ */
+bool rocpulse_alloc_count_supported(void);
+
+uint64_t rocpulse_alloc_count_get(void);
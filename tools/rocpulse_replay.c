@@ -0,0 +1,815 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* Replays packets from a pcap capture of a Roc session into Roc receiver
+ * decoder as fast as possible, and reports decoding throughput.
+ *
+ * Receiver is configured from the same arguments and by the same code as in
+ * module-roc-sink-input, and frames are pulled in fixed-size chunks, as sink
+ * pulls them from sink input. Packets are pushed according to their capture
+ * timestamps relative to the stream position, so that receiver sees the same
+ * packet timing as during capture, but without waiting for real time.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* public pulseaudio headers */
+#include <pulse/sample.h>
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/modargs.h>
+
+/* roc headers */
+#include <roc/context.h>
+#include <roc/log.h>
+#include <roc/version.h>
+
+#if ROC_VERSION < ROC_VERSION_CODE(0, 4, 0)
+#error "rocpulse_replay requires Roc Toolkit 0.4 or later"
+#endif
+
+#include <roc/receiver_decoder.h>
+
+/* local headers */
+#include "rocpulse_alloc_count.h"
+#include "rocpulse_helpers.h"
+
+static const char* const replay_modargs[] = {
+    "local_source_port",
+    "local_repair_port",
+    "local_control_port",
+    "sink_input_rate",
+    "sink_input_format",
+    "sink_input_chans",
+    "packet_encoding_id",
+    "packet_encoding_rate",
+    "packet_encoding_format",
+    "packet_encoding_chans",
+    "fec_encoding",
+    "resampler_backend",
+    "resampler_profile",
+    "latency_backend",
+    "latency_profile",
+    "target_latency_msec",
+    "latency_tolerance_msec",
+    "no_play_timeout_msec",
+    "choppy_play_timeout_msec",
+    NULL,
+};
+
+/* classic pcap format, see pcap-savefile(5) */
+#define PCAP_MAGIC_USEC 0xa1b2c3d4
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_MAGIC_USEC_SWAPPED 0xd4c3b2a1
+#define PCAP_MAGIC_NSEC_SWAPPED 0x4d3cb2a1
+
+#define PCAP_LINKTYPE_NULL 0
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_LINKTYPE_RAW_OLD 12
+#define PCAP_LINKTYPE_RAW 101
+#define PCAP_LINKTYPE_LINUX_SLL 113
+#define PCAP_LINKTYPE_IPV4 228
+#define PCAP_LINKTYPE_IPV6 229
+#define PCAP_LINKTYPE_LINUX_SLL2 276
+
+#define ETHERTYPE_IPV4 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+
+#define IPPROTO_UDP_NUM 17
+
+/* UDP payload from capture, with capture time */
+struct replay_packet {
+    uint64_t time_ns;
+    roc_interface iface;
+    uint8_t* data;
+    size_t size;
+};
+
+struct replay_capture {
+    struct replay_packet* packets;
+    size_t n_packets;
+    size_t n_alloc;
+
+    size_t n_source;
+    size_t n_repair;
+    size_t n_control;
+    size_t n_skipped;
+};
+
+struct replay_ports {
+    unsigned int source;
+    unsigned int repair;
+    unsigned int control;
+};
+
+struct replay_stats {
+    uint64_t wall_ns;
+    uint64_t push_ns;
+    uint64_t pop_ns;
+    uint64_t n_pushed;
+    uint64_t n_popped;
+    uint64_t n_allocs;
+    roc_connection_metrics conn_metrics;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint16_t read_be16(const uint8_t* p) {
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t read_u32(const uint8_t* p, bool swap) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return swap ? __builtin_bswap32(v) : v;
+}
+
+/* find UDP payload in IP packet; returns false for anything else */
+static bool parse_ip(const uint8_t* buf,
+                     size_t size,
+                     unsigned int* dst_port,
+                     const uint8_t** payload,
+                     size_t* payload_size) {
+    if (size < 1) {
+        return false;
+    }
+
+    size_t hdr_size = 0;
+
+    switch (buf[0] >> 4) {
+    case 4:
+        if (size < 20 || buf[9] != IPPROTO_UDP_NUM) {
+            return false;
+        }
+        /* fragments can't be decoded without reassembly */
+        if ((read_be16(buf + 6) & 0x3fff) != 0) {
+            return false;
+        }
+        hdr_size = (size_t)(buf[0] & 0x0f) * 4;
+        if (hdr_size < 20) {
+            return false;
+        }
+        break;
+
+    case 6:
+        /* extension headers are not supported */
+        if (size < 40 || buf[6] != IPPROTO_UDP_NUM) {
+            return false;
+        }
+        hdr_size = 40;
+        break;
+
+    default:
+        return false;
+    }
+
+    if (size < hdr_size + 8) {
+        return false;
+    }
+
+    const uint8_t* udp = buf + hdr_size;
+    size_t udp_size = read_be16(udp + 4);
+
+    if (udp_size < 8 || udp_size > size - hdr_size) {
+        return false;
+    }
+
+    *dst_port = read_be16(udp + 2);
+    *payload = udp + 8;
+    *payload_size = udp_size - 8;
+
+    return true;
+}
+
+/* skip link-layer header; returns false for non-IP frames */
+static bool parse_link(uint32_t linktype,
+                       const uint8_t* buf,
+                       size_t size,
+                       const uint8_t** ip,
+                       size_t* ip_size) {
+    size_t offset = 0;
+
+    switch (linktype) {
+    case PCAP_LINKTYPE_NULL:
+        offset = 4;
+        break;
+
+    case PCAP_LINKTYPE_ETHERNET: {
+        offset = 14;
+        if (size < offset) {
+            return false;
+        }
+        uint16_t ethertype = read_be16(buf + 12);
+        if (ethertype == ETHERTYPE_VLAN) {
+            offset += 4;
+            if (size < offset) {
+                return false;
+            }
+            ethertype = read_be16(buf + 16);
+        }
+        if (ethertype != ETHERTYPE_IPV4 && ethertype != ETHERTYPE_IPV6) {
+            return false;
+        }
+    } break;
+
+    case PCAP_LINKTYPE_RAW_OLD:
+    case PCAP_LINKTYPE_RAW:
+    case PCAP_LINKTYPE_IPV4:
+    case PCAP_LINKTYPE_IPV6:
+        offset = 0;
+        break;
+
+    case PCAP_LINKTYPE_LINUX_SLL:
+        offset = 16;
+        break;
+
+    case PCAP_LINKTYPE_LINUX_SLL2:
+        offset = 20;
+        break;
+
+    default:
+        return false;
+    }
+
+    if (size < offset) {
+        return false;
+    }
+
+    *ip = buf + offset;
+    *ip_size = size - offset;
+
+    return true;
+}
+
+static void add_packet(struct replay_capture* capture,
+                       uint64_t time_ns,
+                       roc_interface iface,
+                       const uint8_t* data,
+                       size_t size) {
+    if (capture->n_packets == capture->n_alloc) {
+        capture->n_alloc = capture->n_alloc ? capture->n_alloc * 2 : 1024;
+        capture->packets = pa_xrealloc(
+            capture->packets, capture->n_alloc * sizeof(struct replay_packet));
+    }
+
+    /* packets are replayed in capture order, so time should not go back */
+    if (capture->n_packets > 0
+        && time_ns < capture->packets[capture->n_packets - 1].time_ns) {
+        time_ns = capture->packets[capture->n_packets - 1].time_ns;
+    }
+
+    struct replay_packet* packet = &capture->packets[capture->n_packets++];
+
+    packet->time_ns = time_ns;
+    packet->iface = iface;
+    packet->data = pa_xmemdup(data, size);
+    packet->size = size;
+}
+
+/* read whole capture into memory, so that file reading is not measured */
+static int load_capture(struct replay_capture* capture,
+                        const char* path,
+                        const struct replay_ports* ports) {
+    uint8_t* buf = NULL;
+    int ret = -1;
+
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        pa_log("can't open %s: %s", path, pa_cstrerror(errno));
+        goto out;
+    }
+
+    uint8_t hdr[24];
+    if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr)) {
+        pa_log("can't read pcap header from %s", path);
+        goto out;
+    }
+
+    bool swap = false;
+    bool nsec = false;
+
+    switch (read_u32(hdr, false)) {
+    case PCAP_MAGIC_USEC:
+        break;
+    case PCAP_MAGIC_NSEC:
+        nsec = true;
+        break;
+    case PCAP_MAGIC_USEC_SWAPPED:
+        swap = true;
+        break;
+    case PCAP_MAGIC_NSEC_SWAPPED:
+        swap = true;
+        nsec = true;
+        break;
+    default:
+        pa_log("%s is not a pcap file (pcapng can be converted with "
+               "\"editcap -F pcap\")",
+               path);
+        goto out;
+    }
+
+    uint32_t snaplen = read_u32(hdr + 16, swap);
+    uint32_t linktype = read_u32(hdr + 20, swap) & 0x0fffffff;
+
+    buf = pa_xmalloc(snaplen > 0 && snaplen < (1 << 20) ? snaplen : (1 << 20));
+
+    for (;;) {
+        uint8_t rec[16];
+        size_t n = fread(rec, 1, sizeof(rec), fp);
+        if (n == 0) {
+            break;
+        }
+        if (n != sizeof(rec)) {
+            pa_log("truncated pcap record in %s", path);
+            goto out;
+        }
+
+        uint64_t time_ns = (uint64_t)read_u32(rec, swap) * 1000000000
+            + (uint64_t)read_u32(rec + 4, swap) * (nsec ? 1 : 1000);
+        uint32_t incl_len = read_u32(rec + 8, swap);
+
+        if (incl_len > (1 << 20) || (snaplen > 0 && incl_len > snaplen)) {
+            pa_log("invalid pcap record length in %s", path);
+            goto out;
+        }
+
+        if (fread(buf, 1, incl_len, fp) != incl_len) {
+            pa_log("truncated pcap record in %s", path);
+            goto out;
+        }
+
+        const uint8_t* ip = NULL;
+        size_t ip_size = 0;
+        unsigned int port = 0;
+        const uint8_t* payload = NULL;
+        size_t payload_size = 0;
+
+        if (!parse_link(linktype, buf, incl_len, &ip, &ip_size)
+            || !parse_ip(ip, ip_size, &port, &payload, &payload_size)
+            || payload_size == 0) {
+            capture->n_skipped++;
+            continue;
+        }
+
+        if (port == ports->source) {
+            add_packet(capture, time_ns, ROC_INTERFACE_AUDIO_SOURCE, payload,
+                       payload_size);
+            capture->n_source++;
+        } else if (port == ports->repair) {
+            add_packet(capture, time_ns, ROC_INTERFACE_AUDIO_REPAIR, payload,
+                       payload_size);
+            capture->n_repair++;
+        } else if (port == ports->control) {
+            add_packet(capture, time_ns, ROC_INTERFACE_AUDIO_CONTROL, payload,
+                       payload_size);
+            capture->n_control++;
+        } else {
+            capture->n_skipped++;
+        }
+    }
+
+    if (capture->n_source == 0) {
+        pa_log("no packets to source port %u found in %s", ports->source, path);
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    pa_xfree(buf);
+    if (fp) {
+        fclose(fp);
+    }
+    return ret;
+}
+
+static void free_capture(struct replay_capture* capture) {
+    for (size_t n = 0; n < capture->n_packets; n++) {
+        pa_xfree(capture->packets[n].data);
+    }
+    pa_xfree(capture->packets);
+}
+
+static int open_decoder(roc_context* context,
+                        const roc_receiver_config* receiver_config,
+                        roc_fec_encoding fec_encoding,
+                        const struct replay_capture* capture,
+                        roc_receiver_decoder** out_decoder) {
+    roc_receiver_decoder* decoder = NULL;
+    roc_protocol proto = 0;
+
+    if (roc_receiver_decoder_open(context, receiver_config, &decoder) < 0) {
+        pa_log("can't create roc receiver decoder");
+        goto error;
+    }
+
+    if (rocpulse_select_protocol(&proto, ROC_INTERFACE_AUDIO_SOURCE, fec_encoding) < 0
+        || roc_receiver_decoder_activate(decoder, ROC_INTERFACE_AUDIO_SOURCE, proto)
+            != 0) {
+        pa_log("can't activate source interface");
+        goto error;
+    }
+
+    if (capture->n_repair > 0 && fec_encoding != ROC_FEC_ENCODING_DISABLE) {
+        if (rocpulse_select_protocol(&proto, ROC_INTERFACE_AUDIO_REPAIR, fec_encoding)
+                < 0
+            || roc_receiver_decoder_activate(decoder, ROC_INTERFACE_AUDIO_REPAIR, proto)
+                != 0) {
+            pa_log("can't activate repair interface");
+            goto error;
+        }
+    }
+
+    if (capture->n_control > 0) {
+        if (roc_receiver_decoder_activate(decoder, ROC_INTERFACE_AUDIO_CONTROL,
+                                          ROC_PROTO_RTCP)
+            != 0) {
+            pa_log("can't activate control interface");
+            goto error;
+        }
+    }
+
+    *out_decoder = decoder;
+    return 0;
+
+error:
+    if (decoder) {
+        roc_receiver_decoder_close(decoder);
+    }
+    return -1;
+}
+
+static int replay(const struct replay_capture* capture,
+                  roc_receiver_decoder* decoder,
+                  size_t frame_size,
+                  uint64_t frame_ns,
+                  struct replay_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    char* buf = pa_xmalloc(frame_size);
+
+    const uint64_t first_ns = capture->packets[0].time_ns;
+
+    size_t next_packet = 0;
+    uint64_t pos_ns = 0;
+    int ret = 0;
+
+    uint64_t alloc_before = rocpulse_alloc_count_get();
+    uint64_t start_ns = now_ns();
+
+    /* pull frames until all packets are pushed */
+    while (next_packet < capture->n_packets) {
+        uint64_t push_start = now_ns();
+
+        /* push packets that were captured before current position */
+        while (next_packet < capture->n_packets
+               && capture->packets[next_packet].time_ns - first_ns <= pos_ns) {
+            const struct replay_packet* packet = &capture->packets[next_packet++];
+
+            roc_packet roc_pkt;
+            roc_pkt.bytes = packet->data;
+            roc_pkt.bytes_size = packet->size;
+
+            /* decoder drops malformed packets, as receiver would */
+            if (roc_receiver_decoder_push_packet(decoder, packet->iface, &roc_pkt)
+                == 0) {
+                stats->n_pushed++;
+            }
+        }
+
+        uint64_t pop_start = now_ns();
+
+        roc_frame frame;
+        memset(&frame, 0, sizeof(frame));
+        frame.samples = buf;
+        frame.samples_size = frame_size;
+
+        if (roc_receiver_decoder_pop_frame(decoder, &frame) != 0) {
+            pa_log("roc_receiver_decoder_pop_frame() failed");
+            ret = -1;
+            break;
+        }
+
+        uint64_t pop_end = now_ns();
+
+        stats->push_ns += pop_start - push_start;
+        stats->pop_ns += pop_end - pop_start;
+        stats->n_popped++;
+
+        pos_ns += frame_ns;
+    }
+
+    stats->wall_ns = now_ns() - start_ns;
+    stats->n_allocs = rocpulse_alloc_count_get() - alloc_before;
+
+    roc_receiver_metrics recv_metrics;
+    memset(&recv_metrics, 0, sizeof(recv_metrics));
+
+    if (roc_receiver_decoder_query(decoder, &recv_metrics, &stats->conn_metrics) != 0) {
+        memset(&stats->conn_metrics, 0, sizeof(stats->conn_metrics));
+    }
+
+    pa_xfree(buf);
+
+    return ret;
+}
+
+static void print_report(const struct replay_capture* capture,
+                         const struct replay_stats* best,
+                         const struct replay_stats* total,
+                         unsigned int iterations,
+                         uint64_t frame_ns,
+                         bool json) {
+    const double audio_sec = (double)best->n_popped * (double)frame_ns / 1e9;
+    const double best_sec = (double)best->wall_ns / 1e9;
+    const double mean_sec = (double)total->wall_ns / 1e9 / iterations;
+
+    const double pops_per_sec = (double)best->n_popped / best_sec;
+    const double push_ns_per_packet
+        = best->n_pushed ? (double)best->push_ns / (double)best->n_pushed : 0;
+    const double pop_ns_per_frame
+        = best->n_popped ? (double)best->pop_ns / (double)best->n_popped : 0;
+    const double allocs_per_packet
+        = best->n_pushed ? (double)best->n_allocs / (double)best->n_pushed : 0;
+
+    if (json) {
+        printf("{\"packets\":{\"source\":%zu,\"repair\":%zu,\"control\":%zu,"
+               "\"skipped\":%zu,\"pushed\":%llu},",
+               capture->n_source, capture->n_repair, capture->n_control,
+               capture->n_skipped, (unsigned long long)best->n_pushed);
+        printf("\"iterations\":%u,\"audio_sec\":%.3f,\"best_sec\":%.6f,"
+               "\"mean_sec\":%.6f,\"realtime_factor\":%.2f,",
+               iterations, audio_sec, best_sec, mean_sec, audio_sec / best_sec);
+        printf("\"frames\":%llu,\"frames_per_sec\":%.1f,"
+               "\"push_ns_per_packet\":%.1f,\"pop_ns_per_frame\":%.1f,",
+               (unsigned long long)best->n_popped, pops_per_sec, push_ns_per_packet,
+               pop_ns_per_frame);
+        if (rocpulse_alloc_count_supported()) {
+            printf("\"allocations\":%llu,\"allocations_per_packet\":%.2f,",
+                   (unsigned long long)best->n_allocs, allocs_per_packet);
+        }
+        printf("\"expected_packets\":%llu,\"lost_packets\":%llu}\n",
+               (unsigned long long)best->conn_metrics.expected_packets,
+               (unsigned long long)best->conn_metrics.lost_packets);
+        return;
+    }
+
+    printf("packets:      %zu source, %zu repair, %zu control, %zu skipped\n",
+           capture->n_source, capture->n_repair, capture->n_control,
+           capture->n_skipped);
+    printf("audio:        %.3f sec in %llu frames\n", audio_sec,
+           (unsigned long long)best->n_popped);
+    printf("time:         %.6f sec best, %.6f sec mean of %u\n", best_sec, mean_sec,
+           iterations);
+    printf("speed:        %.2fx realtime, %.1f frames/sec\n", audio_sec / best_sec,
+           pops_per_sec);
+    printf("push:         %.1f ns/packet\n", push_ns_per_packet);
+    printf("pop:          %.1f ns/frame\n", pop_ns_per_frame);
+    if (rocpulse_alloc_count_supported()) {
+        printf("allocations:  %llu, %.2f per packet\n",
+               (unsigned long long)best->n_allocs, allocs_per_packet);
+    }
+    printf("roc metrics:  %llu expected, %llu lost packets\n",
+           (unsigned long long)best->conn_metrics.expected_packets,
+           (unsigned long long)best->conn_metrics.lost_packets);
+}
+
+static void print_usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [options] <capture.pcap> [receiver arguments...]\n"
+            "\n"
+            "options:\n"
+            "  -n <count>  number of iterations (default 5)\n"
+            "  -f <msec>   length of frame pulled from decoder (default 10)\n"
+            "  -j          print report in JSON\n"
+            "  -v          enable roc logs\n"
+            "\n"
+            "receiver arguments are the same as for module-roc-sink-input, e.g.\n"
+            "  fec_encoding=rs8m local_source_port=10001 target_latency_msec=100\n",
+            argv0);
+}
+
+int main(int argc, char** argv) {
+    unsigned int iterations = 5;
+    double frame_msec = 10;
+    bool json = false;
+    bool verbose = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:f:jvh")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = (unsigned int)atoi(optarg);
+            break;
+        case 'f':
+            frame_msec = atof(optarg);
+            break;
+        case 'j':
+            json = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (optind >= argc || iterations == 0 || frame_msec <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    const char* path = argv[optind++];
+
+    /* remaining arguments form module-style argument string */
+    char* arg_str = pa_xstrdup("");
+    for (int n = optind; n < argc; n++) {
+        char* s = pa_sprintf_malloc("%s %s", arg_str, argv[n]);
+        pa_xfree(arg_str);
+        arg_str = s;
+    }
+
+    roc_log_set_level(verbose ? ROC_LOG_DEBUG : ROC_LOG_ERROR);
+
+    pa_modargs* args = NULL;
+    roc_context* context = NULL;
+    roc_receiver_decoder* decoder = NULL;
+    struct replay_capture capture;
+    int ret = 1;
+
+    memset(&capture, 0, sizeof(capture));
+
+    if (!(args = pa_modargs_new(arg_str, replay_modargs))) {
+        pa_log("invalid arguments: %s", arg_str);
+        goto out;
+    }
+
+    /* receiver config, same as in module-roc-sink-input */
+    roc_receiver_config receiver_config;
+    memset(&receiver_config, 0, sizeof(receiver_config));
+
+    pa_sample_format_t sample_format = PA_SAMPLE_INVALID;
+    pa_channel_map channel_map;
+
+    if (rocpulse_parse_media_encoding(&receiver_config.frame_encoding, &sample_format,
+                                      &channel_map, args, "sink_input_rate",
+                                      "sink_input_format", "sink_input_chans")
+        < 0) {
+        goto out;
+    }
+
+    roc_packet_encoding packet_encoding_id = 0;
+    roc_media_encoding packet_encoding;
+    memset(&packet_encoding, 0, sizeof(packet_encoding));
+
+    if (rocpulse_parse_packet_encoding(&packet_encoding_id, args, "packet_encoding_id")
+        < 0) {
+        goto out;
+    }
+
+    if (packet_encoding_id != 0) {
+        if (rocpulse_parse_media_encoding(&packet_encoding, NULL, NULL, args,
+                                          "packet_encoding_rate",
+                                          "packet_encoding_format",
+                                          "packet_encoding_chans")
+            < 0) {
+            goto out;
+        }
+    }
+
+    if (rocpulse_parse_receiver_config(&receiver_config, args) < 0) {
+        goto out;
+    }
+
+    roc_fec_encoding fec_encoding = ROC_FEC_ENCODING_DEFAULT;
+    if (rocpulse_parse_fec_encoding(&fec_encoding, args, "fec_encoding") < 0) {
+        goto out;
+    }
+
+    struct replay_ports ports;
+    if (rocpulse_parse_uint(&ports.source, args, "local_source_port",
+                            ROCPULSE_DEFAULT_SOURCE_PORT)
+            < 0
+        || rocpulse_parse_uint(&ports.repair, args, "local_repair_port",
+                               ROCPULSE_DEFAULT_REPAIR_PORT)
+            < 0
+        || rocpulse_parse_uint(&ports.control, args, "local_control_port",
+                               ROCPULSE_DEFAULT_CONTROL_PORT)
+            < 0) {
+        goto out;
+    }
+
+    /* frame size, as requested by sink */
+    pa_sample_spec sample_spec;
+    if (rocpulse_extract_encoding(&receiver_config.frame_encoding, sample_format,
+                                  &sample_spec)
+        < 0) {
+        goto out;
+    }
+
+    const size_t frame_samples
+        = (size_t)(frame_msec * receiver_config.frame_encoding.rate / 1000);
+    if (frame_samples == 0) {
+        pa_log("frame length is too small");
+        goto out;
+    }
+
+    const size_t frame_size = frame_samples * pa_frame_size(&sample_spec);
+    const uint64_t frame_ns
+        = (uint64_t)frame_samples * 1000000000 / receiver_config.frame_encoding.rate;
+
+    if (load_capture(&capture, path, &ports) < 0) {
+        goto out;
+    }
+
+    struct replay_stats best, total;
+    memset(&best, 0, sizeof(best));
+    memset(&total, 0, sizeof(total));
+
+    for (unsigned int iter = 0; iter < iterations; iter++) {
+        /* fresh context and decoder for every iteration, so that every run
+         * starts a new session
+         */
+        roc_context_config context_config;
+        memset(&context_config, 0, sizeof(context_config));
+
+        if (roc_context_open(&context_config, &context) < 0) {
+            pa_log("can't create roc context");
+            goto out;
+        }
+
+        if (packet_encoding_id != 0) {
+            if (roc_context_register_encoding(context, packet_encoding_id,
+                                              &packet_encoding)
+                < 0) {
+                pa_log("can't register packet encoding");
+                goto out;
+            }
+        }
+
+        if (open_decoder(context, &receiver_config, fec_encoding, &capture, &decoder)
+            < 0) {
+            goto out;
+        }
+
+        struct replay_stats stats;
+        if (replay(&capture, decoder, frame_size, frame_ns, &stats) < 0) {
+            goto out;
+        }
+
+        if (iter == 0 || stats.wall_ns < best.wall_ns) {
+            best = stats;
+        }
+        total.wall_ns += stats.wall_ns;
+
+        roc_receiver_decoder_close(decoder);
+        decoder = NULL;
+
+        roc_context_close(context);
+        context = NULL;
+    }
+
+    print_report(&capture, &best, &total, iterations, frame_ns, json);
+    ret = 0;
+
+out:
+    if (decoder) {
+        roc_receiver_decoder_close(decoder);
+    }
+    if (context) {
+        roc_context_close(context);
+    }
+    if (args) {
+        pa_modargs_free(args);
+    }
+    free_capture(&capture);
+    pa_xfree(arg_str);
+
+    return ret;
+}
@@ -0,0 +1,799 @@
+/*
+ * This file is part of Roc PulseAudio integration.
+ *
+ * Copyright (c) Roc Streaming authors
+ *
+ * Licensed under GNU Lesser General Public License 2.1 or any later version.
+ */
+
+/* Runs sink path of module-roc-sink as fast as possible and reports its cost.
+ *
+ * Every tick does what process_samples() does, but without real-time clock:
+ * takes a chunk of synthetic samples instead of pa_sink_render(), converts it
+ * to floats if sink format needs conversion, and writes it to Roc sender
+ * encoder. Packets produced by encoder are then either dropped or sent to a
+ * local UDP socket, instead of being sent by Roc network thread; the socket is
+ * written either packet by packet, or by batch sender once per tick, as
+ * module-roc-sink does with batch_send. With shm writer, batch sender passes
+ * packets to a local receiver via shared memory, as with remote_socket, and
+ * the ring is drained after every tick, outside of measured time.
+ *
+ * Sender is configured from the same arguments and by the same code as in
+ * module-roc-sink.
+ */
+
+/* config.h from pulseaudio directory (generated after ./configure) */
+#include <config.h>
+
+/* system headers */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* public pulseaudio headers */
+#include <pulse/sample.h>
+#include <pulse/xmalloc.h>
+
+/* private pulseaudio headers */
+#include <pulsecore/core-error.h>
+#include <pulsecore/core-util.h>
+#include <pulsecore/log.h>
+#include <pulsecore/macro.h>
+#include <pulsecore/modargs.h>
+
+/* roc headers */
+#include <roc/context.h>
+#include <roc/log.h>
+#include <roc/version.h>
+
+#if ROC_VERSION < ROC_VERSION_CODE(0, 4, 0)
+#error "rocpulse_sender_bench requires Roc Toolkit 0.4 or later"
+#endif
+
+#include <roc/sender_encoder.h>
+
+/* local headers */
+#include "rocpulse_alloc_count.h"
+#include "rocpulse_batch.h"
+#include "rocpulse_shm.h"
+#include "rocpulse_convert.h"
+#include "rocpulse_helpers.h"
+
+static const char* const sender_bench_modargs[] = {
+    "sink_rate",
+    "sink_format",
+    "sink_chans",
+    "packet_encoding_id",
+    "packet_encoding_rate",
+    "packet_encoding_format",
+    "packet_encoding_chans",
+    "packet_length_msec",
+    "fec_encoding",
+    "fec_block_nbsrc",
+    "fec_block_nbrpr",
+    "resampler_backend",
+    "resampler_profile",
+    "latency_backend",
+    "latency_profile",
+    "target_latency_msec",
+    "latency_tolerance_msec",
+    NULL,
+};
+
+/* large enough for any packet produced by encoder */
+#define PACKET_BUFFER_SIZE 65536
+
+/* frequency of synthetic tone */
+#define TONE_FREQ 440.0
+
+enum packet_writer {
+    WRITER_NULL,
+    WRITER_UDP,
+    WRITER_BATCH,
+    WRITER_SHM,
+};
+
+/* interfaces activated on encoder, in order of popping packets */
+static const roc_interface encoder_ifaces[] = {
+    ROC_INTERFACE_AUDIO_SOURCE,
+    ROC_INTERFACE_AUDIO_REPAIR,
+    ROC_INTERFACE_AUDIO_CONTROL,
+};
+
+#define N_IFACES (sizeof(encoder_ifaces) / sizeof(encoder_ifaces[0]))
+
+struct sender_bench {
+    pa_sample_spec sample_spec;
+
+    /* one second of synthetic samples in sink format, replaces pa_sink_render() */
+    char* synth_buf;
+    size_t synth_size;
+    size_t synth_pos;
+
+    /* same as in module-roc-sink */
+    float* convert_buf;
+    size_t convert_buf_samples;
+
+    roc_sender_encoder* encoder;
+    bool iface_active[N_IFACES];
+
+    /* used instead of encoder with batch writer */
+    rocpulse_batch_sender* batch;
+
+    enum packet_writer writer;
+    int sock;
+    struct sockaddr_in sock_addr;
+
+    /* both sides of shared memory with shm writer */
+    char* shm_path;
+    int shm_listen_fd;
+    rocpulse_shm* shm;
+    rocpulse_shm* shm_peer;
+
+    char* packet_buf;
+};
+
+struct sender_bench_stats {
+    uint64_t wall_ns;
+    uint64_t write_ns;
+    uint64_t send_ns;
+    uint64_t n_ticks;
+    uint64_t n_frames;
+    uint64_t n_allocs;
+    uint64_t n_packets[N_IFACES];
+    uint64_t n_bytes;
+    /* batch sender doesn't report interfaces and bytes */
+    uint64_t n_batched_packets;
+    uint64_t n_syscalls;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void init_synth(struct sender_bench* b) {
+    const pa_sample_spec* ss = &b->sample_spec;
+
+    const size_t n_frames = ss->rate;
+    const size_t n_samples = n_frames * ss->channels;
+
+    float* samples = pa_xnew(float, n_samples);
+
+    for (size_t n = 0; n < n_frames; n++) {
+        float s = (float)(0.5 * sin(2 * M_PI * TONE_FREQ * (double)n / ss->rate));
+        for (size_t c = 0; c < ss->channels; c++) {
+            samples[n * ss->channels + c] = s;
+        }
+    }
+
+    b->synth_size = n_frames * pa_frame_size(ss);
+    b->synth_buf = pa_xmalloc(b->synth_size);
+
+    if (rocpulse_convert_is_native(ss->format)) {
+        memcpy(b->synth_buf, samples, b->synth_size);
+    } else {
+        rocpulse_convert_from_float(b->synth_buf, ss->format, samples, n_samples);
+    }
+
+    pa_xfree(samples);
+}
+
+/* return next chunk of synthetic samples, in place of pa_sink_render() */
+static const char* render_synth(struct sender_bench* b, size_t* length) {
+    if (b->synth_pos == b->synth_size) {
+        b->synth_pos = 0;
+    }
+
+    *length = PA_MIN(*length, b->synth_size - b->synth_pos);
+
+    const char* buf = b->synth_buf + b->synth_pos;
+    b->synth_pos += *length;
+
+    return buf;
+}
+
+static int push_frame(struct sender_bench* b, const roc_frame* frame) {
+    if (b->batch) {
+        return rocpulse_batch_sender_write(b->batch, frame);
+    }
+
+    return roc_sender_encoder_push_frame(b->encoder, frame);
+}
+
+/* same as write_samples() in module-roc-sink, but writes to encoder */
+static int write_samples(struct sender_bench* b, const char* buf, size_t size) {
+    roc_frame frame;
+    memset(&frame, 0, sizeof(frame));
+
+    if (!b->convert_buf) {
+        frame.samples = (void*)buf;
+        frame.samples_size = size;
+
+        return push_frame(b, &frame);
+    }
+
+    /* convert samples to floats piece by piece and write each piece */
+    const size_t sample_size = pa_sample_size(&b->sample_spec);
+    size_t n_samples = size / sample_size;
+
+    while (n_samples > 0) {
+        size_t n = PA_MIN(n_samples, b->convert_buf_samples);
+
+        rocpulse_convert_to_float(b->convert_buf, buf, b->sample_spec.format, n);
+
+        frame.samples = b->convert_buf;
+        frame.samples_size = n * sizeof(float);
+
+        if (push_frame(b, &frame) != 0) {
+            return -1;
+        }
+
+        buf += n * sample_size;
+        n_samples -= n;
+    }
+
+    return 0;
+}
+
+/* pop all packets produced by encoder and pass them to packet writer */
+static void send_packets(struct sender_bench* b, struct sender_bench_stats* stats) {
+    if (b->batch) {
+        /* batch sender queues packets until flush */
+        return;
+    }
+
+    for (size_t i = 0; i < N_IFACES; i++) {
+        if (!b->iface_active[i]) {
+            continue;
+        }
+
+        for (;;) {
+            roc_packet packet;
+            packet.bytes = b->packet_buf;
+            packet.bytes_size = PACKET_BUFFER_SIZE;
+
+            if (roc_sender_encoder_pop_packet(b->encoder, encoder_ifaces[i], &packet)
+                != 0) {
+                /* no more packets */
+                break;
+            }
+
+            stats->n_packets[i]++;
+            stats->n_bytes += packet.bytes_size;
+
+            if (b->writer == WRITER_UDP) {
+                /* errors are ignored, as roc does with udp */
+                (void)sendto(b->sock, packet.bytes, packet.bytes_size, 0,
+                             (struct sockaddr*)&b->sock_addr, sizeof(b->sock_addr));
+                stats->n_syscalls++;
+            }
+        }
+    }
+}
+
+static int open_encoder(struct sender_bench* b,
+                        roc_context* context,
+                        const roc_sender_config* sender_config) {
+    if (b->writer == WRITER_BATCH || b->writer == WRITER_SHM) {
+        /* all interfaces are sent to the same socket */
+        rocpulse_address addr;
+        memset(&addr, 0, sizeof(addr));
+        memcpy(&addr.addr, &b->sock_addr, sizeof(b->sock_addr));
+        addr.addr_len = sizeof(b->sock_addr);
+
+        const rocpulse_address* repair_addr = NULL;
+        if (sender_config->fec_encoding != ROC_FEC_ENCODING_DISABLE) {
+            repair_addr = &addr;
+        }
+
+        /* pacing makes no sense faster than real time */
+        if (!(b->batch = rocpulse_batch_sender_new(context, sender_config,
+                                                   ROCPULSE_PACING_DISABLE, &addr,
+                                                   repair_addr, &addr, NULL))) {
+            return -1;
+        }
+
+        /* sender passes memory while connecting, so handshake is done at once */
+        if (b->writer == WRITER_SHM) {
+            if (!(b->shm = rocpulse_shm_connect(b->shm_path))
+                || !(b->shm_peer = rocpulse_shm_accept(b->shm_listen_fd))
+                || rocpulse_shm_handshake(b->shm_peer) != 1) {
+                return -1;
+            }
+
+            rocpulse_batch_sender_set_shm(b->batch, b->shm);
+        }
+
+        return 0;
+    }
+
+    if (roc_sender_encoder_open(context, sender_config, &b->encoder) < 0) {
+        pa_log("can't create roc sender encoder");
+        return -1;
+    }
+
+    for (size_t i = 0; i < N_IFACES; i++) {
+        roc_protocol proto = 0;
+
+        b->iface_active[i] = false;
+
+        if (encoder_ifaces[i] == ROC_INTERFACE_AUDIO_REPAIR
+            && sender_config->fec_encoding == ROC_FEC_ENCODING_DISABLE) {
+            continue;
+        }
+
+        if (rocpulse_select_protocol(&proto, encoder_ifaces[i],
+                                     sender_config->fec_encoding)
+            < 0) {
+            return -1;
+        }
+
+        if (roc_sender_encoder_activate(b->encoder, encoder_ifaces[i], proto) != 0) {
+            pa_log("can't activate encoder interface");
+            return -1;
+        }
+
+        b->iface_active[i] = true;
+    }
+
+    return 0;
+}
+
+static int open_writer(struct sender_bench* b) {
+    if (b->writer == WRITER_NULL) {
+        return 0;
+    }
+
+    /* packets are sent to our own socket, which is never read, so that
+     * kernel drops them after receive buffer is full
+     */
+    if ((b->sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        pa_log("can't create socket: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    memset(&b->sock_addr, 0, sizeof(b->sock_addr));
+    b->sock_addr.sin_family = AF_INET;
+    b->sock_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    socklen_t addr_len = sizeof(b->sock_addr);
+    if (bind(b->sock, (struct sockaddr*)&b->sock_addr, addr_len) < 0
+        || getsockname(b->sock, (struct sockaddr*)&b->sock_addr, &addr_len) < 0) {
+        pa_log("can't bind socket: %s", pa_cstrerror(errno));
+        return -1;
+    }
+
+    /* UDP socket is still needed as fallback of batch sender */
+    if (b->writer == WRITER_SHM) {
+        b->shm_path
+            = pa_sprintf_malloc("/tmp/rocpulse_sender_bench.%d.sock", (int)getpid());
+
+        if ((b->shm_listen_fd = rocpulse_shm_listen(b->shm_path)) < 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* act as receiver and free ring for next tick */
+static void drain_shm(struct sender_bench* b) {
+    unsigned int tag = 0;
+
+    rocpulse_shm_clear_event(b->shm_peer);
+
+    while (rocpulse_shm_read(b->shm_peer, &tag, b->packet_buf, PACKET_BUFFER_SIZE) > 0) {
+    }
+}
+
+static int run(struct sender_bench* b,
+               size_t tick_size,
+               uint64_t total_bytes,
+               struct sender_bench_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    uint64_t rendered_bytes = 0;
+
+    uint64_t alloc_before = rocpulse_alloc_count_get();
+    uint64_t start_ns = now_ns();
+
+    while (rendered_bytes < total_bytes) {
+        uint64_t expected_bytes = PA_MIN(rendered_bytes + tick_size, total_bytes);
+
+        /* same loop as in process_samples() */
+        while (rendered_bytes < expected_bytes) {
+            size_t length = (size_t)(expected_bytes - rendered_bytes);
+            const char* buf = render_synth(b, &length);
+
+            uint64_t write_start = now_ns();
+
+            if (write_samples(b, buf, length) != 0) {
+                pa_log("roc_sender_encoder_push_frame() failed");
+                return -1;
+            }
+
+            uint64_t send_start = now_ns();
+
+            send_packets(b, stats);
+
+            uint64_t send_end = now_ns();
+
+            stats->write_ns += send_start - write_start;
+            stats->send_ns += send_end - send_start;
+
+            rendered_bytes += length;
+        }
+
+        /* batch sender sends all packets of the tick at once */
+        if (b->batch) {
+            uint64_t flush_start = now_ns();
+
+            rocpulse_batch_stats batch_stats;
+            rocpulse_batch_sender_flush(b->batch, 0, &batch_stats);
+
+            stats->send_ns += now_ns() - flush_start;
+            stats->n_batched_packets += batch_stats.n_packets;
+            stats->n_syscalls += batch_stats.n_syscalls;
+        }
+
+        if (b->shm_peer) {
+            drain_shm(b);
+        }
+
+        stats->n_ticks++;
+    }
+
+    stats->wall_ns = now_ns() - start_ns;
+    stats->n_allocs = rocpulse_alloc_count_get() - alloc_before;
+    stats->n_frames = total_bytes / pa_frame_size(&b->sample_spec);
+
+    return 0;
+}
+
+static void print_report(const struct sender_bench* b,
+                         const struct sender_bench_stats* best,
+                         const struct sender_bench_stats* total,
+                         unsigned int iterations,
+                         bool json) {
+    const double audio_sec = (double)best->n_frames / b->sample_spec.rate;
+    const double best_sec = (double)best->wall_ns / 1e9;
+    const double mean_sec = (double)total->wall_ns / 1e9 / iterations;
+
+    const double ns_per_frame = (double)best->wall_ns / (double)best->n_frames;
+    const double write_ns_per_frame = (double)best->write_ns / (double)best->n_frames;
+    const double send_ns_per_frame = (double)best->send_ns / (double)best->n_frames;
+    const double ns_per_tick = (double)best->wall_ns / (double)best->n_ticks;
+    const double allocs_per_frame = (double)best->n_allocs / (double)best->n_frames;
+    const double allocs_per_tick = (double)best->n_allocs / (double)best->n_ticks;
+    const double syscalls_per_tick = (double)best->n_syscalls / (double)best->n_ticks;
+
+    if (json) {
+        printf("{\"iterations\":%u,\"audio_sec\":%.3f,\"best_sec\":%.6f,"
+               "\"mean_sec\":%.6f,\"realtime_factor\":%.2f,",
+               iterations, audio_sec, best_sec, mean_sec, audio_sec / best_sec);
+        printf("\"frames\":%llu,\"ticks\":%llu,\"ns_per_frame\":%.2f,"
+               "\"write_ns_per_frame\":%.2f,\"send_ns_per_frame\":%.2f,"
+               "\"ns_per_tick\":%.1f,",
+               (unsigned long long)best->n_frames, (unsigned long long)best->n_ticks,
+               ns_per_frame, write_ns_per_frame, send_ns_per_frame, ns_per_tick);
+        if (rocpulse_alloc_count_supported()) {
+            printf("\"allocations\":%llu,\"allocations_per_frame\":%.4f,"
+                   "\"allocations_per_tick\":%.2f,",
+                   (unsigned long long)best->n_allocs, allocs_per_frame,
+                   allocs_per_tick);
+        }
+        printf("\"syscalls\":%llu,\"syscalls_per_tick\":%.2f,",
+               (unsigned long long)best->n_syscalls, syscalls_per_tick);
+        if (b->writer == WRITER_BATCH || b->writer == WRITER_SHM) {
+            printf("\"packets\":{\"total\":%llu}}\n",
+                   (unsigned long long)best->n_batched_packets);
+            return;
+        }
+        printf("\"packets\":{\"source\":%llu,\"repair\":%llu,\"control\":%llu},"
+               "\"bytes\":%llu}\n",
+               (unsigned long long)best->n_packets[0],
+               (unsigned long long)best->n_packets[1],
+               (unsigned long long)best->n_packets[2],
+               (unsigned long long)best->n_bytes);
+        return;
+    }
+
+    printf("audio:        %.3f sec in %llu ticks\n", audio_sec,
+           (unsigned long long)best->n_ticks);
+    printf("time:         %.6f sec best, %.6f sec mean of %u\n", best_sec, mean_sec,
+           iterations);
+    printf("speed:        %.2fx realtime\n", audio_sec / best_sec);
+    printf("cost:         %.2f ns/frame (write %.2f, send %.2f), %.1f ns/tick\n",
+           ns_per_frame, write_ns_per_frame, send_ns_per_frame, ns_per_tick);
+    if (rocpulse_alloc_count_supported()) {
+        printf("allocations:  %llu, %.4f per frame, %.2f per tick\n",
+               (unsigned long long)best->n_allocs, allocs_per_frame, allocs_per_tick);
+    }
+    printf("syscalls:     %llu, %.2f per tick\n", (unsigned long long)best->n_syscalls,
+           syscalls_per_tick);
+    if (b->writer == WRITER_BATCH || b->writer == WRITER_SHM) {
+        printf("packets:      %llu\n", (unsigned long long)best->n_batched_packets);
+        return;
+    }
+    printf("packets:      %llu source, %llu repair, %llu control, %llu bytes\n",
+           (unsigned long long)best->n_packets[0],
+           (unsigned long long)best->n_packets[1],
+           (unsigned long long)best->n_packets[2], (unsigned long long)best->n_bytes);
+}
+
+static void print_usage(const char* argv0) {
+    fprintf(stderr,
+            "usage: %s [options] [sender arguments...]\n"
+            "\n"
+            "options:\n"
+            "  -n <count>  number of iterations (default 5)\n"
+            "  -d <sec>    duration of audio per iteration (default 60)\n"
+            "  -t <msec>   length of audio written per tick (default 10)\n"
+            "  -w <writer> packet writer: null, udp, batch, or shm (default null)\n"
+            "  -j          print report in JSON\n"
+            "  -v          enable roc logs\n"
+            "\n"
+            "sender arguments are the same as for module-roc-sink, e.g.\n"
+            "  sink_rate=48000 sink_chans=stereo fec_encoding=rs8m "
+            "packet_length_msec=5\n",
+            argv0);
+}
+
+int main(int argc, char** argv) {
+    unsigned int iterations = 5;
+    double duration_sec = 60;
+    double tick_msec = 10;
+    bool json = false;
+    bool verbose = false;
+
+    struct sender_bench bench;
+    memset(&bench, 0, sizeof(bench));
+    bench.sock = -1;
+    bench.shm_listen_fd = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:t:w:jvh")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = (unsigned int)atoi(optarg);
+            break;
+        case 'd':
+            duration_sec = atof(optarg);
+            break;
+        case 't':
+            tick_msec = atof(optarg);
+            break;
+        case 'w':
+            if (strcmp(optarg, "null") == 0) {
+                bench.writer = WRITER_NULL;
+            } else if (strcmp(optarg, "udp") == 0) {
+                bench.writer = WRITER_UDP;
+            } else if (strcmp(optarg, "batch") == 0) {
+                bench.writer = WRITER_BATCH;
+            } else if (strcmp(optarg, "shm") == 0) {
+                bench.writer = WRITER_SHM;
+            } else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'j':
+            json = true;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (iterations == 0 || duration_sec <= 0 || tick_msec <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    /* remaining arguments form module-style argument string */
+    char* arg_str = pa_xstrdup("");
+    for (int n = optind; n < argc; n++) {
+        char* s = pa_sprintf_malloc("%s %s", arg_str, argv[n]);
+        pa_xfree(arg_str);
+        arg_str = s;
+    }
+
+    roc_log_set_level(verbose ? ROC_LOG_DEBUG : ROC_LOG_ERROR);
+
+    pa_modargs* args = NULL;
+    roc_context* context = NULL;
+    int ret = 1;
+
+    if (!(args = pa_modargs_new(arg_str, sender_bench_modargs))) {
+        pa_log("invalid arguments: %s", arg_str);
+        goto out;
+    }
+
+    /* sender config, same as in module-roc-sink */
+    roc_sender_config sender_config;
+    memset(&sender_config, 0, sizeof(sender_config));
+
+    pa_sample_format_t sample_format = PA_SAMPLE_INVALID;
+    pa_channel_map channel_map;
+
+    if (rocpulse_parse_media_encoding(&sender_config.frame_encoding, &sample_format,
+                                      &channel_map, args, "sink_rate", "sink_format",
+                                      "sink_chans")
+        < 0) {
+        goto out;
+    }
+
+    if (rocpulse_parse_packet_encoding(&sender_config.packet_encoding, args,
+                                       "packet_encoding_id")
+        < 0) {
+        goto out;
+    }
+
+    bool has_packet_encoding = false;
+    roc_media_encoding packet_encoding;
+    memset(&packet_encoding, 0, sizeof(packet_encoding));
+
+    if (sender_config.packet_encoding == 0) {
+        if (sender_config.frame_encoding.channels == ROC_CHANNEL_LAYOUT_MULTITRACK) {
+            pa_log("packet_encoding_id should be set when sink_chans is not mono or "
+                   "stereo");
+            goto out;
+        }
+        sender_config.packet_encoding = ROC_PACKET_ENCODING_AVP_L16_STEREO;
+    } else {
+        if (rocpulse_parse_media_encoding(&packet_encoding, NULL, NULL, args,
+                                          "packet_encoding_rate",
+                                          "packet_encoding_format",
+                                          "packet_encoding_chans")
+            < 0) {
+            goto out;
+        }
+        has_packet_encoding = true;
+    }
+
+    if (rocpulse_parse_sender_config(&sender_config, args) < 0) {
+        goto out;
+    }
+
+    if (rocpulse_extract_encoding(&sender_config.frame_encoding, sample_format,
+                                  &bench.sample_spec)
+        < 0) {
+        goto out;
+    }
+
+    if (!rocpulse_convert_is_native(bench.sample_spec.format)) {
+        /* keep whole frames in every piece passed to roc */
+        bench.convert_buf_samples = ROCPULSE_CONVERT_BUFFER_SAMPLES
+            - ROCPULSE_CONVERT_BUFFER_SAMPLES % bench.sample_spec.channels;
+        bench.convert_buf = pa_xnew(float, bench.convert_buf_samples);
+    }
+
+    const size_t frame_size = pa_frame_size(&bench.sample_spec);
+    const size_t tick_size
+        = (size_t)(tick_msec * bench.sample_spec.rate / 1000) * frame_size;
+    const uint64_t total_bytes
+        = (uint64_t)(duration_sec * bench.sample_spec.rate) * frame_size;
+
+    if (tick_size == 0 || total_bytes == 0) {
+        pa_log("tick or duration is too small");
+        goto out;
+    }
+
+    init_synth(&bench);
+
+    bench.packet_buf = pa_xmalloc(PACKET_BUFFER_SIZE);
+
+    if (open_writer(&bench) < 0) {
+        goto out;
+    }
+
+    struct sender_bench_stats best, total;
+    memset(&best, 0, sizeof(best));
+    memset(&total, 0, sizeof(total));
+
+    for (unsigned int iter = 0; iter < iterations; iter++) {
+        /* fresh context and encoder for every iteration */
+        roc_context_config context_config;
+        memset(&context_config, 0, sizeof(context_config));
+
+        if (roc_context_open(&context_config, &context) < 0) {
+            pa_log("can't create roc context");
+            goto out;
+        }
+
+        if (has_packet_encoding) {
+            if (roc_context_register_encoding(context, sender_config.packet_encoding,
+                                              &packet_encoding)
+                < 0) {
+                pa_log("can't register packet encoding");
+                goto out;
+            }
+        }
+
+        if (open_encoder(&bench, context, &sender_config) < 0) {
+            goto out;
+        }
+
+        struct sender_bench_stats stats;
+        if (run(&bench, tick_size, total_bytes, &stats) < 0) {
+            goto out;
+        }
+
+        if (iter == 0 || stats.wall_ns < best.wall_ns) {
+            best = stats;
+        }
+        total.wall_ns += stats.wall_ns;
+
+        if (bench.encoder) {
+            roc_sender_encoder_close(bench.encoder);
+            bench.encoder = NULL;
+        }
+        if (bench.batch) {
+            rocpulse_batch_sender_free(bench.batch);
+            bench.batch = NULL;
+        }
+        if (bench.shm) {
+            rocpulse_shm_free(bench.shm);
+            bench.shm = NULL;
+        }
+        if (bench.shm_peer) {
+            rocpulse_shm_free(bench.shm_peer);
+            bench.shm_peer = NULL;
+        }
+
+        roc_context_close(context);
+        context = NULL;
+    }
+
+    print_report(&bench, &best, &total, iterations, json);
+    ret = 0;
+
+out:
+    if (bench.encoder) {
+        roc_sender_encoder_close(bench.encoder);
+    }
+    if (bench.batch) {
+        rocpulse_batch_sender_free(bench.batch);
+    }
+    if (bench.shm) {
+        rocpulse_shm_free(bench.shm);
+    }
+    if (bench.shm_peer) {
+        rocpulse_shm_free(bench.shm_peer);
+    }
+    if (context) {
+        roc_context_close(context);
+    }
+    if (bench.sock >= 0) {
+        close(bench.sock);
+    }
+    if (bench.shm_listen_fd >= 0) {
+        close(bench.shm_listen_fd);
+        unlink(bench.shm_path);
+    }
+    pa_xfree(bench.shm_path);
+    if (args) {
+        pa_modargs_free(args);
+    }
+    pa_xfree(bench.packet_buf);
+    pa_xfree(bench.synth_buf);
+    pa_xfree(bench.convert_buf);
+    pa_xfree(arg_str);
+
+    return ret;
+}